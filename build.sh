@@ -3,5 +3,8 @@ if [ ! -d "build" ]; then
   mkdir build
 fi
 pushd build
-gcc -g ../source/lettuce_main.c -o lettuce
+gcc -g ../source/lettuce_main.c -o lettuce -lpthread -ldl
+gcc -g -O2 -DLETTUCE_PROFILE=1 ../source/lettuce_main.c -o lettuce_profile -lpthread -ldl
+gcc -g ../source/lettuce_load_generator.c -o lettuce_load_generator -lpthread
+gcc -g -O2 ../source/lettuce_bench.c -o lettuce_bench -lpthread
 popd
\ No newline at end of file
@@ -45,6 +45,9 @@ enum
     ABSTRACT_SYNTAX_TREE_NODE_if_then_else,
     ABSTRACT_SYNTAX_TREE_NODE_function_definition,
     ABSTRACT_SYNTAX_TREE_NODE_function_call,
+    ABSTRACT_SYNTAX_TREE_NODE_array_literal,
+    ABSTRACT_SYNTAX_TREE_NODE_index,
+    ABSTRACT_SYNTAX_TREE_NODE_operator_reference,
 };
 
 enum
@@ -53,6 +56,27 @@ enum
     EVALUATION_RESULT_number,
     EVALUATION_RESULT_boolean,
     EVALUATION_RESULT_closure,
+    EVALUATION_RESULT_array,
+    EVALUATION_RESULT_builtin,
+    EVALUATION_RESULT_compiled,
+};
+
+// NOTE(rjf): The limits an evaluation can be stopped by (see EvaluationLimits).
+//            An error result says which one it ran into, or none, for errors
+//            that are the program's own fault.
+#define EVALUATION_LIMIT_LIST \
+EvaluationLimit(none)         \
+EvaluationLimit(depth)        \
+EvaluationLimit(fuel)         \
+EvaluationLimit(memory)       \
+EvaluationLimit(deadline)
+
+enum
+{
+#define EvaluationLimit(name) EVALUATION_LIMIT_##name,
+    EVALUATION_LIMIT_LIST
+#undef EvaluationLimit
+    EVALUATION_LIMIT_COUNT
 };
 
 typedef struct InterpreterEnvironment InterpreterEnvironment;
@@ -66,6 +90,7 @@ typedef struct EvaluationResult
         struct
         {
             char *error_string;
+            int limit;
         }
         error;
         double number;
@@ -78,6 +103,35 @@ typedef struct EvaluationResult
             InterpreterEnvironment *environment;
         }
         closure;
+        
+        // NOTE(rjf): Arrays only hold numbers, contiguously, on the arena.
+        struct
+        {
+            double *elements;
+            unsigned int count;
+        }
+        array;
+        
+        // NOTE(rjf): A builtin function (see lettuce_array.c), possibly with
+        //            some of its arguments already applied.
+        struct
+        {
+            int type;
+            int operator_type;
+            int applied_count;
+            struct EvaluationResult *applied;
+        }
+        builtin;
+        
+        // NOTE(rjf): A closure made by a function that tiered execution
+        //            compiled (see lettuce_tier.c), with call being the
+        //            LettuceCallClosure to call it with.
+        struct
+        {
+            void *closure;
+            void *call;
+        }
+        compiled;
     };
 }
 EvaluationResult;
@@ -85,13 +139,38 @@ EvaluationResult;
 typedef struct AbstractSyntaxTreeNode
 {
     int type;
+    
+    // NOTE(rjf): Points at the token the node was parsed from, for mapping the
+    //            node back to a line and column.
+    char *source;
+    
+#if LETTUCE_PROFILE
+    unsigned long long profile_visits;
+    unsigned long long profile_inclusive_cycles;
+    unsigned long long profile_exclusive_cycles;
+    unsigned int profile_active_count;
+#endif
+    
     union
     {
         
+        // NOTE(rjf): let rec f = ... and g = ... in body is parsed as
+        //            let f = ... in let g = ... in body, with recursive_count 2
+        //            on the outermost of those lets. Every binding of a group is
+        //            a function, and the group is evaluated all at once (see
+        //            LetRecursiveCount), so the bindings can refer to each other
+        //            and to themselves.
         struct Let
         {
             char *string;
             int string_length;
+            unsigned int recursive_count;
+            
+            // NOTE(rjf): Set by escape analysis when the binding is a function
+            //            that's only ever called in the body, so its environment
+            //            can go on the evaluation stack's region.
+            int binding_does_not_escape;
+            
             AbstractSyntaxTreeNode *binding_expression;
             AbstractSyntaxTreeNode *body_expression;
         }
@@ -139,21 +218,56 @@ typedef struct AbstractSyntaxTreeNode
         }
         if_then_else;
         
+        // NOTE(rjf): function(a, b, c) is parsed as function(a) function(b)
+        //            function(c), with param_count 3 on the outermost of those
+        //            so it can be printed back the same way. Calls don't need it:
+        //            they bind the parameters of as many nested functions as they
+        //            have arguments for, however the functions were written.
         struct FunctionDefinition
         {
             char *param_name;
             int param_name_length;
+            unsigned int param_count;
             AbstractSyntaxTreeNode *body;
         }
         function_definition;
         
+        // NOTE(rjf): f(a, b, c) is parsed as f(a)(b)(c), with argument_count 3 on
+        //            the outermost of those calls, which is evaluated as a single
+        //            call with three arguments (see FunctionCallArgumentCount).
         struct FunctionCall
         {
             AbstractSyntaxTreeNode *closure;
             AbstractSyntaxTreeNode *parameter;
+            unsigned int argument_count;
+            
+            // NOTE(rjf): Set by escape analysis when closure is a function
+            //            literal, which can't outlive the call.
+            int closure_does_not_escape;
         }
         function_call;
         
+        struct ArrayLiteral
+        {
+            AbstractSyntaxTreeNode **elements;
+            unsigned int element_count;
+        }
+        array_literal;
+        
+        struct Index
+        {
+            AbstractSyntaxTreeNode *array;
+            AbstractSyntaxTreeNode *index;
+        }
+        index;
+        
+        // NOTE(rjf): A binary operator used as a function, like (+).
+        struct OperatorReference
+        {
+            int type;
+        }
+        operator_reference;
+        
     };
 }
 AbstractSyntaxTreeNode;
@@ -161,472 +275,2623 @@ AbstractSyntaxTreeNode;
 static AbstractSyntaxTreeNode *
 MemoryArenaAllocateNode(MemoryArena *arena)
 {
-    return MemoryArenaAllocate(arena, sizeof(AbstractSyntaxTreeNode));
+    return MemoryArenaAllocateZero(arena, sizeof(AbstractSyntaxTreeNode), MEMORY_ARENA_CATEGORY_ast_nodes);
 }
 
-static void
-PrintAbstractSyntaxTree(AbstractSyntaxTreeNode *root)
+// NOTE(rjf): How many of the calls nested in node, counting node, make up one
+//            call with several arguments. The count is only trusted as far as
+//            the nested calls are still there, since the optimizer can rewrite
+//            the inner ones.
+static unsigned int
+FunctionCallArgumentCount(AbstractSyntaxTreeNode *node)
 {
-    switch(root->type)
+    unsigned int count = 1;
+    for(AbstractSyntaxTreeNode *inner = node->function_call.closure;
+        count < node->function_call.argument_count && inner &&
+        inner->type == ABSTRACT_SYNTAX_TREE_NODE_function_call;
+        inner = inner->function_call.closure)
     {
-        case ABSTRACT_SYNTAX_TREE_NODE_let:
-        {
-            printf("let %.*s = (", root->let.string_length, root->let.string);
-            PrintAbstractSyntaxTree(root->let.binding_expression);
-            printf(") in (");
-            PrintAbstractSyntaxTree(root->let.body_expression);
-            printf(")");
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_identifier:
-        {
-            printf("%.*s", root->identifier.string_length, root->identifier.string);
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
-        {
-            printf("%f", root->numeric_constant.value);
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
-        {
-            printf("%s", root->boolean_constant.value ? "true" : "false");
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
-        {
-            printf("(");
-            PrintAbstractSyntaxTree(root->binary_operator.left);
-            
-#define BinaryOperator(name, str) if(root->binary_operator.type == BINARY_OPERATOR_##name) { printf(" " str " "); }
-            BINARY_OPERATOR_LIST
-#undef BinaryOperator
-            
-                PrintAbstractSyntaxTree(root->binary_operator.right);
-            printf(")");
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
-        {
-            printf("if(");
-            PrintAbstractSyntaxTree(root->if_then_else.condition);
-            printf(") then ");
-            PrintAbstractSyntaxTree(root->if_then_else.pass_code);
-            if(root->if_then_else.fail_code)
-            {
-                printf(" else ");
-                PrintAbstractSyntaxTree(root->if_then_else.fail_code);
-            }
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
-        {
-            printf("function(%.*s) ", root->function_definition.param_name_length,
-                   root->function_definition.param_name);
-            PrintAbstractSyntaxTree(root->function_definition.body);
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_function_call:
-        {
-            PrintAbstractSyntaxTree(root->function_call.closure);
-            printf("(");
-            PrintAbstractSyntaxTree(root->function_call.parameter);
-            printf(")");
-            break;
-        }
-        default: break;
+        ++count;
     }
+    return count;
 }
 
-#define INTERPRETER_ENVIRONMENT_DEFAULT_IDENTIFIER_TABLE_SIZE 512
-
-typedef struct InterpreterEnvironment
+// NOTE(rjf): The call nested in node whose parameter is argument index (from
+//            the left) of the count that node has. Index 0 is the innermost
+//            call, whose closure is the function being called.
+static AbstractSyntaxTreeNode *
+FunctionCallNested(AbstractSyntaxTreeNode *node, unsigned int count, unsigned int index)
 {
-    MemoryArena *arena;
-    
-    unsigned int identifier_table_count;
-    unsigned int identifier_table_cap;
-    
-    struct
-    {
-        EvaluationResult value;
-    }
-    *identifier_table_values;
-    
-    struct
+    for(unsigned int i = index + 1; i < count; ++i)
     {
-        char *string;
-        int string_length;
-        int deleted;
+        node = node->function_call.closure;
     }
-    *identifier_table_keys;
+    return node;
 }
-InterpreterEnvironment;
 
+// NOTE(rjf): Like FunctionCallArgumentCount, for the parameters of the nested
+//            function definitions that were written as one.
 static unsigned int
-HashString(char *str, int str_len)
+FunctionDefinitionParamCount(AbstractSyntaxTreeNode *node)
 {
-    unsigned int hash = 5381;
-    int c;
-    int i = 0;
-    while(c = *str++ && i < str_len)
+    unsigned int count = 1;
+    for(AbstractSyntaxTreeNode *inner = node->function_definition.body;
+        count < node->function_definition.param_count && inner &&
+        inner->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition;
+        inner = inner->function_definition.body)
     {
-        hash = ((hash << 5) + hash) + c; // == hash * 33 + c
-        ++i;
+        ++count;
     }
-    
-    return hash;
+    return count;
 }
 
-static InterpreterEnvironment *
-InterpreterEnvironmentDuplicate(InterpreterEnvironment *environment)
+// NOTE(rjf): How many lets, counting node, make up the let rec group that node
+//            starts, or 0 if it doesn't start one. Like FunctionCallArgumentCount,
+//            this only counts the lets that are still there, with functions
+//            bound.
+static unsigned int
+LetRecursiveCount(AbstractSyntaxTreeNode *node)
 {
-    InterpreterEnvironment *new_environment = MemoryArenaAllocate(environment->arena,
-                                                                  sizeof(InterpreterEnvironment));
-    new_environment->arena = environment->arena;
-    new_environment->identifier_table_count = environment->identifier_table_count;
-    new_environment->identifier_table_cap = environment->identifier_table_cap;
-    new_environment->identifier_table_values = MemoryArenaAllocate(environment->arena,
-                                                                   new_environment->identifier_table_cap * sizeof(new_environment->identifier_table_values[0]));
-    new_environment->identifier_table_keys = MemoryArenaAllocate(environment->arena,
-                                                                 new_environment->identifier_table_cap * sizeof(new_environment->identifier_table_keys[0]));
-    
-    MemoryCopy(new_environment->identifier_table_values, environment->identifier_table_values,
-               sizeof(new_environment->identifier_table_values[0]) * new_environment->identifier_table_cap);
-    MemoryCopy(new_environment->identifier_table_keys, environment->identifier_table_keys,
-               sizeof(new_environment->identifier_table_keys[0]) * new_environment->identifier_table_cap);
-    
-    return new_environment;
+    unsigned int count = 0;
+    if(node->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+    {
+        for(AbstractSyntaxTreeNode *let = node;
+            count < node->let.recursive_count && let && let->type == ABSTRACT_SYNTAX_TREE_NODE_let &&
+            let->let.binding_expression &&
+            let->let.binding_expression->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition;
+            let = let->let.body_expression)
+        {
+            ++count;
+        }
+    }
+    return count;
 }
 
-static int
-InterpreterEnvironmentBind(InterpreterEnvironment *environment, char *string, int string_length,
-                           EvaluationResult evaluation)
+// NOTE(rjf): The let at index in the group that node starts. The body of the
+//            group is the body of the last one.
+static AbstractSyntaxTreeNode *
+LetRecursiveNested(AbstractSyntaxTreeNode *node, unsigned int index)
 {
-    int added = 0;
-    
-    if(!environment->identifier_table_cap)
-    {
-        environment->identifier_table_count = 0;
-        environment->identifier_table_cap = INTERPRETER_ENVIRONMENT_DEFAULT_IDENTIFIER_TABLE_SIZE;
-        environment->identifier_table_values = MemoryArenaAllocate(environment->arena,
-                                                                   sizeof(environment->identifier_table_values[0]) *
-                                                                   environment->identifier_table_cap);
-        environment->identifier_table_keys = MemoryArenaAllocate(environment->arena, sizeof(environment->identifier_table_keys[0]) *
-                                                                 environment->identifier_table_cap);
-    }
-    
-    if(environment->identifier_table_count >= environment->identifier_table_cap)
+    for(unsigned int i = 0; i < index; ++i)
     {
-        // TODO(rjf): We need to expand the table.
+        node = node->let.body_expression;
     }
-    
-    unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
-    unsigned int original_hash_slot = hash_slot;
-    
-    for(;;)
+    return node;
+}
+
+// NOTE(rjf): The profiler is only compiled in when LETTUCE_PROFILE is defined
+//            (see lettuce_profiler.c). Otherwise these hooks are nothing, unless
+//            the including program defines its own (lettuce_bench does, to count
+//            evaluated nodes).
+#if LETTUCE_PROFILE
+static void ProfilerEnterNode(AbstractSyntaxTreeNode *node);
+static void ProfilerExitNode(AbstractSyntaxTreeNode *node);
+#define ProfileNodeBegin(node) ProfilerEnterNode(node)
+#define ProfileNodeEnd(node) ProfilerExitNode(node)
+#elif !defined(ProfileNodeBegin)
+#define ProfileNodeBegin(node)
+#define ProfileNodeEnd(node)
+#endif
+
+#define ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_LIST \
+AbstractSyntaxTreePrintFormat(source,   "source") \
+AbstractSyntaxTreePrintFormat(sexpr,    "sexpr") \
+AbstractSyntaxTreePrintFormat(indented, "indented") \
+AbstractSyntaxTreePrintFormat(json,     "json") \
+
+enum
+{
+#define AbstractSyntaxTreePrintFormat(name, str) ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_##name,
+    ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_LIST
+#undef AbstractSyntaxTreePrintFormat
+    ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_COUNT
+};
+
+static char *abstract_syntax_tree_print_format_names[ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_COUNT] = {
+#define AbstractSyntaxTreePrintFormat(name, str) str,
+    ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_LIST
+#undef AbstractSyntaxTreePrintFormat
+};
+
+static char *
+BinaryOperatorString(int type)
+{
+    char *result = "?";
+#define BinaryOperator(name, str) if(type == BINARY_OPERATOR_##name) { result = str; }
+    BINARY_OPERATOR_LIST
+#undef BinaryOperator
+    return result;
+}
+
+// NOTE(rjf): The printer doesn't recurse, so that it can't overflow the stack
+//            on deeply nested programs. Instead, it keeps its own stack of
+//            things left to print, which are either a node or a piece of
+//            text; printing a node pushes its pieces in reverse order.
+typedef struct AbstractSyntaxTreePrintItem
+{
+    AbstractSyntaxTreeNode *node;
+    char *string;
+    int string_length;
+    int depth;
+}
+AbstractSyntaxTreePrintItem;
+
+typedef struct AbstractSyntaxTreePrintStack
+{
+    AbstractSyntaxTreePrintItem *items;
+    unsigned int count;
+    unsigned int cap;
+}
+AbstractSyntaxTreePrintStack;
+
+static void
+AbstractSyntaxTreePrintPush(AbstractSyntaxTreePrintStack *stack, AbstractSyntaxTreeNode *node,
+                            char *string, int string_length, int depth)
+{
+    if(stack->count >= stack->cap)
     {
-        if(!environment->identifier_table_keys[hash_slot].deleted &&
-           environment->identifier_table_keys[hash_slot].string)
-        {
-            if(environment->identifier_table_keys[hash_slot].string &&
-               StringMatch(string, string_length,
-                           environment->identifier_table_keys[hash_slot].string,
-                           environment->identifier_table_keys[hash_slot].string_length))
-            {
-                environment->identifier_table_values[hash_slot].value = evaluation;
-                added = 1;
-                break;
-            }
-            else
-            {
-                ++hash_slot;
-                if(hash_slot >= environment->identifier_table_cap)
-                {
-                    hash_slot = 0;
-                }
-                else if(hash_slot == original_hash_slot)
-                {
-                    break;
-                }
-            }
-        }
-        else
-        {
-            added = 1;
-            environment->identifier_table_values[hash_slot].value = evaluation;
-            environment->identifier_table_keys[hash_slot].string = string;
-            environment->identifier_table_keys[hash_slot].string_length = string_length;
-            environment->identifier_table_keys[hash_slot].deleted = 0;
-        }
+        stack->cap = stack->cap ? stack->cap * 2 : 256;
+        stack->items = realloc(stack->items, sizeof(stack->items[0]) * stack->cap);
     }
-    
-    return added;
+    AbstractSyntaxTreePrintItem *item = stack->items + stack->count++;
+    item->node = node;
+    item->string = string;
+    item->string_length = string_length;
+    item->depth = depth;
 }
 
-static int
-InterpreterEnvironmentLookUp(InterpreterEnvironment *environment, char *string, int string_length,
-                             EvaluationResult *out_result)
+#define PushNode(node, depth) AbstractSyntaxTreePrintPush(&stack, (node), 0, 0, (depth))
+#define PushText(str) AbstractSyntaxTreePrintPush(&stack, 0, (str), (int)strlen(str), 0)
+
+static void
+PrintAbstractSyntaxTree(OutputBuffer *output, AbstractSyntaxTreeNode *root, int format)
 {
-    int found = 0;
+    AbstractSyntaxTreePrintStack stack = {0};
+    PushNode(root, 0);
     
-    if(environment->identifier_table_cap)
+    while(stack.count > 0)
     {
-        unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
-        unsigned int original_hash_slot = hash_slot;
+        AbstractSyntaxTreePrintItem item = stack.items[--stack.count];
+        AbstractSyntaxTreeNode *node = item.node;
+        int depth = item.depth;
         
-        for(;;)
+        if(!node)
         {
-            if(environment->identifier_table_keys[hash_slot].string ||
-               environment->identifier_table_keys[hash_slot].deleted)
+            OutputWrite(output, item.string, item.string_length);
+            continue;
+        }
+        
+        switch(format)
+        {
+            
+            // NOTE(rjf): The same syntax programs are written in, with
+            //            everything parenthesized.
+            default:
+            case ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_source:
             {
-                if(!environment->identifier_table_keys[hash_slot].deleted &&
-                   environment->identifier_table_keys[hash_slot].string &&
-                   StringMatch(string, string_length,
-                               environment->identifier_table_keys[hash_slot].string,
-                               environment->identifier_table_keys[hash_slot].string_length))
+                switch(node->type)
                 {
-                    found = 1;
-                    if(out_result)
+                    case ABSTRACT_SYNTAX_TREE_NODE_let:
                     {
-                        *out_result = environment->identifier_table_values[hash_slot].value;
+                        unsigned int recursive_count = LetRecursiveCount(node);
+                        if(recursive_count)
+                        {
+                            OutputWriteCString(output, "let rec ");
+                            PushText(")");
+                            PushNode(LetRecursiveNested(node, recursive_count - 1)->let.body_expression, 0);
+                            PushText(") in (");
+                            for(unsigned int i = recursive_count; i > 0; --i)
+                            {
+                                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i-1);
+                                PushNode(let->let.binding_expression, 0);
+                                PushText(" = (");
+                                AbstractSyntaxTreePrintPush(&stack, 0, let->let.string, let->let.string_length, 0);
+                                if(i > 1)
+                                {
+                                    PushText(") and ");
+                                }
+                            }
+                            break;
+                        }
+                        OutputWriteCString(output, "let ");
+                        OutputWrite(output, node->let.string, node->let.string_length);
+                        OutputWriteCString(output, " = (");
+                        PushText(")");
+                        PushNode(node->let.body_expression, 0);
+                        PushText(") in (");
+                        PushNode(node->let.binding_expression, 0);
+                        break;
                     }
-                    break;
-                }
-                else
-                {
-                    ++hash_slot;
-                    if(hash_slot >= environment->identifier_table_cap)
+                    case ABSTRACT_SYNTAX_TREE_NODE_identifier:
                     {
-                        hash_slot = 0;
+                        OutputWrite(output, node->identifier.string, node->identifier.string_length);
+                        break;
                     }
-                    else if(hash_slot == original_hash_slot)
+                    case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+                    {
+                        OutputWriteNumberInStyle(output, node->numeric_constant.value, NUMBER_FORMAT_STYLE_fixed);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+                    {
+                        OutputWriteCString(output, node->boolean_constant.value ? "true" : "false");
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
                     {
+                        OutputWriteCharacter(output, '(');
+                        PushText(")");
+                        PushNode(node->binary_operator.right, 0);
+                        PushText(" ");
+                        PushText(BinaryOperatorString(node->binary_operator.type));
+                        PushText(" ");
+                        PushNode(node->binary_operator.left, 0);
                         break;
                     }
+                    case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                    {
+                        OutputWriteCString(output, "if(");
+                        if(node->if_then_else.fail_code)
+                        {
+                            PushNode(node->if_then_else.fail_code, 0);
+                            PushText(" else ");
+                        }
+                        PushNode(node->if_then_else.pass_code, 0);
+                        PushText(") then ");
+                        PushNode(node->if_then_else.condition, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                    {
+                        OutputWriteCString(output, "function(");
+                        unsigned int param_count = FunctionDefinitionParamCount(node);
+                        for(unsigned int i = 0; i < param_count; ++i)
+                        {
+                            if(i)
+                            {
+                                OutputWriteCString(output, ", ");
+                                node = node->function_definition.body;
+                            }
+                            OutputWrite(output, node->function_definition.param_name,
+                                        node->function_definition.param_name_length);
+                        }
+                        OutputWriteCString(output, ") ");
+                        PushNode(node->function_definition.body, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                    {
+                        unsigned int argument_count = FunctionCallArgumentCount(node);
+                        PushText(")");
+                        for(unsigned int i = argument_count; i > 0; --i)
+                        {
+                            PushNode(FunctionCallNested(node, argument_count, i-1)->function_call.parameter, 0);
+                            if(i > 1)
+                            {
+                                PushText(", ");
+                            }
+                        }
+                        PushText("(");
+                        PushNode(FunctionCallNested(node, argument_count, 0)->function_call.closure, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                    {
+                        OutputWriteCharacter(output, '{');
+                        PushText("}");
+                        for(unsigned int i = node->array_literal.element_count; i > 0; --i)
+                        {
+                            PushNode(node->array_literal.elements[i-1], 0);
+                            if(i > 1)
+                            {
+                                PushText(", ");
+                            }
+                        }
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_index:
+                    {
+                        PushText("]");
+                        PushNode(node->index.index, 0);
+                        PushText("[");
+                        PushNode(node->index.array, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+                    {
+                        OutputWriteCharacter(output, '(');
+                        OutputWriteCString(output, BinaryOperatorString(node->operator_reference.type));
+                        OutputWriteCharacter(output, ')');
+                        break;
+                    }
+                    default: break;
                 }
-            }
-            else
-            {
                 break;
             }
-        }
-    }
-    
-    return found;
-}
-
-static int
-InterpreterEnvironmentDelete(InterpreterEnvironment *environment, char *string, int string_length)
-{
-    int found = 0;
-    
-    if(environment->identifier_table_cap)
-    {
-        unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
-        unsigned int original_hash_slot = hash_slot;
-        
-        for(;;)
-        {
-            if(environment->identifier_table_keys[hash_slot].string ||
-               environment->identifier_table_keys[hash_slot].deleted)
+            
+            // NOTE(rjf): Compact S-expressions, e.g. (let x 1 (+ x 2)).
+            case ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_sexpr:
             {
-                if(environment->identifier_table_keys[hash_slot].string &&
-                   StringMatch(string, string_length,
-                               environment->identifier_table_keys[hash_slot].string,
-                               environment->identifier_table_keys[hash_slot].string_length))
+                switch(node->type)
                 {
-                    found = 1;
-                    environment->identifier_table_keys[hash_slot].deleted = 1;
-                    environment->identifier_table_keys[hash_slot].string = 0;
-                    environment->identifier_table_keys[hash_slot].string_length = 0;
-                    break;
+                    case ABSTRACT_SYNTAX_TREE_NODE_let:
+                    {
+                        // NOTE(rjf): A let rec group is (letrec ((f ...) (g ...)) body).
+                        unsigned int recursive_count = LetRecursiveCount(node);
+                        if(recursive_count)
+                        {
+                            OutputWriteCString(output, "(letrec (");
+                            PushText(")");
+                            PushNode(LetRecursiveNested(node, recursive_count - 1)->let.body_expression, 0);
+                            PushText(") ");
+                            for(unsigned int i = recursive_count; i > 0; --i)
+                            {
+                                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i-1);
+                                PushText(")");
+                                PushNode(let->let.binding_expression, 0);
+                                PushText(" ");
+                                AbstractSyntaxTreePrintPush(&stack, 0, let->let.string, let->let.string_length, 0);
+                                PushText(i > 1 ? " (" : "(");
+                            }
+                            break;
+                        }
+                        OutputWriteCString(output, "(let ");
+                        OutputWrite(output, node->let.string, node->let.string_length);
+                        OutputWriteCharacter(output, ' ');
+                        PushText(")");
+                        PushNode(node->let.body_expression, 0);
+                        PushText(" ");
+                        PushNode(node->let.binding_expression, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                    {
+                        OutputWrite(output, node->identifier.string, node->identifier.string_length);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+                    {
+                        OutputWriteNumber(output, node->numeric_constant.value);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+                    {
+                        OutputWriteCString(output, node->boolean_constant.value ? "true" : "false");
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                    {
+                        OutputWriteCharacter(output, '(');
+                        OutputWriteCString(output, BinaryOperatorString(node->binary_operator.type));
+                        OutputWriteCharacter(output, ' ');
+                        PushText(")");
+                        PushNode(node->binary_operator.right, 0);
+                        PushText(" ");
+                        PushNode(node->binary_operator.left, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                    {
+                        OutputWriteCString(output, "(if ");
+                        PushText(")");
+                        if(node->if_then_else.fail_code)
+                        {
+                            PushNode(node->if_then_else.fail_code, 0);
+                            PushText(" ");
+                        }
+                        PushNode(node->if_then_else.pass_code, 0);
+                        PushText(" ");
+                        PushNode(node->if_then_else.condition, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                    {
+                        OutputWriteCString(output, "(function ");
+                        OutputWrite(output, node->function_definition.param_name,
+                                    node->function_definition.param_name_length);
+                        OutputWriteCharacter(output, ' ');
+                        PushText(")");
+                        PushNode(node->function_definition.body, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                    {
+                        OutputWriteCString(output, "(call ");
+                        PushText(")");
+                        PushNode(node->function_call.parameter, 0);
+                        PushText(" ");
+                        PushNode(node->function_call.closure, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                    {
+                        OutputWriteCString(output, "(array");
+                        PushText(")");
+                        for(unsigned int i = node->array_literal.element_count; i > 0; --i)
+                        {
+                            PushNode(node->array_literal.elements[i-1], 0);
+                            PushText(" ");
+                        }
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_index:
+                    {
+                        OutputWriteCString(output, "(index ");
+                        PushText(")");
+                        PushNode(node->index.index, 0);
+                        PushText(" ");
+                        PushNode(node->index.array, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+                    {
+                        OutputWriteCString(output, BinaryOperatorString(node->operator_reference.type));
+                        break;
+                    }
+                    default: break;
                 }
-                else
+                break;
+            }
+            
+            // NOTE(rjf): One node per line, with its children on the lines
+            //            after it, indented one level further.
+            case ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_indented:
+            {
+                OutputWriteSpaces(output, depth*2);
+                switch(node->type)
                 {
-                    ++hash_slot;
-                    if(hash_slot >= environment->identifier_table_cap)
+                    case ABSTRACT_SYNTAX_TREE_NODE_let:
                     {
-                        hash_slot = 0;
+                        // NOTE(rjf): A let rec group is one line with all of its
+                        //            names, followed by their bindings, in order,
+                        //            and then the body.
+                        unsigned int recursive_count = LetRecursiveCount(node);
+                        if(recursive_count)
+                        {
+                            OutputWriteCString(output, "let rec");
+                            PushNode(LetRecursiveNested(node, recursive_count - 1)->let.body_expression, depth+1);
+                            for(unsigned int i = 0; i < recursive_count; ++i)
+                            {
+                                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+                                OutputWriteCString(output, i ? " and " : " ");
+                                OutputWrite(output, let->let.string, let->let.string_length);
+                            }
+                            for(unsigned int i = recursive_count; i > 0; --i)
+                            {
+                                PushNode(LetRecursiveNested(node, i-1)->let.binding_expression, depth+1);
+                            }
+                            break;
+                        }
+                        OutputWriteCString(output, "let ");
+                        OutputWrite(output, node->let.string, node->let.string_length);
+                        PushNode(node->let.body_expression, depth+1);
+                        PushNode(node->let.binding_expression, depth+1);
+                        break;
                     }
-                    else if(hash_slot == original_hash_slot)
+                    case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                    {
+                        OutputWrite(output, node->identifier.string, node->identifier.string_length);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+                    {
+                        OutputWriteNumber(output, node->numeric_constant.value);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+                    {
+                        OutputWriteCString(output, node->boolean_constant.value ? "true" : "false");
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                    {
+                        OutputWriteCString(output, BinaryOperatorString(node->binary_operator.type));
+                        PushNode(node->binary_operator.right, depth+1);
+                        PushNode(node->binary_operator.left, depth+1);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                    {
+                        OutputWriteCString(output, "if");
+                        if(node->if_then_else.fail_code)
+                        {
+                            PushNode(node->if_then_else.fail_code, depth+1);
+                        }
+                        PushNode(node->if_then_else.pass_code, depth+1);
+                        PushNode(node->if_then_else.condition, depth+1);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                    {
+                        OutputWriteCString(output, "function ");
+                        OutputWrite(output, node->function_definition.param_name,
+                                    node->function_definition.param_name_length);
+                        PushNode(node->function_definition.body, depth+1);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_call:
                     {
+                        OutputWriteCString(output, "call");
+                        PushNode(node->function_call.parameter, depth+1);
+                        PushNode(node->function_call.closure, depth+1);
                         break;
                     }
+                    case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                    {
+                        OutputWriteCString(output, "array");
+                        for(unsigned int i = node->array_literal.element_count; i > 0; --i)
+                        {
+                            PushNode(node->array_literal.elements[i-1], depth+1);
+                        }
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_index:
+                    {
+                        OutputWriteCString(output, "index");
+                        PushNode(node->index.index, depth+1);
+                        PushNode(node->index.array, depth+1);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+                    {
+                        OutputWriteCString(output, "operator ");
+                        OutputWriteCString(output, BinaryOperatorString(node->operator_reference.type));
+                        break;
+                    }
+                    default: break;
                 }
+                OutputWriteCharacter(output, '\n');
+                break;
             }
-            else
+            
+            case ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_json:
             {
+                switch(node->type)
+                {
+                    case ABSTRACT_SYNTAX_TREE_NODE_let:
+                    {
+                        // NOTE(rjf): Names are only ever letters, digits, underscores
+                        //            and #, so they don't need escaping here.
+                        unsigned int recursive_count = LetRecursiveCount(node);
+                        if(recursive_count)
+                        {
+                            OutputWriteCString(output, "{\"type\":\"let_rec\",\"bindings\":[");
+                            PushText("}");
+                            PushNode(LetRecursiveNested(node, recursive_count - 1)->let.body_expression, 0);
+                            PushText("],\"body\":");
+                            for(unsigned int i = recursive_count; i > 0; --i)
+                            {
+                                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i-1);
+                                PushText("}");
+                                PushNode(let->let.binding_expression, 0);
+                                PushText("\",\"binding\":");
+                                AbstractSyntaxTreePrintPush(&stack, 0, let->let.string, let->let.string_length, 0);
+                                PushText(i > 1 ? ",{\"name\":\"" : "{\"name\":\"");
+                            }
+                            break;
+                        }
+                        OutputWriteCString(output, "{\"type\":\"let\",\"name\":");
+                        OutputWriteJSONString(output, node->let.string, node->let.string_length);
+                        OutputWriteCString(output, ",\"binding\":");
+                        PushText("}");
+                        PushNode(node->let.body_expression, 0);
+                        PushText(",\"body\":");
+                        PushNode(node->let.binding_expression, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"identifier\",\"name\":");
+                        OutputWriteJSONString(output, node->identifier.string, node->identifier.string_length);
+                        OutputWriteCharacter(output, '}');
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+                    {
+                        // NOTE(rjf): JSON has no infinities, so huge literals become null.
+                        double value = node->numeric_constant.value;
+                        OutputWriteCString(output, "{\"type\":\"number\",\"value\":");
+                        if(value - value == 0)
+                        {
+                            OutputWriteNumber(output, value);
+                        }
+                        else
+                        {
+                            OutputWriteCString(output, "null");
+                        }
+                        OutputWriteCharacter(output, '}');
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+                    {
+                        OutputWriteCString(output, node->boolean_constant.value ?
+                                           "{\"type\":\"boolean\",\"value\":true}" :
+                                           "{\"type\":\"boolean\",\"value\":false}");
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"binary_operator\",\"operator\":\"");
+                        OutputWriteCString(output, BinaryOperatorString(node->binary_operator.type));
+                        OutputWriteCString(output, "\",\"left\":");
+                        PushText("}");
+                        PushNode(node->binary_operator.right, 0);
+                        PushText(",\"right\":");
+                        PushNode(node->binary_operator.left, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"if\",\"condition\":");
+                        PushText("}");
+                        if(node->if_then_else.fail_code)
+                        {
+                            PushNode(node->if_then_else.fail_code, 0);
+                            PushText(",\"else\":");
+                        }
+                        PushNode(node->if_then_else.pass_code, 0);
+                        PushText(",\"then\":");
+                        PushNode(node->if_then_else.condition, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"function\",\"parameter\":");
+                        OutputWriteJSONString(output, node->function_definition.param_name,
+                                              node->function_definition.param_name_length);
+                        OutputWriteCString(output, ",\"body\":");
+                        PushText("}");
+                        PushNode(node->function_definition.body, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"call\",\"function\":");
+                        PushText("}");
+                        PushNode(node->function_call.parameter, 0);
+                        PushText(",\"argument\":");
+                        PushNode(node->function_call.closure, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"array\",\"elements\":[");
+                        PushText("]}");
+                        for(unsigned int i = node->array_literal.element_count; i > 0; --i)
+                        {
+                            PushNode(node->array_literal.elements[i-1], 0);
+                            if(i > 1)
+                            {
+                                PushText(",");
+                            }
+                        }
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_index:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"index\",\"array\":");
+                        PushText("}");
+                        PushNode(node->index.index, 0);
+                        PushText(",\"index\":");
+                        PushNode(node->index.array, 0);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+                    {
+                        OutputWriteCString(output, "{\"type\":\"operator\",\"operator\":\"");
+                        OutputWriteCString(output, BinaryOperatorString(node->operator_reference.type));
+                        OutputWriteCString(output, "\"}");
+                        break;
+                    }
+                    default:
+                    {
+                        OutputWriteCString(output, "null");
+                        break;
+                    }
+                }
                 break;
             }
+            
         }
     }
     
-    return found;
+    free(stack.items);
 }
 
-static EvaluationResult
-EvaluateAbstractSyntaxTree(InterpreterEnvironment *environment,
-                           AbstractSyntaxTreeNode *root)
+#undef PushNode
+#undef PushText
+
+#define INTERPRETER_ENVIRONMENT_DEFAULT_IDENTIFIER_TABLE_SIZE 512
+
+// NOTE(rjf): The garbage collector is defined in lettuce_garbage_collector.c,
+//            because it needs to know the layout of environments, but
+//            environments and the evaluator need to call into it.
+typedef struct GarbageCollector GarbageCollector;
+
+enum
 {
-    EvaluationResult result = {0};
+    GARBAGE_COLLECTOR_OBJECT_environment,
+    GARBAGE_COLLECTOR_OBJECT_value_table,
+    GARBAGE_COLLECTOR_OBJECT_key_table,
+};
+
+enum
+{
+    GARBAGE_COLLECTOR_ROOT_result,
+    GARBAGE_COLLECTOR_ROOT_environment_pointer,
+    GARBAGE_COLLECTOR_ROOT_environment,
+    GARBAGE_COLLECTOR_ROOT_evaluation_stack,
+};
+
+static void *GarbageCollectorAllocate(GarbageCollector *gc, unsigned int size, int type);
+static void *GarbageCollectorAllocateZero(GarbageCollector *gc, unsigned int size, int type);
+static void GarbageCollectorWriteBarrier(GarbageCollector *gc, void *payload);
+static void GarbageCollectorPushRoot(GarbageCollector *gc, int type, void *slot);
+static void GarbageCollectorPopRoots(GarbageCollector *gc, unsigned int count);
+static void GarbageCollectorSafepoint(GarbageCollector *gc, unsigned long long bytes_needed);
+static unsigned long long GarbageCollectorHeapBytes(GarbageCollector *gc);
+
+// NOTE(rjf): The evaluator's explicit stack, defined with the evaluator.
+typedef struct EvaluationStack EvaluationStack;
+
+typedef struct InterpreterEnvironment
+{
+    MemoryArena *arena;
     
-    switch(root->type)
+    // NOTE(rjf): When this is set, the environment's tables and any environments
+    //            duplicated from it are allocated by the collector rather than on
+    //            the arena.
+    GarbageCollector *gc;
+    
+    // NOTE(rjf): Shared by every environment duplicated from this one, like the
+    //            arena. If it isn't set, each evaluation makes its own.
+    EvaluationStack *stack;
+    
+    // NOTE(rjf): Only set for environments on the evaluation stack's region,
+    //            where it says how far to rewind the region to free them.
+    MemoryArenaMarker *region_marker;
+    
+    unsigned int identifier_table_count;
+    unsigned int identifier_table_cap;
+    
+    struct
     {
-        case ABSTRACT_SYNTAX_TREE_NODE_let:
-        {
-            EvaluationResult binding = EvaluateAbstractSyntaxTree(environment, root->let.binding_expression);
-            InterpreterEnvironmentBind(environment, root->let.string, root->let.string_length,
-                                       binding);
-            EvaluationResult body = EvaluateAbstractSyntaxTree(environment, root->let.body_expression);
-            InterpreterEnvironmentDelete(environment, root->let.string, root->let.string_length);
-            
-            result = body;
-            
-            break;
-        }
-        case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+        EvaluationResult value;
+    }
+    *identifier_table_values;
+    
+    struct
+    {
+        char *string;
+        int string_length;
+        int deleted;
+    }
+    *identifier_table_keys;
+}
+InterpreterEnvironment;
+
+static unsigned int
+HashString(char *str, int str_len)
+{
+    unsigned int hash = 5381;
+    int c;
+    int i = 0;
+    while(c = *str++ && i < str_len)
+    {
+        hash = ((hash << 5) + hash) + c; // == hash * 33 + c
+        ++i;
+    }
+    
+    return hash;
+}
+
+static void *
+InterpreterEnvironmentAllocate(InterpreterEnvironment *environment, unsigned int size, int type, int category,
+                               int zero)
+{
+    void *result = 0;
+    if(environment->gc)
+    {
+        result = (zero ? GarbageCollectorAllocateZero(environment->gc, size, type) :
+                  GarbageCollectorAllocate(environment->gc, size, type));
+    }
+    else
+    {
+        result = (zero ? MemoryArenaAllocateZero(environment->arena, size, category) :
+                  MemoryArenaAllocate(environment->arena, size, category));
+    }
+    return result;
+}
+
+// NOTE(rjf): An upper bound on how much duplicating or reserving the environment
+//            allocates, so the evaluator can collect before doing either.
+static unsigned long long
+InterpreterEnvironmentAllocationSize(InterpreterEnvironment *environment)
+{
+    unsigned long long cap = environment->identifier_table_cap;
+    if(!cap)
+    {
+        cap = INTERPRETER_ENVIRONMENT_DEFAULT_IDENTIFIER_TABLE_SIZE;
+    }
+    return (sizeof(InterpreterEnvironment) +
+            cap * (sizeof(environment->identifier_table_values[0]) + sizeof(environment->identifier_table_keys[0])) +
+            3*64);
+}
+
+static void
+InterpreterEnvironmentReserve(InterpreterEnvironment *environment)
+{
+    if(!environment->identifier_table_cap)
+    {
+        environment->identifier_table_count = 0;
+        environment->identifier_table_cap = INTERPRETER_ENVIRONMENT_DEFAULT_IDENTIFIER_TABLE_SIZE;
+        environment->identifier_table_values = InterpreterEnvironmentAllocate(environment,
+                                                                              sizeof(environment->identifier_table_values[0]) *
+                                                                              environment->identifier_table_cap,
+                                                                              GARBAGE_COLLECTOR_OBJECT_value_table,
+                                                                              MEMORY_ARENA_CATEGORY_environments, 1);
+        environment->identifier_table_keys = InterpreterEnvironmentAllocate(environment,
+                                                                            sizeof(environment->identifier_table_keys[0]) *
+                                                                            environment->identifier_table_cap,
+                                                                            GARBAGE_COLLECTOR_OBJECT_key_table,
+                                                                            MEMORY_ARENA_CATEGORY_environments, 1);
+        
+        // NOTE(rjf): No write barrier is needed here. Collected environments get
+        //            their tables as soon as they're created, so the only ones that
+        //            come through here are roots, which aren't collected, and ones
+        //            that InterpreterEnvironmentDuplicate just allocated, which are
+        //            either in the nursery or already remembered.
+    }
+}
+
+// NOTE(rjf): Allocates on region instead, when it's set, which is only done
+//            without a collector.
+static void *
+InterpreterEnvironmentAllocateOn(InterpreterEnvironment *environment, MemoryArena *region, unsigned int size,
+                                 int type)
+{
+    void *result = 0;
+    if(region)
+    {
+        result = MemoryArenaAllocate(region, size, MEMORY_ARENA_CATEGORY_closures);
+    }
+    else
+    {
+        result = InterpreterEnvironmentAllocate(environment, size, type, MEMORY_ARENA_CATEGORY_closures, 0);
+    }
+    return result;
+}
+
+// NOTE(rjf): The duplicate keeps using environment's arena for everything that
+//            is allocated through it later, even if it's on region itself.
+static InterpreterEnvironment *
+InterpreterEnvironmentDuplicateOn(InterpreterEnvironment *environment, MemoryArena *region)
+{
+    InterpreterEnvironment *new_environment = InterpreterEnvironmentAllocateOn(environment, region, sizeof(InterpreterEnvironment),
+                                                                               GARBAGE_COLLECTOR_OBJECT_environment);
+    new_environment->arena = environment->arena;
+    new_environment->gc = environment->gc;
+    new_environment->stack = environment->stack;
+    new_environment->region_marker = 0;
+    
+    // NOTE(rjf): The new environment always gets its own table, even when the
+    //            one being duplicated doesn't have one yet. Otherwise, the table
+    //            would be allocated lazily by the first bind, which could happen
+    //            inside an arena scope that is about to be released.
+    if(environment->identifier_table_cap)
+    {
+        new_environment->identifier_table_count = environment->identifier_table_count;
+        new_environment->identifier_table_cap = environment->identifier_table_cap;
+        new_environment->identifier_table_values = InterpreterEnvironmentAllocateOn(environment, region,
+                                                                                    new_environment->identifier_table_cap * sizeof(new_environment->identifier_table_values[0]),
+                                                                                    GARBAGE_COLLECTOR_OBJECT_value_table);
+        new_environment->identifier_table_keys = InterpreterEnvironmentAllocateOn(environment, region,
+                                                                                  new_environment->identifier_table_cap * sizeof(new_environment->identifier_table_keys[0]),
+                                                                                  GARBAGE_COLLECTOR_OBJECT_key_table);
+        
+        MemoryCopy(new_environment->identifier_table_values, environment->identifier_table_values,
+                   sizeof(new_environment->identifier_table_values[0]) * new_environment->identifier_table_cap);
+        MemoryCopy(new_environment->identifier_table_keys, environment->identifier_table_keys,
+                   sizeof(new_environment->identifier_table_keys[0]) * new_environment->identifier_table_cap);
+    }
+    else
+    {
+        new_environment->identifier_table_cap = 0;
+        InterpreterEnvironmentReserve(new_environment);
+    }
+    
+    return new_environment;
+}
+
+static InterpreterEnvironment *
+InterpreterEnvironmentDuplicate(InterpreterEnvironment *environment)
+{
+    return InterpreterEnvironmentDuplicateOn(environment, 0);
+}
+
+static int
+InterpreterEnvironmentBind(InterpreterEnvironment *environment, char *string, int string_length,
+                           EvaluationResult evaluation)
+{
+    int added = 0;
+    
+    InterpreterEnvironmentReserve(environment);
+    
+    if(environment->identifier_table_count >= environment->identifier_table_cap)
+    {
+        // TODO(rjf): We need to expand the table.
+    }
+    
+    unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
+    unsigned int original_hash_slot = hash_slot;
+    
+    for(;;)
+    {
+        if(!environment->identifier_table_keys[hash_slot].deleted &&
+           environment->identifier_table_keys[hash_slot].string)
+        {
+            if(environment->identifier_table_keys[hash_slot].string &&
+               StringMatch(string, string_length,
+                           environment->identifier_table_keys[hash_slot].string,
+                           environment->identifier_table_keys[hash_slot].string_length))
+            {
+                environment->identifier_table_values[hash_slot].value = evaluation;
+                GarbageCollectorWriteBarrier(environment->gc, environment->identifier_table_values);
+                added = 1;
+                break;
+            }
+            else
+            {
+                ++hash_slot;
+                if(hash_slot >= environment->identifier_table_cap)
+                {
+                    hash_slot = 0;
+                }
+                else if(hash_slot == original_hash_slot)
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            added = 1;
+            environment->identifier_table_values[hash_slot].value = evaluation;
+            GarbageCollectorWriteBarrier(environment->gc, environment->identifier_table_values);
+            environment->identifier_table_keys[hash_slot].string = string;
+            environment->identifier_table_keys[hash_slot].string_length = string_length;
+            environment->identifier_table_keys[hash_slot].deleted = 0;
+        }
+    }
+    
+    return added;
+}
+
+static int
+InterpreterEnvironmentLookUp(InterpreterEnvironment *environment, char *string, int string_length,
+                             EvaluationResult *out_result)
+{
+    int found = 0;
+    
+    if(environment->identifier_table_cap)
+    {
+        unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
+        unsigned int original_hash_slot = hash_slot;
+        
+        for(;;)
+        {
+            if(environment->identifier_table_keys[hash_slot].string ||
+               environment->identifier_table_keys[hash_slot].deleted)
+            {
+                if(!environment->identifier_table_keys[hash_slot].deleted &&
+                   environment->identifier_table_keys[hash_slot].string &&
+                   StringMatch(string, string_length,
+                               environment->identifier_table_keys[hash_slot].string,
+                               environment->identifier_table_keys[hash_slot].string_length))
+                {
+                    found = 1;
+                    if(out_result)
+                    {
+                        *out_result = environment->identifier_table_values[hash_slot].value;
+                    }
+                    break;
+                }
+                else
+                {
+                    ++hash_slot;
+                    if(hash_slot >= environment->identifier_table_cap)
+                    {
+                        hash_slot = 0;
+                    }
+                    else if(hash_slot == original_hash_slot)
+                    {
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+    
+    return found;
+}
+
+static int
+InterpreterEnvironmentDelete(InterpreterEnvironment *environment, char *string, int string_length)
+{
+    int found = 0;
+    
+    if(environment->identifier_table_cap)
+    {
+        unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
+        unsigned int original_hash_slot = hash_slot;
+        
+        for(;;)
+        {
+            if(environment->identifier_table_keys[hash_slot].string ||
+               environment->identifier_table_keys[hash_slot].deleted)
+            {
+                if(environment->identifier_table_keys[hash_slot].string &&
+                   StringMatch(string, string_length,
+                               environment->identifier_table_keys[hash_slot].string,
+                               environment->identifier_table_keys[hash_slot].string_length))
+                {
+                    found = 1;
+                    EvaluationResult empty_value = {0};
+                    environment->identifier_table_values[hash_slot].value = empty_value;
+                    environment->identifier_table_keys[hash_slot].deleted = 1;
+                    environment->identifier_table_keys[hash_slot].string = 0;
+                    environment->identifier_table_keys[hash_slot].string_length = 0;
+                    break;
+                }
+                else
+                {
+                    ++hash_slot;
+                    if(hash_slot >= environment->identifier_table_cap)
+                    {
+                        hash_slot = 0;
+                    }
+                    else if(hash_slot == original_hash_slot)
+                    {
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+    
+    return found;
+}
+
+// NOTE(rjf): Binds string to *value, and puts what it was bound to before in
+//            *value. Returns 0 if it wasn't bound. This finds the slot the same
+//            way InterpreterEnvironmentBind does, in one pass.
+static int
+InterpreterEnvironmentExchange(InterpreterEnvironment *environment, char *string, int string_length,
+                               EvaluationResult *value)
+{
+    int shadowed = 0;
+    
+    InterpreterEnvironmentReserve(environment);
+    
+    unsigned int hash_slot = HashString(string, string_length) % environment->identifier_table_cap;
+    unsigned int original_hash_slot = hash_slot;
+    
+    for(;;)
+    {
+        if(!environment->identifier_table_keys[hash_slot].deleted &&
+           environment->identifier_table_keys[hash_slot].string)
+        {
+            if(StringMatch(string, string_length,
+                           environment->identifier_table_keys[hash_slot].string,
+                           environment->identifier_table_keys[hash_slot].string_length))
+            {
+                EvaluationResult previous = environment->identifier_table_values[hash_slot].value;
+                environment->identifier_table_values[hash_slot].value = *value;
+                GarbageCollectorWriteBarrier(environment->gc, environment->identifier_table_values);
+                *value = previous;
+                shadowed = 1;
+                break;
+            }
+            
+            ++hash_slot;
+            if(hash_slot >= environment->identifier_table_cap)
+            {
+                hash_slot = 0;
+            }
+            if(hash_slot == original_hash_slot)
+            {
+                break;
+            }
+        }
+        else
+        {
+            environment->identifier_table_values[hash_slot].value = *value;
+            GarbageCollectorWriteBarrier(environment->gc, environment->identifier_table_values);
+            environment->identifier_table_keys[hash_slot].string = string;
+            environment->identifier_table_keys[hash_slot].string_length = string_length;
+            environment->identifier_table_keys[hash_slot].deleted = 0;
+            *value = (EvaluationResult){0};
+            break;
+        }
+    }
+    
+    return shadowed;
+}
+
+// NOTE(rjf): Undoes InterpreterEnvironmentExchange.
+static void
+InterpreterEnvironmentRestore(InterpreterEnvironment *environment, char *string, int string_length,
+                              EvaluationResult value, int shadowed)
+{
+    if(shadowed)
+    {
+        InterpreterEnvironmentBind(environment, string, string_length, value);
+    }
+    else
+    {
+        InterpreterEnvironmentDelete(environment, string, string_length);
+    }
+}
+
+// NOTE(rjf): Makes the functions of the let rec group that node starts, count
+//            lets long, and binds them in environment. They share one copy of
+//            environment, with the group bound in it as well, so their bodies
+//            find each other, and themselves, without another closure being made
+//            for every call, like self-application needs. Returns the first of
+//            them. With a collector, this has to come right after a safepoint.
+static EvaluationResult
+InterpreterEnvironmentBindRecursive(InterpreterEnvironment *environment, AbstractSyntaxTreeNode *node,
+                                    unsigned int count)
+{
+    InterpreterEnvironment *shared = InterpreterEnvironmentDuplicate(environment);
+    EvaluationResult first = {0};
+    
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+        AbstractSyntaxTreeNode *definition = let->let.binding_expression;
+        EvaluationResult closure = {
+            EVALUATION_RESULT_closure,
+        };
+        closure.closure.body = definition->function_definition.body;
+        closure.closure.environment = shared;
+        closure.closure.param_name = definition->function_definition.param_name;
+        closure.closure.param_name_length = definition->function_definition.param_name_length;
+        InterpreterEnvironmentBind(shared, let->let.string, let->let.string_length, closure);
+        InterpreterEnvironmentBind(environment, let->let.string, let->let.string_length, closure);
+        if(!i)
+        {
+            first = closure;
+        }
+    }
+    
+    return first;
+}
+
+// NOTE(rjf): Scalar results don't point at anything, so when a let or a call
+//            produces one, everything that was allocated while computing it
+//            (duplicated environments, closures, error strings) is garbage and
+//            the arena can be rewound to where it was before.
+static int
+EvaluationResultIsScalar(EvaluationResult result)
+{
+    return (result.type == EVALUATION_RESULT_number ||
+            result.type == EVALUATION_RESULT_boolean);
+}
+
+// NOTE(rjf): Errors that aren't from running into a limit.
+static EvaluationResult
+EvaluationErrorResult(char *error_string)
+{
+    EvaluationResult result = {0};
+    result.type = EVALUATION_RESULT_error;
+    result.error.error_string = error_string;
+    return result;
+}
+
+// NOTE(rjf): Writes result on a line of its own, the way --batch does.
+static void
+OutputWriteEvaluationResult(OutputBuffer *output, EvaluationResult result)
+{
+    switch(result.type)
+    {
+        case EVALUATION_RESULT_error:
+        {
+            OutputWriteF(output, "RUNTIME ERROR: %s\n", result.error.error_string);
+            break;
+        }
+        case EVALUATION_RESULT_number:
+        {
+            OutputWriteNumber(output, result.number);
+            OutputWriteCharacter(output, '\n');
+            break;
+        }
+        case EVALUATION_RESULT_boolean:
+        {
+            OutputWriteCString(output, result.boolean ? "true\n" : "false\n");
+            break;
+        }
+        case EVALUATION_RESULT_array:
+        {
+            OutputWriteArray(output, result.array.elements, result.array.count);
+            OutputWriteCharacter(output, '\n');
+            break;
+        }
+        case EVALUATION_RESULT_closure:
+        case EVALUATION_RESULT_builtin:
+        case EVALUATION_RESULT_compiled:
+        {
+            OutputWriteCString(output, "closure\n");
+            break;
+        }
+        default: break;
+    }
+}
+
+// NOTE(rjf): Builtin functions take their arguments one at a time, like
+//            closures, so fold(f)(0)(a) is fold applied to f, then 0, then a.
+//            An operator used as a function, like (+), is the operator builtin,
+//            which can't be referred to by name.
+#define BUILTIN_LIST \
+Builtin(operator, 0,        2) \
+Builtin(map,      "map",    2) \
+Builtin(fold,     "fold",   3) \
+Builtin(filter,   "filter", 2) \
+Builtin(sum,      "sum",    1) \
+Builtin(dot,      "dot",    2) \
+Builtin(length,   "length", 1) \
+
+enum
+{
+#define Builtin(name, str, arity) BUILTIN_##name,
+    BUILTIN_LIST
+#undef Builtin
+    BUILTIN_COUNT
+};
+
+static char *builtin_names[BUILTIN_COUNT] = {
+#define Builtin(name, str, arity) str,
+    BUILTIN_LIST
+#undef Builtin
+};
+
+static int builtin_arities[BUILTIN_COUNT] = {
+#define Builtin(name, str, arity) arity,
+    BUILTIN_LIST
+#undef Builtin
+};
+
+// NOTE(rjf): Builtins are only looked up once an identifier isn't found in
+//            the environment, so programs can shadow them.
+static int
+BuiltinLookUp(char *string, int string_length, EvaluationResult *out_result)
+{
+    int found = 0;
+    for(int i = 0; i < BUILTIN_COUNT; ++i)
+    {
+        if(builtin_names[i] && StringMatch(string, string_length, builtin_names[i],
+                                           CalculateCStringLength(builtin_names[i])))
+        {
+            EvaluationResult result = {0};
+            result.type = EVALUATION_RESULT_builtin;
+            result.builtin.type = i;
+            *out_result = result;
+            found = 1;
+            break;
+        }
+    }
+    return found;
+}
+
+// NOTE(rjf): The builtins themselves, and arithmetic on arrays, are in
+//            lettuce_array.c.
+static EvaluationResult BuiltinApply(InterpreterEnvironment *environment, EvaluationResult *builtin,
+                                     EvaluationResult *argument);
+static EvaluationResult ArrayBinaryOperator(InterpreterEnvironment *environment, int operator_type,
+                                            EvaluationResult left, EvaluationResult right);
+
+static EvaluationResult EvaluateAbstractSyntaxTree(InterpreterEnvironment *environment,
+                                                   AbstractSyntaxTreeNode *root);
+
+static EvaluationResult
+EvaluateBinaryOperator(int type, EvaluationResult left_eval, EvaluationResult right_eval)
+{
+    EvaluationResult result = {0};
+    
+    if(type == BINARY_OPERATOR_plus)
+    { 
+        result.type = EVALUATION_RESULT_number;
+        result.number = left_eval.number + right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_minus)
+    {
+        result.type = EVALUATION_RESULT_number;
+        result.number = left_eval.number - right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_multiply)
+    {
+        result.type = EVALUATION_RESULT_number;
+        result.number = left_eval.number * right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_divide)
+    {
+        result.type = EVALUATION_RESULT_number;
+        result.number = left_eval.number / right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_and)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.boolean && right_eval.boolean;
+    }
+    else if(type == BINARY_OPERATOR_or)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.boolean || right_eval.boolean;
+    }
+    else if(type == BINARY_OPERATOR_less_than)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.number < right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_less_than_equal_to)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.number <= right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_greater_than)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.number > right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_greater_than_equal_to)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.number >= right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_equal_to)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.number == right_eval.number;
+    }
+    else if(type == BINARY_OPERATOR_not_equal_to)
+    {
+        result.type = EVALUATION_RESULT_boolean;
+        result.boolean = left_eval.number != right_eval.number;
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): Runs a call with compiled code, if it can, returning 1 with the
+//            result in result. Otherwise it returns 0, with a compiled closure
+//            in function turned into one of ours. Does nothing, and returns 0,
+//            when the stack has no tier.
+#if LETTUCE_TIER
+static int TierCall(InterpreterEnvironment *environment, EvaluationResult *function, EvaluationResult *argument,
+                    EvaluationResult *result);
+#endif
+
+// NOTE(rjf): Calls a closure or a builtin with one argument. The function must
+//            be in a slot that is registered with the garbage collector, since
+//            a collection can move its environment during the call.
+static EvaluationResult
+EvaluationResultApply(InterpreterEnvironment *environment, EvaluationResult *function,
+                      EvaluationResult *argument)
+{
+    EvaluationResult result = {0};
+    
+    int ran_compiled = 0;
+#if LETTUCE_TIER
+    EvaluationResult materialized = {0};
+    if(function->type == EVALUATION_RESULT_closure && environment->stack)
+    {
+        ran_compiled = TierCall(environment, function, argument, &result);
+    }
+    else if(function->type == EVALUATION_RESULT_compiled && environment->stack)
+    {
+        // NOTE(rjf): The compiled closure may be turned into one of ours, which
+        //            shouldn't change the caller's value.
+        materialized = *function;
+        ran_compiled = TierCall(environment, &materialized, argument, &result);
+        function = &materialized;
+    }
+#endif
+    
+    if(ran_compiled)
+    {
+        // NOTE(rjf): TierCall has already put the result in result.
+    }
+    else if(function->type == EVALUATION_RESULT_closure)
+    {
+        GarbageCollector *gc = function->closure.environment->gc;
+        EvaluationResult shadowed_value = *argument;
+        GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_result, &shadowed_value);
+        int shadowed = InterpreterEnvironmentExchange(function->closure.environment, function->closure.param_name,
+                                                      function->closure.param_name_length, &shadowed_value);
+        result = EvaluateAbstractSyntaxTree(function->closure.environment, function->closure.body);
+        InterpreterEnvironmentRestore(function->closure.environment, function->closure.param_name,
+                                      function->closure.param_name_length, shadowed_value, shadowed);
+        GarbageCollectorPopRoots(gc, 1);
+    }
+    else if(function->type == EVALUATION_RESULT_builtin)
+    {
+        result = BuiltinApply(environment, function, argument);
+    }
+    else if(function->type == EVALUATION_RESULT_error)
+    {
+        result = *function;
+    }
+    else
+    {
+        result = EvaluationErrorResult("Called a value that is not a function.");
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): The evaluator doesn't recurse on the C stack. Instead, every node
+//            that is waiting on one of its children (a let waiting on its
+//            binding, a call waiting on its argument, ...) leaves a frame on an
+//            explicit stack, saying what to do with the child's value when it
+//            comes back. Frames live in fixed-size segments: the first one is
+//            inside the stack itself, and the rest are allocated on the stack's
+//            own arena as it gets deeper and are kept around for reuse, so
+//            nesting costs memory rather than a crash. When a program goes
+//            deeper than max_depth frames, evaluation stops with an error.
+//
+//            Evaluations started by builtins (like map calling a closure) run
+//            on the same stack, above the frames of the evaluation that called
+//            them, so the limit covers them too.
+//
+//            The other limits (see EvaluationLimits) are for programs that can't
+//            be trusted to finish, or to finish without eating all the memory.
+//            They're checked every EVALUATION_LIMIT_CHECK_INTERVAL node visits,
+//            rather than on every one, and count from when the outermost
+//            evaluation on the stack started. Going past any of them unwinds
+//            the whole stack, like going too deep, rewinding the arena at every
+//            let and call on the way, and the result is an error that says
+//            which limit it was.
+
+#define EVALUATION_STACK_SEGMENT_SIZE 64
+#define EVALUATION_STACK_DEFAULT_MAX_DEPTH 1000000
+#define EVALUATION_LIMIT_CHECK_INTERVAL 1024
+
+// NOTE(rjf): Everything that's 0 is unlimited, except for max_depth, which is
+//            EVALUATION_STACK_DEFAULT_MAX_DEPTH frames then.
+typedef struct EvaluationLimits
+{
+    unsigned long long max_depth;
+    
+    // NOTE(rjf): How many nodes may be evaluated.
+    unsigned long long max_fuel;
+    
+    // NOTE(rjf): How much the evaluation may add to the arena, the region, and
+    //            the collector's heap. This is only checked along with the
+    //            others, so it can be overshot by what a few thousand nodes
+    //            allocate.
+    unsigned long long max_bytes;
+    
+    unsigned long long deadline_milliseconds;
+}
+EvaluationLimits;
+
+enum
+{
+    EVALUATION_FRAME_let_binding,
+    EVALUATION_FRAME_let_body,
+    EVALUATION_FRAME_if_condition,
+    EVALUATION_FRAME_if_branch,
+    EVALUATION_FRAME_call_function,
+    EVALUATION_FRAME_call_argument,
+    EVALUATION_FRAME_call_body,
+    EVALUATION_FRAME_binary_left,
+    EVALUATION_FRAME_binary_right,
+    EVALUATION_FRAME_index_array,
+    EVALUATION_FRAME_index_index,
+    EVALUATION_FRAME_array_element,
+};
+
+// NOTE(rjf): value is the function being called, the left operand, the array
+//            being indexed, or the array being filled in, depending on type.
+//            marker is only saved by lets and calls. For calls, element_index
+//            is how many arguments the call has, argument_count how many of
+//            them are on the stack's argument list, and bound_count how many of
+//            those have been bound while the body runs.
+typedef struct EvaluationFrame
+{
+    int type;
+    unsigned int element_index;
+    unsigned int argument_count;
+    unsigned int bound_count;
+    AbstractSyntaxTreeNode *node;
+    InterpreterEnvironment *environment;
+    EvaluationResult value;
+    MemoryArenaMarker marker;
+}
+EvaluationFrame;
+
+// NOTE(rjf): Once it's bound, an argument swaps places with what its parameter
+//            shadowed in the closure's environment, if anything.
+typedef struct EvaluationArgument
+{
+    EvaluationResult value;
+    int shadowed;
+}
+EvaluationArgument;
+
+typedef struct EvaluationStackSegment EvaluationStackSegment;
+typedef struct EvaluationStackSegment
+{
+    EvaluationStackSegment *previous;
+    EvaluationStackSegment *next;
+    EvaluationFrame frames[EVALUATION_STACK_SEGMENT_SIZE];
+}
+EvaluationStackSegment;
+
+typedef struct EvaluationStack
+{
+    MemoryArena arena;
+    EvaluationStackSegment first_segment;
+    EvaluationStackSegment *segment;
+    unsigned int segment_count;
+    unsigned long long depth;
+    unsigned long long max_depth;
+    unsigned long long peak_depth;
+    
+    EvaluationLimits limits;
+    unsigned long long fuel_used;
+    unsigned long long base_bytes;
+    unsigned long long deadline;
+    
+    // NOTE(rjf): Counts down node visits until the limits are next checked,
+    //            from limit_period.
+    unsigned long long limit_countdown;
+    unsigned long long limit_period;
+    
+    // NOTE(rjf): Set when a limit is hit, so that every evaluation on the stack
+    //            unwinds, rather than carrying on with the error as a value. The
+    //            message is kept here rather than on the arena, which is rewound
+    //            while unwinding.
+    char *abort_error;
+    int abort_limit;
+    char abort_error_buffer[128];
+    
+    // NOTE(rjf): With slice_nodes set, EvaluationBegin and EvaluationResume stop
+    //            at the first limit check after that many more nodes, and save
+    //            where they were here.
+    unsigned long long slice_nodes;
+    unsigned long long slice_end;
+    int suspended;
+    int suspended_closure_on_region;
+    AbstractSyntaxTreeNode *suspended_node;
+    InterpreterEnvironment *suspended_environment;
+    EvaluationResult suspended_value;
+    
+    // NOTE(rjf): Environments of closures that escape analysis showed don't
+    //            outlive the let or call that made them. Lets and calls nest,
+    //            so the region is rewound to free each one when its let or call
+    //            is done, whatever it produces.
+    MemoryArena region;
+    unsigned long long region_closure_count;
+    unsigned long long region_bytes;
+    unsigned long long region_peak_bytes;
+    
+    // NOTE(rjf): The arguments of the calls on the stack. A call's arguments are
+    //            all evaluated, in the caller's environment, before any of them
+    //            is bound, and what the parameters shadowed is put back when the
+    //            body is done, so a closure that calls itself, which binds into
+    //            the environment it's running in, gets its own parameters back.
+    EvaluationArgument *arguments;
+    unsigned long long argument_count;
+    unsigned long long argument_cap;
+    
+    // NOTE(rjf): With this set, closure calls are counted, and hot functions
+    //            are run compiled (see lettuce_tier.c).
+    struct Tier *tier;
+}
+EvaluationStack;
+
+// NOTE(rjf): limits can be 0, for just the default depth limit.
+static void
+EvaluationStackInit(EvaluationStack *stack, EvaluationLimits *limits)
+{
+    MemoryArena arena = stack->arena;
+    memset(stack, 0, sizeof(*stack));
+    stack->arena = arena;
+    stack->region.backend = arena.backend;
+    stack->segment = &stack->first_segment;
+    if(limits)
+    {
+        stack->limits = *limits;
+    }
+    stack->max_depth = stack->limits.max_depth ? stack->limits.max_depth : EVALUATION_STACK_DEFAULT_MAX_DEPTH;
+    stack->limit_countdown = stack->limit_period = EVALUATION_LIMIT_CHECK_INTERVAL;
+}
+
+static void
+EvaluationStackCleanUp(EvaluationStack *stack)
+{
+    free(stack->arguments);
+    MemoryArenaCleanUp(&stack->arena);
+    MemoryArenaCleanUp(&stack->region);
+}
+
+static void
+EvaluationStackPrintStats(EvaluationStack *stack, FILE *file)
+{
+    fprintf(file, "evaluation stack: peak depth %llu frames (limit %llu), %u extra segments\n",
+            stack->peak_depth, stack->max_depth, stack->segment_count);
+    fprintf(file, "evaluation stack: %llu closure environments (%llu bytes) on the region instead of the arena, "
+            "%llu bytes at most at once\n", stack->region_closure_count, stack->region_bytes, stack->region_peak_bytes);
+    fprintf(file, "evaluation stack: %llu nodes evaluated", stack->fuel_used + stack->limit_period - stack->limit_countdown);
+    if(stack->limits.max_fuel)
+    {
+        fprintf(file, " (limit %llu)", stack->limits.max_fuel);
+    }
+    fprintf(file, "\n");
+}
+
+static void
+EvaluationStackAbort(EvaluationStack *stack, int limit, char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(stack->abort_error_buffer, sizeof(stack->abort_error_buffer), format, args);
+    va_end(args);
+    stack->abort_error = stack->abort_error_buffer;
+    stack->abort_limit = limit;
+}
+
+static unsigned long long
+EvaluationStackUsedBytes(EvaluationStack *stack, InterpreterEnvironment *environment)
+{
+    return environment->arena->bytes + stack->region.bytes + GarbageCollectorHeapBytes(environment->gc);
+}
+
+// NOTE(rjf): Called by the outermost evaluation on the stack.
+static void
+EvaluationStackBeginLimits(EvaluationStack *stack, InterpreterEnvironment *environment)
+{
+    stack->fuel_used = 0;
+    stack->base_bytes = EvaluationStackUsedBytes(stack, environment);
+    stack->deadline = 0;
+    if(stack->limits.deadline_milliseconds)
+    {
+        stack->deadline = GetTimeInNanoseconds() + stack->limits.deadline_milliseconds * 1000000ull;
+    }
+    stack->limit_period = EVALUATION_LIMIT_CHECK_INTERVAL;
+    if(stack->limits.max_fuel && stack->limits.max_fuel + 1 < stack->limit_period)
+    {
+        stack->limit_period = stack->limits.max_fuel + 1;
+    }
+    stack->limit_countdown = stack->limit_period;
+}
+
+// NOTE(rjf): Called when limit_countdown runs out. Returns 0, after starting to
+//            unwind, if a limit has been hit. Otherwise, the countdown starts
+//            over, and is shortened if the fuel runs out before it's done, so
+//            the fuel limit is exact.
+static int
+EvaluationStackCheckLimits(EvaluationStack *stack, InterpreterEnvironment *environment)
+{
+    EvaluationLimits *limits = &stack->limits;
+    stack->fuel_used += stack->limit_period;
+    
+    if(limits->max_fuel && stack->fuel_used > limits->max_fuel)
+    {
+        stack->fuel_used = limits->max_fuel;
+        EvaluationStackAbort(stack, EVALUATION_LIMIT_fuel, "Evaluation ran out of fuel after %llu nodes.",
+                             limits->max_fuel);
+    }
+    else if(limits->max_bytes)
+    {
+        unsigned long long used = EvaluationStackUsedBytes(stack, environment);
+        if(used > stack->base_bytes && used - stack->base_bytes > limits->max_bytes)
+        {
+            EvaluationStackAbort(stack, EVALUATION_LIMIT_memory, "Evaluation used more than the limit of %llu bytes.",
+                                 limits->max_bytes);
+        }
+    }
+    if(!stack->abort_error && stack->deadline && GetTimeInNanoseconds() >= stack->deadline)
+    {
+        EvaluationStackAbort(stack, EVALUATION_LIMIT_deadline, "Evaluation took longer than the limit of %llu ms.",
+                             limits->deadline_milliseconds);
+    }
+    
+    stack->limit_period = EVALUATION_LIMIT_CHECK_INTERVAL;
+    if(limits->max_fuel && limits->max_fuel + 1 - stack->fuel_used < stack->limit_period)
+    {
+        stack->limit_period = limits->max_fuel + 1 - stack->fuel_used;
+    }
+    stack->limit_countdown = stack->limit_period;
+    
+    return !stack->abort_error;
+}
+
+static InterpreterEnvironment *
+EvaluationStackDuplicateEnvironment(EvaluationStack *stack, InterpreterEnvironment *environment)
+{
+    MemoryArena *region = &stack->region;
+    unsigned long long bytes = region->bytes;
+    MemoryArenaMarker marker = MemoryArenaSave(region);
+    MemoryArenaMarker *region_marker = MemoryArenaAllocate(region, sizeof(*region_marker), MEMORY_ARENA_CATEGORY_other);
+    *region_marker = marker;
+    
+    InterpreterEnvironment *new_environment = InterpreterEnvironmentDuplicateOn(environment, region);
+    new_environment->region_marker = region_marker;
+    
+    ++stack->region_closure_count;
+    stack->region_bytes += region->bytes - bytes;
+    if(region->bytes > stack->region_peak_bytes)
+    {
+        stack->region_peak_bytes = region->bytes;
+    }
+    return new_environment;
+}
+
+// NOTE(rjf): Takes what the let, or let rec group, that frame is for bound back
+//            out of its environment.
+static void
+EvaluationFrameUnbindLet(EvaluationFrame *frame)
+{
+    AbstractSyntaxTreeNode *let = frame->node;
+    unsigned int count = LetRecursiveCount(let);
+    for(unsigned int i = 0; i < count || i == 0; ++i)
+    {
+        InterpreterEnvironmentDelete(frame->environment, let->let.string, let->let.string_length);
+        let = let->let.body_expression;
+    }
+}
+
+// NOTE(rjf): Frees the environment of a closure made by the let or call that
+//            frame is for, if it's on the region.
+static void
+EvaluationStackReleaseClosure(EvaluationStack *stack, EvaluationFrame *frame)
+{
+    AbstractSyntaxTreeNode *node = frame->node;
+    int owned = 0;
+    if(node->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+    {
+        owned = node->let.binding_does_not_escape;
+    }
+    else if(node->type == ABSTRACT_SYNTAX_TREE_NODE_function_call)
+    {
+        owned = FunctionCallNested(node, FunctionCallArgumentCount(node), 0)->function_call.closure_does_not_escape;
+    }
+    
+    if(owned && frame->value.type == EVALUATION_RESULT_closure &&
+       frame->value.closure.environment->region_marker)
+    {
+        MemoryArenaRestore(&stack->region, *frame->value.closure.environment->region_marker);
+    }
+}
+
+static EvaluationFrame *
+EvaluationStackTop(EvaluationStack *stack)
+{
+    return stack->segment->frames + (stack->depth - 1) % EVALUATION_STACK_SEGMENT_SIZE;
+}
+
+// NOTE(rjf): Returns 0 if the stack is already max_depth frames deep.
+static EvaluationFrame *
+EvaluationStackPush(EvaluationStack *stack, int type, AbstractSyntaxTreeNode *node,
+                    InterpreterEnvironment *environment)
+{
+    EvaluationFrame *frame = 0;
+    
+    if(stack->depth < stack->max_depth)
+    {
+        if(stack->depth && stack->depth % EVALUATION_STACK_SEGMENT_SIZE == 0)
+        {
+            if(!stack->segment->next)
+            {
+                EvaluationStackSegment *segment = MemoryArenaAllocate(&stack->arena, sizeof(EvaluationStackSegment),
+                                                                      MEMORY_ARENA_CATEGORY_other);
+                segment->previous = stack->segment;
+                segment->next = 0;
+                stack->segment->next = segment;
+                ++stack->segment_count;
+            }
+            stack->segment = stack->segment->next;
+        }
+        
+        ++stack->depth;
+        if(stack->depth > stack->peak_depth)
+        {
+            stack->peak_depth = stack->depth;
+        }
+        
+        frame = EvaluationStackTop(stack);
+        frame->type = type;
+        frame->node = node;
+        frame->environment = environment;
+        frame->value.type = EVALUATION_RESULT_error;
+    }
+    
+    return frame;
+}
+
+static void
+EvaluationStackPop(EvaluationStack *stack)
+{
+    --stack->depth;
+    if(stack->depth && stack->depth % EVALUATION_STACK_SEGMENT_SIZE == 0)
+    {
+        stack->segment = stack->segment->previous;
+    }
+}
+
+static void
+EvaluationStackPushArgument(EvaluationStack *stack, EvaluationResult value)
+{
+    if(stack->argument_count >= stack->argument_cap)
+    {
+        stack->argument_cap = stack->argument_cap ? stack->argument_cap * 2 : 64;
+        stack->arguments = realloc(stack->arguments, sizeof(stack->arguments[0]) * stack->argument_cap);
+    }
+    stack->arguments[stack->argument_count].value = value;
+    stack->arguments[stack->argument_count].shadowed = 0;
+    ++stack->argument_count;
+}
+
+// NOTE(rjf): Takes the first count of a call's arguments off of the stack. The
+//            call's arguments are always the last ones on it.
+static void
+EvaluationStackRemoveArguments(EvaluationStack *stack, EvaluationFrame *frame, unsigned int count)
+{
+    EvaluationArgument *arguments = stack->arguments + stack->argument_count - frame->argument_count;
+    memmove(arguments, arguments + count, sizeof(arguments[0]) * (frame->argument_count - count));
+    frame->argument_count -= count;
+    stack->argument_count -= count;
+}
+
+// NOTE(rjf): Puts back what the parameters of the closure in frame->value
+//            shadowed, last one first, and takes their arguments off the stack.
+static void
+EvaluationStackUnbindArguments(EvaluationStack *stack, EvaluationFrame *frame)
+{
+    EvaluationArgument *arguments = stack->arguments + stack->argument_count - frame->argument_count;
+    InterpreterEnvironment *environment = frame->value.closure.environment;
+    for(unsigned int i = frame->bound_count; i > 0; --i)
+    {
+        char *param_name = frame->value.closure.param_name;
+        int param_name_length = frame->value.closure.param_name_length;
+        AbstractSyntaxTreeNode *definition = frame->value.closure.body;
+        for(unsigned int j = 1; j < i; ++j)
+        {
+            param_name = definition->function_definition.param_name;
+            param_name_length = definition->function_definition.param_name_length;
+            definition = definition->function_definition.body;
+        }
+        InterpreterEnvironmentRestore(environment, param_name, param_name_length, arguments[i-1].value,
+                                      arguments[i-1].shadowed);
+    }
+    EvaluationStackRemoveArguments(stack, frame, frame->bound_count);
+    frame->bound_count = 0;
+}
+
+// NOTE(rjf): Calls frame->value with the arguments the frame has on the stack,
+//            from the left, for as long as that doesn't take evaluating a body.
+//            A closure binds as many of the arguments as it has parameters for,
+//            counting the ones of the functions nested right inside of it, and
+//            then this returns 1, with *node and *environment set to the body.
+//            Whatever is left is called with the body's result once it's done.
+//            Otherwise, it returns 0, with the result in *value.
+static int
+EvaluationStackApplyArguments(EvaluationStack *stack, EvaluationFrame *frame, EvaluationResult *value,
+                              AbstractSyntaxTreeNode **node, InterpreterEnvironment **environment)
+{
+    int started_body = 0;
+    
+    while(frame->argument_count && !started_body)
+    {
+        unsigned int first_argument = stack->argument_count - frame->argument_count;
+        unsigned int used_count = 0;
+        
+#if LETTUCE_TIER
+        // NOTE(rjf): When compiled code doesn't run the call, a compiled closure
+        //            is turned back into one of ours, and the call goes on below.
+        //            Compiled code can call back into this stack, which can move
+        //            the arguments, so they're only found again after this.
+        if(frame->value.type == EVALUATION_RESULT_closure ||
+           frame->value.type == EVALUATION_RESULT_compiled)
         {
-            if(!InterpreterEnvironmentLookUp(environment, root->identifier.string, root->identifier.string_length,
-                                             &result))
+            EvaluationResult argument = stack->arguments[first_argument].value;
+            if(TierCall(frame->environment, &frame->value, &argument, value))
             {
-                // NOTE(rjf): ERROR! Identifier not found.
-                result.type = EVALUATION_RESULT_error;
-                result.error.error_string = MakeStringOnArenaF(environment->arena,
-                                                               "%.*s was not declared in this scope.",
-                                                               root->identifier.string_length, root->identifier.string);
+                frame->value = *value;
+                used_count = 1;
             }
-            break;
         }
-        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+#endif
+        
+        if(used_count)
         {
-            EvaluationResult condition_evaluation =
-                EvaluateAbstractSyntaxTree(environment, root->if_then_else.condition);
-            
-            if(condition_evaluation.boolean)
-            {
-                result = EvaluateAbstractSyntaxTree(environment, root->if_then_else.pass_code);
-            }
-            else
+            EvaluationStackRemoveArguments(stack, frame, used_count);
+        }
+        else if(frame->value.type == EVALUATION_RESULT_closure)
+        {
+            EvaluationArgument *arguments = stack->arguments + first_argument;
+            InterpreterEnvironment *closure_environment = frame->value.closure.environment;
+            char *param_name = frame->value.closure.param_name;
+            int param_name_length = frame->value.closure.param_name_length;
+            AbstractSyntaxTreeNode *body = frame->value.closure.body;
+            for(;;)
             {
-                if(root->if_then_else.fail_code)
+                EvaluationArgument *argument = arguments + frame->bound_count++;
+                argument->shadowed = InterpreterEnvironmentExchange(closure_environment, param_name, param_name_length,
+                                                                    &argument->value);
+                if(frame->bound_count < frame->argument_count && body &&
+                   body->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+                {
+                    param_name = body->function_definition.param_name;
+                    param_name_length = body->function_definition.param_name_length;
+                    body = body->function_definition.body;
+                }
+                else
                 {
-                    result = EvaluateAbstractSyntaxTree(environment, root->if_then_else.fail_code);
+                    break;
                 }
             }
-            
-            break;
+            frame->type = EVALUATION_FRAME_call_body;
+            *environment = closure_environment;
+            *node = body;
+            started_body = 1;
         }
-        case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+        else if(frame->value.type == EVALUATION_RESULT_builtin)
         {
-            EvaluationResult closure = {
-                EVALUATION_RESULT_closure,
-            };
-            closure.closure.body = root->function_definition.body;
-            closure.closure.environment = InterpreterEnvironmentDuplicate(environment);
-            closure.closure.param_name = root->function_definition.param_name;
-            closure.closure.param_name_length = root->function_definition.param_name_length;
-            result = closure;
-            
-            break;
+            EvaluationResult argument = stack->arguments[first_argument].value;
+            frame->value = BuiltinApply(frame->environment, &frame->value, &argument);
+            EvaluationStackRemoveArguments(stack, frame, 1);
         }
-        case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+        else
         {
-            EvaluationResult closure = EvaluateAbstractSyntaxTree(environment, root->function_call.closure);
+            if(frame->value.type != EVALUATION_RESULT_error)
             {
-                InterpreterEnvironment *call_environment = closure.closure.environment;
-                EvaluationResult arg = EvaluateAbstractSyntaxTree(call_environment, root->function_call.parameter);
-                InterpreterEnvironmentBind(call_environment, closure.closure.param_name,
-                                           closure.closure.param_name_length,
-                                           arg);
-                result = EvaluateAbstractSyntaxTree(call_environment, closure.closure.body);
-                InterpreterEnvironmentDelete(call_environment, closure.closure.param_name,
-                                             closure.closure.param_name_length);
+                frame->value = EvaluationErrorResult("Called a value that is not a function.");
             }
-            break;
+            EvaluationStackRemoveArguments(stack, frame, frame->argument_count);
         }
-        case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+    }
+    
+    if(!started_body)
+    {
+        *value = frame->value;
+    }
+    return started_body;
+}
+
+// NOTE(rjf): Finds the next element of an array literal, starting at index,
+//            that isn't a numeric constant, copying the constants before it
+//            straight into the array. Returns the element count if there
+//            isn't one.
+static unsigned int
+EvaluationArrayLiteralSkipConstants(AbstractSyntaxTreeNode *node, double *elements, unsigned int index)
+{
+    unsigned int count = node->array_literal.element_count;
+    for(; index < count; ++index)
+    {
+        AbstractSyntaxTreeNode *element = node->array_literal.elements[index];
+        if(element->type != ABSTRACT_SYNTAX_TREE_NODE_numeric_constant)
         {
-            result.type = EVALUATION_RESULT_number;
-            result.number = root->numeric_constant.value;
             break;
         }
-        case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+        elements[index] = element->numeric_constant.value;
+    }
+    return index;
+}
+
+// NOTE(rjf): For the parts of a tree the parser left out after an error.
+static EvaluationResult
+EvaluationMissingExpressionError(void)
+{
+    return EvaluationErrorResult("Expected an expression.");
+}
+
+static EvaluationResult
+EvaluateIndex(InterpreterEnvironment *environment, EvaluationResult array, EvaluationResult index)
+{
+    EvaluationResult result = {0};
+    
+    if(array.type == EVALUATION_RESULT_error)
+    {
+        result = array;
+    }
+    else if(index.type == EVALUATION_RESULT_error)
+    {
+        result = index;
+    }
+    else if(array.type != EVALUATION_RESULT_array)
+    {
+        result.type = EVALUATION_RESULT_error;
+        result.error.error_string = "Indexed a value that is not an array.";
+    }
+    else if(index.type != EVALUATION_RESULT_number)
+    {
+        result.type = EVALUATION_RESULT_error;
+        result.error.error_string = "Array indices must be numbers.";
+    }
+    else if(!(index.number >= 0 && index.number < array.array.count) ||
+            (double)(unsigned int)index.number != index.number)
+    {
+        char index_string[NUMBER_FORMAT_MAX_LENGTH];
+        int index_length = NumberFormat(index_string, index.number, NUMBER_FORMAT_STYLE_general);
+        result.type = EVALUATION_RESULT_error;
+        result.error.error_string = MakeStringOnArenaF(environment->arena,
+                                                       "%.*s is not a valid index into an array of length %u.",
+                                                       index_length, index_string, array.array.count);
+    }
+    else
+    {
+        result.type = EVALUATION_RESULT_number;
+        result.number = array.array.elements[(unsigned int)index.number];
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): Evaluates root on stack, or, with resume set, picks up the
+//            evaluation that was suspended there. Only the evaluation at the
+//            bottom of the stack is ever suspended: ones started by builtins
+//            have C frames of their own in the way, so they run to the end, and
+//            a slice that ends inside of one is carried over to its caller.
+static EvaluationResult
+EvaluateOnStack(EvaluationStack *stack, InterpreterEnvironment *environment,
+                AbstractSyntaxTreeNode *root, int resume)
+{
+    unsigned long long base_depth = stack->depth;
+    
+    // NOTE(rjf): When node is set, it is evaluated in environment, either
+    //            producing a value right away or pushing a frame and moving on to
+    //            a child. When it isn't, value is handed to the frame on top of
+    //            the stack, which either finishes (and pops), or sets node to
+    //            evaluate its next child.
+    AbstractSyntaxTreeNode *node = root;
+    EvaluationResult value = {0};
+    
+    // NOTE(rjf): Set by a let or call that escape analysis says owns the closure
+    //            about to be made, which is always the very next node evaluated.
+    int next_closure_on_region = 0;
+    
+    if(resume)
+    {
+        base_depth = 0;
+        node = stack->suspended_node;
+        environment = stack->suspended_environment;
+        value = stack->suspended_value;
+        next_closure_on_region = stack->suspended_closure_on_region;
+        stack->suspended = 0;
+        stack->slice_end = stack->fuel_used + stack->slice_nodes;
+    }
+    
+    // NOTE(rjf): With a garbage collector attached, environments can move at any
+    //            safepoint. The stack's frames are scanned as roots, and so are
+    //            the environment being evaluated in and the value being returned.
+    //            The whole stack is scanned at once, so only the evaluation at
+    //            the bottom of it registers it.
+    GarbageCollector *gc = environment->gc;
+    unsigned int root_count = 2;
+    GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_environment_pointer, &environment);
+    GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_result, &value);
+    if(base_depth == 0)
+    {
+        GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_evaluation_stack, stack);
+        ++root_count;
+        if(!resume)
         {
-            result.type = EVALUATION_RESULT_boolean;
-            result.boolean = root->boolean_constant.value;
-            break;
+            EvaluationStackBeginLimits(stack, environment);
+            stack->slice_end = stack->slice_nodes;
         }
-        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+    }
+    
+    if(!node)
+    {
+        value = EvaluationMissingExpressionError();
+    }
+    
+    for(;;)
+    {
+        if(node && !--stack->limit_countdown)
         {
-            EvaluationResult left_eval = EvaluateAbstractSyntaxTree(environment, root->binary_operator.left);
-            EvaluationResult right_eval = EvaluateAbstractSyntaxTree(environment, root->binary_operator.right);
-            
-            if(root->binary_operator.type == BINARY_OPERATOR_plus)
-            { 
-                result.type = EVALUATION_RESULT_number;
-                result.number = left_eval.number + right_eval.number;
-            }
-            else if(root->binary_operator.type == BINARY_OPERATOR_minus)
-            {
-                result.type = EVALUATION_RESULT_number;
-                result.number = left_eval.number - right_eval.number;
-            }
-            else if(root->binary_operator.type == BINARY_OPERATOR_multiply)
+            if(!EvaluationStackCheckLimits(stack, environment))
             {
-                result.type = EVALUATION_RESULT_number;
-                result.number = left_eval.number * right_eval.number;
+                node = 0;
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_divide)
+            else if(base_depth == 0 && stack->slice_nodes && stack->fuel_used >= stack->slice_end)
             {
-                result.type = EVALUATION_RESULT_number;
-                result.number = left_eval.number / right_eval.number;
+                stack->suspended = 1;
+                stack->suspended_node = node;
+                stack->suspended_environment = environment;
+                stack->suspended_value = value;
+                stack->suspended_closure_on_region = next_closure_on_region;
+                break;
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_and)
+        }
+        
+        if(node)
+        {
+            ProfileNodeBegin(node);
+            
+            int closure_on_region = next_closure_on_region;
+            next_closure_on_region = 0;
+            
+            EvaluationFrame *frame = 0;
+            int frame_type = -1;
+            AbstractSyntaxTreeNode *child = 0;
+            unsigned int element_index = 0;
+            
+            switch(node->type)
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.boolean && right_eval.boolean;
+                case ABSTRACT_SYNTAX_TREE_NODE_let:
+                {
+                    // NOTE(rjf): The table has to exist before the marker is saved,
+                    //            since it outlives the let.
+                    if(!environment->identifier_table_cap)
+                    {
+                        GarbageCollectorSafepoint(gc, InterpreterEnvironmentAllocationSize(environment));
+                        InterpreterEnvironmentReserve(environment);
+                    }
+                    element_index = LetRecursiveCount(node);
+                    if(element_index)
+                    {
+                        // NOTE(rjf): A let rec group's functions are bound when
+                        //            its frame is pushed, and it goes right to
+                        //            the body.
+                        frame_type = EVALUATION_FRAME_let_body;
+                        child = LetRecursiveNested(node, element_index - 1)->let.body_expression;
+                    }
+                    else
+                    {
+                        frame_type = EVALUATION_FRAME_let_binding;
+                        child = node->let.binding_expression;
+                        next_closure_on_region = child && node->let.binding_does_not_escape && !gc;
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                {
+                    if(!InterpreterEnvironmentLookUp(environment, node->identifier.string,
+                                                     node->identifier.string_length, &value) &&
+                       !BuiltinLookUp(node->identifier.string, node->identifier.string_length, &value))
+                    {
+                        // NOTE(rjf): ERROR! Identifier not found.
+                        value = EvaluationErrorResult(MakeStringOnArenaF(environment->arena,
+                                                                         "%.*s was not declared in this scope.",
+                                                                         node->identifier.string_length,
+                                                                         node->identifier.string));
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                {
+                    frame_type = EVALUATION_FRAME_if_condition;
+                    child = node->if_then_else.condition;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                {
+                    EvaluationResult closure = {
+                        EVALUATION_RESULT_closure,
+                    };
+                    closure.closure.body = node->function_definition.body;
+                    GarbageCollectorSafepoint(gc, InterpreterEnvironmentAllocationSize(environment));
+                    if(closure_on_region)
+                    {
+                        closure.closure.environment = EvaluationStackDuplicateEnvironment(stack, environment);
+                    }
+                    else
+                    {
+                        closure.closure.environment = InterpreterEnvironmentDuplicate(environment);
+                    }
+                    closure.closure.param_name = node->function_definition.param_name;
+                    closure.closure.param_name_length = node->function_definition.param_name_length;
+                    value = closure;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                {
+                    element_index = FunctionCallArgumentCount(node);
+                    AbstractSyntaxTreeNode *innermost = FunctionCallNested(node, element_index, 0);
+                    frame_type = EVALUATION_FRAME_call_function;
+                    child = innermost->function_call.closure;
+                    next_closure_on_region = child && innermost->function_call.closure_does_not_escape && !gc;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+                {
+                    value.type = EVALUATION_RESULT_number;
+                    value.number = node->numeric_constant.value;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+                {
+                    value.type = EVALUATION_RESULT_boolean;
+                    value.boolean = node->boolean_constant.value;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                {
+                    unsigned int count = node->array_literal.element_count;
+                    double *elements = 0;
+                    if(count)
+                    {
+                        elements = MemoryArenaAllocate(environment->arena, sizeof(double)*count,
+                                                       MEMORY_ARENA_CATEGORY_arrays);
+                    }
+                    
+                    value.type = EVALUATION_RESULT_array;
+                    value.array.elements = elements;
+                    value.array.count = count;
+                    
+                    element_index = EvaluationArrayLiteralSkipConstants(node, elements, 0);
+                    if(element_index < count)
+                    {
+                        frame_type = EVALUATION_FRAME_array_element;
+                        child = node->array_literal.elements[element_index];
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_index:
+                {
+                    frame_type = EVALUATION_FRAME_index_array;
+                    child = node->index.array;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+                {
+                    value.type = EVALUATION_RESULT_builtin;
+                    value.builtin.type = BUILTIN_operator;
+                    value.builtin.operator_type = node->operator_reference.type;
+                    value.builtin.applied_count = 0;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                {
+                    frame_type = EVALUATION_FRAME_binary_left;
+                    child = node->binary_operator.left;
+                    break;
+                }
+                default:
+                {
+                    value = (EvaluationResult){0};
+                    break;
+                }
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_or)
+            
+            if(frame_type < 0)
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.boolean || right_eval.boolean;
+                ProfileNodeEnd(node);
+                node = 0;
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_less_than)
+            else if((frame = EvaluationStackPush(stack, frame_type, node, environment)))
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.number < right_eval.number;
+                if(frame_type == EVALUATION_FRAME_let_binding)
+                {
+                    frame->marker = MemoryArenaSave(environment->arena);
+                }
+                else if(frame_type == EVALUATION_FRAME_let_body)
+                {
+                    frame->marker = MemoryArenaSave(environment->arena);
+                    GarbageCollectorSafepoint(gc, InterpreterEnvironmentAllocationSize(environment));
+                    frame->value = InterpreterEnvironmentBindRecursive(frame->environment, node, element_index);
+                }
+                else if(frame_type == EVALUATION_FRAME_call_function)
+                {
+                    frame->marker = MemoryArenaSave(environment->arena);
+                    frame->element_index = element_index;
+                    frame->argument_count = 0;
+                    frame->bound_count = 0;
+                }
+                else if(frame_type == EVALUATION_FRAME_array_element)
+                {
+                    frame->value = value;
+                    frame->element_index = element_index;
+                }
+                node = child;
+                if(!node)
+                {
+                    value = EvaluationMissingExpressionError();
+                }
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_less_than_equal_to)
+            else
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.number <= right_eval.number;
+                EvaluationStackAbort(stack, EVALUATION_LIMIT_depth, "Evaluation went deeper than the limit of %llu frames.",
+                                     stack->max_depth);
+                next_closure_on_region = 0;
+                ProfileNodeEnd(node);
+                node = 0;
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_greater_than)
+        }
+        else if(stack->depth == base_depth)
+        {
+            break;
+        }
+        else
+        {
+            EvaluationFrame *frame = EvaluationStackTop(stack);
+            int finished = 1;
+            
+            if(stack->abort_error)
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.number > right_eval.number;
+                // NOTE(rjf): Unwinding. Bindings that were made still have to be
+                //            taken back out of their environments, and since the
+                //            error message isn't on the arena, everything lets and
+                //            calls allocated there can go right away.
+                if(frame->type == EVALUATION_FRAME_let_body)
+                {
+                    EvaluationFrameUnbindLet(frame);
+                }
+                else if(frame->type == EVALUATION_FRAME_call_body)
+                {
+                    EvaluationStackUnbindArguments(stack, frame);
+                }
+                if(frame->type == EVALUATION_FRAME_call_argument ||
+                   frame->type == EVALUATION_FRAME_call_body)
+                {
+                    EvaluationStackRemoveArguments(stack, frame, frame->argument_count);
+                }
+                if(frame->type == EVALUATION_FRAME_let_binding ||
+                   frame->type == EVALUATION_FRAME_let_body ||
+                   frame->type == EVALUATION_FRAME_call_function ||
+                   frame->type == EVALUATION_FRAME_call_argument ||
+                   frame->type == EVALUATION_FRAME_call_body)
+                {
+                    MemoryArenaRestore(frame->environment->arena, frame->marker);
+                }
+                value = EvaluationErrorResult(stack->abort_error);
+                value.error.limit = stack->abort_limit;
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_greater_than_equal_to)
+            else switch(frame->type)
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.number >= right_eval.number;
+                case EVALUATION_FRAME_let_binding:
+                {
+                    InterpreterEnvironmentBind(frame->environment, frame->node->let.string,
+                                               frame->node->let.string_length, value);
+                    frame->value = value;
+                    frame->type = EVALUATION_FRAME_let_body;
+                    environment = frame->environment;
+                    node = frame->node->let.body_expression;
+                    finished = 0;
+                    break;
+                }
+                case EVALUATION_FRAME_let_body:
+                {
+                    EvaluationFrameUnbindLet(frame);
+                    if(EvaluationResultIsScalar(value))
+                    {
+                        MemoryArenaRestore(frame->environment->arena, frame->marker);
+                    }
+                    break;
+                }
+                case EVALUATION_FRAME_if_condition:
+                {
+                    AbstractSyntaxTreeNode *branch = (value.boolean ? frame->node->if_then_else.pass_code :
+                                                      frame->node->if_then_else.fail_code);
+                    if(branch)
+                    {
+                        frame->type = EVALUATION_FRAME_if_branch;
+                        environment = frame->environment;
+                        node = branch;
+                        finished = 0;
+                    }
+                    else
+                    {
+                        value = (EvaluationResult){0};
+                    }
+                    break;
+                }
+                case EVALUATION_FRAME_if_branch:
+                {
+                    break;
+                }
+                case EVALUATION_FRAME_call_function:
+                {
+                    if(value.type == EVALUATION_RESULT_closure ||
+                       value.type == EVALUATION_RESULT_builtin ||
+                       value.type == EVALUATION_RESULT_compiled)
+                    {
+                        // NOTE(rjf): The arguments belong to the caller, so they're
+                        //            evaluated in the caller's environment, not the
+                        //            closure's.
+                        frame->value = value;
+                        frame->type = EVALUATION_FRAME_call_argument;
+                        environment = frame->environment;
+                        node = FunctionCallNested(frame->node, frame->element_index, 0)->function_call.parameter;
+                        finished = 0;
+                    }
+                    else if(value.type != EVALUATION_RESULT_error)
+                    {
+                        value = EvaluationErrorResult("Called a value that is not a function.");
+                    }
+                    break;
+                }
+                case EVALUATION_FRAME_call_argument:
+                {
+                    EvaluationStackPushArgument(stack, value);
+                    ++frame->argument_count;
+                    if(frame->argument_count < frame->element_index)
+                    {
+                        environment = frame->environment;
+                        node = FunctionCallNested(frame->node, frame->element_index,
+                                                  frame->argument_count)->function_call.parameter;
+                        finished = 0;
+                    }
+                    else
+                    {
+                        finished = !EvaluationStackApplyArguments(stack, frame, &value, &node, &environment);
+                    }
+                    break;
+                }
+                case EVALUATION_FRAME_call_body:
+                {
+                    // NOTE(rjf): With more arguments than the closure had
+                    //            parameters, the body's result is called with the
+                    //            rest. The closure is done with by then.
+                    EvaluationStackUnbindArguments(stack, frame);
+                    if(frame->argument_count)
+                    {
+                        EvaluationStackReleaseClosure(stack, frame);
+                        frame->value = value;
+                        finished = !EvaluationStackApplyArguments(stack, frame, &value, &node, &environment);
+                    }
+                    break;
+                }
+                case EVALUATION_FRAME_binary_left:
+                {
+                    frame->value = value;
+                    frame->type = EVALUATION_FRAME_binary_right;
+                    environment = frame->environment;
+                    node = frame->node->binary_operator.right;
+                    finished = 0;
+                    break;
+                }
+                case EVALUATION_FRAME_binary_right:
+                {
+                    int type = frame->node->binary_operator.type;
+                    if(frame->value.type == EVALUATION_RESULT_array || value.type == EVALUATION_RESULT_array)
+                    {
+                        value = ArrayBinaryOperator(frame->environment, type, frame->value, value);
+                    }
+                    else
+                    {
+                        value = EvaluateBinaryOperator(type, frame->value, value);
+                    }
+                    break;
+                }
+                case EVALUATION_FRAME_index_array:
+                {
+                    frame->value = value;
+                    frame->type = EVALUATION_FRAME_index_index;
+                    environment = frame->environment;
+                    node = frame->node->index.index;
+                    finished = 0;
+                    break;
+                }
+                case EVALUATION_FRAME_index_index:
+                {
+                    value = EvaluateIndex(frame->environment, frame->value, value);
+                    break;
+                }
+                case EVALUATION_FRAME_array_element:
+                {
+                    AbstractSyntaxTreeNode *array = frame->node;
+                    if(value.type == EVALUATION_RESULT_number)
+                    {
+                        double *elements = frame->value.array.elements;
+                        elements[frame->element_index] = value.number;
+                        frame->element_index = EvaluationArrayLiteralSkipConstants(array, elements,
+                                                                                   frame->element_index + 1);
+                        if(frame->element_index < array->array_literal.element_count)
+                        {
+                            environment = frame->environment;
+                            node = array->array_literal.elements[frame->element_index];
+                            finished = 0;
+                        }
+                        else
+                        {
+                            value = frame->value;
+                        }
+                    }
+                    else if(value.type != EVALUATION_RESULT_error)
+                    {
+                        value = EvaluationErrorResult("Array elements must be numbers.");
+                    }
+                    break;
+                }
+                default: break;
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_equal_to)
+            
+            if(!finished && !node)
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.number == right_eval.number;
+                value = EvaluationMissingExpressionError();
             }
-            else if(root->binary_operator.type == BINARY_OPERATOR_not_equal_to)
+            else if(finished)
             {
-                result.type = EVALUATION_RESULT_boolean;
-                result.boolean = left_eval.number != right_eval.number;
+                if(!stack->abort_error &&
+                   (frame->type == EVALUATION_FRAME_call_function ||
+                    frame->type == EVALUATION_FRAME_call_argument ||
+                    frame->type == EVALUATION_FRAME_call_body) &&
+                   EvaluationResultIsScalar(value))
+                {
+                    MemoryArenaRestore(frame->environment->arena, frame->marker);
+                }
+                EvaluationStackReleaseClosure(stack, frame);
+                ProfileNodeEnd(frame->node);
+                EvaluationStackPop(stack);
             }
-            
-            break;
         }
-        default: break;
+    }
+    
+    if(stack->abort_error)
+    {
+        value = EvaluationErrorResult(stack->abort_error);
+        value.error.limit = stack->abort_limit;
+        if(base_depth == 0)
+        {
+            // NOTE(rjf): The message is in the stack, which can be reused or freed
+            //            once we return, so the result gets its own copy.
+            value.error.error_string = MakeStringOnArenaF(environment->arena, "%s", stack->abort_error);
+            stack->abort_error = 0;
+            stack->abort_limit = EVALUATION_LIMIT_none;
+        }
+    }
+    
+    GarbageCollectorPopRoots(gc, root_count);
+    
+    return value;
+}
+
+static EvaluationResult
+EvaluateAbstractSyntaxTree(InterpreterEnvironment *environment,
+                           AbstractSyntaxTreeNode *root)
+{
+    EvaluationResult result = {0};
+    
+    // NOTE(rjf): Hosts normally give environments a stack to share. Without one,
+    //            this evaluation gets its own, which only allocates if it has to
+    //            grow past the first segment.
+    if(environment->stack)
+    {
+        result = EvaluateOnStack(environment->stack, environment, root, 0);
+    }
+    else
+    {
+        EvaluationStack *stack = malloc(sizeof(*stack));
+        stack->arena = (MemoryArena){0};
+        stack->arena.backend = MEMORY_ARENA_BACKEND_chunked;
+        EvaluationStackInit(stack, 0);
+        result = EvaluateOnStack(stack, environment, root, 0);
+        EvaluationStackCleanUp(stack);
+        free(stack);
     }
     
     return result;
 }
+
+// NOTE(rjf): Evaluates root in slices of stack->slice_nodes nodes, so that a host
+//            can interleave many evaluations on one thread. Returns 1, with
+//            *result set, once the evaluation is done, and 0 when a slice ends
+//            first, after which EvaluationResume runs the next one. The stack
+//            can't be used for anything else until then.
+static int
+EvaluationBegin(EvaluationStack *stack, InterpreterEnvironment *environment,
+                AbstractSyntaxTreeNode *root, EvaluationResult *result)
+{
+    *result = EvaluateOnStack(stack, environment, root, 0);
+    return !stack->suspended;
+}
+
+static int
+EvaluationResume(EvaluationStack *stack, EvaluationResult *result)
+{
+    *result = EvaluateOnStack(stack, 0, 0, 1);
+    return !stack->suspended;
+}
@@ -0,0 +1,1048 @@
+
+// NOTE(rjf): Array values, and the builtins that work on them.
+//
+//            Arrays are contiguous doubles on the arena, so building one is a
+//            single allocation. Element-wise arithmetic, sum, and dot run as
+//            straight loops over them. map, fold, and filter take a function;
+//            when that function is simple enough (an operator, or a lambda
+//            whose body is just arithmetic and comparisons on its parameters,
+//            constants, and numbers it captured), it is compiled into a small
+//            kernel that is run over blocks of elements at a time, with one
+//            vectorized loop per operator. Anything else falls back to calling
+//            the function once per element, like the evaluator would.
+//
+//            When the CPU has AVX2 (checked at run time, so the program still
+//            runs everywhere), the loops use 256-bit vectors. Sums and
+//            products are accumulated in several lanes at once, so their
+//            rounding can differ slightly from adding the elements in order.
+
+#define ARRAY_KERNEL_MAX_INSTRUCTIONS 64
+#define ARRAY_KERNEL_MAX_STACK 16
+#define ARRAY_KERNEL_BLOCK_SIZE 256
+
+static double
+ArrayOperatorScalar(int operator_type, double a, double b)
+{
+    double result = 0;
+    switch(operator_type)
+    {
+        case BINARY_OPERATOR_plus:                  { result = a + b; break; }
+        case BINARY_OPERATOR_minus:                 { result = a - b; break; }
+        case BINARY_OPERATOR_multiply:              { result = a * b; break; }
+        case BINARY_OPERATOR_divide:                { result = a / b; break; }
+        case BINARY_OPERATOR_less_than:             { result = a < b; break; }
+        case BINARY_OPERATOR_less_than_equal_to:    { result = a <= b; break; }
+        case BINARY_OPERATOR_greater_than:          { result = a > b; break; }
+        case BINARY_OPERATOR_greater_than_equal_to: { result = a >= b; break; }
+        case BINARY_OPERATOR_equal_to:              { result = a == b; break; }
+        case BINARY_OPERATOR_not_equal_to:          { result = a != b; break; }
+        case BINARY_OPERATOR_and:                   { result = a != 0 && b != 0; break; }
+        case BINARY_OPERATOR_or:                    { result = a != 0 || b != 0; break; }
+        default: break;
+    }
+    return result;
+}
+
+// NOTE(rjf): out[i] = a[i] op b[i]. A step of 0 means that operand is a single
+//            value used for every element. Comparisons and logical operators
+//            produce 1 or 0.
+static void
+ArrayKernelBinaryScalar(int operator_type, double *a, int a_step, double *b, int b_step,
+                        double *out, unsigned int count)
+{
+#define ArrayKernelScalarLoop(expression) \
+    for(unsigned int i = 0; i < count; ++i) \
+    { \
+        double x = a[i*a_step]; \
+        double y = b[i*b_step]; \
+        out[i] = (expression); \
+    }
+    
+    switch(operator_type)
+    {
+        case BINARY_OPERATOR_plus:     { ArrayKernelScalarLoop(x + y); break; }
+        case BINARY_OPERATOR_minus:    { ArrayKernelScalarLoop(x - y); break; }
+        case BINARY_OPERATOR_multiply: { ArrayKernelScalarLoop(x * y); break; }
+        case BINARY_OPERATOR_divide:   { ArrayKernelScalarLoop(x / y); break; }
+        default:
+        {
+            ArrayKernelScalarLoop(ArrayOperatorScalar(operator_type, x, y));
+            break;
+        }
+    }
+    
+#undef ArrayKernelScalarLoop
+}
+
+static double
+ArrayReduceScalar(int operator_type, double *values, unsigned int count)
+{
+    double result = operator_type == BINARY_OPERATOR_multiply ? 1.0 : 0.0;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        result = operator_type == BINARY_OPERATOR_multiply ? result * values[i] : result + values[i];
+    }
+    return result;
+}
+
+static double
+ArrayDotScalar(double *a, double *b, unsigned int count)
+{
+    double result = 0;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+#if LETTUCE_AVX2
+
+__attribute__((target("avx2")))
+static void
+ArrayKernelBinaryAVX2(int operator_type, double *a, int a_step, double *b, int b_step,
+                      double *out, unsigned int count)
+{
+    unsigned int i = 0;
+    __m256d ones = _mm256_set1_pd(1.0);
+    __m256d zeros = _mm256_setzero_pd();
+    
+#define ArrayKernelAVX2Loop(expression) \
+    if(a_step && b_step) \
+    { \
+        for(; i + 4 <= count; i += 4) \
+        { \
+            __m256d x = _mm256_loadu_pd(a + i); \
+            __m256d y = _mm256_loadu_pd(b + i); \
+            _mm256_storeu_pd(out + i, (expression)); \
+        } \
+    } \
+    else if(b_step) \
+    { \
+        __m256d x = _mm256_set1_pd(a[0]); \
+        for(; i + 4 <= count; i += 4) \
+        { \
+            __m256d y = _mm256_loadu_pd(b + i); \
+            _mm256_storeu_pd(out + i, (expression)); \
+        } \
+    } \
+    else if(a_step) \
+    { \
+        __m256d y = _mm256_set1_pd(b[0]); \
+        for(; i + 4 <= count; i += 4) \
+        { \
+            __m256d x = _mm256_loadu_pd(a + i); \
+            _mm256_storeu_pd(out + i, (expression)); \
+        } \
+    }
+    
+#define ArrayKernelAVX2Compare(predicate) _mm256_and_pd(_mm256_cmp_pd(x, y, predicate), ones)
+    
+    switch(operator_type)
+    {
+        case BINARY_OPERATOR_plus:                  { ArrayKernelAVX2Loop(_mm256_add_pd(x, y)); break; }
+        case BINARY_OPERATOR_minus:                 { ArrayKernelAVX2Loop(_mm256_sub_pd(x, y)); break; }
+        case BINARY_OPERATOR_multiply:              { ArrayKernelAVX2Loop(_mm256_mul_pd(x, y)); break; }
+        case BINARY_OPERATOR_divide:                { ArrayKernelAVX2Loop(_mm256_div_pd(x, y)); break; }
+        case BINARY_OPERATOR_less_than:             { ArrayKernelAVX2Loop(ArrayKernelAVX2Compare(_CMP_LT_OQ)); break; }
+        case BINARY_OPERATOR_less_than_equal_to:    { ArrayKernelAVX2Loop(ArrayKernelAVX2Compare(_CMP_LE_OQ)); break; }
+        case BINARY_OPERATOR_greater_than:          { ArrayKernelAVX2Loop(ArrayKernelAVX2Compare(_CMP_GT_OQ)); break; }
+        case BINARY_OPERATOR_greater_than_equal_to: { ArrayKernelAVX2Loop(ArrayKernelAVX2Compare(_CMP_GE_OQ)); break; }
+        case BINARY_OPERATOR_equal_to:              { ArrayKernelAVX2Loop(ArrayKernelAVX2Compare(_CMP_EQ_OQ)); break; }
+        case BINARY_OPERATOR_not_equal_to:          { ArrayKernelAVX2Loop(ArrayKernelAVX2Compare(_CMP_NEQ_UQ)); break; }
+        case BINARY_OPERATOR_and:
+        {
+            ArrayKernelAVX2Loop(_mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x, zeros, _CMP_NEQ_UQ),
+                                                            _mm256_cmp_pd(y, zeros, _CMP_NEQ_UQ)), ones));
+            break;
+        }
+        case BINARY_OPERATOR_or:
+        {
+            ArrayKernelAVX2Loop(_mm256_and_pd(_mm256_or_pd(_mm256_cmp_pd(x, zeros, _CMP_NEQ_UQ),
+                                                           _mm256_cmp_pd(y, zeros, _CMP_NEQ_UQ)), ones));
+            break;
+        }
+        default: break;
+    }
+    
+#undef ArrayKernelAVX2Compare
+#undef ArrayKernelAVX2Loop
+    
+    // NOTE(rjf): Whatever is left over (or everything, if both operands are
+    //            single values) is done one element at a time.
+    ArrayKernelBinaryScalar(operator_type, a + i*a_step, a_step, b + i*b_step, b_step, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double
+ArrayReduceAVX2(int operator_type, double *values, unsigned int count)
+{
+    unsigned int i = 0;
+    double result = 0;
+    
+    if(operator_type == BINARY_OPERATOR_multiply)
+    {
+        __m256d product0 = _mm256_set1_pd(1.0);
+        __m256d product1 = _mm256_set1_pd(1.0);
+        for(; i + 8 <= count; i += 8)
+        {
+            product0 = _mm256_mul_pd(product0, _mm256_loadu_pd(values + i));
+            product1 = _mm256_mul_pd(product1, _mm256_loadu_pd(values + i + 4));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_mul_pd(product0, product1));
+        result = (lanes[0] * lanes[1]) * (lanes[2] * lanes[3]);
+        for(; i < count; ++i)
+        {
+            result *= values[i];
+        }
+    }
+    else
+    {
+        __m256d sum0 = _mm256_setzero_pd();
+        __m256d sum1 = _mm256_setzero_pd();
+        __m256d sum2 = _mm256_setzero_pd();
+        __m256d sum3 = _mm256_setzero_pd();
+        for(; i + 16 <= count; i += 16)
+        {
+            sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(values + i));
+            sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(values + i + 4));
+            sum2 = _mm256_add_pd(sum2, _mm256_loadu_pd(values + i + 8));
+            sum3 = _mm256_add_pd(sum3, _mm256_loadu_pd(values + i + 12));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(sum0, sum1), _mm256_add_pd(sum2, sum3)));
+        result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for(; i < count; ++i)
+        {
+            result += values[i];
+        }
+    }
+    
+    return result;
+}
+
+__attribute__((target("avx2")))
+static double
+ArrayDotAVX2(double *a, double *b, unsigned int count)
+{
+    unsigned int i = 0;
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    for(; i + 8 <= count; i += 8)
+    {
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+    double result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for(; i < count; ++i)
+    {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+#define ArrayUseAVX2() __builtin_cpu_supports("avx2")
+
+#else
+
+#define ArrayUseAVX2() 0
+#define ArrayKernelBinaryAVX2 ArrayKernelBinaryScalar
+#define ArrayReduceAVX2 ArrayReduceScalar
+#define ArrayDotAVX2 ArrayDotScalar
+
+#endif
+
+static void
+ArrayKernelBinary(int operator_type, double *a, int a_step, double *b, int b_step, double *out, unsigned int count)
+{
+    if(ArrayUseAVX2())
+    {
+        ArrayKernelBinaryAVX2(operator_type, a, a_step, b, b_step, out, count);
+    }
+    else
+    {
+        ArrayKernelBinaryScalar(operator_type, a, a_step, b, b_step, out, count);
+    }
+}
+
+// NOTE(rjf): Sum (or product, for BINARY_OPERATOR_multiply) of the values.
+static double
+ArrayReduce(int operator_type, double *values, unsigned int count)
+{
+    return ArrayUseAVX2() ? ArrayReduceAVX2(operator_type, values, count) : ArrayReduceScalar(operator_type, values, count);
+}
+
+static double
+ArrayDot(double *a, double *b, unsigned int count)
+{
+    return ArrayUseAVX2() ? ArrayDotAVX2(a, b, count) : ArrayDotScalar(a, b, count);
+}
+
+// NOTE(rjf): A compiled simple function. It is a postfix program: element,
+//            accumulator and constant instructions push a value, and operator
+//            instructions pop two and push the result. Each value on the stack
+//            is a whole block of elements (or one value shared by all of them),
+//            so every instruction is one loop over the block.
+enum
+{
+    ARRAY_KERNEL_INSTRUCTION_element,
+    ARRAY_KERNEL_INSTRUCTION_accumulator,
+    ARRAY_KERNEL_INSTRUCTION_constant,
+    ARRAY_KERNEL_INSTRUCTION_operator,
+};
+
+enum
+{
+    ARRAY_KERNEL_TYPE_invalid,
+    ARRAY_KERNEL_TYPE_number,
+    ARRAY_KERNEL_TYPE_boolean,
+};
+
+typedef struct ArrayKernelInstruction
+{
+    int type;
+    int operator_type;
+    double constant;
+}
+ArrayKernelInstruction;
+
+typedef struct ArrayKernel
+{
+    int result_type;
+    int instruction_count;
+    ArrayKernelInstruction instructions[ARRAY_KERNEL_MAX_INSTRUCTIONS];
+}
+ArrayKernel;
+
+// NOTE(rjf): What the identifiers in a lambda's body can refer to. The
+//            accumulator is only there for fold's two-parameter functions.
+typedef struct ArrayKernelScope
+{
+    char *element_name;
+    int element_name_length;
+    char *accumulator_name;
+    int accumulator_name_length;
+    int accumulator_allowed;
+    InterpreterEnvironment *environment;
+}
+ArrayKernelScope;
+
+static int
+ArrayKernelPush(ArrayKernel *kernel, int type, int operator_type, double constant)
+{
+    int success = 0;
+    if(kernel->instruction_count < ARRAY_KERNEL_MAX_INSTRUCTIONS)
+    {
+        ArrayKernelInstruction *instruction = kernel->instructions + kernel->instruction_count++;
+        instruction->type = type;
+        instruction->operator_type = operator_type;
+        instruction->constant = constant;
+        success = 1;
+    }
+    return success;
+}
+
+// NOTE(rjf): Compiles node, returning the type of its value, or
+//            ARRAY_KERNEL_TYPE_invalid if it isn't simple. depth is how many
+//            values are already on the stack when it runs.
+static int
+ArrayKernelCompileNode(ArrayKernel *kernel, AbstractSyntaxTreeNode *node, ArrayKernelScope *scope, int depth)
+{
+    int type = ARRAY_KERNEL_TYPE_invalid;
+    
+    if(depth >= ARRAY_KERNEL_MAX_STACK)
+    {
+        return type;
+    }
+    
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+        {
+            if(ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_constant, 0, node->numeric_constant.value))
+            {
+                type = ARRAY_KERNEL_TYPE_number;
+            }
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+        {
+            if(ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_constant, 0, node->boolean_constant.value ? 1.0 : 0.0))
+            {
+                type = ARRAY_KERNEL_TYPE_boolean;
+            }
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+        {
+            char *name = node->identifier.string;
+            int name_length = node->identifier.string_length;
+            EvaluationResult value = {0};
+            
+            if(StringMatch(name, name_length, scope->element_name, scope->element_name_length))
+            {
+                if(ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_element, 0, 0))
+                {
+                    type = ARRAY_KERNEL_TYPE_number;
+                }
+            }
+            else if(scope->accumulator_name &&
+                    StringMatch(name, name_length, scope->accumulator_name, scope->accumulator_name_length))
+            {
+                if(scope->accumulator_allowed &&
+                   ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_accumulator, 0, 0))
+                {
+                    type = ARRAY_KERNEL_TYPE_number;
+                }
+            }
+            else if(InterpreterEnvironmentLookUp(scope->environment, name, name_length, &value))
+            {
+                // NOTE(rjf): Captured numbers and booleans can't change during the
+                //            call, so they're compiled in as constants.
+                if(value.type == EVALUATION_RESULT_number &&
+                   ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_constant, 0, value.number))
+                {
+                    type = ARRAY_KERNEL_TYPE_number;
+                }
+                else if(value.type == EVALUATION_RESULT_boolean &&
+                        ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_constant, 0, value.boolean ? 1.0 : 0.0))
+                {
+                    type = ARRAY_KERNEL_TYPE_boolean;
+                }
+            }
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+        {
+            int operator_type = node->binary_operator.type;
+            int left_type = ArrayKernelCompileNode(kernel, node->binary_operator.left, scope, depth);
+            int right_type = ArrayKernelCompileNode(kernel, node->binary_operator.right, scope, depth+1);
+            
+            int operands_type = ARRAY_KERNEL_TYPE_number;
+            int result_type = ARRAY_KERNEL_TYPE_boolean;
+            if(operator_type == BINARY_OPERATOR_and || operator_type == BINARY_OPERATOR_or)
+            {
+                operands_type = ARRAY_KERNEL_TYPE_boolean;
+            }
+            else if(operator_type == BINARY_OPERATOR_plus || operator_type == BINARY_OPERATOR_minus ||
+                    operator_type == BINARY_OPERATOR_multiply || operator_type == BINARY_OPERATOR_divide)
+            {
+                result_type = ARRAY_KERNEL_TYPE_number;
+            }
+            
+            if(left_type == operands_type && right_type == operands_type)
+            {
+                // NOTE(rjf): Constant operands are folded right away.
+                ArrayKernelInstruction *last = kernel->instructions + kernel->instruction_count - 1;
+                if(last[-1].type == ARRAY_KERNEL_INSTRUCTION_constant &&
+                   last[0].type == ARRAY_KERNEL_INSTRUCTION_constant)
+                {
+                    last[-1].constant = ArrayOperatorScalar(operator_type, last[-1].constant, last[0].constant);
+                    --kernel->instruction_count;
+                    type = result_type;
+                }
+                else if(ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_operator, operator_type, 0))
+                {
+                    type = result_type;
+                }
+            }
+            break;
+        }
+        default: break;
+    }
+    
+    return type;
+}
+
+// NOTE(rjf): Compiles a function of one parameter (an element), or of two
+//            (accumulator, then element) for fold. Returns 0 if the function
+//            isn't simple enough.
+static int
+ArrayKernelCompileFunction(ArrayKernel *kernel, EvaluationResult *function, int parameter_count)
+{
+    kernel->instruction_count = 0;
+    kernel->result_type = ARRAY_KERNEL_TYPE_invalid;
+    
+    if(function->type == EVALUATION_RESULT_builtin && function->builtin.type == BUILTIN_operator)
+    {
+        int operator_type = function->builtin.operator_type;
+        int is_arithmetic = (operator_type == BINARY_OPERATOR_plus || operator_type == BINARY_OPERATOR_minus ||
+                             operator_type == BINARY_OPERATOR_multiply || operator_type == BINARY_OPERATOR_divide);
+        int is_logical = (operator_type == BINARY_OPERATOR_and || operator_type == BINARY_OPERATOR_or);
+        
+        if(parameter_count == 2 && function->builtin.applied_count == 0 && !is_logical)
+        {
+            ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_accumulator, 0, 0);
+            ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_element, 0, 0);
+            ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_operator, operator_type, 0);
+            kernel->result_type = is_arithmetic ? ARRAY_KERNEL_TYPE_number : ARRAY_KERNEL_TYPE_boolean;
+        }
+        else if(parameter_count == 1 && function->builtin.applied_count == 1 && !is_logical &&
+                function->builtin.applied[0].type == EVALUATION_RESULT_number)
+        {
+            ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_constant, 0, function->builtin.applied[0].number);
+            ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_element, 0, 0);
+            ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_operator, operator_type, 0);
+            kernel->result_type = is_arithmetic ? ARRAY_KERNEL_TYPE_number : ARRAY_KERNEL_TYPE_boolean;
+        }
+    }
+    else if(function->type == EVALUATION_RESULT_closure)
+    {
+        ArrayKernelScope scope = {0};
+        scope.environment = function->closure.environment;
+        AbstractSyntaxTreeNode *body = function->closure.body;
+        
+        if(parameter_count == 2)
+        {
+            scope.accumulator_name = function->closure.param_name;
+            scope.accumulator_name_length = function->closure.param_name_length;
+            scope.accumulator_allowed = 1;
+            if(body->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+            {
+                scope.element_name = body->function_definition.param_name;
+                scope.element_name_length = body->function_definition.param_name_length;
+                body = body->function_definition.body;
+            }
+            else
+            {
+                body = 0;
+            }
+        }
+        else
+        {
+            scope.element_name = function->closure.param_name;
+            scope.element_name_length = function->closure.param_name_length;
+        }
+        
+        if(body)
+        {
+            kernel->result_type = ArrayKernelCompileNode(kernel, body, &scope, 0);
+        }
+    }
+    
+    return kernel->result_type != ARRAY_KERNEL_TYPE_invalid;
+}
+
+// NOTE(rjf): Runs the kernel over count elements (at most a block's worth),
+//            writing one result per element to out.
+static void
+ArrayKernelRun(ArrayKernel *kernel, double *elements, double accumulator, double *out, unsigned int count)
+{
+    double storage[ARRAY_KERNEL_MAX_STACK][ARRAY_KERNEL_BLOCK_SIZE];
+    double *stack_values[ARRAY_KERNEL_MAX_STACK];
+    int stack_steps[ARRAY_KERNEL_MAX_STACK];
+    int stack_count = 0;
+    
+    for(int i = 0; i < kernel->instruction_count; ++i)
+    {
+        ArrayKernelInstruction *instruction = kernel->instructions + i;
+        switch(instruction->type)
+        {
+            case ARRAY_KERNEL_INSTRUCTION_element:
+            {
+                stack_values[stack_count] = elements;
+                stack_steps[stack_count++] = 1;
+                break;
+            }
+            case ARRAY_KERNEL_INSTRUCTION_accumulator:
+            {
+                stack_values[stack_count] = &accumulator;
+                stack_steps[stack_count++] = 0;
+                break;
+            }
+            case ARRAY_KERNEL_INSTRUCTION_constant:
+            {
+                stack_values[stack_count] = &instruction->constant;
+                stack_steps[stack_count++] = 0;
+                break;
+            }
+            case ARRAY_KERNEL_INSTRUCTION_operator:
+            {
+                stack_count -= 2;
+                double *destination = (i == kernel->instruction_count - 1) ? out : storage[stack_count];
+                ArrayKernelBinary(instruction->operator_type,
+                                  stack_values[stack_count], stack_steps[stack_count],
+                                  stack_values[stack_count+1], stack_steps[stack_count+1],
+                                  destination, count);
+                stack_values[stack_count] = destination;
+                stack_steps[stack_count++] = 1;
+                break;
+            }
+            default: break;
+        }
+    }
+    
+    if(stack_values[0] != out)
+    {
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            out[i] = stack_values[0][i*stack_steps[0]];
+        }
+    }
+}
+
+static EvaluationResult
+ArrayErrorResult(char *message)
+{
+    EvaluationResult result = {0};
+    result.type = EVALUATION_RESULT_error;
+    result.error.error_string = message;
+    return result;
+}
+
+static EvaluationResult
+ArrayAllocate(InterpreterEnvironment *environment, unsigned int count)
+{
+    EvaluationResult result = {0};
+    result.type = EVALUATION_RESULT_array;
+    result.array.count = count;
+    if(count)
+    {
+        result.array.elements = MemoryArenaAllocate(environment->arena, sizeof(double)*count,
+                                                    MEMORY_ARENA_CATEGORY_arrays);
+    }
+    return result;
+}
+
+static EvaluationResult
+ArrayBinaryOperator(InterpreterEnvironment *environment, int operator_type,
+                    EvaluationResult left, EvaluationResult right)
+{
+    EvaluationResult result = {0};
+    
+    if(left.type == EVALUATION_RESULT_error)
+    {
+        result = left;
+    }
+    else if(right.type == EVALUATION_RESULT_error)
+    {
+        result = right;
+    }
+    else if(operator_type != BINARY_OPERATOR_plus && operator_type != BINARY_OPERATOR_minus &&
+            operator_type != BINARY_OPERATOR_multiply && operator_type != BINARY_OPERATOR_divide)
+    {
+        result = ArrayErrorResult("Only +, -, * and / work on arrays.");
+    }
+    else if((left.type != EVALUATION_RESULT_array && left.type != EVALUATION_RESULT_number) ||
+            (right.type != EVALUATION_RESULT_array && right.type != EVALUATION_RESULT_number))
+    {
+        result = ArrayErrorResult("Arrays can only be combined with arrays and numbers.");
+    }
+    else if(left.type == EVALUATION_RESULT_array && right.type == EVALUATION_RESULT_array &&
+            left.array.count != right.array.count)
+    {
+        result = ArrayErrorResult("Arrays of different lengths can't be combined.");
+    }
+    else
+    {
+        unsigned int count = left.type == EVALUATION_RESULT_array ? left.array.count : right.array.count;
+        result = ArrayAllocate(environment, count);
+        
+        double *a = left.type == EVALUATION_RESULT_array ? left.array.elements : &left.number;
+        double *b = right.type == EVALUATION_RESULT_array ? right.array.elements : &right.number;
+        ArrayKernelBinary(operator_type, a, left.type == EVALUATION_RESULT_array,
+                          b, right.type == EVALUATION_RESULT_array, result.array.elements, count);
+    }
+    
+    return result;
+}
+
+static EvaluationResult
+BuiltinMap(InterpreterEnvironment *environment, EvaluationResult *function, EvaluationResult array)
+{
+    EvaluationResult result = {0};
+    ArrayKernel kernel;
+    
+    if(array.type != EVALUATION_RESULT_array)
+    {
+        result = ArrayErrorResult("map expects an array.");
+    }
+    else if(ArrayKernelCompileFunction(&kernel, function, 1) && kernel.result_type == ARRAY_KERNEL_TYPE_number)
+    {
+        result = ArrayAllocate(environment, array.array.count);
+        for(unsigned int i = 0; i < array.array.count; i += ARRAY_KERNEL_BLOCK_SIZE)
+        {
+            unsigned int count = array.array.count - i;
+            if(count > ARRAY_KERNEL_BLOCK_SIZE)
+            {
+                count = ARRAY_KERNEL_BLOCK_SIZE;
+            }
+            ArrayKernelRun(&kernel, array.array.elements + i, 0, result.array.elements + i, count);
+        }
+    }
+    else
+    {
+        // NOTE(rjf): Our copy of the environment pointer has to be updated if a
+        //            collection during a call moves the environment.
+        GarbageCollectorPushRoot(environment->gc, GARBAGE_COLLECTOR_ROOT_environment_pointer, &environment);
+        result = ArrayAllocate(environment, array.array.count);
+        for(unsigned int i = 0; i < array.array.count; ++i)
+        {
+            MemoryArenaMarker marker = MemoryArenaSave(environment->arena);
+            EvaluationResult element = { EVALUATION_RESULT_number };
+            element.number = array.array.elements[i];
+            EvaluationResult value = EvaluationResultApply(environment, function, &element);
+            
+            if(value.type != EVALUATION_RESULT_number)
+            {
+                result = value.type == EVALUATION_RESULT_error ? value : ArrayErrorResult("map's function must return numbers.");
+                break;
+            }
+            result.array.elements[i] = value.number;
+            MemoryArenaRestore(environment->arena, marker);
+        }
+        GarbageCollectorPopRoots(environment->gc, 1);
+    }
+    
+    return result;
+}
+
+static EvaluationResult
+BuiltinFilter(InterpreterEnvironment *environment, EvaluationResult *function, EvaluationResult array)
+{
+    EvaluationResult result = {0};
+    ArrayKernel kernel;
+    
+    if(array.type != EVALUATION_RESULT_array)
+    {
+        result = ArrayErrorResult("filter expects an array.");
+    }
+    else if(ArrayKernelCompileFunction(&kernel, function, 1) && kernel.result_type == ARRAY_KERNEL_TYPE_boolean)
+    {
+        // NOTE(rjf): The result is allocated at the size of the input, since we
+        //            don't know how many elements will pass until we're done.
+        result = ArrayAllocate(environment, array.array.count);
+        unsigned int kept = 0;
+        double keep[ARRAY_KERNEL_BLOCK_SIZE];
+        for(unsigned int i = 0; i < array.array.count; i += ARRAY_KERNEL_BLOCK_SIZE)
+        {
+            unsigned int count = array.array.count - i;
+            if(count > ARRAY_KERNEL_BLOCK_SIZE)
+            {
+                count = ARRAY_KERNEL_BLOCK_SIZE;
+            }
+            double *elements = array.array.elements + i;
+            ArrayKernelRun(&kernel, elements, 0, keep, count);
+            for(unsigned int j = 0; j < count; ++j)
+            {
+                result.array.elements[kept] = elements[j];
+                kept += keep[j] != 0;
+            }
+        }
+        result.array.count = kept;
+    }
+    else
+    {
+        GarbageCollectorPushRoot(environment->gc, GARBAGE_COLLECTOR_ROOT_environment_pointer, &environment);
+        result = ArrayAllocate(environment, array.array.count);
+        unsigned int kept = 0;
+        for(unsigned int i = 0; i < array.array.count; ++i)
+        {
+            MemoryArenaMarker marker = MemoryArenaSave(environment->arena);
+            EvaluationResult element = { EVALUATION_RESULT_number };
+            element.number = array.array.elements[i];
+            EvaluationResult value = EvaluationResultApply(environment, function, &element);
+            
+            if(value.type != EVALUATION_RESULT_boolean)
+            {
+                result = value.type == EVALUATION_RESULT_error ? value : ArrayErrorResult("filter's function must return booleans.");
+                break;
+            }
+            if(value.boolean)
+            {
+                result.array.elements[kept++] = element.number;
+            }
+            MemoryArenaRestore(environment->arena, marker);
+        }
+        GarbageCollectorPopRoots(environment->gc, 1);
+        if(result.type == EVALUATION_RESULT_array)
+        {
+            result.array.count = kept;
+        }
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): If function is acc + f(x) or acc * f(x) (either way around, or
+//            the operator itself) where f doesn't use acc, fold is a sum or
+//            product of f over the array, and f gets compiled into kernel.
+static int
+ArrayKernelCompileReduction(ArrayKernel *kernel, EvaluationResult *function, int *operator_type_out)
+{
+    int success = 0;
+    kernel->instruction_count = 0;
+    
+    if(function->type == EVALUATION_RESULT_builtin && function->builtin.type == BUILTIN_operator &&
+       function->builtin.applied_count == 0 &&
+       (function->builtin.operator_type == BINARY_OPERATOR_plus ||
+        function->builtin.operator_type == BINARY_OPERATOR_multiply))
+    {
+        ArrayKernelPush(kernel, ARRAY_KERNEL_INSTRUCTION_element, 0, 0);
+        kernel->result_type = ARRAY_KERNEL_TYPE_number;
+        *operator_type_out = function->builtin.operator_type;
+        success = 1;
+    }
+    else if(function->type == EVALUATION_RESULT_closure &&
+            function->closure.body->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+    {
+        AbstractSyntaxTreeNode *inner = function->closure.body;
+        AbstractSyntaxTreeNode *body = inner->function_definition.body;
+        
+        ArrayKernelScope scope = {0};
+        scope.environment = function->closure.environment;
+        scope.element_name = inner->function_definition.param_name;
+        scope.element_name_length = inner->function_definition.param_name_length;
+        scope.accumulator_name = function->closure.param_name;
+        scope.accumulator_name_length = function->closure.param_name_length;
+        
+        // NOTE(rjf): If both parameters have the same name, the inner one hides
+        //            the accumulator, so this can't be a reduction.
+        int accumulator_hidden = StringMatch(scope.element_name, scope.element_name_length,
+                                             scope.accumulator_name, scope.accumulator_name_length);
+        
+        if(!accumulator_hidden && body->type == ABSTRACT_SYNTAX_TREE_NODE_binary_operator &&
+           (body->binary_operator.type == BINARY_OPERATOR_plus ||
+            body->binary_operator.type == BINARY_OPERATOR_multiply))
+        {
+            AbstractSyntaxTreeNode *sides[2] = { body->binary_operator.left, body->binary_operator.right };
+            for(int i = 0; i < 2 && !success; ++i)
+            {
+                AbstractSyntaxTreeNode *side = sides[i];
+                if(side->type == ABSTRACT_SYNTAX_TREE_NODE_identifier &&
+                   StringMatch(side->identifier.string, side->identifier.string_length,
+                               scope.accumulator_name, scope.accumulator_name_length))
+                {
+                    kernel->instruction_count = 0;
+                    if(ArrayKernelCompileNode(kernel, sides[1-i], &scope, 0) == ARRAY_KERNEL_TYPE_number)
+                    {
+                        kernel->result_type = ARRAY_KERNEL_TYPE_number;
+                        *operator_type_out = body->binary_operator.type;
+                        success = 1;
+                    }
+                }
+            }
+        }
+    }
+    
+    return success;
+}
+
+static EvaluationResult
+BuiltinFold(InterpreterEnvironment *environment, EvaluationResult *function, EvaluationResult *initial,
+            EvaluationResult array)
+{
+    EvaluationResult result = {0};
+    ArrayKernel kernel;
+    int operator_type = 0;
+    
+    if(array.type != EVALUATION_RESULT_array)
+    {
+        result = ArrayErrorResult("fold expects an array.");
+    }
+    else if(initial->type == EVALUATION_RESULT_number && ArrayKernelCompileReduction(&kernel, function, &operator_type))
+    {
+        double accumulator = initial->number;
+        double values[ARRAY_KERNEL_BLOCK_SIZE];
+        for(unsigned int i = 0; i < array.array.count; i += ARRAY_KERNEL_BLOCK_SIZE)
+        {
+            unsigned int count = array.array.count - i;
+            if(count > ARRAY_KERNEL_BLOCK_SIZE)
+            {
+                count = ARRAY_KERNEL_BLOCK_SIZE;
+            }
+            double *block = array.array.elements + i;
+            if(kernel.instruction_count > 1 || kernel.instructions[0].type != ARRAY_KERNEL_INSTRUCTION_element)
+            {
+                ArrayKernelRun(&kernel, block, 0, values, count);
+                block = values;
+            }
+            double partial = ArrayReduce(operator_type, block, count);
+            accumulator = ArrayOperatorScalar(operator_type, accumulator, partial);
+        }
+        result.type = EVALUATION_RESULT_number;
+        result.number = accumulator;
+    }
+    else if(initial->type == EVALUATION_RESULT_number && ArrayKernelCompileFunction(&kernel, function, 2) &&
+            kernel.result_type == ARRAY_KERNEL_TYPE_number)
+    {
+        // NOTE(rjf): Each step depends on the last, so this runs the kernel on one
+        //            element at a time, which still skips the closure calls.
+        double accumulator = initial->number;
+        for(unsigned int i = 0; i < array.array.count; ++i)
+        {
+            ArrayKernelRun(&kernel, array.array.elements + i, accumulator, &accumulator, 1);
+        }
+        result.type = EVALUATION_RESULT_number;
+        result.number = accumulator;
+    }
+    else
+    {
+        // NOTE(rjf): The function takes the accumulator, and returns a function
+        //            that takes the element.
+        GarbageCollector *gc = environment->gc;
+        EvaluationResult accumulator = *initial;
+        EvaluationResult partial = {0};
+        GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_result, &accumulator);
+        GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_result, &partial);
+        GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_environment_pointer, &environment);
+        
+        for(unsigned int i = 0; i < array.array.count && accumulator.type != EVALUATION_RESULT_error; ++i)
+        {
+            MemoryArenaMarker marker = MemoryArenaSave(environment->arena);
+            EvaluationResult element = { EVALUATION_RESULT_number };
+            element.number = array.array.elements[i];
+            partial = EvaluationResultApply(environment, function, &accumulator);
+            accumulator = EvaluationResultApply(environment, &partial, &element);
+            if(EvaluationResultIsScalar(accumulator))
+            {
+                MemoryArenaRestore(environment->arena, marker);
+            }
+        }
+        
+        GarbageCollectorPopRoots(gc, 3);
+        result = accumulator;
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): Applies a builtin to one more argument. Until it has all of its
+//            arguments, that just makes a new builtin value with the argument
+//            added to the ones already applied.
+static EvaluationResult
+BuiltinApply(InterpreterEnvironment *environment, EvaluationResult *builtin, EvaluationResult *argument)
+{
+    EvaluationResult result = {0};
+    GarbageCollector *gc = environment->gc;
+    GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_environment_pointer, &environment);
+    
+    int type = builtin->builtin.type;
+    int applied_count = builtin->builtin.applied_count;
+    
+    if(argument->type == EVALUATION_RESULT_error)
+    {
+        result = *argument;
+    }
+    else if(applied_count + 1 < builtin_arities[type])
+    {
+        // NOTE(rjf): The applied arguments can hold closures, so with a collector
+        //            they're a collected value table, like an environment's.
+        unsigned int size = sizeof(EvaluationResult) * (applied_count + 1);
+        GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_result, argument);
+        GarbageCollectorSafepoint(gc, size + 64);
+        GarbageCollectorPopRoots(gc, 1);
+        
+        EvaluationResult *applied = InterpreterEnvironmentAllocate(environment, size, GARBAGE_COLLECTOR_OBJECT_value_table,
+                                                                   MEMORY_ARENA_CATEGORY_closures, 1);
+        for(int i = 0; i < applied_count; ++i)
+        {
+            applied[i] = builtin->builtin.applied[i];
+        }
+        applied[applied_count] = *argument;
+        GarbageCollectorWriteBarrier(gc, applied);
+        
+        result = *builtin;
+        result.builtin.applied = applied;
+        result.builtin.applied_count = applied_count + 1;
+    }
+    else
+    {
+        EvaluationResult arguments[3] = {0};
+        for(int i = 0; i < applied_count; ++i)
+        {
+            arguments[i] = builtin->builtin.applied[i];
+        }
+        arguments[applied_count] = *argument;
+        
+        for(int i = 0; i <= applied_count; ++i)
+        {
+            GarbageCollectorPushRoot(gc, GARBAGE_COLLECTOR_ROOT_result, arguments + i);
+        }
+        
+        switch(type)
+        {
+            case BUILTIN_operator:
+            {
+                int operator_type = builtin->builtin.operator_type;
+                if(arguments[0].type == EVALUATION_RESULT_array || arguments[1].type == EVALUATION_RESULT_array)
+                {
+                    result = ArrayBinaryOperator(environment, operator_type, arguments[0], arguments[1]);
+                }
+                else
+                {
+                    result = EvaluateBinaryOperator(operator_type, arguments[0], arguments[1]);
+                }
+                break;
+            }
+            case BUILTIN_map:
+            {
+                result = BuiltinMap(environment, arguments + 0, arguments[1]);
+                break;
+            }
+            case BUILTIN_filter:
+            {
+                result = BuiltinFilter(environment, arguments + 0, arguments[1]);
+                break;
+            }
+            case BUILTIN_fold:
+            {
+                result = BuiltinFold(environment, arguments + 0, arguments + 1, arguments[2]);
+                break;
+            }
+            case BUILTIN_sum:
+            {
+                if(arguments[0].type == EVALUATION_RESULT_array)
+                {
+                    result.type = EVALUATION_RESULT_number;
+                    result.number = ArrayReduce(BINARY_OPERATOR_plus, arguments[0].array.elements, arguments[0].array.count);
+                }
+                else
+                {
+                    result = ArrayErrorResult("sum expects an array.");
+                }
+                break;
+            }
+            case BUILTIN_dot:
+            {
+                if(arguments[0].type != EVALUATION_RESULT_array || arguments[1].type != EVALUATION_RESULT_array)
+                {
+                    result = ArrayErrorResult("dot expects two arrays.");
+                }
+                else if(arguments[0].array.count != arguments[1].array.count)
+                {
+                    result = ArrayErrorResult("dot expects arrays of the same length.");
+                }
+                else
+                {
+                    result.type = EVALUATION_RESULT_number;
+                    result.number = ArrayDot(arguments[0].array.elements, arguments[1].array.elements,
+                                             arguments[0].array.count);
+                }
+                break;
+            }
+            case BUILTIN_length:
+            {
+                if(arguments[0].type == EVALUATION_RESULT_array)
+                {
+                    result.type = EVALUATION_RESULT_number;
+                    result.number = arguments[0].array.count;
+                }
+                else
+                {
+                    result = ArrayErrorResult("length expects an array.");
+                }
+                break;
+            }
+            default: break;
+        }
+        
+        GarbageCollectorPopRoots(gc, applied_count + 1);
+    }
+    
+    GarbageCollectorPopRoots(gc, 1);
+    return result;
+}
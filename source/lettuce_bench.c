@@ -0,0 +1,1312 @@
+// NOTE(rjf): For pthread_getattr_np, which the parser uses to find out how
+//            much stack it has (see ParseStackLimit).
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define LETTUCE_POSIX 1
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LETTUCE_AVX2 1
+#include <immintrin.h>
+#else
+#define LETTUCE_AVX2 0
+#endif
+
+// NOTE(rjf): Counts every node the evaluator visits, for nodes/s.
+static unsigned long long benchmark_evaluated_node_count;
+#define ProfileNodeBegin(node) (++benchmark_evaluated_node_count)
+#define ProfileNodeEnd(node)
+
+#include "lettuce_utilities.c"
+#include "lettuce_number_format.c"
+#include "lettuce_perf_counters.c"
+#include "lettuce_output.c"
+#include "lettuce_tokenizer.c"
+#include "lettuce_abstract_syntax_tree.c"
+#include "lettuce_garbage_collector.c"
+#include "lettuce_array.c"
+#include "lettuce_parse.c"
+#include "lettuce_optimize.c"
+#include "lettuce_escape_analysis.c"
+
+// NOTE(rjf): Benchmarks for the interpreter. By default, this generates a set of
+//            synthetic programs that each stress one thing, and times the
+//            phases of interpreting them (tokenize, parse, print, evaluate)
+//            separately. --json prints the results in a form that can be
+//            diffed between builds. --arenas runs the arena backend benchmarks
+//            instead, which report the fastest run, since they are about what
+//            the allocator costs, not about noise from the rest of the system.
+//            --numbers checks that number formatting round-trips, and times it
+//            against printf, the same way.
+
+#define BENCHMARK_REPETITIONS 5
+
+typedef struct ArenaBenchmarkBackend
+{
+    char *name;
+    int backend;
+    int flags;
+}
+ArenaBenchmarkBackend;
+
+static ArenaBenchmarkBackend arena_benchmark_backends[] = {
+    { "chunked",      MEMORY_ARENA_BACKEND_chunked, 0 },
+    { "virtual",      MEMORY_ARENA_BACKEND_virtual, 0 },
+    { "virtual+huge", MEMORY_ARENA_BACKEND_virtual, MEMORY_ARENA_FLAG_huge_pages },
+};
+
+static void
+ArenaBenchmarkNodes(MemoryArena *arena, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        AbstractSyntaxTreeNode *node = MemoryArenaAllocateNode(arena);
+        node->type = ABSTRACT_SYNTAX_TREE_NODE_numeric_constant;
+        node->numeric_constant.value = i;
+    }
+}
+
+static void
+ArenaBenchmarkEnvironments(MemoryArena *arena, int count)
+{
+    // NOTE(rjf): Every closure creation duplicates the environment, which is
+    //            where most of an evaluation's memory goes.
+    InterpreterEnvironment environment = {0};
+    environment.arena = arena;
+    EvaluationResult value = { EVALUATION_RESULT_number };
+    InterpreterEnvironmentBind(&environment, "x", 1, value);
+    for(int i = 0; i < count; ++i)
+    {
+        InterpreterEnvironmentDuplicate(&environment);
+    }
+}
+
+static void
+ArenaBenchmarkMixed(MemoryArena *arena, int count)
+{
+    // NOTE(rjf): Roughly what parsing and evaluating does: mostly nodes, with
+    //            the occasional odd-sized error string in between.
+    for(int i = 0; i < count; ++i)
+    {
+        MemoryArenaAllocateNode(arena);
+        if(i % 8 == 0)
+        {
+            MakeStringOnArenaF(arena, "identifier_%d was not declared in this scope.", i);
+        }
+    }
+}
+
+static char *
+GenerateClosureProgram(int binding_count)
+{
+    // NOTE(rjf): let f = function(a) function(b) a + b in
+    //            let v0 = f(0)(1) in let v1 = f(1)(2) in ... 0
+    int capacity = 64 + binding_count * 48;
+    char *source = malloc(capacity);
+    int length = snprintf(source, capacity, "let f = function(a) function(b) a + b in\n");
+    for(int i = 0; i < binding_count; ++i)
+    {
+        length += snprintf(source + length, capacity - length, "let v%d = f(%d)(%d) in\n", i, i, i+1);
+    }
+    snprintf(source + length, capacity - length, "0");
+    return source;
+}
+
+static void
+ArenaBenchmarkInterpret(MemoryArena *arena, char *source)
+{
+    Tokenizer tokenizer = {0};
+    TokenizerInit(&tokenizer, source, CalculateCStringLength(source));
+    ParseError error = {0};
+    AbstractSyntaxTreeNode *root = ParseExpression(&tokenizer, arena, &error);
+    if(root && !error.string)
+    {
+        InterpreterEnvironment environment = {0};
+        environment.arena = arena;
+        EvaluateAbstractSyntaxTree(&environment, root);
+    }
+}
+
+enum
+{
+    ARENA_BENCHMARK_nodes,
+    ARENA_BENCHMARK_environments,
+    ARENA_BENCHMARK_mixed,
+    ARENA_BENCHMARK_interpret,
+    ARENA_BENCHMARK_COUNT
+};
+
+// NOTE(rjf): Returns the number of operations the benchmark performed.
+static int
+RunArenaBenchmark(int benchmark, MemoryArena *arena, char *closure_program)
+{
+    int operation_count = 0;
+    switch(benchmark)
+    {
+        case ARENA_BENCHMARK_nodes:        { operation_count = 1000000; ArenaBenchmarkNodes(arena, operation_count); break; }
+        case ARENA_BENCHMARK_environments: { operation_count = 4000; ArenaBenchmarkEnvironments(arena, operation_count); break; }
+        case ARENA_BENCHMARK_mixed:        { operation_count = 1000000; ArenaBenchmarkMixed(arena, operation_count); break; }
+        case ARENA_BENCHMARK_interpret:    { operation_count = 2000; ArenaBenchmarkInterpret(arena, closure_program); break; }
+        default: break;
+    }
+    return operation_count;
+}
+
+static void
+RunArenaBenchmarks(void)
+{
+    char *benchmark_names[ARENA_BENCHMARK_COUNT] = {
+        "ast nodes (1M)",
+        "environment duplicates (4K)",
+        "mixed nodes + strings (1M)",
+        "parse + evaluate closures (2K lets)",
+    };
+    
+    char *closure_program = GenerateClosureProgram(2000);
+    
+    printf("%-38s %-14s %12s %12s %12s\n", "benchmark", "backend", "cold ms", "reset ms", "ns/op");
+    
+    for(int benchmark = 0; benchmark < ARENA_BENCHMARK_COUNT; ++benchmark)
+    {
+        for(int backend = 0; backend < sizeof(arena_benchmark_backends)/sizeof(arena_benchmark_backends[0]); ++backend)
+        {
+            // NOTE(rjf): "cold" is a fresh arena each run, so it includes getting
+            //            memory from the system. "reset" reuses one arena, which is
+            //            what the server and batch modes do.
+            unsigned long long best_cold = ~0ull;
+            unsigned long long best_reset = ~0ull;
+            int operation_count = 0;
+            
+            MemoryArena reused_arena = {0};
+            reused_arena.backend = arena_benchmark_backends[backend].backend;
+            reused_arena.flags = arena_benchmark_backends[backend].flags;
+            
+            for(int repetition = 0; repetition < BENCHMARK_REPETITIONS; ++repetition)
+            {
+                MemoryArena cold_arena = {0};
+                cold_arena.backend = arena_benchmark_backends[backend].backend;
+                cold_arena.flags = arena_benchmark_backends[backend].flags;
+                
+                unsigned long long start_time = GetTimeInNanoseconds();
+                operation_count = RunArenaBenchmark(benchmark, &cold_arena, closure_program);
+                unsigned long long elapsed = GetTimeInNanoseconds() - start_time;
+                if(elapsed < best_cold)
+                {
+                    best_cold = elapsed;
+                }
+                MemoryArenaCleanUp(&cold_arena);
+            }
+            
+            RunArenaBenchmark(benchmark, &reused_arena, closure_program);
+            for(int repetition = 0; repetition < BENCHMARK_REPETITIONS; ++repetition)
+            {
+                MemoryArenaReset(&reused_arena);
+                unsigned long long start_time = GetTimeInNanoseconds();
+                RunArenaBenchmark(benchmark, &reused_arena, closure_program);
+                unsigned long long elapsed = GetTimeInNanoseconds() - start_time;
+                if(elapsed < best_reset)
+                {
+                    best_reset = elapsed;
+                }
+            }
+            
+            MemoryArenaCleanUp(&reused_arena);
+            
+            printf("%-38s %-14s %12.3f %12.3f %12.1f\n", benchmark_names[benchmark],
+                   arena_benchmark_backends[backend].name,
+                   best_cold / 1e6, best_reset / 1e6, (double)best_cold / operation_count);
+        }
+    }
+    
+    free(closure_program);
+}
+
+#define NUMBER_BENCHMARK_COUNT 1000000
+
+static unsigned long long
+NumberBenchmarkRandom(unsigned long long *state)
+{
+    // NOTE(rjf): xorshift64.
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// NOTE(rjf): Half of the numbers are random bit patterns, which cover every
+//            exponent, and half look like what programs compute: integers,
+//            ratios, and short decimals.
+static void
+GenerateBenchmarkNumbers(double *numbers, int count)
+{
+    unsigned long long state = 88172645463325252ull;
+    for(int i = 0; i < count; ++i)
+    {
+        unsigned long long random = NumberBenchmarkRandom(&state);
+        double number = 0;
+        switch(i % 6)
+        {
+            case 0: case 2: case 4:
+            {
+                do
+                {
+                    random = NumberBenchmarkRandom(&state);
+                    memcpy(&number, &random, sizeof(number));
+                }
+                while(number != number || number - number != 0);
+                break;
+            }
+            case 1: number = (double)(random % 1000000); break;
+            case 3: number = (double)(random % 100000) / (double)(1 + (random >> 32) % 1000); break;
+            case 5: number = (double)(random % 10000) / 100.0; break;
+        }
+        numbers[i] = number;
+    }
+}
+
+// NOTE(rjf): Returns how many numbers didn't read back exactly, or weren't the
+//            shortest that do.
+static int
+CheckNumberFormatRoundTrips(double *numbers, int count)
+{
+    int failure_count = 0;
+    char buffer[NUMBER_FORMAT_MAX_LENGTH+1];
+    
+    for(int i = 0; i < count; ++i)
+    {
+        for(int style = NUMBER_FORMAT_STYLE_general; style <= NUMBER_FORMAT_STYLE_fixed; ++style)
+        {
+            int length = NumberFormat(buffer, numbers[i], style);
+            buffer[length] = 0;
+            double read_back = strtod(buffer, 0);
+            if(memcmp(&read_back, numbers + i, sizeof(read_back)))
+            {
+                if(failure_count++ < 10)
+                {
+                    fprintf(stderr, "%.17g was formatted as %s, which reads back as %.17g.\n",
+                            numbers[i], buffer, read_back);
+                }
+            }
+        }
+        
+        // NOTE(rjf): printf rounds correctly, so if it can get away with one
+        //            digit less, we weren't the shortest.
+        int length = NumberFormat(buffer, numbers[i], NUMBER_FORMAT_STYLE_general);
+        int first_digit = -1;
+        int last_digit = -1;
+        for(int j = 0; j < length && buffer[j] != 'e'; ++j)
+        {
+            if(buffer[j] >= '1' && buffer[j] <= '9')
+            {
+                first_digit = first_digit < 0 ? j : first_digit;
+                last_digit = j;
+            }
+        }
+        int digit_count = 0;
+        for(int j = first_digit; j >= 0 && j <= last_digit; ++j)
+        {
+            digit_count += buffer[j] != '.';
+        }
+        if(digit_count > 1)
+        {
+            char shorter[64];
+            snprintf(shorter, sizeof(shorter), "%.*e", digit_count - 2, numbers[i]);
+            if(strtod(shorter, 0) == numbers[i] && failure_count++ < 10)
+            {
+                buffer[length] = 0;
+                fprintf(stderr, "%.17g was formatted as %s, but %s is shorter.\n", numbers[i], buffer, shorter);
+            }
+        }
+    }
+    
+    return failure_count;
+}
+
+enum
+{
+    NUMBER_BENCHMARK_number_format,
+    NUMBER_BENCHMARK_printf_17g,
+    NUMBER_BENCHMARK_printf_shortest_of_15g_17g,
+    NUMBER_BENCHMARK_COUNT_METHODS,
+};
+
+static unsigned long long
+RunNumberFormatBenchmark(int method, double *numbers, int count)
+{
+    char buffer[NUMBER_FORMAT_MAX_LENGTH];
+    unsigned long long total_length = 0;
+    
+    for(int i = 0; i < count; ++i)
+    {
+        switch(method)
+        {
+            case NUMBER_BENCHMARK_number_format:
+            {
+                total_length += NumberFormat(buffer, numbers[i], NUMBER_FORMAT_STYLE_general);
+                break;
+            }
+            case NUMBER_BENCHMARK_printf_17g:
+            {
+                total_length += snprintf(buffer, sizeof(buffer), "%.17g", numbers[i]);
+                break;
+            }
+            case NUMBER_BENCHMARK_printf_shortest_of_15g_17g:
+            {
+                int length = snprintf(buffer, sizeof(buffer), "%.15g", numbers[i]);
+                if(strtod(buffer, 0) != numbers[i])
+                {
+                    length = snprintf(buffer, sizeof(buffer), "%.17g", numbers[i]);
+                }
+                total_length += length;
+                break;
+            }
+        }
+    }
+    
+    return total_length;
+}
+
+static int
+RunNumberFormatBenchmarks(void)
+{
+    double *numbers = malloc(sizeof(double) * NUMBER_BENCHMARK_COUNT);
+    GenerateBenchmarkNumbers(numbers, NUMBER_BENCHMARK_COUNT);
+    
+    double special_numbers[] = {
+        0.0, -0.0, 1.0, -1.0, 0.1, 0.3, 0.1 + 0.2, 1e21, 1e-5, 1e15, 1e16, 1e17, 1e23,
+        5e-324, 2.2250738585072009e-308, 2.2250738585072014e-308, 1.7976931348623157e308,
+        9007199254740993.0, 123456789012345678.0,
+    };
+    int failure_count = CheckNumberFormatRoundTrips(special_numbers, sizeof(special_numbers)/sizeof(special_numbers[0]));
+    failure_count += CheckNumberFormatRoundTrips(numbers, NUMBER_BENCHMARK_COUNT);
+    printf("round trips: %d numbers, %d failures\n", NUMBER_BENCHMARK_COUNT, failure_count);
+    
+    char *method_names[NUMBER_BENCHMARK_COUNT_METHODS] = {
+        "NumberFormat",
+        "printf %.17g",
+        "printf %.15g or %.17g",
+    };
+    
+    printf("%-24s %12s %12s %12s\n", "method", "ms", "ns/number", "MB/s");
+    for(int method = 0; method < NUMBER_BENCHMARK_COUNT_METHODS; ++method)
+    {
+        unsigned long long best = ~0ull;
+        unsigned long long total_length = 0;
+        for(int repetition = 0; repetition < BENCHMARK_REPETITIONS; ++repetition)
+        {
+            unsigned long long start_time = GetTimeInNanoseconds();
+            total_length = RunNumberFormatBenchmark(method, numbers, NUMBER_BENCHMARK_COUNT);
+            unsigned long long elapsed = GetTimeInNanoseconds() - start_time;
+            if(elapsed < best)
+            {
+                best = elapsed;
+            }
+        }
+        printf("%-24s %12.3f %12.1f %12.1f\n", method_names[method], best / 1e6,
+               (double)best / NUMBER_BENCHMARK_COUNT, total_length * 1e3 / best);
+    }
+    
+    free(numbers);
+    return failure_count == 0;
+}
+
+// NOTE(rjf): Growable, null-terminated string for the program generators.
+typedef struct StringBuilder
+{
+    char *data;
+    unsigned long long length;
+    unsigned long long capacity;
+}
+StringBuilder;
+
+static void
+StringBuilderAppendF(StringBuilder *builder, char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(0, 0, format, args);
+    va_end(args);
+    
+    if(builder->length + needed + 1 > builder->capacity)
+    {
+        builder->capacity = builder->capacity ? builder->capacity * 2 : 4096;
+        while(builder->length + needed + 1 > builder->capacity)
+        {
+            builder->capacity *= 2;
+        }
+        builder->data = realloc(builder->data, builder->capacity);
+    }
+    
+    va_start(args, format);
+    vsnprintf(builder->data + builder->length, needed + 1, format, args);
+    va_end(args);
+    builder->length += needed;
+}
+
+// NOTE(rjf): 1 + 2 * 3 - 4 + ... with n operands. The parser and evaluator
+//            both recurse once per operator.
+static void
+GenerateOperatorChain(StringBuilder *builder, int n)
+{
+    char *operators[] = { "+", "*", "-", "+" };
+    StringBuilderAppendF(builder, "1");
+    for(int i = 1; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, " %s %d", operators[i % 4], i % 7 + 1);
+    }
+}
+
+// NOTE(rjf): (1 + (2 + (3 + ... n))), nested n deep.
+static void
+GenerateDeepNesting(StringBuilder *builder, int n)
+{
+    for(int i = 0; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "(%d + ", i % 10);
+    }
+    StringBuilderAppendF(builder, "0");
+    for(int i = 0; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, ")");
+    }
+}
+
+// NOTE(rjf): let v0 = 0 in let v1 = v0 + 1 in ... vn. Each let is live until the
+//            end, so this is bounded by the size of the identifier table.
+static void
+GenerateManyLets(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder, "let v0 = 0 in\n");
+    for(int i = 1; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "let v%d = v%d + 1 in\n", i, i-1);
+    }
+    StringBuilderAppendF(builder, "v%d", n-1);
+}
+
+// NOTE(rjf): A three-argument curried function, applied n times.
+static void
+GenerateCurriedClosures(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder, "let add3 = function(a) function(b) function(c) a + b * c in\n");
+    StringBuilderAppendF(builder, "let r0 = add3(0)(1)(2) in\n");
+    for(int i = 1; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "let r%d = add3(r%d)(%d)(2) in\n", i, i-1, i % 5);
+    }
+    StringBuilderAppendF(builder, "r%d", n-1);
+}
+
+// NOTE(rjf): Recursion through self-application: sums 1..n, n calls deep.
+//            Every step makes a closure for self(self).
+static void
+GenerateRecursiveCombinator(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder,
+                         "let sum = function(self) function(n)\n"
+                         "    if n == 0 then 0 else n + self(self)(n - 1) in\n"
+                         "sum(sum)(%d)", n);
+}
+
+// NOTE(rjf): The same sum through the fixed point combinator (the strict
+//            version of Y), which makes several closures every step.
+static void
+GenerateFixedPointCombinator(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder,
+                         "let fix = function(f)\n"
+                         "    (function(x) f(function(v) x(x)(v)))(function(x) f(function(v) x(x)(v))) in\n"
+                         "let sum = fix(function(self) function(n)\n"
+                         "    if n == 0 then 0 else n + self(n - 1)) in\n"
+                         "sum(%d)", n);
+}
+
+// NOTE(rjf): The same sum with let rec, which makes its one closure when it's
+//            bound, and then none while it recurses.
+static void
+GenerateLetRec(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder,
+                         "let rec sum = function(n)\n"
+                         "    if n == 0 then 0 else n + sum(n - 1) in\n"
+                         "sum(%d)", n);
+}
+
+// NOTE(rjf): Two mutually recursive functions in one let rec group, which sum
+//            the even and odd numbers in 1..n with different weights.
+static void
+GenerateMutualLetRec(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder,
+                         "let rec even = function(n)\n"
+                         "    if n == 0 then 0 else n + odd(n - 1)\n"
+                         "and odd = function(n)\n"
+                         "    if n == 0 then 0 else n * 2 + even(n - 1) in\n"
+                         "even(%d)", n);
+}
+
+// NOTE(rjf): A function that maps 0..n-1 to literals with a chain of ifs,
+//            looked up a few times.
+static void
+GenerateLiteralTable(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder, "let table = function(i)\n");
+    for(int i = 0; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "    if i == %d then %d.%d else\n", i, i * 3 + 1, i % 10);
+    }
+    StringBuilderAppendF(builder, "    0 in\ntable(0) + table(%d) + table(%d) + table(%d)", n/4, n/2, n-1);
+}
+
+// NOTE(rjf): An n-element array literal, put through the array builtins. The
+//            callbacks are all simple enough to run as kernels, except the
+//            last fold's, which takes the per-element call path.
+static void
+GenerateArrayKernels(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder, "let a = {");
+    for(int i = 0; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "%s%d.%d", i ? ", " : "", i % 100, i % 10);
+    }
+    StringBuilderAppendF(builder, "} in\n"
+                         "let b = map(function(x) x * 2 + 1)(a) in\n"
+                         "let c = filter(function(x) x < 100)(b) in\n"
+                         "let d = a * b - a in\n"
+                         "sum(c) + dot(a)(d) + fold(function(s) function(x) s + x * x)(0)(b) +\n"
+                         "fold(function(m) function(x) if x > m then x else m)(0)(a) + length(c)");
+}
+
+// NOTE(rjf): A sum of n terms, each one of a handful of subexpressions, the way
+//            generated code tends to repeat itself. --hash-cons shares them.
+static void
+GenerateRepeatedSubexpressions(StringBuilder *builder, int n)
+{
+    char *terms[] = {
+        "(x * y + 2) * (x - 1)",
+        "f(x + 1)",
+        "(if x < y then x * 2 else y * 2)",
+        "f(x + 1) * (x * y + 2)",
+        "{x, y, x + y}[2]",
+    };
+    int term_count = sizeof(terms)/sizeof(terms[0]);
+    StringBuilderAppendF(builder, "let x = 3 in let y = 4 in let f = function(v) v * v - 1 in\n");
+    for(int i = 0; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "%s%s", i ? " + " : "", terms[i % term_count]);
+    }
+}
+
+// NOTE(rjf): The kind of code a code generator writes: small helper functions,
+//            and function literals applied on the spot. --optimize inlines them.
+static void
+GenerateHelperCalls(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder,
+                         "let scale = function(x) x * 3 in\n"
+                         "let offset = function(x) function(y) x + y in\n"
+                         "let clamp = function(x) if x > 1000 then x / 2 else x in\n"
+                         "let v0 = 1 in\n");
+    for(int i = 1; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "let v%d = clamp((function(x) x * 2 - scale(1))(offset(v%d)(%d))) in\n",
+                             i, i-1, i % 5);
+    }
+    StringBuilderAppendF(builder, "v%d", n-1);
+}
+
+// NOTE(rjf): Lets that each build an array with the help of a function of their
+//            own. Since the lets produce arrays, the arena can't be rewound
+//            after them, so this is what escape analysis is for.
+static void
+GenerateLocalHelpers(StringBuilder *builder, int n)
+{
+    StringBuilderAppendF(builder, "let v0 = {0, 1} in\n");
+    for(int i = 1; i < n; ++i)
+    {
+        StringBuilderAppendF(builder, "let v%d = let step = function(x) x * 2 + %d in {step(v%d[0]), step(v%d[1]) / 4} in\n",
+                             i, i % 3, i-1, i-1);
+    }
+    StringBuilderAppendF(builder, "sum(v%d)", n-1);
+}
+
+typedef struct BenchmarkWorkload
+{
+    char *name;
+    void (*generate)(StringBuilder *builder, int n);
+    int default_size;
+}
+BenchmarkWorkload;
+
+static BenchmarkWorkload benchmark_workloads[] = {
+    { "operator_chain",       GenerateOperatorChain,       10000 },
+    { "deep_nesting",         GenerateDeepNesting,         10000 },
+    { "many_lets",            GenerateManyLets,            400   },
+    { "curried_closures",     GenerateCurriedClosures,     400   },
+    { "recursive_combinator", GenerateRecursiveCombinator, 2000  },
+    { "fixed_point_combinator", GenerateFixedPointCombinator, 2000 },
+    { "let_rec",              GenerateLetRec,              2000  },
+    { "mutual_let_rec",       GenerateMutualLetRec,        2000  },
+    { "literal_table",        GenerateLiteralTable,        2000  },
+    { "array_kernels",        GenerateArrayKernels,        100000 },
+    { "repeated_subexpressions", GenerateRepeatedSubexpressions, 5000 },
+    { "helper_calls",         GenerateHelperCalls,         400   },
+    { "local_helpers",        GenerateLocalHelpers,        400   },
+};
+
+enum
+{
+    BENCHMARK_PHASE_tokenize,
+    BENCHMARK_PHASE_parse,
+    BENCHMARK_PHASE_print,
+    BENCHMARK_PHASE_evaluate,
+    BENCHMARK_PHASE_COUNT
+};
+
+static char *benchmark_phase_names[BENCHMARK_PHASE_COUNT] = {
+    "tokenize",
+    "parse",
+    "print",
+    "evaluate",
+};
+
+typedef struct BenchmarkOptions
+{
+    int warmup_count;
+    int repetition_count;
+    double scale;
+    int json;
+    int hash_cons;
+    int optimize;
+    int no_escape_analysis;
+    char *workload;
+    PerfCounters counters;
+}
+BenchmarkOptions;
+
+typedef struct BenchmarkPhaseResult
+{
+    double median_ns;
+    double mad_ns;
+    double megabytes_per_second;
+    double nodes_per_second;
+    
+    // NOTE(rjf): Per run of the phase, only filled in with --counters.
+    PerfCounterValues counters;
+    double nodes;
+}
+BenchmarkPhaseResult;
+
+typedef struct BenchmarkResult
+{
+    char *workload;
+    int size;
+    unsigned long long source_bytes;
+    unsigned long long token_count;
+    unsigned long long node_count;
+    unsigned long long evaluated_node_count;
+    char *evaluation_error;
+    
+    // NOTE(rjf): Closures put on the evaluation stack's region thanks to escape
+    //            analysis, and the ones that were still made on the arena.
+    unsigned long long region_closure_count;
+    unsigned long long region_bytes;
+    unsigned long long arena_closure_allocation_count;
+    unsigned long long arena_closure_peak_bytes;
+    
+    // NOTE(rjf): Only filled in with --optimize.
+    unsigned long long eliminated_call_count;
+    
+    // NOTE(rjf): Only filled in with --hash-cons.
+    unsigned long long unique_node_count;
+    double deduplication_ratio;
+    BenchmarkPhaseResult phases[BENCHMARK_PHASE_COUNT];
+}
+BenchmarkResult;
+
+static int
+CompareDoubles(const void *a, const void *b)
+{
+    double double_a = *(const double *)a;
+    double double_b = *(const double *)b;
+    return double_a < double_b ? -1 : double_a > double_b ? 1 : 0;
+}
+
+static double
+MedianOfSorted(double *values, int count)
+{
+    return (count % 2) ? values[count/2] : 0.5 * (values[count/2 - 1] + values[count/2]);
+}
+
+// NOTE(rjf): Median and median absolute deviation, which unlike the mean and
+//            standard deviation aren't thrown off by the odd slow run.
+static void
+ComputeMedianAndMAD(double *samples, int count, double *median_out, double *mad_out)
+{
+    qsort(samples, count, sizeof(samples[0]), CompareDoubles);
+    double median = MedianOfSorted(samples, count);
+    double *deviations = malloc(sizeof(deviations[0]) * count);
+    for(int i = 0; i < count; ++i)
+    {
+        deviations[i] = samples[i] > median ? samples[i] - median : median - samples[i];
+    }
+    qsort(deviations, count, sizeof(deviations[0]), CompareDoubles);
+    *median_out = median;
+    *mad_out = MedianOfSorted(deviations, count);
+    free(deviations);
+}
+
+static unsigned long long
+CountTokens(char *source, unsigned long long source_length)
+{
+    unsigned long long count = 0;
+    Tokenizer tokenizer = {0};
+    TokenizerInit(&tokenizer, source, source_length);
+    for(;;)
+    {
+        Token token = {0};
+        NextToken(&tokenizer, &token);
+        if(!token.type)
+        {
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+static unsigned long long
+CountNodes(AbstractSyntaxTreeNode *root)
+{
+    unsigned long long count = 0;
+    if(root)
+    {
+        count = 1;
+        switch(root->type)
+        {
+            case ABSTRACT_SYNTAX_TREE_NODE_let:
+            {
+                count += CountNodes(root->let.binding_expression) + CountNodes(root->let.body_expression);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+            {
+                count += CountNodes(root->binary_operator.left) + CountNodes(root->binary_operator.right);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+            {
+                count += (CountNodes(root->if_then_else.condition) + CountNodes(root->if_then_else.pass_code) +
+                          CountNodes(root->if_then_else.fail_code));
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+            {
+                count += CountNodes(root->function_definition.body);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+            {
+                count += CountNodes(root->function_call.closure) + CountNodes(root->function_call.parameter);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+            {
+                for(unsigned int i = 0; i < root->array_literal.element_count; ++i)
+                {
+                    count += CountNodes(root->array_literal.elements[i]);
+                }
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_index:
+            {
+                count += CountNodes(root->index.array) + CountNodes(root->index.index);
+                break;
+            }
+            default: break;
+        }
+    }
+    return count;
+}
+
+typedef struct BenchmarkContext
+{
+    char *source;
+    unsigned long long source_length;
+    MemoryArena parse_arena;
+    MemoryArena evaluate_arena;
+    EvaluationStack *stack;
+    AbstractSyntaxTreeNodeTable *node_table;
+    Optimizer *optimizer;
+    int escape_analysis;
+    AbstractSyntaxTreeNode *root;
+    OutputBuffer *null_output;
+    EvaluationResult result;
+}
+BenchmarkContext;
+
+static void
+RunBenchmarkPhase(BenchmarkContext *context, int phase)
+{
+    switch(phase)
+    {
+        case BENCHMARK_PHASE_tokenize:
+        {
+            CountTokens(context->source, context->source_length);
+            break;
+        }
+        case BENCHMARK_PHASE_parse:
+        {
+            MemoryArenaReset(&context->parse_arena);
+            Tokenizer tokenizer = {0};
+            TokenizerInit(&tokenizer, context->source, context->source_length);
+            if(context->node_table)
+            {
+                AbstractSyntaxTreeNodeTableReset(context->node_table);
+                tokenizer.node_table = context->node_table;
+            }
+            ParseError error = {0};
+            context->root = ParseExpression(&tokenizer, &context->parse_arena, &error);
+            if(error.string)
+            {
+                context->root = 0;
+            }
+            else if(context->optimizer)
+            {
+                OptimizerInit(context->optimizer, &context->parse_arena, OPTIMIZER_DEFAULT_BUDGET);
+                context->root = OptimizeAbstractSyntaxTree(context->optimizer, context->root);
+            }
+            if(context->root && context->escape_analysis)
+            {
+                EscapeAnalyzeAbstractSyntaxTree(context->root);
+            }
+            break;
+        }
+        case BENCHMARK_PHASE_print:
+        {
+            PrintAbstractSyntaxTree(context->null_output, context->root, ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_source);
+            OutputFlush(context->null_output);
+            break;
+        }
+        case BENCHMARK_PHASE_evaluate:
+        {
+            MemoryArenaReset(&context->evaluate_arena);
+            InterpreterEnvironment environment = {0};
+            environment.arena = &context->evaluate_arena;
+            environment.stack = context->stack;
+            context->result = EvaluateAbstractSyntaxTree(&environment, context->root);
+            break;
+        }
+        default: break;
+    }
+}
+
+static int
+RunWorkloadBenchmark(BenchmarkWorkload *workload, BenchmarkOptions *options, BenchmarkResult *result)
+{
+    int success = 1;
+    int size = (int)(workload->default_size * options->scale);
+    if(size < 1)
+    {
+        size = 1;
+    }
+    
+    StringBuilder builder = {0};
+    workload->generate(&builder, size);
+    
+    BenchmarkContext context = {0};
+    context.source = builder.data;
+    context.source_length = builder.length;
+    context.null_output = malloc(sizeof(*context.null_output));
+    OutputBufferInit(context.null_output, open("/dev/null", O_WRONLY));
+    context.stack = malloc(sizeof(*context.stack));
+    context.stack->arena = (MemoryArena){0};
+    EvaluationStackInit(context.stack, 0);
+    if(options->hash_cons)
+    {
+        context.node_table = calloc(1, sizeof(*context.node_table));
+    }
+    if(options->optimize)
+    {
+        context.optimizer = calloc(1, sizeof(*context.optimizer));
+    }
+    context.escape_analysis = !options->no_escape_analysis;
+    
+    result->workload = workload->name;
+    result->size = size;
+    result->source_bytes = builder.length;
+    result->token_count = CountTokens(context.source, context.source_length);
+    
+    // NOTE(rjf): Parse once up front so every phase after it has a tree to
+    //            work with, and so we know the tree is valid at all.
+    RunBenchmarkPhase(&context, BENCHMARK_PHASE_parse);
+    if(!context.root)
+    {
+        fprintf(stderr, "ERROR: Generated %s program did not parse.\n", workload->name);
+        success = 0;
+    }
+    else
+    {
+        result->node_count = CountNodes(context.root);
+        if(context.optimizer)
+        {
+            result->eliminated_call_count = (context.optimizer->applied_function_count +
+                                             context.optimizer->inlined_call_count);
+        }
+        if(context.node_table)
+        {
+            result->unique_node_count = context.node_table->node_count - context.node_table->duplicate_count;
+            result->deduplication_ratio = AbstractSyntaxTreeNodeTableDeduplicationRatio(context.node_table);
+        }
+        
+        benchmark_evaluated_node_count = 0;
+        RunBenchmarkPhase(&context, BENCHMARK_PHASE_evaluate);
+        result->evaluated_node_count = benchmark_evaluated_node_count;
+        result->region_closure_count = context.stack->region_closure_count;
+        result->region_bytes = context.stack->region_bytes;
+        MemoryArenaCategoryStats *closure_stats = context.evaluate_arena.category_stats + MEMORY_ARENA_CATEGORY_closures;
+        result->arena_closure_allocation_count = closure_stats->total_count;
+        result->arena_closure_peak_bytes = closure_stats->peak_bytes;
+        if(context.result.type == EVALUATION_RESULT_error)
+        {
+            result->evaluation_error = context.result.error.error_string;
+        }
+        
+        double *samples = malloc(sizeof(samples[0]) * options->repetition_count);
+        for(int phase = 0; phase < BENCHMARK_PHASE_COUNT; ++phase)
+        {
+            for(int i = 0; i < options->warmup_count; ++i)
+            {
+                RunBenchmarkPhase(&context, phase);
+            }
+            for(int i = 0; i < options->repetition_count; ++i)
+            {
+                unsigned long long start_time = GetTimeInNanoseconds();
+                RunBenchmarkPhase(&context, phase);
+                samples[i] = (double)(GetTimeInNanoseconds() - start_time);
+            }
+            
+            BenchmarkPhaseResult *phase_result = result->phases + phase;
+            ComputeMedianAndMAD(samples, options->repetition_count, &phase_result->median_ns, &phase_result->mad_ns);
+            double seconds = phase_result->median_ns > 0 ? phase_result->median_ns / 1e9 : 1e-9;
+            unsigned long long nodes = (phase == BENCHMARK_PHASE_evaluate ? result->evaluated_node_count :
+                                        phase == BENCHMARK_PHASE_tokenize ? result->token_count :
+                                        result->node_count);
+            phase_result->megabytes_per_second = result->source_bytes / (1024.0*1024.0) / seconds;
+            phase_result->nodes_per_second = nodes / seconds;
+            phase_result->nodes = (double)nodes;
+            
+            // NOTE(rjf): Counters get runs of their own, so starting and stopping
+            //            them doesn't show up in the timings.
+            if(options->counters.available_count)
+            {
+                PerfCountersStart(&options->counters);
+                for(int i = 0; i < options->repetition_count; ++i)
+                {
+                    RunBenchmarkPhase(&context, phase);
+                }
+                PerfCountersStop(&options->counters, &phase_result->counters);
+                for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+                {
+                    phase_result->counters.values[i] /= options->repetition_count;
+                }
+            }
+        }
+        free(samples);
+    }
+    
+    close(context.null_output->fd);
+    free(context.null_output);
+    EvaluationStackCleanUp(context.stack);
+    free(context.stack);
+    if(context.node_table)
+    {
+        AbstractSyntaxTreeNodeTableCleanUp(context.node_table);
+        free(context.node_table);
+    }
+    free(context.optimizer);
+    MemoryArenaCleanUp(&context.parse_arena);
+    MemoryArenaCleanUp(&context.evaluate_arena);
+    free(builder.data);
+    return success;
+}
+
+static void
+PrintBenchmarkResultsJSON(BenchmarkResult *results, int result_count, BenchmarkOptions *options)
+{
+    printf("{\n");
+    printf("  \"build\": { \"compiler\": \"%s\", \"optimized\": %s },\n", __VERSION__,
+#ifdef __OPTIMIZE__
+           "true"
+#else
+           "false"
+#endif
+           );
+    printf("  \"warmup\": %d,\n", options->warmup_count);
+    printf("  \"repetitions\": %d,\n", options->repetition_count);
+    printf("  \"workloads\": [\n");
+    for(int i = 0; i < result_count; ++i)
+    {
+        BenchmarkResult *result = results + i;
+        printf("    {\n");
+        printf("      \"name\": \"%s\",\n", result->workload);
+        printf("      \"size\": %d,\n", result->size);
+        printf("      \"source_bytes\": %llu,\n", result->source_bytes);
+        printf("      \"tokens\": %llu,\n", result->token_count);
+        printf("      \"ast_nodes\": %llu,\n", result->node_count);
+        printf("      \"evaluated_nodes\": %llu,\n", result->evaluated_node_count);
+        printf("      \"evaluation_error\": %s%s%s,\n", result->evaluation_error ? "\"" : "",
+               result->evaluation_error ? result->evaluation_error : "null", result->evaluation_error ? "\"" : "");
+        printf("      \"region_closures\": %llu,\n", result->region_closure_count);
+        printf("      \"region_bytes\": %llu,\n", result->region_bytes);
+        printf("      \"arena_closure_allocations\": %llu,\n", result->arena_closure_allocation_count);
+        printf("      \"arena_closure_peak_bytes\": %llu,\n", result->arena_closure_peak_bytes);
+        if(options->optimize)
+        {
+            printf("      \"eliminated_calls\": %llu,\n", result->eliminated_call_count);
+        }
+        if(options->hash_cons)
+        {
+            printf("      \"unique_ast_nodes\": %llu,\n", result->unique_node_count);
+            printf("      \"deduplication_ratio\": %.3f,\n", result->deduplication_ratio);
+        }
+        printf("      \"phases\": {\n");
+        for(int phase = 0; phase < BENCHMARK_PHASE_COUNT; ++phase)
+        {
+            BenchmarkPhaseResult *phase_result = result->phases + phase;
+            printf("        \"%s\": { \"median_ns\": %.0f, \"mad_ns\": %.0f, \"mb_per_s\": %.3f, \"nodes_per_s\": %.0f",
+                   benchmark_phase_names[phase], phase_result->median_ns, phase_result->mad_ns,
+                   phase_result->megabytes_per_second, phase_result->nodes_per_second);
+            if(options->counters.available_count)
+            {
+                for(int per_node = 0; per_node < 2; ++per_node)
+                {
+                    printf(", \"%s\": {", per_node ? "counters_per_node" : "counters");
+                    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+                    {
+                        printf("%s\"%s\": ", i ? ", " : " ", perf_counter_names[i]);
+                        if(phase_result->counters.available[i])
+                        {
+                            double divisor = per_node && phase_result->nodes > 0 ? phase_result->nodes : 1.0;
+                            printf("%.3f", phase_result->counters.values[i] / divisor);
+                        }
+                        else
+                        {
+                            printf("null");
+                        }
+                    }
+                    printf(" }");
+                }
+            }
+            printf(" }%s\n", phase+1 < BENCHMARK_PHASE_COUNT ? "," : "");
+        }
+        printf("      }\n");
+        printf("    }%s\n", i+1 < result_count ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+static void
+PrintBenchmarkResultsTable(BenchmarkResult *results, int result_count, BenchmarkOptions *options)
+{
+    printf("%-22s %-9s %10s %12s %9s %12s %14s\n", "workload", "phase", "bytes", "median us", "mad %", "MB/s", "nodes/s");
+    for(int i = 0; i < result_count; ++i)
+    {
+        BenchmarkResult *result = results + i;
+        for(int phase = 0; phase < BENCHMARK_PHASE_COUNT; ++phase)
+        {
+            BenchmarkPhaseResult *phase_result = result->phases + phase;
+            printf("%-22s %-9s %10llu %12.1f %8.1f%% %12.1f %14.0f\n",
+                   phase == 0 ? result->workload : "", benchmark_phase_names[phase], result->source_bytes,
+                   phase_result->median_ns / 1e3,
+                   phase_result->median_ns > 0 ? 100.0 * phase_result->mad_ns / phase_result->median_ns : 0.0,
+                   phase_result->megabytes_per_second, phase_result->nodes_per_second);
+            if(options->counters.available_count)
+            {
+                printf("%-32s per run: ", "");
+                PerfCounterValuesPrint(stdout, &phase_result->counters, 1.0);
+                printf("\n%-32s per node:", "");
+                PerfCounterValuesPrint(stdout, &phase_result->counters, phase_result->nodes > 0 ? phase_result->nodes : 1.0);
+                printf("\n");
+            }
+        }
+        if(result->evaluation_error)
+        {
+            printf("%-22s evaluation error: %s\n", "", result->evaluation_error);
+        }
+        if(result->region_closure_count || result->arena_closure_allocation_count)
+        {
+            printf("%-22s closures: %llu on the region (%llu bytes), %llu allocations on the arena (%llu bytes at peak)\n",
+                   "", result->region_closure_count, result->region_bytes,
+                   result->arena_closure_allocation_count, result->arena_closure_peak_bytes);
+        }
+        if(options->optimize)
+        {
+            printf("%-22s optimizer: %llu call sites eliminated\n", "", result->eliminated_call_count);
+        }
+        if(result->deduplication_ratio > 0)
+        {
+            printf("%-22s hash-consing: %llu unique nodes (%.2fx deduplication)\n", "",
+                   result->unique_node_count, result->deduplication_ratio);
+        }
+    }
+}
+
+static void
+PrintUsage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program_name);
+    fprintf(stderr, "    --json                  Print results as JSON\n");
+    fprintf(stderr, "    --workload <name>       Only run one workload\n");
+    fprintf(stderr, "    --scale <factor>        Multiply every workload's size (default: 1)\n");
+    fprintf(stderr, "    --warmup <count>        Untimed runs per phase (default: 3)\n");
+    fprintf(stderr, "    --repetitions <count>   Timed runs per phase (default: 15)\n");
+    fprintf(stderr, "    --no-escape-analysis    Put every closure on the arena, for comparison\n");
+    fprintf(stderr, "    --optimize              Run the optimizer after parsing (timed as part of parsing)\n");
+    fprintf(stderr, "    --hash-cons             Parse with hash-consing, and report how many nodes were shared\n");
+    fprintf(stderr, "    --counters              Also report hardware performance counters per phase and per node\n");
+    fprintf(stderr, "    --arenas                Run the arena backend benchmarks instead\n");
+    fprintf(stderr, "    --numbers               Check number formatting round trips, and time it, instead\n");
+}
+
+int
+main(int argument_count, char **arguments)
+{
+    BenchmarkOptions options = {0};
+    options.warmup_count = 3;
+    options.repetition_count = 15;
+    options.scale = 1.0;
+    int run_arena_benchmarks = 0;
+    int run_number_benchmarks = 0;
+    int use_counters = 0;
+    
+    for(int i = 1; i < argument_count; ++i)
+    {
+        if(!strcmp(arguments[i], "--json"))
+        {
+            options.json = 1;
+        }
+        else if(!strcmp(arguments[i], "--workload") && i+1 < argument_count)
+        {
+            options.workload = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--scale") && i+1 < argument_count)
+        {
+            options.scale = atof(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--warmup") && i+1 < argument_count)
+        {
+            options.warmup_count = atoi(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--repetitions") && i+1 < argument_count)
+        {
+            options.repetition_count = atoi(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--no-escape-analysis"))
+        {
+            options.no_escape_analysis = 1;
+        }
+        else if(!strcmp(arguments[i], "--optimize"))
+        {
+            options.optimize = 1;
+        }
+        else if(!strcmp(arguments[i], "--hash-cons"))
+        {
+            options.hash_cons = 1;
+        }
+        else if(!strcmp(arguments[i], "--arenas"))
+        {
+            run_arena_benchmarks = 1;
+        }
+        else if(!strcmp(arguments[i], "--numbers"))
+        {
+            run_number_benchmarks = 1;
+        }
+        else if(!strcmp(arguments[i], "--counters"))
+        {
+            use_counters = 1;
+        }
+        else
+        {
+            PrintUsage(arguments[0]);
+            return 1;
+        }
+    }
+    
+    if(options.repetition_count < 1 || options.warmup_count < 0 || options.scale <= 0)
+    {
+        PrintUsage(arguments[0]);
+        return 1;
+    }
+    
+    if(run_arena_benchmarks)
+    {
+        RunArenaBenchmarks();
+        return 0;
+    }
+    
+    if(run_number_benchmarks)
+    {
+        return RunNumberFormatBenchmarks() ? 0 : 1;
+    }
+    
+    if(use_counters && !PerfCountersOpen(&options.counters))
+    {
+        fprintf(stderr, "Performance counters are not available (see /proc/sys/kernel/perf_event_paranoid), "
+                "continuing without them.\n");
+    }
+    
+    int workload_count = sizeof(benchmark_workloads)/sizeof(benchmark_workloads[0]);
+    BenchmarkResult *results = calloc(workload_count, sizeof(BenchmarkResult));
+    int result_count = 0;
+    int success = 1;
+    
+    for(int i = 0; i < workload_count; ++i)
+    {
+        if(!options.workload || !strcmp(options.workload, benchmark_workloads[i].name))
+        {
+            if(RunWorkloadBenchmark(benchmark_workloads + i, &options, results + result_count))
+            {
+                ++result_count;
+            }
+            else
+            {
+                success = 0;
+            }
+        }
+    }
+    
+    if(options.workload && !result_count && success)
+    {
+        fprintf(stderr, "Unknown workload \"%s\".\n", options.workload);
+        return 1;
+    }
+    
+    if(options.json)
+    {
+        PrintBenchmarkResultsJSON(results, result_count, &options);
+    }
+    else
+    {
+        PrintBenchmarkResultsTable(results, result_count, &options);
+    }
+    
+    PerfCountersClose(&options.counters);
+    free(results);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,1416 @@
+// NOTE(rjf): An ahead-of-time compiler from lettuce to C. A parsed program is
+//            turned into a standalone C translation unit, which --compile hands
+//            to the system's C compiler to build a shared object, loads with
+//            dlopen, and calls in place of EvaluateAbstractSyntaxTree.
+//
+//            - Every function literal becomes a C function taking the closure
+//              and the argument, and a closure is a pointer to that function
+//              followed by the values it captured when it was made, rather
+//              than a copy of the whole environment. Which values those are is
+//              found by a free variable analysis before anything is emitted:
+//              a function captures every name its body uses but doesn't bind
+//              itself, including the ones the functions inside of it capture.
+//            - Lets become C locals, and a let chain is emitted as one flat
+//              list of statements, however long it is. A let rec group's
+//              closures are all allocated before any of their captures are
+//              filled in, so they can capture each other and themselves.
+//            - Calls to a function bound by a let in the same function call
+//              its C function directly, instead of going through the closure.
+//
+//            Values have the same representation as in the interpreter, and
+//            operators and ifs do exactly what EvaluateBinaryOperator and the
+//            evaluator do. Names are resolved lexically, though, so the one
+//            place the results can differ is a let that shadows a name that's
+//            used again after the let is over, which the interpreter's flat
+//            environments report as not declared. Arrays and the builtins that
+//            work on them aren't supported, and programs using them are
+//            rejected before anything is written.
+//
+//            Compiled programs recurse on the C stack, so the depth limit counts
+//            calls rather than frames, and they also stop once they've used
+//            EMIT_C_MAX_STACK_BYTES of stack. Closures are allocated in chunks
+//            on the arena that's passed in, all of which are freed once the
+//            program is done. Fuel isn't counted, since there are no nodes to
+//            count; memory and deadline limits work as they do in the
+//            interpreter.
+
+#define EMIT_C_MAX_DEPTH 4096
+#define EMIT_C_MAX_STACK_BYTES (4*1024*1024)
+#define EMIT_C_CHUNK_SIZE (64*1024)
+#define EMIT_C_CHECK_INTERVAL 1024
+
+// NOTE(rjf): Why a compiled evaluation stopped, other than the limits, which
+//            are reported as EVALUATION_LIMITs.
+enum
+{
+    EMIT_C_ABORT_stack = EVALUATION_LIMIT_COUNT,
+    EMIT_C_ABORT_host,
+};
+
+// NOTE(rjf): A function literal in the program. Hash-consed trees can share
+//            one between several places, but what it captures only depends on
+//            its body, so it's still compiled once.
+typedef struct EmitCFunction
+{
+    AbstractSyntaxTreeNode *definition;
+    unsigned int index;
+    
+    // NOTE(rjf): Names the body uses that it doesn't bind, in the order they're
+    //            stored in the closure.
+    OptimizerName *captures;
+    unsigned int capture_count;
+    unsigned int capture_cap;
+}
+EmitCFunction;
+
+// NOTE(rjf): A name bound by a let in the function being emitted, or by the
+//            analysis while walking a body. known_function is set when the let
+//            binds a function literal, so calls to it can be made directly.
+typedef struct EmitCBinding
+{
+    char *string;
+    int string_length;
+    unsigned int local;
+    EmitCFunction *known_function;
+}
+EmitCBinding;
+
+typedef struct EmitC
+{
+    OutputBuffer *output;
+    char *error;
+    char error_buffer[256];
+    unsigned int depth;
+    
+    EmitCFunction **functions;
+    unsigned int function_count;
+    unsigned int function_cap;
+    
+    // NOTE(rjf): Open addressing, from function literal nodes to indices into
+    //            functions, plus one, so 0 is an empty slot.
+    unsigned int *function_table;
+    unsigned int function_table_cap;
+    
+    EmitCBinding *bindings;
+    unsigned int binding_count;
+    unsigned int binding_cap;
+    
+    // NOTE(rjf): The function being emitted, which is 0 for the program itself,
+    //            and how many locals it has used so far. v0 is the result.
+    EmitCFunction *function;
+    unsigned int local_count;
+    int indent;
+}
+EmitC;
+
+static void
+EmitCFail(EmitC *emitter, char *format, ...)
+{
+    if(!emitter->error)
+    {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(emitter->error_buffer, sizeof(emitter->error_buffer), format, args);
+        va_end(args);
+        emitter->error = emitter->error_buffer;
+    }
+}
+
+static int
+EmitCEnter(EmitC *emitter)
+{
+    int entered = 0;
+    if(emitter->error)
+    {
+    }
+    else if(emitter->depth < EMIT_C_MAX_DEPTH)
+    {
+        ++emitter->depth;
+        entered = 1;
+    }
+    else
+    {
+        EmitCFail(emitter, "Expression is nested too deeply to compile.");
+    }
+    return entered;
+}
+
+static void
+EmitCPushBinding(EmitC *emitter, char *string, int string_length, unsigned int local,
+                 EmitCFunction *known_function)
+{
+    if(emitter->binding_count >= emitter->binding_cap)
+    {
+        emitter->binding_cap = emitter->binding_cap ? emitter->binding_cap * 2 : 256;
+        emitter->bindings = realloc(emitter->bindings, sizeof(emitter->bindings[0]) * emitter->binding_cap);
+    }
+    EmitCBinding *binding = emitter->bindings + emitter->binding_count++;
+    binding->string = string;
+    binding->string_length = string_length;
+    binding->local = local;
+    binding->known_function = known_function;
+}
+
+// NOTE(rjf): Only the bindings from base up belong to the function that's
+//            being looked at.
+static EmitCBinding *
+EmitCLookUpBinding(EmitC *emitter, unsigned int base, char *string, int string_length)
+{
+    EmitCBinding *result = 0;
+    for(unsigned int i = emitter->binding_count; i > base; --i)
+    {
+        EmitCBinding *binding = emitter->bindings + i - 1;
+        if(StringMatch(binding->string, binding->string_length, string, string_length))
+        {
+            result = binding;
+            break;
+        }
+    }
+    return result;
+}
+
+static int
+EmitCFindCapture(EmitCFunction *function, char *string, int string_length)
+{
+    int result = -1;
+    for(unsigned int i = 0; i < function->capture_count; ++i)
+    {
+        if(StringMatch(function->captures[i].string, function->captures[i].string_length, string, string_length))
+        {
+            result = (int)i;
+            break;
+        }
+    }
+    return result;
+}
+
+// NOTE(rjf): With no function, the name is free in the whole program, and it
+//            can only be a builtin or an error.
+static void
+EmitCAddCapture(EmitC *emitter, EmitCFunction *function, char *string, int string_length)
+{
+    if(!function)
+    {
+        EvaluationResult builtin;
+        if(BuiltinLookUp(string, string_length, &builtin))
+        {
+            EmitCFail(emitter, "%.*s can't be used in compiled programs.", string_length, string);
+        }
+    }
+    else if(EmitCFindCapture(function, string, string_length) < 0)
+    {
+        if(function->capture_count >= function->capture_cap)
+        {
+            function->capture_cap = function->capture_cap ? function->capture_cap * 2 : 8;
+            function->captures = realloc(function->captures, sizeof(function->captures[0]) * function->capture_cap);
+        }
+        function->captures[function->capture_count].string = string;
+        function->captures[function->capture_count].string_length = string_length;
+        ++function->capture_count;
+    }
+}
+
+static unsigned int
+EmitCHashPointer(void *pointer)
+{
+    unsigned long long value = (unsigned long long)pointer;
+    value ^= value >> 29;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 32;
+    return (unsigned int)value;
+}
+
+static EmitCFunction *
+EmitCLookUpFunction(EmitC *emitter, AbstractSyntaxTreeNode *definition)
+{
+    EmitCFunction *result = 0;
+    if(emitter->function_table_cap)
+    {
+        unsigned int mask = emitter->function_table_cap - 1;
+        for(unsigned int slot = EmitCHashPointer(definition) & mask;
+            emitter->function_table[slot];
+            slot = (slot + 1) & mask)
+        {
+            EmitCFunction *function = emitter->functions[emitter->function_table[slot] - 1];
+            if(function->definition == definition)
+            {
+                result = function;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static void
+EmitCInsertFunction(EmitC *emitter, EmitCFunction *function)
+{
+    if(emitter->function_count >= emitter->function_cap)
+    {
+        emitter->function_cap = emitter->function_cap ? emitter->function_cap * 2 : 64;
+        emitter->functions = realloc(emitter->functions, sizeof(emitter->functions[0]) * emitter->function_cap);
+    }
+    function->index = emitter->function_count;
+    emitter->functions[emitter->function_count++] = function;
+    
+    // NOTE(rjf): The table is kept at most half full.
+    if(emitter->function_count * 2 > emitter->function_table_cap)
+    {
+        free(emitter->function_table);
+        emitter->function_table_cap = emitter->function_table_cap ? emitter->function_table_cap * 2 : 128;
+        emitter->function_table = calloc(emitter->function_table_cap, sizeof(emitter->function_table[0]));
+        unsigned int mask = emitter->function_table_cap - 1;
+        for(unsigned int i = 0; i < emitter->function_count; ++i)
+        {
+            unsigned int slot = EmitCHashPointer(emitter->functions[i]->definition) & mask;
+            while(emitter->function_table[slot])
+            {
+                slot = (slot + 1) & mask;
+            }
+            emitter->function_table[slot] = i + 1;
+        }
+    }
+    else
+    {
+        unsigned int mask = emitter->function_table_cap - 1;
+        unsigned int slot = EmitCHashPointer(function->definition) & mask;
+        while(emitter->function_table[slot])
+        {
+            slot = (slot + 1) & mask;
+        }
+        emitter->function_table[slot] = function->index + 1;
+    }
+}
+
+static EmitCFunction *EmitCAnalyzeFunction(EmitC *emitter, AbstractSyntaxTreeNode *definition);
+
+// NOTE(rjf): The free variable analysis. Walks node, in a function whose own
+//            bindings start at base, and adds every name that isn't bound there
+//            to the function's captures.
+static void
+EmitCAnalyze(EmitC *emitter, EmitCFunction *function, unsigned int base, AbstractSyntaxTreeNode *node)
+{
+    if(EmitCEnter(emitter))
+    {
+        unsigned int binding_count = emitter->binding_count;
+        
+        // NOTE(rjf): Let bodies are walked in this loop rather than recursively,
+        //            so let chains can be as long as the program.
+        while(node && !emitter->error)
+        {
+            AbstractSyntaxTreeNode *next = 0;
+            switch(node->type)
+            {
+                case ABSTRACT_SYNTAX_TREE_NODE_let:
+                {
+                    // NOTE(rjf): A let rec group's names are bound before its
+                    //            bindings are walked, since they can use them.
+                    unsigned int recursive_count = LetRecursiveCount(node);
+                    for(unsigned int i = 0; i < recursive_count; ++i)
+                    {
+                        AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+                        EmitCPushBinding(emitter, let->let.string, let->let.string_length, 0, 0);
+                    }
+                    for(unsigned int i = 0; i < recursive_count; ++i)
+                    {
+                        EmitCAnalyze(emitter, function, base, LetRecursiveNested(node, i)->let.binding_expression);
+                    }
+                    if(recursive_count)
+                    {
+                        next = LetRecursiveNested(node, recursive_count - 1)->let.body_expression;
+                        break;
+                    }
+                    
+                    EmitCAnalyze(emitter, function, base, node->let.binding_expression);
+                    EmitCPushBinding(emitter, node->let.string, node->let.string_length, 0, 0);
+                    next = node->let.body_expression;
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                {
+                    if(!EmitCLookUpBinding(emitter, base, node->identifier.string, node->identifier.string_length))
+                    {
+                        EmitCAddCapture(emitter, function, node->identifier.string, node->identifier.string_length);
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                {
+                    EmitCAnalyze(emitter, function, base, node->binary_operator.left);
+                    EmitCAnalyze(emitter, function, base, node->binary_operator.right);
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+                {
+                    EmitCAnalyze(emitter, function, base, node->unary_operator.expression);
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                {
+                    EmitCAnalyze(emitter, function, base, node->if_then_else.condition);
+                    EmitCAnalyze(emitter, function, base, node->if_then_else.pass_code);
+                    EmitCAnalyze(emitter, function, base, node->if_then_else.fail_code);
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                {
+                    // NOTE(rjf): Whatever the inner function captures has to be
+                    //            there when it's made, so it's used here.
+                    EmitCFunction *inner = EmitCAnalyzeFunction(emitter, node);
+                    for(unsigned int i = 0; inner && i < inner->capture_count; ++i)
+                    {
+                        if(!EmitCLookUpBinding(emitter, base, inner->captures[i].string, inner->captures[i].string_length))
+                        {
+                            EmitCAddCapture(emitter, function, inner->captures[i].string, inner->captures[i].string_length);
+                        }
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                {
+                    EmitCAnalyze(emitter, function, base, node->function_call.closure);
+                    EmitCAnalyze(emitter, function, base, node->function_call.parameter);
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                case ABSTRACT_SYNTAX_TREE_NODE_index:
+                case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+                {
+                    EmitCFail(emitter, "Arrays and operators used as functions can't be used in compiled programs.");
+                    break;
+                }
+                default: break;
+            }
+            node = next;
+        }
+        
+        emitter->binding_count = binding_count;
+        --emitter->depth;
+    }
+}
+
+static EmitCFunction *
+EmitCAnalyzeFunction(EmitC *emitter, AbstractSyntaxTreeNode *definition)
+{
+    EmitCFunction *function = EmitCLookUpFunction(emitter, definition);
+    if(!function)
+    {
+        function = calloc(1, sizeof(*function));
+        function->definition = definition;
+        EmitCInsertFunction(emitter, function);
+        
+        unsigned int base = emitter->binding_count;
+        EmitCPushBinding(emitter, definition->function_definition.param_name,
+                         definition->function_definition.param_name_length, 0, 0);
+        EmitCAnalyze(emitter, function, base, definition->function_definition.body);
+        emitter->binding_count = base;
+    }
+    return function;
+}
+
+static void
+EmitCLine(EmitC *emitter, char *format, ...)
+{
+    OutputWriteSpaces(emitter->output, emitter->indent * 4);
+    
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if(length >= (int)sizeof(line))
+    {
+        length = sizeof(line) - 1;
+    }
+    
+    if(length > 0)
+    {
+        OutputWrite(emitter->output, line, (unsigned int)length);
+    }
+    OutputWriteCharacter(emitter->output, '\n');
+}
+
+static unsigned int
+EmitCDeclareLocal(EmitC *emitter)
+{
+    unsigned int local = emitter->local_count++;
+    EmitCLine(emitter, "LettuceValue v%u;", local);
+    return local;
+}
+
+// NOTE(rjf): Names only ever contain letters, digits, underscores and #, so
+//            they can go in string literals as they are.
+static void
+EmitCUndeclared(EmitC *emitter, char *destination, char *string, int string_length)
+{
+    EmitCLine(emitter, "%s = LettuceError(\"%.*s was not declared in this scope.\");",
+              destination, string_length, string);
+}
+
+// NOTE(rjf): Writes the C expression for a name's value into access, or
+//            returns 0 if it isn't declared. The function's bindings are
+//            everything on the stack, since nothing else is pushed while one is
+//            being emitted.
+static int
+EmitCAccess(EmitC *emitter, char *access, unsigned int access_size, char *string, int string_length,
+            EmitCBinding **binding_out)
+{
+    int found = 1;
+    EmitCBinding *binding = EmitCLookUpBinding(emitter, 0, string, string_length);
+    int capture = -1;
+    if(binding)
+    {
+        if(binding->local == (unsigned int)-1)
+        {
+            snprintf(access, access_size, "argument");
+        }
+        else
+        {
+            snprintf(access, access_size, "v%u", binding->local);
+        }
+    }
+    else if(emitter->function &&
+            (capture = EmitCFindCapture(emitter->function, string, string_length)) >= 0)
+    {
+        snprintf(access, access_size, "closure->captures[%d]", capture);
+    }
+    else
+    {
+        found = 0;
+    }
+    if(binding_out)
+    {
+        *binding_out = binding;
+    }
+    return found;
+}
+
+// NOTE(rjf): A closure is made in two steps, so a let rec group's closures can
+//            all be allocated before any of them captures the others.
+static void
+EmitCAllocateClosure(EmitC *emitter, EmitCFunction *function, char *destination_name)
+{
+    EmitCLine(emitter, "%s.type = LETTUCE_CLOSURE;", destination_name);
+    EmitCLine(emitter, "%s.closure = LettuceAllocateClosure(context, LettuceFunction%u, %u);",
+              destination_name, function->index, function->capture_count);
+}
+
+static void
+EmitCFillCaptures(EmitC *emitter, EmitCFunction *function, char *destination_name)
+{
+    for(unsigned int i = 0; i < function->capture_count; ++i)
+    {
+        char *string = function->captures[i].string;
+        int string_length = function->captures[i].string_length;
+        char capture_destination[64];
+        snprintf(capture_destination, sizeof(capture_destination), "%s.closure->captures[%u]",
+                 destination_name, i);
+        
+        char access[64];
+        if(EmitCAccess(emitter, access, sizeof(access), string, string_length, 0))
+        {
+            EmitCLine(emitter, "%s = %s;", capture_destination, access);
+        }
+        else
+        {
+            EmitCUndeclared(emitter, capture_destination, string, string_length);
+        }
+    }
+}
+
+static void
+EmitCExpression(EmitC *emitter, AbstractSyntaxTreeNode *node, unsigned int destination)
+{
+    if(EmitCEnter(emitter))
+    {
+        unsigned int binding_count = emitter->binding_count;
+        char destination_name[32];
+        snprintf(destination_name, sizeof(destination_name), "v%u", destination);
+        
+        for(;;)
+        {
+            if(!node)
+            {
+                EmitCLine(emitter, "%s = LettuceError(\"Expected an expression.\");", destination_name);
+                break;
+            }
+            
+            unsigned int recursive_count = LetRecursiveCount(node);
+            if(recursive_count)
+            {
+                // NOTE(rjf): The group's locals are consecutive, and are bound
+                //            before any of its closures are made.
+                unsigned int first_local = emitter->local_count;
+                for(unsigned int i = 0; i < recursive_count; ++i)
+                {
+                    AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+                    unsigned int local = EmitCDeclareLocal(emitter);
+                    EmitCPushBinding(emitter, let->let.string, let->let.string_length, local,
+                                     EmitCLookUpFunction(emitter, let->let.binding_expression));
+                }
+                for(unsigned int i = 0; i < recursive_count; ++i)
+                {
+                    char local_name[32];
+                    snprintf(local_name, sizeof(local_name), "v%u", first_local + i);
+                    EmitCAllocateClosure(emitter, emitter->bindings[emitter->binding_count - recursive_count + i].known_function,
+                                         local_name);
+                }
+                for(unsigned int i = 0; i < recursive_count; ++i)
+                {
+                    char local_name[32];
+                    snprintf(local_name, sizeof(local_name), "v%u", first_local + i);
+                    EmitCFillCaptures(emitter, emitter->bindings[emitter->binding_count - recursive_count + i].known_function,
+                                      local_name);
+                }
+                node = LetRecursiveNested(node, recursive_count - 1)->let.body_expression;
+                continue;
+            }
+            
+            if(node->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+            {
+                AbstractSyntaxTreeNode *binding = node->let.binding_expression;
+                unsigned int local = EmitCDeclareLocal(emitter);
+                EmitCExpression(emitter, binding, local);
+                EmitCFunction *known_function = 0;
+                if(binding && binding->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+                {
+                    known_function = EmitCLookUpFunction(emitter, binding);
+                }
+                EmitCPushBinding(emitter, node->let.string, node->let.string_length, local, known_function);
+                node = node->let.body_expression;
+                continue;
+            }
+            
+            switch(node->type)
+            {
+                case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                {
+                    char access[64];
+                    if(EmitCAccess(emitter, access, sizeof(access), node->identifier.string,
+                                   node->identifier.string_length, 0))
+                    {
+                        EmitCLine(emitter, "%s = %s;", destination_name, access);
+                    }
+                    else
+                    {
+                        EmitCUndeclared(emitter, destination_name, node->identifier.string,
+                                        node->identifier.string_length);
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+                {
+                    double value = node->numeric_constant.value;
+                    EmitCLine(emitter, "%s.type = LETTUCE_NUMBER;", destination_name);
+                    if(value != value)
+                    {
+                        EmitCLine(emitter, "%s.number = __builtin_nan(\"\");", destination_name);
+                    }
+                    else if(value - value != 0)
+                    {
+                        EmitCLine(emitter, "%s.number = %s__builtin_inf();", destination_name, value < 0 ? "-" : "");
+                    }
+                    else
+                    {
+                        char number[NUMBER_FORMAT_MAX_LENGTH];
+                        int number_length = NumberFormat(number, value, NUMBER_FORMAT_STYLE_general);
+                        EmitCLine(emitter, "%s.number = %.*s;", destination_name, number_length, number);
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+                {
+                    EmitCLine(emitter, "%s.type = LETTUCE_BOOLEAN;", destination_name);
+                    EmitCLine(emitter, "%s.boolean = %d;", destination_name, node->boolean_constant.value);
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                {
+                    static char *operators[] = {
+                        0,
+#define BinaryOperator(name, str) str,
+                        BINARY_OPERATOR_LIST
+#undef BinaryOperator
+                    };
+                    int type = node->binary_operator.type;
+                    int boolean_operands = (type == BINARY_OPERATOR_and || type == BINARY_OPERATOR_or);
+                    int boolean_result = !(type == BINARY_OPERATOR_plus || type == BINARY_OPERATOR_minus ||
+                                           type == BINARY_OPERATOR_multiply || type == BINARY_OPERATOR_divide);
+                    
+                    // NOTE(rjf): Both sides are always evaluated, like in the
+                    //            interpreter, so && and || don't short-circuit.
+                    unsigned int left = EmitCDeclareLocal(emitter);
+                    EmitCExpression(emitter, node->binary_operator.left, left);
+                    unsigned int right = EmitCDeclareLocal(emitter);
+                    EmitCExpression(emitter, node->binary_operator.right, right);
+                    
+                    if(type > BINARY_OPERATOR_invalid && type < (int)(sizeof(operators) / sizeof(operators[0])))
+                    {
+                        char *field = boolean_operands ? "boolean" : "number";
+                        EmitCLine(emitter, "%s.type = %s;", destination_name, boolean_result ? "LETTUCE_BOOLEAN" : "LETTUCE_NUMBER");
+                        EmitCLine(emitter, "%s.%s = v%u.%s %s v%u.%s;", destination_name, boolean_result ? "boolean" : "number",
+                                  left, field, operators[type], right, field);
+                    }
+                    else
+                    {
+                        EmitCLine(emitter, "%s = (LettuceValue){0};", destination_name);
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                {
+                    unsigned int condition = EmitCDeclareLocal(emitter);
+                    EmitCExpression(emitter, node->if_then_else.condition, condition);
+                    EmitCLine(emitter, "if(v%u.boolean)", condition);
+                    AbstractSyntaxTreeNode *branches[2] = { node->if_then_else.pass_code, node->if_then_else.fail_code };
+                    for(int i = 0; i < 2; ++i)
+                    {
+                        if(i)
+                        {
+                            EmitCLine(emitter, "else");
+                        }
+                        EmitCLine(emitter, "{");
+                        ++emitter->indent;
+                        if(branches[i])
+                        {
+                            EmitCExpression(emitter, branches[i], destination);
+                        }
+                        else
+                        {
+                            EmitCLine(emitter, "%s = (LettuceValue){0};", destination_name);
+                        }
+                        --emitter->indent;
+                        EmitCLine(emitter, "}");
+                    }
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                {
+                    EmitCFunction *function = EmitCLookUpFunction(emitter, node);
+                    EmitCAllocateClosure(emitter, function, destination_name);
+                    EmitCFillCaptures(emitter, function, destination_name);
+                    break;
+                }
+                case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                {
+                    AbstractSyntaxTreeNode *callee = node->function_call.closure;
+                    EmitCFunction *known_function = 0;
+                    EmitCBinding *binding = 0;
+                    char access[64];
+                    unsigned int closure = 0;
+                    
+                    if(callee && callee->type == ABSTRACT_SYNTAX_TREE_NODE_identifier &&
+                       EmitCAccess(emitter, access, sizeof(access), callee->identifier.string,
+                                   callee->identifier.string_length, &binding) &&
+                       binding && binding->known_function)
+                    {
+                        known_function = binding->known_function;
+                    }
+                    else
+                    {
+                        closure = EmitCDeclareLocal(emitter);
+                        EmitCExpression(emitter, callee, closure);
+                        if(callee && callee->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+                        {
+                            known_function = EmitCLookUpFunction(emitter, callee);
+                        }
+                        snprintf(access, sizeof(access), "v%u", closure);
+                    }
+                    
+                    // NOTE(rjf): Like in the interpreter, the argument is only
+                    //            evaluated once the function turns out to be one.
+                    if(known_function)
+                    {
+                        unsigned int argument = EmitCDeclareLocal(emitter);
+                        EmitCExpression(emitter, node->function_call.parameter, argument);
+                        EmitCLine(emitter, "%s = LettuceFunction%u(context, %s.closure, v%u);",
+                                  destination_name, known_function->index, access, argument);
+                    }
+                    else
+                    {
+                        EmitCLine(emitter, "if(v%u.type == LETTUCE_CLOSURE)", closure);
+                        EmitCLine(emitter, "{");
+                        ++emitter->indent;
+                        unsigned int argument = EmitCDeclareLocal(emitter);
+                        EmitCExpression(emitter, node->function_call.parameter, argument);
+                        EmitCLine(emitter, "%s = v%u.closure->function(context, v%u.closure, v%u);",
+                                  destination_name, closure, closure, argument);
+                        --emitter->indent;
+                        EmitCLine(emitter, "}");
+                        EmitCLine(emitter, "else if(v%u.type == LETTUCE_ERROR)", closure);
+                        EmitCLine(emitter, "{");
+                        EmitCLine(emitter, "    %s = v%u;", destination_name, closure);
+                        EmitCLine(emitter, "}");
+                        EmitCLine(emitter, "else");
+                        EmitCLine(emitter, "{");
+                        EmitCLine(emitter, "    %s = LettuceError(\"Called a value that is not a function.\");", destination_name);
+                        EmitCLine(emitter, "}");
+                    }
+                    break;
+                }
+                default:
+                {
+                    EmitCLine(emitter, "%s = (LettuceValue){0};", destination_name);
+                    break;
+                }
+            }
+            break;
+        }
+        
+        emitter->binding_count = binding_count;
+        --emitter->depth;
+    }
+}
+
+// NOTE(rjf): Everything the generated code needs that doesn't depend on the
+//            program. LettuceValue and LettuceHost have to stay the same as
+//            CompiledValue and CompiledProgramHost below.
+// NOTE(rjf): Everything the generated code needs that doesn't depend on the
+//            program. LettuceValue, LettuceHost, and the start of LettuceContext
+//            have to stay the same as CompiledValue, CompiledHost and
+//            CompiledContext below.
+//
+//            The host can hand in closures of its own, whose function is a host
+//            function with the same signature as LettuceFunction, which gets
+//            the context and can stop the whole evaluation through stop.
+static char *emit_c_runtime =
+"#include <setjmp.h>\n"
+"\n"
+"typedef struct LettuceClosure LettuceClosure;\n"
+"typedef struct LettuceContext LettuceContext;\n"
+"\n"
+"typedef struct LettuceValue\n"
+"{\n"
+"    int type;\n"
+"    union\n"
+"    {\n"
+"        struct\n"
+"        {\n"
+"            char *error_string;\n"
+"            int limit;\n"
+"        }\n"
+"        error;\n"
+"        double number;\n"
+"        int boolean;\n"
+"        LettuceClosure *closure;\n"
+"        void *host;\n"
+"    };\n"
+"}\n"
+"LettuceValue;\n"
+"\n"
+"typedef LettuceValue LettuceFunction(LettuceContext *context, LettuceClosure *closure, LettuceValue argument);\n"
+"\n"
+"struct LettuceClosure\n"
+"{\n"
+"    LettuceFunction *function;\n"
+"    LettuceValue captures[];\n"
+"};\n"
+"\n"
+"typedef struct LettuceHost\n"
+"{\n"
+"    void *(*allocate)(void *user, unsigned long long size);\n"
+"    int (*check)(void *user);\n"
+"    void *user;\n"
+"    unsigned long long max_depth;\n"
+"    unsigned long long max_stack_bytes;\n"
+"    unsigned long long chunk_size;\n"
+"    char *stack_base;\n"
+"}\n"
+"LettuceHost;\n"
+"\n"
+"struct LettuceContext\n"
+"{\n"
+"    LettuceHost *host;\n"
+"    void (*stop)(LettuceContext *context, int abort);\n"
+"    char *at;\n"
+"    char *end;\n"
+"    char *stack_base;\n"
+"    unsigned long long depth;\n"
+"    unsigned int countdown;\n"
+"    jmp_buf abort;\n"
+"};\n"
+"\n"
+"static LettuceValue\n"
+"LettuceError(char *error_string)\n"
+"{\n"
+"    LettuceValue value = {0};\n"
+"    value.type = LETTUCE_ERROR;\n"
+"    value.error.error_string = error_string;\n"
+"    return value;\n"
+"}\n"
+"\n"
+"static void\n"
+"LettuceEnter(LettuceContext *context)\n"
+"{\n"
+"    char marker;\n"
+"    unsigned long long stack_bytes = (context->stack_base > &marker ? context->stack_base - &marker :\n"
+"                                      &marker - context->stack_base);\n"
+"    if(++context->depth > context->host->max_depth)\n"
+"    {\n"
+"        longjmp(context->abort, LETTUCE_LIMIT_DEPTH);\n"
+"    }\n"
+"    if(stack_bytes > context->host->max_stack_bytes)\n"
+"    {\n"
+"        longjmp(context->abort, LETTUCE_ABORT_STACK);\n"
+"    }\n"
+"    if(!--context->countdown)\n"
+"    {\n"
+"        context->countdown = LETTUCE_CHECK_INTERVAL;\n"
+"        int limit = context->host->check(context->host->user);\n"
+"        if(limit)\n"
+"        {\n"
+"            longjmp(context->abort, limit);\n"
+"        }\n"
+"    }\n"
+"}\n"
+"\n"
+"static LettuceClosure *\n"
+"LettuceAllocateClosure(LettuceContext *context, LettuceFunction *function, unsigned int capture_count)\n"
+"{\n"
+"    unsigned long long size = sizeof(LettuceClosure) + capture_count*sizeof(LettuceValue);\n"
+"    if((unsigned long long)(context->end - context->at) < size)\n"
+"    {\n"
+"        unsigned long long chunk_size = size > context->host->chunk_size ? size : context->host->chunk_size;\n"
+"        context->at = context->host->allocate(context->host->user, chunk_size);\n"
+"        if(!context->at)\n"
+"        {\n"
+"            longjmp(context->abort, LETTUCE_LIMIT_MEMORY);\n"
+"        }\n"
+"        context->end = context->at + chunk_size;\n"
+"    }\n"
+"    LettuceClosure *closure = (LettuceClosure *)context->at;\n"
+"    context->at += size;\n"
+"    closure->function = function;\n"
+"    return closure;\n"
+"}\n"
+"\n"
+"static void\n"
+"LettuceStop(LettuceContext *context, int abort)\n"
+"{\n"
+"    longjmp(context->abort, abort);\n"
+"}\n"
+"\n"
+"static void\n"
+"LettuceContextInit(LettuceContext *context, LettuceHost *host, char *stack_base)\n"
+"{\n"
+"    context->host = host;\n"
+"    context->stop = LettuceStop;\n"
+"    context->at = context->end = 0;\n"
+"    context->stack_base = host->stack_base ? host->stack_base : stack_base;\n"
+"    context->depth = 0;\n"
+"    context->countdown = LETTUCE_CHECK_INTERVAL;\n"
+"}\n"
+"\n"
+"// NOTE(rjf): When the evaluation is stopped, the result is an error with no\n"
+"//            string, and error.limit saying why.\n"
+"static LettuceValue\n"
+"LettuceAborted(int abort)\n"
+"{\n"
+"    LettuceValue result = LettuceError(0);\n"
+"    result.error.limit = abort;\n"
+"    return result;\n"
+"}\n"
+"\n";
+
+static void
+EmitCFunctionBody(EmitC *emitter, EmitCFunction *function, AbstractSyntaxTreeNode *root)
+{
+    emitter->function = function;
+    emitter->local_count = 1;
+    emitter->binding_count = 0;
+    emitter->indent = 1;
+    
+    OutputWriteCString(emitter->output, "static LettuceValue\n");
+    if(function)
+    {
+        AbstractSyntaxTreeNode *definition = function->definition;
+        OutputWriteF(emitter->output, "LettuceFunction%u(LettuceContext *context, LettuceClosure *closure, LettuceValue argument)\n{\n",
+                     function->index);
+        EmitCLine(emitter, "LettuceEnter(context);");
+        if(!function->capture_count)
+        {
+            EmitCLine(emitter, "(void)closure;");
+        }
+        EmitCLine(emitter, "LettuceValue v0;");
+        EmitCPushBinding(emitter, definition->function_definition.param_name,
+                         definition->function_definition.param_name_length, (unsigned int)-1, 0);
+        EmitCExpression(emitter, definition->function_definition.body, 0);
+        EmitCLine(emitter, "--context->depth;");
+    }
+    else
+    {
+        OutputWriteCString(emitter->output, "LettuceProgram(LettuceContext *context)\n{\n");
+        EmitCLine(emitter, "LettuceValue v0;");
+        EmitCExpression(emitter, root, 0);
+    }
+    EmitCLine(emitter, "return v0;");
+    OutputWriteCString(emitter->output, "}\n\n");
+}
+
+static void
+EmitCFreeFunctions(EmitCFunction **functions, unsigned int function_count)
+{
+    for(unsigned int i = 0; i < function_count; ++i)
+    {
+        free(functions[i]->captures);
+        free(functions[i]);
+    }
+    free(functions);
+}
+
+// NOTE(rjf): Writes a C translation unit to output, and returns 0, or returns
+//            why it can't be compiled, in which case nothing has been written.
+//
+//            Without a definition, the unit is for the whole program at root,
+//            and LettuceEvaluate evaluates it. With one, that function literal
+//            is compiled on its own, along with the ones inside it, into a
+//            unit that exports them as LettuceFunctions, with the first being
+//            definition, and LettuceCallClosure, which calls a closure. What
+//            each of them was compiled from, and the names their closures'
+//            captures are the values of, is stored in functions_out, to be
+//            freed by the caller with EmitCFreeFunctions.
+static char *
+EmitCUnit(AbstractSyntaxTreeNode *root, AbstractSyntaxTreeNode *definition, OutputBuffer *output,
+          char *error_buffer, unsigned int error_buffer_size,
+          EmitCFunction ***functions_out, unsigned int *function_count_out)
+{
+    EmitC emitter = {0};
+    emitter.output = output;
+    
+    if(definition)
+    {
+        EmitCAnalyzeFunction(&emitter, definition);
+    }
+    else
+    {
+        EmitCAnalyze(&emitter, 0, 0, root);
+    }
+    
+    if(!emitter.error)
+    {
+        OutputWriteCString(output, "// NOTE(rjf): Generated by lettuce --emit-c.\n\n");
+        OutputWriteF(output, "#define LETTUCE_ERROR %d\n", EVALUATION_RESULT_error);
+        OutputWriteF(output, "#define LETTUCE_NUMBER %d\n", EVALUATION_RESULT_number);
+        OutputWriteF(output, "#define LETTUCE_BOOLEAN %d\n", EVALUATION_RESULT_boolean);
+        OutputWriteF(output, "#define LETTUCE_CLOSURE %d\n", EVALUATION_RESULT_closure);
+        OutputWriteF(output, "#define LETTUCE_LIMIT_DEPTH %d\n", EVALUATION_LIMIT_depth);
+        OutputWriteF(output, "#define LETTUCE_LIMIT_MEMORY %d\n", EVALUATION_LIMIT_memory);
+        OutputWriteF(output, "#define LETTUCE_ABORT_STACK %d\n", EMIT_C_ABORT_stack);
+        OutputWriteF(output, "#define LETTUCE_CHECK_INTERVAL %d\n\n", EMIT_C_CHECK_INTERVAL);
+        OutputWriteCString(output, emit_c_runtime);
+        
+        for(unsigned int i = 0; i < emitter.function_count; ++i)
+        {
+            OutputWriteF(output, "static LettuceFunction LettuceFunction%u;\n", i);
+        }
+        OutputWriteCharacter(output, '\n');
+        
+        if(!definition)
+        {
+            EmitCFunctionBody(&emitter, 0, root);
+        }
+        for(unsigned int i = 0; i < emitter.function_count; ++i)
+        {
+            EmitCFunctionBody(&emitter, emitter.functions[i], 0);
+        }
+        
+        if(definition)
+        {
+            OutputWriteCString(output, "LettuceFunction *LettuceFunctions[] =\n{\n");
+            for(unsigned int i = 0; i < emitter.function_count; ++i)
+            {
+                OutputWriteF(output, "    LettuceFunction%u,\n", i);
+            }
+            OutputWriteCString(output, "};\n\n");
+        }
+        
+        OutputWriteCString(output, "LettuceValue\n");
+        OutputWriteCString(output, (definition ?
+                                    "LettuceCallClosure(LettuceHost *host, LettuceClosure *closure, LettuceValue argument)\n" :
+                                    "LettuceEvaluate(LettuceHost *host)\n"));
+        OutputWriteCString(output,
+                           "{\n"
+                           "    LettuceValue result;\n"
+                           "    LettuceContext context;\n"
+                           "    char marker;\n"
+                           "    LettuceContextInit(&context, host, &marker);\n"
+                           "    int abort = setjmp(context.abort);\n"
+                           "    if(abort)\n"
+                           "    {\n"
+                           "        result = LettuceAborted(abort);\n"
+                           "    }\n"
+                           "    else\n"
+                           "    {\n");
+        OutputWriteCString(output, (definition ?
+                                    "        result = closure->function(&context, closure, argument);\n" :
+                                    "        result = LettuceProgram(&context);\n"));
+        OutputWriteCString(output,
+                           "    }\n"
+                           "    return result;\n"
+                           "}\n");
+        
+        if(definition && functions_out)
+        {
+            *functions_out = emitter.functions;
+            *function_count_out = emitter.function_count;
+            emitter.functions = 0;
+            emitter.function_count = 0;
+        }
+    }
+    
+    char *error = 0;
+    if(emitter.error)
+    {
+        snprintf(error_buffer, error_buffer_size, "%s", emitter.error);
+        error = error_buffer;
+    }
+    
+    EmitCFreeFunctions(emitter.functions, emitter.function_count);
+    free(emitter.function_table);
+    free(emitter.bindings);
+    
+    return error;
+}
+
+#if LETTUCE_POSIX
+
+// NOTE(rjf): The same as LettuceValue, LettuceClosure and LettuceHost in the
+//            generated code.
+typedef struct CompiledValue
+{
+    int type;
+    union
+    {
+        struct
+        {
+            char *error_string;
+            int limit;
+        }
+        error;
+        double number;
+        int boolean;
+        struct CompiledClosure *closure;
+        void *host;
+    };
+}
+CompiledValue;
+
+typedef struct CompiledClosure
+{
+    void *function;
+    CompiledValue captures[];
+}
+CompiledClosure;
+
+typedef struct CompiledHost
+{
+    void *(*allocate)(void *user, unsigned long long size);
+    int (*check)(void *user);
+    void *user;
+    unsigned long long max_depth;
+    unsigned long long max_stack_bytes;
+    unsigned long long chunk_size;
+    char *stack_base;
+}
+CompiledHost;
+
+typedef struct CompiledContext
+{
+    CompiledHost *host;
+    void (*stop)(struct CompiledContext *context, int abort);
+}
+CompiledContext;
+
+typedef CompiledValue CompiledProgramEntry(CompiledHost *host);
+
+typedef struct CompiledProgram
+{
+    void *library;
+    CompiledProgramEntry *evaluate;
+    char *error;
+    char error_buffer[512];
+}
+CompiledProgram;
+
+// NOTE(rjf): Writes the C for the program at root to path, or for definition
+//            on its own (see EmitCUnit). Returns 0, or why it couldn't, in
+//            error_buffer.
+static char *
+EmitCUnitFile(AbstractSyntaxTreeNode *root, AbstractSyntaxTreeNode *definition, char *path,
+              char *error_buffer, unsigned int error_buffer_size,
+              EmitCFunction ***functions_out, unsigned int *function_count_out)
+{
+    char *error = 0;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        snprintf(error_buffer, error_buffer_size, "\"%s\" could not be opened for writing.", path);
+        error = error_buffer;
+    }
+    else
+    {
+        OutputBuffer *output = malloc(sizeof(*output));
+        OutputBufferInit(output, fd);
+        error = EmitCUnit(root, definition, output, error_buffer, error_buffer_size, functions_out, function_count_out);
+        if(!OutputFlush(output) && !error)
+        {
+            snprintf(error_buffer, error_buffer_size, "\"%s\" could not be written.", path);
+            error = error_buffer;
+        }
+        free(output);
+        close(fd);
+        if(error)
+        {
+            unlink(path);
+        }
+    }
+    return error;
+}
+
+static char *
+EmitCFile(AbstractSyntaxTreeNode *root, char *path, char *error_buffer, unsigned int error_buffer_size)
+{
+    return EmitCUnitFile(root, 0, path, error_buffer, error_buffer_size, 0, 0);
+}
+
+extern char **environ;
+
+// NOTE(rjf): Emits a unit (see EmitCUnit) to a temporary directory, builds it
+//            with $CC (or gcc) -O2 into a shared object there, and loads it.
+//            The files are deleted again right away. Returns the library, or
+//            0 with error_out saying why. This doesn't touch anything shared,
+//            so it can run on any thread.
+static void *
+EmitCBuildLibrary(AbstractSyntaxTreeNode *root, AbstractSyntaxTreeNode *definition,
+                  char *error_buffer, unsigned int error_buffer_size, char **error_out,
+                  EmitCFunction ***functions_out, unsigned int *function_count_out)
+{
+    void *library = 0;
+    char *error = 0;
+    
+    char *temporary_directory = getenv("TMPDIR");
+    if(!temporary_directory || !temporary_directory[0])
+    {
+        temporary_directory = "/tmp";
+    }
+    char directory[256];
+    snprintf(directory, sizeof(directory), "%s/lettuce-XXXXXX", temporary_directory);
+    char source_path[300];
+    char library_path[300];
+    
+    if(!mkdtemp(directory))
+    {
+        snprintf(error_buffer, error_buffer_size, "A temporary directory could not be created in \"%s\".",
+                 temporary_directory);
+        error = error_buffer;
+    }
+    else
+    {
+        snprintf(source_path, sizeof(source_path), "%s/program.c", directory);
+        snprintf(library_path, sizeof(library_path), "%s/program.so", directory);
+        error = EmitCUnitFile(root, definition, source_path, error_buffer, error_buffer_size,
+                              functions_out, function_count_out);
+        
+        if(!error)
+        {
+            char *compiler = getenv("CC");
+            if(!compiler || !compiler[0])
+            {
+                compiler = "gcc";
+            }
+            
+            // NOTE(rjf): The compiler's own messages go to our stderr.
+            char *compiler_arguments[] = { compiler, "-O2", "-shared", "-fPIC", "-o", library_path, source_path, 0 };
+            pid_t pid = 0;
+            int status = 0;
+            if(posix_spawnp(&pid, compiler, 0, 0, compiler_arguments, environ) != 0)
+            {
+                snprintf(error_buffer, error_buffer_size, "\"%s\" could not be started.", compiler);
+                error = error_buffer;
+            }
+            else
+            {
+                while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+                if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    snprintf(error_buffer, error_buffer_size, "\"%s\" could not compile the generated C.", compiler);
+                    error = error_buffer;
+                }
+            }
+        }
+        
+        if(!error)
+        {
+            library = dlopen(library_path, RTLD_NOW | RTLD_LOCAL);
+            if(!library)
+            {
+                snprintf(error_buffer, error_buffer_size, "The compiled program could not be loaded: %s", dlerror());
+                error = error_buffer;
+            }
+        }
+        
+        unlink(source_path);
+        unlink(library_path);
+        rmdir(directory);
+    }
+    
+    if(error && functions_out && *functions_out)
+    {
+        EmitCFreeFunctions(*functions_out, *function_count_out);
+        *functions_out = 0;
+        *function_count_out = 0;
+    }
+    *error_out = error;
+    return library;
+}
+
+// NOTE(rjf): Returns 0 if the program couldn't be compiled, with program->error
+//            saying why, and evaluating the program then produces that error.
+static int
+CompiledProgramBuild(CompiledProgram *program, AbstractSyntaxTreeNode *root)
+{
+    memset(program, 0, sizeof(*program));
+    program->library = EmitCBuildLibrary(root, 0, program->error_buffer, sizeof(program->error_buffer),
+                                         &program->error, 0, 0);
+    if(program->library)
+    {
+        program->evaluate = (CompiledProgramEntry *)dlsym(program->library, "LettuceEvaluate");
+        if(!program->evaluate)
+        {
+            program->error = "The compiled program has no entry point.";
+        }
+    }
+    return !program->error;
+}
+
+typedef struct CompiledProgramEvaluation
+{
+    MemoryArena *arena;
+    EvaluationLimits *limits;
+    unsigned long long start_bytes;
+    unsigned long long start_time;
+}
+CompiledProgramEvaluation;
+
+static void *
+CompiledProgramAllocate(void *user, unsigned long long size)
+{
+    CompiledProgramEvaluation *evaluation = user;
+    void *result = 0;
+    if(!evaluation->limits->max_bytes ||
+       evaluation->arena->bytes + size - evaluation->start_bytes <= evaluation->limits->max_bytes)
+    {
+        result = MemoryArenaAllocateAligned(evaluation->arena, (unsigned int)size, MEMORY_ARENA_MAX_ALIGNMENT,
+                                            MEMORY_ARENA_CATEGORY_closures);
+    }
+    return result;
+}
+
+static int
+CompiledProgramCheck(void *user)
+{
+    CompiledProgramEvaluation *evaluation = user;
+    int limit = EVALUATION_LIMIT_none;
+    if(evaluation->limits->deadline_milliseconds &&
+       GetTimeInNanoseconds() - evaluation->start_time > evaluation->limits->deadline_milliseconds * 1000000ull)
+    {
+        limit = EVALUATION_LIMIT_deadline;
+    }
+    return limit;
+}
+
+// NOTE(rjf): Evaluates the compiled program, with everything it allocates on
+//            arena, which is rewound afterwards. limits can be 0. Error
+//            messages are put on arena.
+static EvaluationResult
+CompiledProgramEvaluate(CompiledProgram *program, MemoryArena *arena, EvaluationLimits *limits)
+{
+    EvaluationResult result = {0};
+    
+    if(program->evaluate)
+    {
+        EvaluationLimits no_limits = {0};
+        CompiledProgramEvaluation evaluation = {0};
+        evaluation.arena = arena;
+        evaluation.limits = limits ? limits : &no_limits;
+        evaluation.start_bytes = arena->bytes;
+        evaluation.start_time = GetTimeInNanoseconds();
+        
+        CompiledHost host = {0};
+        host.allocate = CompiledProgramAllocate;
+        host.check = CompiledProgramCheck;
+        host.user = &evaluation;
+        host.max_depth = evaluation.limits->max_depth ? evaluation.limits->max_depth : EVALUATION_STACK_DEFAULT_MAX_DEPTH;
+        host.max_stack_bytes = EMIT_C_MAX_STACK_BYTES;
+        host.chunk_size = EMIT_C_CHUNK_SIZE;
+        
+        MemoryArenaMarker marker = MemoryArenaSave(arena);
+        CompiledValue value = program->evaluate(&host);
+        MemoryArenaRestore(arena, marker);
+        
+        result.type = value.type;
+        if(value.type == EVALUATION_RESULT_number)
+        {
+            result.number = value.number;
+        }
+        else if(value.type == EVALUATION_RESULT_boolean)
+        {
+            result.boolean = value.boolean;
+        }
+        else if(value.type == EVALUATION_RESULT_closure)
+        {
+            result = EvaluationErrorResult("Compiled programs can't evaluate to a function.");
+        }
+        else if(value.error.limit && !value.error.error_string)
+        {
+            int limit = value.error.limit;
+            result.error.limit = limit;
+            if(limit == EMIT_C_ABORT_stack)
+            {
+                result.error.limit = EVALUATION_LIMIT_depth;
+                result.error.error_string = "Compiled program ran out of stack.";
+            }
+            else if(limit == EVALUATION_LIMIT_depth)
+            {
+                result.error.error_string = MakeStringOnArenaF(arena, "Compiled program went deeper than the limit of %llu calls.",
+                                                               host.max_depth);
+            }
+            else if(limit == EVALUATION_LIMIT_memory)
+            {
+                result.error.error_string = MakeStringOnArenaF(arena, "Evaluation used more than the limit of %llu bytes.",
+                                                               evaluation.limits->max_bytes);
+            }
+            else
+            {
+                result.error.error_string = MakeStringOnArenaF(arena, "Evaluation took longer than the limit of %llu ms.",
+                                                               evaluation.limits->deadline_milliseconds);
+            }
+        }
+        else
+        {
+            // NOTE(rjf): Error strings from the program itself point into the
+            //            shared object, so they're copied.
+            result.error.limit = value.error.limit;
+            result.error.error_string = (value.error.error_string ?
+                                         MakeStringOnArenaF(arena, "%s", value.error.error_string) : 0);
+        }
+    }
+    else
+    {
+        result = EvaluationErrorResult(program->error ? program->error : "Program was not compiled.");
+    }
+    
+    return result;
+}
+
+static void
+CompiledProgramCleanUp(CompiledProgram *program)
+{
+    if(program->library)
+    {
+        dlclose(program->library);
+    }
+    memset(program, 0, sizeof(*program));
+}
+
+#endif
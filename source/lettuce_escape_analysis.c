@@ -0,0 +1,247 @@
+// NOTE(rjf): Escape analysis, a pass over the tree that finds closures which
+//            can't outlive the let or call that creates them. The evaluator puts
+//            their environments on its stack's region, which is rewound as soon
+//            as that let or call is done, rather than on the arena, where they'd
+//            stay until the end of the program unless the let or call happens
+//            to produce a number or a boolean.
+//
+//            - A function literal that's called right away,
+//              (function(x) body)(argument), never escapes the call. Nothing
+//              can refer to it, and closures made inside of it copy its
+//              bindings, not its environment. Calls like that get
+//              closure_does_not_escape set.
+//            - A function bound by let f = function(x) ... in body doesn't
+//              escape the let if every f in body is called right there, f(...),
+//              and none of them are inside of a function literal, which could
+//              be returned and call f after the let is over. Lets like that get
+//              binding_does_not_escape set.
+//
+//            Other closures made while f is bound do copy f, and can outlive the
+//            let, but since they don't mention f, nothing will look it up in
+//            them. A collector would still follow it, so with --gc, regions
+//            aren't used at all.
+//
+//            Every f in body counts, even where a parameter or another let
+//            shadows it. That can only make the analysis more conservative.
+//            The tree is walked with an explicit stack, since let chains can
+//            be as long as the program.
+
+#define ESCAPE_ANALYSIS_MAX_CANDIDATES 256
+
+enum
+{
+    ESCAPE_ANALYSIS_WORK_visit,
+    ESCAPE_ANALYSIS_WORK_visit_callee,
+    ESCAPE_ANALYSIS_WORK_enter_let,
+    ESCAPE_ANALYSIS_WORK_leave_let,
+    ESCAPE_ANALYSIS_WORK_leave_function,
+};
+
+typedef struct EscapeAnalysisWork
+{
+    int type;
+    AbstractSyntaxTreeNode *node;
+}
+EscapeAnalysisWork;
+
+// NOTE(rjf): A let-bound function whose body is being walked.
+typedef struct EscapeAnalysisCandidate
+{
+    AbstractSyntaxTreeNode *let;
+    unsigned int function_depth;
+    int escapes;
+}
+EscapeAnalysisCandidate;
+
+typedef struct EscapeAnalysis
+{
+    EscapeAnalysisWork *work;
+    unsigned int work_count;
+    unsigned int work_cap;
+    EscapeAnalysisCandidate candidates[ESCAPE_ANALYSIS_MAX_CANDIDATES];
+    unsigned int candidate_count;
+    unsigned int function_depth;
+}
+EscapeAnalysis;
+
+static void
+EscapeAnalysisPush(EscapeAnalysis *analysis, int type, AbstractSyntaxTreeNode *node)
+{
+    if(node)
+    {
+        if(analysis->work_count >= analysis->work_cap)
+        {
+            analysis->work_cap = analysis->work_cap ? analysis->work_cap * 2 : 256;
+            analysis->work = realloc(analysis->work, sizeof(analysis->work[0]) * analysis->work_cap);
+        }
+        analysis->work[analysis->work_count].type = type;
+        analysis->work[analysis->work_count].node = node;
+        ++analysis->work_count;
+    }
+}
+
+static void
+EscapeAnalysisVisitIdentifier(EscapeAnalysis *analysis, AbstractSyntaxTreeNode *node, int called)
+{
+    for(unsigned int i = analysis->candidate_count; i > 0; --i)
+    {
+        EscapeAnalysisCandidate *candidate = analysis->candidates + i - 1;
+        if(StringMatch(candidate->let->let.string, candidate->let->let.string_length,
+                       node->identifier.string, node->identifier.string_length))
+        {
+            if(!called || analysis->function_depth != candidate->function_depth)
+            {
+                candidate->escapes = 1;
+            }
+            break;
+        }
+    }
+}
+
+// NOTE(rjf): Sets binding_does_not_escape on every let in the tree, and
+//            closure_does_not_escape on every call, and returns how many lets and
+//            calls were found to have closures that don't escape.
+static unsigned long long
+EscapeAnalyzeAbstractSyntaxTree(AbstractSyntaxTreeNode *root)
+{
+    unsigned long long local_function_count = 0;
+    EscapeAnalysis analysis = {0};
+    EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, root);
+    
+    while(analysis.work_count)
+    {
+        EscapeAnalysisWork work = analysis.work[--analysis.work_count];
+        AbstractSyntaxTreeNode *node = work.node;
+        
+        switch(work.type)
+        {
+            case ESCAPE_ANALYSIS_WORK_enter_let:
+            {
+                EscapeAnalysisCandidate *candidate = analysis.candidates + analysis.candidate_count++;
+                candidate->let = node;
+                candidate->function_depth = analysis.function_depth;
+                candidate->escapes = 0;
+                break;
+            }
+            case ESCAPE_ANALYSIS_WORK_leave_let:
+            {
+                EscapeAnalysisCandidate *candidate = analysis.candidates + --analysis.candidate_count;
+                if(!candidate->escapes)
+                {
+                    node->let.binding_does_not_escape = 1;
+                    ++local_function_count;
+                }
+                break;
+            }
+            case ESCAPE_ANALYSIS_WORK_leave_function:
+            {
+                --analysis.function_depth;
+                break;
+            }
+            default:
+            {
+                switch(node->type)
+                {
+                    case ABSTRACT_SYNTAX_TREE_NODE_let:
+                    {
+                        node->let.binding_does_not_escape = 0;
+                        AbstractSyntaxTreeNode *binding = node->let.binding_expression;
+                        unsigned int recursive_count = LetRecursiveCount(node);
+                        
+                        // NOTE(rjf): A let rec group's functions share an
+                        //            environment that refers to them, which the
+                        //            evaluator never puts on the region, so they
+                        //            aren't candidates.
+                        if(recursive_count)
+                        {
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit,
+                                               LetRecursiveNested(node, recursive_count - 1)->let.body_expression);
+                            for(unsigned int i = recursive_count; i > 0; --i)
+                            {
+                                EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit,
+                                                   LetRecursiveNested(node, i-1)->let.binding_expression);
+                            }
+                        }
+                        
+                        // NOTE(rjf): A let's binding and body are done with before
+                        //            anything after the let is visited, so the
+                        //            candidate count is the same when it's entered.
+                        else if(binding && binding->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition &&
+                                analysis.candidate_count < ESCAPE_ANALYSIS_MAX_CANDIDATES)
+                        {
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_leave_let, node);
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->let.body_expression);
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_enter_let, node);
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, binding);
+                        }
+                        else
+                        {
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->let.body_expression);
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, binding);
+                        }
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+                    {
+                        EscapeAnalysisVisitIdentifier(&analysis, node, work.type == ESCAPE_ANALYSIS_WORK_visit_callee);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+                    {
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->binary_operator.right);
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->binary_operator.left);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+                    {
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->unary_operator.expression);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+                    {
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->if_then_else.fail_code);
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->if_then_else.pass_code);
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->if_then_else.condition);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+                    {
+                        ++analysis.function_depth;
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_leave_function, node);
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->function_definition.body);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+                    {
+                        AbstractSyntaxTreeNode *closure = node->function_call.closure;
+                        node->function_call.closure_does_not_escape = (closure &&
+                                                                       closure->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition);
+                        local_function_count += node->function_call.closure_does_not_escape;
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->function_call.parameter);
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit_callee, node->function_call.closure);
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+                    {
+                        for(unsigned int i = node->array_literal.element_count; i > 0; --i)
+                        {
+                            EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->array_literal.elements[i-1]);
+                        }
+                        break;
+                    }
+                    case ABSTRACT_SYNTAX_TREE_NODE_index:
+                    {
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->index.index);
+                        EscapeAnalysisPush(&analysis, ESCAPE_ANALYSIS_WORK_visit, node->index.array);
+                        break;
+                    }
+                    default: break;
+                }
+                break;
+            }
+        }
+    }
+    
+    free(analysis.work);
+    return local_function_count;
+}
@@ -0,0 +1,550 @@
+
+// NOTE(rjf): Optional generational garbage collector for runtime values.
+//
+//            When an environment has a collector attached, the environments it
+//            creates (and so every closure's captured environment) and their
+//            identifier tables are allocated here instead of on the arena. New
+//            objects are bump-allocated in a fixed-size nursery. A minor
+//            collection copies the live nursery objects into the old space
+//            (Cheney-style), which promotes them, and then empties the nursery.
+//            When the old space has grown past a threshold, a major collection
+//            copies everything that is live into fresh old space blocks and
+//            frees the old ones.
+//
+//            The collector is precise. Its roots are the slots the evaluator
+//            registers on the root stack, plus the remembered set, which holds
+//            old objects that have had a pointer to a nursery object written
+//            into them since the last minor collection.
+//
+//            Collections only happen at safepoints, which the evaluator calls
+//            before it allocates. Allocation itself never collects, so code
+//            that allocates several objects in a row doesn't need to root the
+//            ones it has already made. If the nursery fills up between
+//            safepoints, objects are allocated straight into the old space.
+//
+//            The AST, source, and error strings stay on the arena.
+
+#define GARBAGE_COLLECTOR_DEFAULT_NURSERY_SIZE (4*1024*1024)
+#define GARBAGE_COLLECTOR_BLOCK_SIZE (4*1024*1024)
+#define GARBAGE_COLLECTOR_MIN_MAJOR_THRESHOLD (64*1024*1024)
+
+// NOTE(rjf): Object types and root types are declared next to
+//            InterpreterEnvironment in lettuce_abstract_syntax_tree.c.
+
+enum
+{
+    GARBAGE_COLLECTOR_OBJECT_FLAG_forwarded  = (1<<0),
+    GARBAGE_COLLECTOR_OBJECT_FLAG_remembered = (1<<1),
+};
+
+typedef struct GarbageCollectorObjectHeader
+{
+    unsigned int size;
+    unsigned short type;
+    unsigned short flags;
+    void *forward;
+}
+GarbageCollectorObjectHeader;
+
+typedef struct GarbageCollectorBlock
+{
+    char *memory;
+    unsigned long long size;
+    unsigned long long used;
+}
+GarbageCollectorBlock;
+
+typedef struct GarbageCollectorRoot
+{
+    int type;
+    void *slot;
+}
+GarbageCollectorRoot;
+
+typedef struct GarbageCollectorStats
+{
+    unsigned long long minor_collections;
+    unsigned long long major_collections;
+    unsigned long long bytes_allocated;
+    unsigned long long bytes_promoted;
+    unsigned long long bytes_allocated_in_old_space;
+    unsigned long long old_space_bytes;
+    unsigned long long peak_old_space_bytes;
+    unsigned long long live_bytes_after_last_major;
+    unsigned long long total_pause_nanoseconds;
+    unsigned long long max_pause_nanoseconds;
+}
+GarbageCollectorStats;
+
+typedef struct GarbageCollector
+{
+    char *nursery;
+    unsigned long long nursery_size;
+    unsigned long long nursery_used;
+    
+    GarbageCollectorBlock *blocks;
+    unsigned int block_count;
+    unsigned int block_cap;
+    unsigned int from_block_count;
+    unsigned long long major_threshold;
+    
+    GarbageCollectorRoot *roots;
+    unsigned int root_count;
+    unsigned int root_cap;
+    
+    void **remembered;
+    unsigned int remembered_count;
+    unsigned int remembered_cap;
+    
+    GarbageCollectorStats stats;
+}
+GarbageCollector;
+
+static void
+GarbageCollectorInit(GarbageCollector *gc, unsigned long long nursery_size)
+{
+    if(!nursery_size)
+    {
+        nursery_size = GARBAGE_COLLECTOR_DEFAULT_NURSERY_SIZE;
+    }
+    gc->nursery_size = nursery_size;
+    gc->nursery = malloc(nursery_size);
+    gc->nursery_used = 0;
+    gc->major_threshold = GARBAGE_COLLECTOR_MIN_MAJOR_THRESHOLD;
+}
+
+static void
+GarbageCollectorCleanUp(GarbageCollector *gc)
+{
+    free(gc->nursery);
+    for(unsigned int i = 0; i < gc->block_count; ++i)
+    {
+        free(gc->blocks[i].memory);
+    }
+    free(gc->blocks);
+    free(gc->roots);
+    free(gc->remembered);
+}
+
+static GarbageCollectorObjectHeader *
+GarbageCollectorHeader(void *payload)
+{
+    return (GarbageCollectorObjectHeader *)payload - 1;
+}
+
+static int
+GarbageCollectorIsInNursery(GarbageCollector *gc, void *payload)
+{
+    return ((char *)payload >= gc->nursery &&
+            (char *)payload < gc->nursery + gc->nursery_size);
+}
+
+// NOTE(rjf): Whether a collection should move the object. Minor collections only
+//            move nursery objects, major ones move everything in from-space.
+//            Anything else, like the root environment on the C stack, stays.
+static int
+GarbageCollectorIsCollected(GarbageCollector *gc, void *payload, int major)
+{
+    int result = GarbageCollectorIsInNursery(gc, payload);
+    for(unsigned int i = 0; major && !result && i < gc->from_block_count; ++i)
+    {
+        GarbageCollectorBlock *block = gc->blocks + i;
+        result = ((char *)payload >= block->memory &&
+                  (char *)payload < block->memory + block->used);
+    }
+    return result;
+}
+
+static void
+GarbageCollectorRemember(GarbageCollector *gc, void *payload)
+{
+    GarbageCollectorObjectHeader *header = GarbageCollectorHeader(payload);
+    if(!(header->flags & GARBAGE_COLLECTOR_OBJECT_FLAG_remembered))
+    {
+        if(gc->remembered_count >= gc->remembered_cap)
+        {
+            gc->remembered_cap = gc->remembered_cap ? gc->remembered_cap * 2 : 256;
+            gc->remembered = realloc(gc->remembered, sizeof(gc->remembered[0]) * gc->remembered_cap);
+        }
+        gc->remembered[gc->remembered_count++] = payload;
+        header->flags |= GARBAGE_COLLECTOR_OBJECT_FLAG_remembered;
+    }
+}
+
+// NOTE(rjf): Has to be called after writing a pointer into an object, so that
+//            old objects pointing into the nursery are found by minor
+//            collections. It's conservative: it doesn't look at what was written.
+static void
+GarbageCollectorWriteBarrier(GarbageCollector *gc, void *payload)
+{
+    if(gc && !GarbageCollectorIsInNursery(gc, payload))
+    {
+        GarbageCollectorRemember(gc, payload);
+    }
+}
+
+static void *
+GarbageCollectorAllocateInOldSpace(GarbageCollector *gc, unsigned long long size)
+{
+    GarbageCollectorBlock *block = gc->block_count ? gc->blocks + gc->block_count - 1 : 0;
+    
+    if(!block || block->used + size > block->size)
+    {
+        if(gc->block_count >= gc->block_cap)
+        {
+            gc->block_cap = gc->block_cap ? gc->block_cap * 2 : 16;
+            gc->blocks = realloc(gc->blocks, sizeof(gc->blocks[0]) * gc->block_cap);
+        }
+        block = gc->blocks + gc->block_count++;
+        block->size = size > GARBAGE_COLLECTOR_BLOCK_SIZE ? size : GARBAGE_COLLECTOR_BLOCK_SIZE;
+        block->memory = malloc(block->size);
+        block->used = 0;
+    }
+    
+    void *result = block->memory + block->used;
+    block->used += size;
+    gc->stats.old_space_bytes += size;
+    if(gc->stats.old_space_bytes > gc->stats.peak_old_space_bytes)
+    {
+        gc->stats.peak_old_space_bytes = gc->stats.old_space_bytes;
+    }
+    return result;
+}
+
+static void *
+GarbageCollectorAllocate(GarbageCollector *gc, unsigned int size, int type)
+{
+    unsigned long long total_size = AlignUpPow2(sizeof(GarbageCollectorObjectHeader) + size, 16);
+    GarbageCollectorObjectHeader *header = 0;
+    
+    if(gc->nursery_used + total_size <= gc->nursery_size)
+    {
+        header = (GarbageCollectorObjectHeader *)(gc->nursery + gc->nursery_used);
+        gc->nursery_used += total_size;
+    }
+    else
+    {
+        header = GarbageCollectorAllocateInOldSpace(gc, total_size);
+        gc->stats.bytes_allocated_in_old_space += total_size;
+    }
+    
+    header->size = (unsigned int)total_size;
+    header->type = (unsigned short)type;
+    header->flags = 0;
+    header->forward = 0;
+    gc->stats.bytes_allocated += total_size;
+    
+    void *payload = header + 1;
+    
+    // NOTE(rjf): Whatever the caller writes into an object that went straight to
+    //            the old space might point into the nursery.
+    if(!GarbageCollectorIsInNursery(gc, payload))
+    {
+        GarbageCollectorRemember(gc, payload);
+    }
+    
+    return payload;
+}
+
+static void *
+GarbageCollectorAllocateZero(GarbageCollector *gc, unsigned int size, int type)
+{
+    void *result = GarbageCollectorAllocate(gc, size, type);
+    memset(result, 0, size);
+    return result;
+}
+
+// NOTE(rjf): Bytes in use by objects that haven't been collected yet, live or
+//            not, which is what counts against an evaluation's memory limit.
+static unsigned long long
+GarbageCollectorHeapBytes(GarbageCollector *gc)
+{
+    return gc ? gc->stats.old_space_bytes + gc->nursery_used : 0;
+}
+
+static void
+GarbageCollectorPushRoot(GarbageCollector *gc, int type, void *slot)
+{
+    if(gc)
+    {
+        if(gc->root_count >= gc->root_cap)
+        {
+            gc->root_cap = gc->root_cap ? gc->root_cap * 2 : 256;
+            gc->roots = realloc(gc->roots, sizeof(gc->roots[0]) * gc->root_cap);
+        }
+        gc->roots[gc->root_count].type = type;
+        gc->roots[gc->root_count].slot = slot;
+        ++gc->root_count;
+    }
+}
+
+static void
+GarbageCollectorPopRoots(GarbageCollector *gc, unsigned int count)
+{
+    if(gc)
+    {
+        gc->root_count -= count;
+    }
+}
+
+static void *
+GarbageCollectorForward(GarbageCollector *gc, void *payload, int major)
+{
+    void *result = payload;
+    
+    if(payload && GarbageCollectorIsCollected(gc, payload, major))
+    {
+        GarbageCollectorObjectHeader *header = GarbageCollectorHeader(payload);
+        if(header->flags & GARBAGE_COLLECTOR_OBJECT_FLAG_forwarded)
+        {
+            result = header->forward;
+        }
+        else
+        {
+            GarbageCollectorObjectHeader *new_header = GarbageCollectorAllocateInOldSpace(gc, header->size);
+            MemoryCopy(new_header, header, header->size);
+            new_header->flags = 0;
+            new_header->forward = 0;
+            
+            header->flags |= GARBAGE_COLLECTOR_OBJECT_FLAG_forwarded;
+            header->forward = new_header + 1;
+            result = header->forward;
+            
+            if(!major)
+            {
+                gc->stats.bytes_promoted += header->size;
+            }
+        }
+    }
+    
+    return result;
+}
+
+static void
+GarbageCollectorForwardEnvironmentFields(GarbageCollector *gc, InterpreterEnvironment *environment, int major)
+{
+    environment->identifier_table_values = GarbageCollectorForward(gc, environment->identifier_table_values, major);
+    environment->identifier_table_keys = GarbageCollectorForward(gc, environment->identifier_table_keys, major);
+}
+
+static void
+GarbageCollectorForwardResult(GarbageCollector *gc, EvaluationResult *result, int major)
+{
+    if(result->type == EVALUATION_RESULT_closure)
+    {
+        result->closure.environment = GarbageCollectorForward(gc, result->closure.environment, major);
+    }
+    else if(result->type == EVALUATION_RESULT_builtin && result->builtin.applied_count)
+    {
+        result->builtin.applied = GarbageCollectorForward(gc, result->builtin.applied, major);
+    }
+}
+
+// NOTE(rjf): Every frame on the stack, including the ones that belong to
+//            evaluations further down, holds an environment and a value, and
+//            calls have their arguments on the side.
+static void
+GarbageCollectorForwardEvaluationStack(GarbageCollector *gc, EvaluationStack *stack, int major)
+{
+    EvaluationStackSegment *segment = &stack->first_segment;
+    for(unsigned long long i = 0; i < stack->depth; ++i)
+    {
+        if(i && i % EVALUATION_STACK_SEGMENT_SIZE == 0)
+        {
+            segment = segment->next;
+        }
+        EvaluationFrame *frame = segment->frames + i % EVALUATION_STACK_SEGMENT_SIZE;
+        frame->environment = GarbageCollectorForward(gc, frame->environment, major);
+        GarbageCollectorForwardResult(gc, &frame->value, major);
+    }
+    for(unsigned long long i = 0; i < stack->argument_count; ++i)
+    {
+        GarbageCollectorForwardResult(gc, &stack->arguments[i].value, major);
+    }
+}
+
+static void
+GarbageCollectorScanObject(GarbageCollector *gc, void *payload, int major)
+{
+    GarbageCollectorObjectHeader *header = GarbageCollectorHeader(payload);
+    
+    switch(header->type)
+    {
+        case GARBAGE_COLLECTOR_OBJECT_environment:
+        {
+            GarbageCollectorForwardEnvironmentFields(gc, payload, major);
+            break;
+        }
+        case GARBAGE_COLLECTOR_OBJECT_value_table:
+        {
+            // NOTE(rjf): Deleted bindings have their values cleared, so every
+            //            closure in here is reachable.
+            EvaluationResult *values = payload;
+            unsigned int count = (header->size - sizeof(GarbageCollectorObjectHeader)) / sizeof(EvaluationResult);
+            for(unsigned int i = 0; i < count; ++i)
+            {
+                GarbageCollectorForwardResult(gc, values + i, major);
+            }
+            break;
+        }
+        default: break;
+    }
+}
+
+static void
+GarbageCollectorCollect(GarbageCollector *gc, int major)
+{
+    unsigned long long start_time = GetTimeInNanoseconds();
+    
+    // NOTE(rjf): For a major collection, every block that exists now is from-space
+    //            and gets freed at the end. Survivors land in blocks after them.
+    unsigned int from_block_count = major ? gc->block_count : 0;
+    gc->from_block_count = from_block_count;
+    if(major)
+    {
+        gc->stats.old_space_bytes = 0;
+        // NOTE(rjf): Start a fresh block so no survivor lands in a from-space block.
+        if(gc->block_count)
+        {
+            gc->blocks[gc->block_count-1].size = gc->blocks[gc->block_count-1].used;
+        }
+    }
+    
+    unsigned int scan_block = gc->block_count ? gc->block_count - 1 : 0;
+    unsigned long long scan_pos = gc->block_count ? gc->blocks[scan_block].used : 0;
+    if(major)
+    {
+        scan_block = gc->block_count;
+        scan_pos = 0;
+    }
+    
+    for(unsigned int i = 0; i < gc->root_count; ++i)
+    {
+        GarbageCollectorRoot *root = gc->roots + i;
+        switch(root->type)
+        {
+            case GARBAGE_COLLECTOR_ROOT_result:
+            {
+                GarbageCollectorForwardResult(gc, root->slot, major);
+                break;
+            }
+            case GARBAGE_COLLECTOR_ROOT_environment_pointer:
+            {
+                InterpreterEnvironment **slot = root->slot;
+                *slot = GarbageCollectorForward(gc, *slot, major);
+                break;
+            }
+            case GARBAGE_COLLECTOR_ROOT_environment:
+            {
+                GarbageCollectorForwardEnvironmentFields(gc, root->slot, major);
+                break;
+            }
+            case GARBAGE_COLLECTOR_ROOT_evaluation_stack:
+            {
+                GarbageCollectorForwardEvaluationStack(gc, root->slot, major);
+                break;
+            }
+            default: break;
+        }
+    }
+    
+    if(!major)
+    {
+        for(unsigned int i = 0; i < gc->remembered_count; ++i)
+        {
+            GarbageCollectorHeader(gc->remembered[i])->flags &= ~GARBAGE_COLLECTOR_OBJECT_FLAG_remembered;
+            GarbageCollectorScanObject(gc, gc->remembered[i], major);
+        }
+    }
+    else
+    {
+        for(unsigned int i = 0; i < gc->remembered_count; ++i)
+        {
+            GarbageCollectorHeader(gc->remembered[i])->flags &= ~GARBAGE_COLLECTOR_OBJECT_FLAG_remembered;
+        }
+    }
+    gc->remembered_count = 0;
+    
+    // NOTE(rjf): Cheney scan over everything copied so far, which copies more.
+    while(scan_block < gc->block_count)
+    {
+        GarbageCollectorBlock *block = gc->blocks + scan_block;
+        if(scan_pos < block->used)
+        {
+            GarbageCollectorObjectHeader *header = (GarbageCollectorObjectHeader *)(block->memory + scan_pos);
+            GarbageCollectorScanObject(gc, header + 1, major);
+            scan_pos += header->size;
+        }
+        else
+        {
+            ++scan_block;
+            scan_pos = 0;
+        }
+    }
+    
+    if(major)
+    {
+        for(unsigned int i = 0; i < from_block_count; ++i)
+        {
+            free(gc->blocks[i].memory);
+        }
+        MemoryCopy(gc->blocks, gc->blocks + from_block_count,
+                   sizeof(gc->blocks[0]) * (gc->block_count - from_block_count));
+        gc->block_count -= from_block_count;
+        gc->from_block_count = 0;
+        
+        gc->stats.live_bytes_after_last_major = gc->stats.old_space_bytes;
+        gc->major_threshold = gc->stats.old_space_bytes * 2;
+        if(gc->major_threshold < GARBAGE_COLLECTOR_MIN_MAJOR_THRESHOLD)
+        {
+            gc->major_threshold = GARBAGE_COLLECTOR_MIN_MAJOR_THRESHOLD;
+        }
+        ++gc->stats.major_collections;
+    }
+    else
+    {
+        ++gc->stats.minor_collections;
+    }
+    
+    gc->nursery_used = 0;
+    
+    unsigned long long pause = GetTimeInNanoseconds() - start_time;
+    gc->stats.total_pause_nanoseconds += pause;
+    if(pause > gc->stats.max_pause_nanoseconds)
+    {
+        gc->stats.max_pause_nanoseconds = pause;
+    }
+}
+
+// NOTE(rjf): Collects if the nursery doesn't have room for bytes_needed more.
+//            Every pointer to a collected object that the caller still needs
+//            has to be reachable from the root stack when this is called.
+static void
+GarbageCollectorSafepoint(GarbageCollector *gc, unsigned long long bytes_needed)
+{
+    if(gc && gc->nursery_used + bytes_needed > gc->nursery_size)
+    {
+        GarbageCollectorCollect(gc, 0);
+        if(gc->stats.old_space_bytes > gc->major_threshold)
+        {
+            GarbageCollectorCollect(gc, 1);
+        }
+    }
+}
+
+static void
+GarbageCollectorPrintStats(GarbageCollector *gc, FILE *file)
+{
+    GarbageCollectorStats *stats = &gc->stats;
+    fprintf(file, "GC: %llu minor, %llu major collections\n", stats->minor_collections, stats->major_collections);
+    fprintf(file, "GC: %.2f MB allocated (%.2f MB directly in old space), %.2f MB promoted\n",
+            stats->bytes_allocated / (1024.0*1024.0),
+            stats->bytes_allocated_in_old_space / (1024.0*1024.0),
+            stats->bytes_promoted / (1024.0*1024.0));
+    fprintf(file, "GC: old space %.2f MB now, %.2f MB peak, %.2f MB live after last major\n",
+            stats->old_space_bytes / (1024.0*1024.0),
+            stats->peak_old_space_bytes / (1024.0*1024.0),
+            stats->live_bytes_after_last_major / (1024.0*1024.0));
+    fprintf(file, "GC: %.3f ms total pause, %.3f ms max pause\n",
+            stats->total_pause_nanoseconds / 1e6, stats->max_pause_nanoseconds / 1e6);
+}
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define LETTUCE_POSIX 1
+
+#include "lettuce_utilities.c"
+#include "lettuce_server_protocol.c"
+
+// NOTE(rjf): Load generator for the evaluation server. Opens a number of
+//            connections, each on its own thread, and has each one send
+//            requests back-to-back, timing every round trip. By default, the
+//            first request on a connection sends the program's source and the
+//            rest refer to it by hash, which is how we expect real callers to
+//            use the server.
+
+typedef struct LoadGeneratorOptions
+{
+    char *socket_path;
+    char *source;
+    unsigned int source_length;
+    int connection_count;
+    int requests_per_connection;
+    int send_source_every_time;
+    int binding_count;
+    char *bindings[SERVER_PROTOCOL_MAX_BINDINGS];
+}
+LoadGeneratorOptions;
+
+typedef struct LoadGeneratorConnection
+{
+    LoadGeneratorOptions *options;
+    pthread_t thread;
+    int completed_requests;
+    int error_responses;
+    int connection_failed;
+    unsigned long long *latencies;
+    SocketReader reader;
+}
+LoadGeneratorConnection;
+
+static int
+CompareLatencies(const void *a, const void *b)
+{
+    unsigned long long latency_a = *(const unsigned long long *)a;
+    unsigned long long latency_b = *(const unsigned long long *)b;
+    return latency_a < latency_b ? -1 : latency_a > latency_b ? 1 : 0;
+}
+
+static void *
+LoadGeneratorConnectionThread(void *data)
+{
+    LoadGeneratorConnection *connection = data;
+    LoadGeneratorOptions *options = connection->options;
+    
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, options->socket_path, sizeof(address.sun_path)-1);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        connection->connection_failed = 1;
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return 0;
+    }
+    connection->reader.fd = fd;
+    
+    // NOTE(rjf): The binding lines are the same for every request, so build them once.
+    char bindings[SERVER_PROTOCOL_MAX_BINDINGS * 64];
+    unsigned int bindings_length = 0;
+    for(int i = 0; i < options->binding_count; ++i)
+    {
+        bindings_length += snprintf(bindings + bindings_length, sizeof(bindings) - bindings_length,
+                                    "%s\n", options->bindings[i]);
+    }
+    
+    unsigned long long hash = HashProgramSource(options->source, options->source_length);
+    char header[SERVER_PROTOCOL_MAX_LINE_LENGTH];
+    char response[SERVER_PROTOCOL_MAX_LINE_LENGTH];
+    
+    for(int i = 0; i < options->requests_per_connection; ++i)
+    {
+        int send_source = i == 0 || options->send_source_every_time;
+        int header_length = 0;
+        if(send_source)
+        {
+            header_length = snprintf(header, sizeof(header), "EVAL %d %u\n",
+                                     options->binding_count, options->source_length);
+        }
+        else
+        {
+            header_length = snprintf(header, sizeof(header), "CALL %016llx %d\n",
+                                     hash, options->binding_count);
+        }
+        
+        unsigned long long start_time = GetTimeInNanoseconds();
+        if(!SocketWriteAll(fd, header, header_length) ||
+           !SocketWriteAll(fd, bindings, bindings_length) ||
+           (send_source && !SocketWriteAll(fd, options->source, options->source_length)) ||
+           SocketReaderReadLine(&connection->reader, response, sizeof(response)) < 0)
+        {
+            connection->connection_failed = 1;
+            break;
+        }
+        unsigned long long end_time = GetTimeInNanoseconds();
+        
+        if(strncmp(response, "OK ", 3))
+        {
+            if(!connection->error_responses)
+            {
+                fprintf(stderr, "Server returned: %s\n", response);
+            }
+            ++connection->error_responses;
+        }
+        connection->latencies[connection->completed_requests++] = end_time - start_time;
+    }
+    
+    close(fd);
+    return 0;
+}
+
+static char *
+LoadEntireFileAndNullTerminate(char *filename)
+{
+    char *result = 0;
+    
+    FILE *file = fopen(filename, "rb");
+    if(file)
+    {
+        unsigned long long size = 0;
+        result = LoadEntireFile(file, &size);
+        fclose(file);
+    }
+    
+    return result;
+}
+
+static void
+PrintUsage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s <socket path> [options]\n", program_name);
+    fprintf(stderr, "    --program <file>       Lettuce file to evaluate (default: a small arithmetic program)\n");
+    fprintf(stderr, "    --bind <name>=<value>  Binding sent with every request (repeatable)\n");
+    fprintf(stderr, "    --connections <count>  Concurrent connections (default: 8)\n");
+    fprintf(stderr, "    --requests <count>     Requests per connection (default: 10000)\n");
+    fprintf(stderr, "    --send-source          Send the source with every request instead of its hash\n");
+}
+
+int
+main(int argument_count, char **arguments)
+{
+    LoadGeneratorOptions options = {0};
+    options.connection_count = 8;
+    options.requests_per_connection = 10000;
+    options.source = "let f = function(x) x * 2 + 1 in f(y)";
+    
+    for(int i = 1; i < argument_count; ++i)
+    {
+        if(!strcmp(arguments[i], "--program") && i+1 < argument_count)
+        {
+            options.source = LoadEntireFileAndNullTerminate(arguments[++i]);
+            if(!options.source)
+            {
+                fprintf(stderr, "FATAL ERROR: \"%s\" could not be loaded.\n", arguments[i]);
+                return 1;
+            }
+        }
+        else if(!strcmp(arguments[i], "--bind") && i+1 < argument_count &&
+                options.binding_count < SERVER_PROTOCOL_MAX_BINDINGS)
+        {
+            char *binding = arguments[++i];
+            char *equals = strchr(binding, '=');
+            if(!equals)
+            {
+                fprintf(stderr, "FATAL ERROR: Binding \"%s\" should look like name=value.\n", binding);
+                return 1;
+            }
+            *equals = ' ';
+            options.bindings[options.binding_count++] = binding;
+        }
+        else if(!strcmp(arguments[i], "--connections") && i+1 < argument_count)
+        {
+            options.connection_count = atoi(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--requests") && i+1 < argument_count)
+        {
+            options.requests_per_connection = atoi(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--send-source"))
+        {
+            options.send_source_every_time = 1;
+        }
+        else if(arguments[i][0] != '-' && !options.socket_path)
+        {
+            options.socket_path = arguments[i];
+        }
+        else
+        {
+            PrintUsage(arguments[0]);
+            return 1;
+        }
+    }
+    
+    if(!options.socket_path || options.connection_count <= 0 || options.requests_per_connection <= 0)
+    {
+        PrintUsage(arguments[0]);
+        return 1;
+    }
+    
+    if(options.binding_count == 0 && !strcmp(options.source, "let f = function(x) x * 2 + 1 in f(y)"))
+    {
+        static char default_binding[] = "y 20";
+        options.bindings[options.binding_count++] = default_binding;
+    }
+    options.source_length = CalculateCStringLength(options.source);
+    
+    LoadGeneratorConnection *connections = calloc(options.connection_count, sizeof(LoadGeneratorConnection));
+    unsigned long long start_time = GetTimeInNanoseconds();
+    for(int i = 0; i < options.connection_count; ++i)
+    {
+        connections[i].options = &options;
+        connections[i].latencies = malloc(sizeof(unsigned long long) * options.requests_per_connection);
+        pthread_create(&connections[i].thread, 0, LoadGeneratorConnectionThread, connections + i);
+    }
+    
+    unsigned long long total_requests = 0;
+    unsigned long long total_errors = 0;
+    int failed_connections = 0;
+    for(int i = 0; i < options.connection_count; ++i)
+    {
+        pthread_join(connections[i].thread, 0);
+        total_requests += connections[i].completed_requests;
+        total_errors += connections[i].error_responses;
+        failed_connections += connections[i].connection_failed;
+    }
+    unsigned long long end_time = GetTimeInNanoseconds();
+    
+    unsigned long long *latencies = malloc(sizeof(unsigned long long) * (total_requests + 1));
+    unsigned long long latency_count = 0;
+    for(int i = 0; i < options.connection_count; ++i)
+    {
+        MemoryCopy(latencies + latency_count, connections[i].latencies,
+                   sizeof(unsigned long long) * connections[i].completed_requests);
+        latency_count += connections[i].completed_requests;
+    }
+    qsort(latencies, latency_count, sizeof(latencies[0]), CompareLatencies);
+    
+    double elapsed_seconds = (end_time - start_time) / 1e9;
+    printf("connections:    %d (%d failed)\n", options.connection_count, failed_connections);
+    printf("requests:       %llu (%llu errors)\n", total_requests, total_errors);
+    printf("elapsed:        %.3f s\n", elapsed_seconds);
+    printf("throughput:     %.0f requests/s\n", elapsed_seconds > 0 ? total_requests / elapsed_seconds : 0.0);
+    if(latency_count)
+    {
+        printf("latency p50:    %.1f us\n", latencies[latency_count*50/100] / 1000.0);
+        printf("latency p99:    %.1f us\n", latencies[latency_count*99/100] / 1000.0);
+        printf("latency max:    %.1f us\n", latencies[latency_count-1] / 1000.0);
+    }
+    
+    return failed_connections || total_errors ? 1 : 0;
+}
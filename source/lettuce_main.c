@@ -1,14 +1,119 @@
+// NOTE(rjf): For pthread_getattr_np, which the parser uses to find out how
+//            much stack it has (see ParseStackLimit).
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__unix__)
+#define LETTUCE_POSIX 1
+#else
+#define LETTUCE_POSIX 0
+#endif
+
+#if LETTUCE_POSIX
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#else
+#include <sys/event.h>
+#endif
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+// NOTE(rjf): Tiered execution compiles hot functions with the C backend on a
+//            background thread, so it needs the same things as --compile.
+#define LETTUCE_TIER LETTUCE_POSIX
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LETTUCE_AVX2 1
+#include <immintrin.h>
+#else
+#define LETTUCE_AVX2 0
+#endif
 
 #include "lettuce_utilities.c"
+#include "lettuce_number_format.c"
+#include "lettuce_perf_counters.c"
+#include "lettuce_output.c"
 #include "lettuce_tokenizer.c"
 #include "lettuce_abstract_syntax_tree.c"
+#include "lettuce_garbage_collector.c"
+#include "lettuce_array.c"
+#include "lettuce_profiler.c"
 #include "lettuce_parse.c"
+#include "lettuce_optimize.c"
+#include "lettuce_escape_analysis.c"
+#include "lettuce_emit_c.c"
+#if LETTUCE_TIER
+#include "lettuce_tier.c"
+#endif
+#if LETTUCE_POSIX
+#include "lettuce_snapshot.c"
+#include "lettuce_pipeline.c"
+#endif
+#include "lettuce_program.c"
+
+#if LETTUCE_POSIX
+#include "lettuce_server_protocol.c"
+#include "lettuce_server.c"
+#endif
+
+typedef struct InterpreterOptions
+{
+    int arena_backend;
+    int arena_flags;
+    int use_garbage_collector;
+    int print_garbage_collector_stats;
+    unsigned long long nursery_size;
+    EvaluationLimits limits;
+    int hash_cons;
+    int optimize;
+    int print_optimizer_stats;
+    unsigned long long inline_budget;
+    int no_escape_analysis;
+    char *emit_c_path;
+    int compile;
+    int tier;
+    unsigned long long tier_threshold;
+    int tier_log;
+    char *snapshot_path;
+    char *snapshot_save_path;
+    char *csv_path;
+    int print_csv_stats;
+    int print_memory_stats;
+    int print_counters;
+    int quiet;
+    int print_format;
+    int batch;
+    char *batch_separator;
+    int profile;
+    int profile_top_count;
+    char *profile_stacks_path;
+}
+InterpreterOptions;
 
 static void
-InterpretCode(char *code)
+InterpretCode(char *code, unsigned long long code_length, InterpreterOptions *options)
 {
     Tokenizer tokenizer_ = {0};
     MemoryArena arena_ = {0};
@@ -18,57 +123,861 @@ InterpretCode(char *code)
     MemoryArena *arena = &arena_;
     InterpreterEnvironment *environment = &environment_;
     
-    tokenizer->at = code;
+    arena->backend = options->arena_backend;
+    arena->flags = options->arena_flags;
+    TokenizerInit(tokenizer, code, code_length);
     environment->arena = arena;
     
+    AbstractSyntaxTreeNodeTable node_table = {0};
+    if(options->hash_cons)
+    {
+        tokenizer->node_table = &node_table;
+    }
+    
+    EvaluationStack *stack = malloc(sizeof(*stack));
+    stack->arena = (MemoryArena){0};
+    EvaluationStackInit(stack, &options->limits);
+    environment->stack = stack;
+    
+    GarbageCollector gc = {0};
+    if(options->use_garbage_collector)
+    {
+        GarbageCollectorInit(&gc, options->nursery_size);
+        environment->gc = &gc;
+        GarbageCollectorPushRoot(&gc, GARBAGE_COLLECTOR_ROOT_environment, environment);
+    }
+    
+#if LETTUCE_POSIX
+    Snapshot snapshot = {0};
+    if(options->snapshot_path && SnapshotLoad(&snapshot, options->snapshot_path, arena, stack))
+    {
+        SnapshotBind(&snapshot, environment);
+    }
+#endif
+    
+    // NOTE(rjf): Everything that goes to stdout goes through here, so it's all
+    //            written with a few large writes at the end of each phase.
+    OutputBuffer *output = malloc(sizeof(*output));
+    OutputBufferInit(output, 1);
+    
+    // NOTE(rjf): Tokenizing happens on demand during parsing, so the two are
+    //            counted together.
+    enum { PHASE_parse, PHASE_print, PHASE_evaluate, PHASE_COUNT };
+    char *phase_names[PHASE_COUNT] = { "parse", "print", "evaluate" };
+    PerfCounters counters = {0};
+    PerfCounterValues phase_counters[PHASE_COUNT] = {0};
+    int phases_run = 0;
+    if(options->print_counters && !PerfCountersOpen(&counters))
+    {
+        fprintf(stderr, "Performance counters are not available (see /proc/sys/kernel/perf_event_paranoid).\n");
+    }
+    
+    PerfCountersStart(&counters);
     ParseError error = {0};
     AbstractSyntaxTreeNode *root = ParseExpression(tokenizer, arena, &error);
+    Optimizer optimizer = {0};
+    if(options->optimize && !error.string)
+    {
+        OptimizerInit(&optimizer, arena, options->inline_budget);
+        root = OptimizeAbstractSyntaxTree(&optimizer, root);
+    }
+    if(!options->no_escape_analysis && !error.string)
+    {
+        EscapeAnalyzeAbstractSyntaxTree(root);
+    }
+    PerfCountersStop(&counters, phase_counters + PHASE_parse);
+    phases_run = 1;
+    AbstractSyntaxTreeNodeTableCleanUp(&node_table);
     
+#if LETTUCE_POSIX
+    CompiledProgram compiled = {0};
+#endif
+#if LETTUCE_TIER
+    Tier tier = {0};
+#endif
     if(error.string)
     {
         fprintf(stderr, "PARSE ERROR: %s\n", error.string);
     }
+#if LETTUCE_POSIX
+    else if(snapshot.error)
+    {
+        fprintf(stderr, "SNAPSHOT ERROR: %s\n", snapshot.error);
+    }
+    else if(options->emit_c_path)
+    {
+        char emit_error[512];
+        if(EmitCFile(root, options->emit_c_path, emit_error, sizeof(emit_error)))
+        {
+            fprintf(stderr, "COMPILE ERROR: %s\n", emit_error);
+        }
+    }
+    else if(options->compile && !CompiledProgramBuild(&compiled, root))
+    {
+        fprintf(stderr, "COMPILE ERROR: %s\n", compiled.error);
+    }
+#endif
     else
     {
-        PrintAbstractSyntaxTree(root);
-        printf("\n");
+        PerfCountersStart(&counters);
+        if(!options->quiet)
+        {
+            PrintAbstractSyntaxTree(output, root, options->print_format);
+            if(options->print_format != ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_indented)
+            {
+                OutputWriteCharacter(output, '\n');
+            }
+            OutputFlush(output);
+        }
+        PerfCountersStop(&counters, phase_counters + PHASE_print);
+        
+#if LETTUCE_PROFILE
+        Profiler profiler = {0};
+        if(options->profile)
+        {
+            ProfilerBegin(&profiler, code, code_length);
+        }
+#endif
+        
+#if LETTUCE_TIER
+        char stack_base;
+        if(options->tier)
+        {
+            TierInit(&tier, options->tier_threshold, options->tier_log, code, code_length, &stack_base);
+            stack->tier = &tier;
+        }
+#endif
+        
+        PerfCountersStart(&counters);
+        EvaluationResult result = {0};
+#if LETTUCE_POSIX
+        if(options->compile)
+        {
+            result = CompiledProgramEvaluate(&compiled, arena, &options->limits);
+        }
+        else if(options->snapshot_save_path)
+        {
+            // NOTE(rjf): The image is written once the prelude is evaluated, and
+            //            then the rest of the program is evaluated as usual.
+            char *snapshot_error = 0;
+            AbstractSyntaxTreeNode *body = SnapshotEvaluatePrelude(environment, root, &result);
+            if(body && !SnapshotSave(options->snapshot_save_path, environment, code, code_length, &snapshot_error))
+            {
+                result = EvaluationErrorResult(MakeStringOnArenaF(arena, "The snapshot could not be saved. %s",
+                                                                  snapshot_error));
+            }
+            else if(body)
+            {
+                result = EvaluateAbstractSyntaxTree(environment, body);
+            }
+        }
+        else
+#endif
+        {
+            result = EvaluateAbstractSyntaxTree(environment, root);
+        }
+        PerfCountersStop(&counters, phase_counters + PHASE_evaluate);
+        phases_run = PHASE_COUNT;
+        
+#if LETTUCE_PROFILE
+        if(options->profile)
+        {
+            ProfilerEnd(&profiler);
+            ProfilerPrintHotSpots(&profiler, stderr, options->profile_top_count);
+            if(options->profile_stacks_path)
+            {
+                FILE *stacks_file = fopen(options->profile_stacks_path, "w");
+                if(!stacks_file || !ProfilerWriteCollapsedStacks(&profiler, stacks_file))
+                {
+                    fprintf(stderr, "ERROR: Could not write stacks to \"%s\".\n", options->profile_stacks_path);
+                }
+                if(stacks_file)
+                {
+                    fclose(stacks_file);
+                }
+            }
+            ProfilerCleanUp(&profiler);
+        }
+#endif
         
-        EvaluationResult result = EvaluateAbstractSyntaxTree(environment, root);
         if(result.type == EVALUATION_RESULT_error)
         {
             fprintf(stderr, "RUNTIME ERROR: %s\n", result.error.error_string);
         }
         else if(result.type == EVALUATION_RESULT_number)
         {
-            printf("Program was evaluated to numeric value %f.\n", result.number);
+            OutputWriteCString(output, "Program was evaluated to numeric value ");
+            OutputWriteNumber(output, result.number);
+            OutputWriteCString(output, ".\n");
         }
         else if(result.type == EVALUATION_RESULT_boolean)
         {
-            printf("Program was evaluated to boolean value %s.\n", result.boolean ? "true" : "false");
+            OutputWriteF(output, "Program was evaluated to boolean value %s.\n", result.boolean ? "true" : "false");
+        }
+        else if(result.type == EVALUATION_RESULT_array)
+        {
+            OutputWriteCString(output, "Program was evaluated to array ");
+            OutputWriteArray(output, result.array.elements, result.array.count);
+            OutputWriteCString(output, ".\n");
         }
     }
     
+    OutputFlush(output);
+    free(output);
+    
+#if LETTUCE_POSIX
+    CompiledProgramCleanUp(&compiled);
+#endif
+#if LETTUCE_TIER
+    if(stack->tier)
+    {
+        TierCleanUp(&tier);
+        stack->tier = 0;
+    }
+#endif
+    
+    if(counters.available_count)
+    {
+        for(int i = 0; i < phases_run; ++i)
+        {
+            fprintf(stderr, "%-9s", phase_names[i]);
+            PerfCounterValuesPrint(stderr, phase_counters + i, 1.0);
+            fprintf(stderr, "\n");
+        }
+        PerfCountersClose(&counters);
+    }
+    
+    if(options->print_optimizer_stats)
+    {
+        OptimizerPrintStats(&optimizer, stderr);
+    }
+    
+    if(options->print_memory_stats)
+    {
+        MemoryArenaPrintStats(arena, stderr);
+        EvaluationStackPrintStats(stack, stderr);
+        if(options->hash_cons)
+        {
+            AbstractSyntaxTreeNodeTablePrintStats(&node_table, stderr);
+        }
+#if LETTUCE_POSIX
+        if(snapshot.base)
+        {
+            SnapshotPrintStats(&snapshot, stderr);
+        }
+#endif
+    }
+    
+    if(options->use_garbage_collector)
+    {
+        if(options->print_garbage_collector_stats)
+        {
+            GarbageCollectorPrintStats(&gc, stderr);
+        }
+        GarbageCollectorCleanUp(&gc);
+    }
+    
+    EvaluationStackCleanUp(stack);
+    free(stack);
     MemoryArenaCleanUp(arena);
+#if LETTUCE_POSIX
+    SnapshotCleanUp(&snapshot);
+#endif
+}
+
+// NOTE(rjf): Batch mode evaluates many independent programs from one input.
+//            By default every non-blank line is a program; with a separator,
+//            programs can span lines and are separated by lines consisting of
+//            just the separator. One line is written per program, in order.
+//            A single arena is rewound between programs rather than freed, so
+//            after the first few programs no memory is allocated at all.
+static void
+InterpretBatch(char *code, unsigned long long code_length, InterpreterOptions *options)
+{
+    MemoryArena arena = {0};
+    arena.backend = options->arena_backend;
+    arena.flags = options->arena_flags;
+    
+    EvaluationStack *stack = malloc(sizeof(*stack));
+    stack->arena = (MemoryArena){0};
+    EvaluationStackInit(stack, &options->limits);
+    
+    AbstractSyntaxTreeNodeTable node_table = {0};
+    Optimizer optimizer = {0};
+    OptimizerInit(&optimizer, &arena, options->inline_budget);
+    
+    OutputBuffer *output = malloc(sizeof(*output));
+    OutputBufferInit(output, 1);
+    
+    int separator_length = options->batch_separator ? (int)strlen(options->batch_separator) : 0;
+    char *at = code;
+    char *end = code + code_length;
+    
+    // NOTE(rjf): Every program starts from the snapshot's bindings, in tables
+    //            of its own, which go when the arena is reset for the next one.
+#if LETTUCE_POSIX
+    Snapshot snapshot = {0};
+    if(options->snapshot_path && !SnapshotLoad(&snapshot, options->snapshot_path, &arena, stack))
+    {
+        fprintf(stderr, "SNAPSHOT ERROR: %s\n", snapshot.error);
+        at = end;
+    }
+#endif
+    
+    while(at < end)
+    {
+        char *program_start = at;
+        char *program_end = end;
+        
+        for(;;)
+        {
+            char *line_start = at;
+            char *line_end = memchr(at, '\n', end - at);
+            if(!line_end)
+            {
+                line_end = end;
+            }
+            at = line_end < end ? line_end + 1 : end;
+            
+            if(!options->batch_separator)
+            {
+                program_end = line_end;
+                break;
+            }
+            
+            if(line_end > line_start && line_end[-1] == '\r')
+            {
+                --line_end;
+            }
+            if(line_end - line_start == separator_length &&
+               !memcmp(line_start, options->batch_separator, separator_length))
+            {
+                program_end = line_start;
+                break;
+            }
+            if(at == end)
+            {
+                program_end = end;
+                break;
+            }
+        }
+        
+        // NOTE(rjf): Blank lines (and empty programs) don't count as programs.
+        Tokenizer tokenizer = {0};
+        TokenizerInit(&tokenizer, program_start, program_end - program_start);
+        if(PeekToken(&tokenizer).type == TOKEN_invalid)
+        {
+            continue;
+        }
+        
+        MemoryArenaReset(&arena);
+        if(options->hash_cons)
+        {
+            AbstractSyntaxTreeNodeTableReset(&node_table);
+            tokenizer.node_table = &node_table;
+        }
+        ParseError error = {0};
+        AbstractSyntaxTreeNode *root = ParseExpression(&tokenizer, &arena, &error);
+        
+        if(error.string || !root)
+        {
+            OutputWriteF(output, "PARSE ERROR: %s\n", error.string ? error.string : "Not a valid expression.");
+            continue;
+        }
+        
+        // NOTE(rjf): The budget is per program, but the counts add up.
+        if(options->optimize)
+        {
+            optimizer.budget = options->inline_budget;
+            root = OptimizeAbstractSyntaxTree(&optimizer, root);
+        }
+        if(!options->no_escape_analysis)
+        {
+            EscapeAnalyzeAbstractSyntaxTree(root);
+        }
+        
+        InterpreterEnvironment environment = {0};
+        environment.arena = &arena;
+        environment.stack = stack;
+#if LETTUCE_POSIX
+        if(snapshot.base)
+        {
+            SnapshotBind(&snapshot, &environment);
+        }
+#endif
+        EvaluationResult result = EvaluateAbstractSyntaxTree(&environment, root);
+        OutputWriteEvaluationResult(output, result);
+    }
+    
+    OutputFlush(output);
+    free(output);
+    
+    if(options->print_optimizer_stats)
+    {
+        OptimizerPrintStats(&optimizer, stderr);
+    }
+    
+    if(options->print_memory_stats)
+    {
+        MemoryArenaPrintStats(&arena, stderr);
+        EvaluationStackPrintStats(stack, stderr);
+        if(options->hash_cons)
+        {
+            AbstractSyntaxTreeNodeTablePrintStats(&node_table, stderr);
+        }
+#if LETTUCE_POSIX
+        if(snapshot.base)
+        {
+            SnapshotPrintStats(&snapshot, stderr);
+        }
+#endif
+    }
+    
+    AbstractSyntaxTreeNodeTableCleanUp(&node_table);
+    EvaluationStackCleanUp(stack);
+    free(stack);
+    MemoryArenaCleanUp(&arena);
+#if LETTUCE_POSIX
+    SnapshotCleanUp(&snapshot);
+#endif
+}
+
+#if LETTUCE_POSIX
+// NOTE(rjf): The program is parsed once, like InterpretCode does, and then
+//            evaluated for every row of the CSV (see lettuce_pipeline.c). Returns
+//            0 if the program didn't parse or the pipeline failed.
+static int
+InterpretPipeline(char *code, unsigned long long code_length, InterpreterOptions *options, int thread_count)
+{
+    Tokenizer tokenizer = {0};
+    MemoryArena arena = {0};
+    arena.backend = options->arena_backend;
+    arena.flags = options->arena_flags;
+    TokenizerInit(&tokenizer, code, code_length);
+    
+    AbstractSyntaxTreeNodeTable node_table = {0};
+    if(options->hash_cons)
+    {
+        tokenizer.node_table = &node_table;
+    }
+    
+    ParseError error = {0};
+    AbstractSyntaxTreeNode *root = ParseExpression(&tokenizer, &arena, &error);
+    Optimizer optimizer = {0};
+    if(options->optimize && !error.string)
+    {
+        OptimizerInit(&optimizer, &arena, options->inline_budget);
+        root = OptimizeAbstractSyntaxTree(&optimizer, root);
+    }
+    if(!options->no_escape_analysis && !error.string)
+    {
+        EscapeAnalyzeAbstractSyntaxTree(root);
+    }
+    AbstractSyntaxTreeNodeTableCleanUp(&node_table);
+    
+    int success = 0;
+    if(error.string || !root)
+    {
+        fprintf(stderr, "PARSE ERROR: %s\n", error.string ? error.string : "Not a valid expression.");
+    }
+    else
+    {
+        success = RunPipeline(options->csv_path, root, &options->limits, thread_count, options->print_csv_stats);
+    }
+    
+    if(options->print_optimizer_stats && options->optimize)
+    {
+        OptimizerPrintStats(&optimizer, stderr);
+    }
+    if(options->print_memory_stats)
+    {
+        MemoryArenaPrintStats(&arena, stderr);
+    }
+    MemoryArenaCleanUp(&arena);
+    return success;
+}
+#endif
+
+static void
+PrintUsage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [--arena <virtual|chunked>] [--huge-pages]\n"
+            "       [--batch] [--batch-separator <line>]\n"
+            "       [--gc] [--gc-stats] [--gc-nursery-size <bytes>]\n"
+            "       [--max-depth <frames>] [--fuel <nodes>] [--max-memory <bytes>] [--deadline <milliseconds>]\n"
+            "       [--hash-cons] [--optimize] [--optimize-stats] [--inline-budget <nodes>] [--no-escape-analysis]\n"
+            "       [--emit-c <file>] [--compile] [--tier] [--tier-threshold <calls>] [--tier-log]\n"
+            "       [--snapshot <image>] [--snapshot-save <image>]\n"
+            "       [--csv <file, or - for stdin>] [--csv-stats] [--threads <count>]\n"
+            "       [--mem-stats] [--counters] [-q] [--ast-format <source|sexpr|indented|json>]\n"
+            "       [--profile] [--profile-top <count>] [--profile-stacks <file>] <lettuce file, or - for stdin>\n", program_name);
+#if LETTUCE_POSIX
+    fprintf(stderr, "       %s --serve <socket path> [--threads <count>] [--slice <nodes>]\n"
+            "       [--max-depth <frames>] [--fuel <nodes>] [--max-memory <bytes>] [--deadline <milliseconds>]\n", program_name);
+#endif
 }
 
 int
 main(int argument_count, char **arguments)
 {
-    if(argument_count > 1)
+    char *filename = 0;
+    char *serve_socket_path = 0;
+    int thread_count = 0;
+    unsigned long long slice_nodes = 0;
+    InterpreterOptions options = {0};
+    options.profile_top_count = 20;
+    options.inline_budget = OPTIMIZER_DEFAULT_BUDGET;
+    
+    for(int i = 1; i < argument_count; ++i)
+    {
+        if(!strcmp(arguments[i], "--arena") && i+1 < argument_count)
+        {
+            ++i;
+            if(!strcmp(arguments[i], "virtual"))
+            {
+                options.arena_backend = MEMORY_ARENA_BACKEND_virtual;
+            }
+            else if(!strcmp(arguments[i], "chunked"))
+            {
+                options.arena_backend = MEMORY_ARENA_BACKEND_chunked;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown arena backend \"%s\".\n", arguments[i]);
+                return 1;
+            }
+        }
+        else if(!strcmp(arguments[i], "--huge-pages"))
+        {
+            options.arena_flags |= MEMORY_ARENA_FLAG_huge_pages;
+        }
+        else if(!strcmp(arguments[i], "--gc"))
+        {
+            options.use_garbage_collector = 1;
+        }
+        else if(!strcmp(arguments[i], "--gc-stats"))
+        {
+            options.use_garbage_collector = 1;
+            options.print_garbage_collector_stats = 1;
+        }
+        else if(!strcmp(arguments[i], "--gc-nursery-size") && i+1 < argument_count)
+        {
+            options.use_garbage_collector = 1;
+            options.nursery_size = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--max-depth") && i+1 < argument_count)
+        {
+            options.limits.max_depth = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--fuel") && i+1 < argument_count)
+        {
+            options.limits.max_fuel = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--max-memory") && i+1 < argument_count)
+        {
+            options.limits.max_bytes = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--deadline") && i+1 < argument_count)
+        {
+            options.limits.deadline_milliseconds = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--counters"))
+        {
+            options.print_counters = 1;
+        }
+        else if(!strcmp(arguments[i], "-q") || !strcmp(arguments[i], "--quiet"))
+        {
+            options.quiet = 1;
+        }
+        else if(!strcmp(arguments[i], "--ast-format") && i+1 < argument_count)
+        {
+            ++i;
+            options.print_format = -1;
+            for(int format = 0; format < ABSTRACT_SYNTAX_TREE_PRINT_FORMAT_COUNT; ++format)
+            {
+                if(!strcmp(arguments[i], abstract_syntax_tree_print_format_names[format]))
+                {
+                    options.print_format = format;
+                }
+            }
+            if(options.print_format < 0)
+            {
+                fprintf(stderr, "Unknown AST format \"%s\".\n", arguments[i]);
+                return 1;
+            }
+        }
+        else if(!strcmp(arguments[i], "--batch"))
+        {
+            options.batch = 1;
+        }
+        else if(!strcmp(arguments[i], "--batch-separator") && i+1 < argument_count)
+        {
+            options.batch = 1;
+            options.batch_separator = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--optimize"))
+        {
+            options.optimize = 1;
+        }
+        else if(!strcmp(arguments[i], "--optimize-stats"))
+        {
+            options.optimize = 1;
+            options.print_optimizer_stats = 1;
+        }
+        else if(!strcmp(arguments[i], "--inline-budget") && i+1 < argument_count)
+        {
+            options.inline_budget = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--no-escape-analysis"))
+        {
+            options.no_escape_analysis = 1;
+        }
+        else if(!strcmp(arguments[i], "--emit-c") && i+1 < argument_count)
+        {
+            options.emit_c_path = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--compile"))
+        {
+            options.compile = 1;
+        }
+        else if(!strcmp(arguments[i], "--tier"))
+        {
+            options.tier = 1;
+        }
+        else if(!strcmp(arguments[i], "--tier-threshold") && i+1 < argument_count)
+        {
+            options.tier = 1;
+            options.tier_threshold = strtoull(arguments[++i], 0, 10);
+        }
+        else if(!strcmp(arguments[i], "--tier-log"))
+        {
+            options.tier = 1;
+            options.tier_log = 1;
+        }
+        else if(!strcmp(arguments[i], "--snapshot") && i+1 < argument_count)
+        {
+            options.snapshot_path = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--snapshot-save") && i+1 < argument_count)
+        {
+            options.snapshot_save_path = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--hash-cons"))
+        {
+            options.hash_cons = 1;
+        }
+        else if(!strcmp(arguments[i], "--mem-stats"))
+        {
+            options.print_memory_stats = 1;
+        }
+        else if(!strcmp(arguments[i], "--profile"))
+        {
+            options.profile = 1;
+        }
+        else if(!strcmp(arguments[i], "--profile-top") && i+1 < argument_count)
+        {
+            options.profile = 1;
+            options.profile_top_count = atoi(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--profile-stacks") && i+1 < argument_count)
+        {
+            options.profile = 1;
+            options.profile_stacks_path = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--csv") && i+1 < argument_count)
+        {
+            options.csv_path = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--csv-stats"))
+        {
+            options.print_csv_stats = 1;
+        }
+        else if(!strcmp(arguments[i], "--serve") && i+1 < argument_count)
+        {
+            serve_socket_path = arguments[++i];
+        }
+        else if(!strcmp(arguments[i], "--threads") && i+1 < argument_count)
+        {
+            thread_count = atoi(arguments[++i]);
+        }
+        else if(!strcmp(arguments[i], "--slice") && i+1 < argument_count)
+        {
+            slice_nodes = strtoull(arguments[++i], 0, 10);
+        }
+        else if(arguments[i][0] == '-' && arguments[i][1] == '-')
+        {
+            fprintf(stderr, "Unknown option \"%s\".\n", arguments[i]);
+            PrintUsage(arguments[0]);
+            return 1;
+        }
+        else
+        {
+            filename = arguments[i];
+        }
+    }
+    
+#if !LETTUCE_PROFILE
+    if(options.profile)
+    {
+        fprintf(stderr, "FATAL ERROR: This build doesn't include the profiler. Use lettuce_profile, "
+                "or build with -DLETTUCE_PROFILE=1.\n");
+        return 1;
+    }
+#endif
+    
+    if(options.batch && (options.use_garbage_collector || options.profile || options.print_counters))
+    {
+        fprintf(stderr, "FATAL ERROR: --gc, --profile and --counters can't be used with --batch.\n");
+        return 1;
+    }
+    
+    if((options.emit_c_path || options.compile) &&
+       (options.batch || options.use_garbage_collector || options.profile || options.limits.max_fuel))
+    {
+        fprintf(stderr, "FATAL ERROR: --emit-c and --compile can't be used with --batch, --gc, --profile or --fuel.\n");
+        return 1;
+    }
+    
+    if(options.tier &&
+       (options.batch || options.use_garbage_collector || options.profile || options.limits.max_fuel ||
+        options.emit_c_path || options.compile))
+    {
+        fprintf(stderr, "FATAL ERROR: --tier can't be used with --batch, --gc, --profile, --fuel, --emit-c or --compile.\n");
+        return 1;
+    }
+    
+    if(options.snapshot_save_path &&
+       (options.snapshot_path || options.batch || options.use_garbage_collector || options.profile ||
+        options.optimize || options.emit_c_path || options.compile || options.tier))
+    {
+        fprintf(stderr, "FATAL ERROR: --snapshot-save can't be used with --snapshot, --batch, --gc, --profile, "
+                "--optimize, --emit-c, --compile or --tier.\n");
+        return 1;
+    }
+    
+    if(options.snapshot_path &&
+       (options.use_garbage_collector || options.profile || options.emit_c_path || options.compile))
+    {
+        fprintf(stderr, "FATAL ERROR: --snapshot can't be used with --gc, --profile, --emit-c or --compile.\n");
+        return 1;
+    }
+    
+#if !LETTUCE_POSIX
+    if(options.snapshot_path || options.snapshot_save_path)
+    {
+        fprintf(stderr, "FATAL ERROR: Snapshots are not supported on this platform.\n");
+        return 1;
+    }
+#endif
+    
+    if(options.csv_path &&
+       (options.batch || options.use_garbage_collector || options.profile || options.print_counters ||
+        options.emit_c_path || options.compile || options.tier || options.snapshot_path || options.snapshot_save_path))
+    {
+        fprintf(stderr, "FATAL ERROR: --csv can't be used with --batch, --gc, --profile, --counters, --emit-c, "
+                "--compile, --tier, --snapshot or --snapshot-save.\n");
+        return 1;
+    }
+    
+    if(options.csv_path && filename && !strcmp(options.csv_path, "-") && !strcmp(filename, "-"))
+    {
+        fprintf(stderr, "FATAL ERROR: The program and the CSV can't both be read from standard input.\n");
+        return 1;
+    }
+    
+#if !LETTUCE_POSIX
+    if(options.csv_path)
+    {
+        fprintf(stderr, "FATAL ERROR: The CSV pipeline is not supported on this platform.\n");
+        return 1;
+    }
+#endif
+    
+#if !LETTUCE_TIER
+    if(options.tier)
+    {
+        fprintf(stderr, "FATAL ERROR: Tiered execution is not supported on this platform.\n");
+        return 1;
+    }
+#endif
+    
+#if !LETTUCE_POSIX
+    if(options.emit_c_path || options.compile)
+    {
+        fprintf(stderr, "FATAL ERROR: Compiling to C is not supported on this platform.\n");
+        return 1;
+    }
+#endif
+    
+    // NOTE(rjf): Only a failed CSV pipeline exits with an error, so that scripts
+    //            feeding it can tell its output is incomplete.
+    int exit_code = 0;
+    
+    if(serve_socket_path)
+    {
+#if LETTUCE_POSIX
+        return RunServer(serve_socket_path, thread_count, &options.limits, slice_nodes);
+#else
+        fprintf(stderr, "FATAL ERROR: Server mode is not supported on this platform.\n");
+        return 1;
+#endif
+    }
+    else if(filename && !strcmp(filename, "-"))
+    {
+        unsigned long long size = 0;
+        char *code = LoadEntireFile(stdin, &size);
+        if(code)
+        {
+            if(options.csv_path)
+            {
+#if LETTUCE_POSIX
+                exit_code = !InterpretPipeline(code, size, &options, thread_count);
+#endif
+            }
+            else if(options.batch)
+            {
+                InterpretBatch(code, size, &options);
+            }
+            else
+            {
+                InterpretCode(code, size, &options);
+            }
+            free(code);
+        }
+        else
+        {
+            fprintf(stderr, "FATAL ERROR: Standard input could not be read.\n");
+        }
+    }
+    else if(filename)
     {
-        char *lettuce_file = LoadEntireFileAndNullTerminate(arguments[1]);
-        if(lettuce_file)
+        SourceFile lettuce_file = {0};
+        if(SourceFileLoad(&lettuce_file, filename))
         {
-            InterpretCode(lettuce_file);
+            if(options.csv_path)
+            {
+#if LETTUCE_POSIX
+                exit_code = !InterpretPipeline(lettuce_file.data, lettuce_file.size, &options, thread_count);
+#endif
+            }
+            else if(options.batch)
+            {
+                InterpretBatch(lettuce_file.data, lettuce_file.size, &options);
+            }
+            else
+            {
+                InterpretCode(lettuce_file.data, lettuce_file.size, &options);
+            }
+            SourceFileUnload(&lettuce_file);
         }
         else
         {
-            fprintf(stderr, "FATAL ERROR: \"%s\" could not be loaded.\n", arguments[1]);
+            fprintf(stderr, "FATAL ERROR: \"%s\" could not be loaded.\n", filename);
         }
     }
     else
     {
-        fprintf(stderr, "Usage: %s <lettuce file>\n", arguments[0]);
+        PrintUsage(arguments[0]);
     }
-    return 0;
+    return exit_code;
 }
\ No newline at end of file
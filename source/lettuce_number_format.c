@@ -0,0 +1,428 @@
+// NOTE(rjf): Turns doubles into the shortest decimal strings that read back as
+//            the same double, without going through printf (which is slow, and
+//            looks at the locale). The digits come from Grisu3, by Florian
+//            Loitsch, which works in 64-bit fixed point with a cached power of
+//            ten, and knows when its answer might not be the shortest. For those
+//            (about half a percent of doubles), it falls back to trying %.*e
+//            with more and more digits until one reads back exactly.
+
+#define NUMBER_FORMAT_MAX_LENGTH 400
+
+enum
+{
+    // NOTE(rjf): Like %g: fixed or exponential notation, whichever %.15g (or
+    //            %.17g, for numbers that need more than 15 digits) would use.
+    NUMBER_FORMAT_STYLE_general,
+    
+    // NOTE(rjf): Always fixed notation, which the tokenizer can read back.
+    NUMBER_FORMAT_STYLE_fixed,
+};
+
+typedef struct NumberFormatFloat
+{
+    unsigned long long f;
+    int e;
+}
+NumberFormatFloat;
+
+typedef struct NumberFormatCachedPower
+{
+    unsigned long long f;
+    short e;
+    short decimal_exponent;
+}
+NumberFormatCachedPower;
+
+// NOTE(rjf): 10^k, for k = -348, -340, ..., 340, rounded to 64 bits.
+static NumberFormatCachedPower number_format_cached_powers[] =
+{
+    {0xfa8fd5a0081c0288ull, -1220, -348},
+    {0xbaaee17fa23ebf76ull, -1193, -340},
+    {0x8b16fb203055ac76ull, -1166, -332},
+    {0xcf42894a5dce35eaull, -1140, -324},
+    {0x9a6bb0aa55653b2dull, -1113, -316},
+    {0xe61acf033d1a45dfull, -1087, -308},
+    {0xab70fe17c79ac6caull, -1060, -300},
+    {0xff77b1fcbebcdc4full, -1034, -292},
+    {0xbe5691ef416bd60cull, -1007, -284},
+    {0x8dd01fad907ffc3cull, -980, -276},
+    {0xd3515c2831559a83ull, -954, -268},
+    {0x9d71ac8fada6c9b5ull, -927, -260},
+    {0xea9c227723ee8bcbull, -901, -252},
+    {0xaecc49914078536dull, -874, -244},
+    {0x823c12795db6ce57ull, -847, -236},
+    {0xc21094364dfb5637ull, -821, -228},
+    {0x9096ea6f3848984full, -794, -220},
+    {0xd77485cb25823ac7ull, -768, -212},
+    {0xa086cfcd97bf97f4ull, -741, -204},
+    {0xef340a98172aace5ull, -715, -196},
+    {0xb23867fb2a35b28eull, -688, -188},
+    {0x84c8d4dfd2c63f3bull, -661, -180},
+    {0xc5dd44271ad3cdbaull, -635, -172},
+    {0x936b9fcebb25c996ull, -608, -164},
+    {0xdbac6c247d62a584ull, -582, -156},
+    {0xa3ab66580d5fdaf6ull, -555, -148},
+    {0xf3e2f893dec3f126ull, -529, -140},
+    {0xb5b5ada8aaff80b8ull, -502, -132},
+    {0x87625f056c7c4a8bull, -475, -124},
+    {0xc9bcff6034c13053ull, -449, -116},
+    {0x964e858c91ba2655ull, -422, -108},
+    {0xdff9772470297ebdull, -396, -100},
+    {0xa6dfbd9fb8e5b88full, -369, -92},
+    {0xf8a95fcf88747d94ull, -343, -84},
+    {0xb94470938fa89bcfull, -316, -76},
+    {0x8a08f0f8bf0f156bull, -289, -68},
+    {0xcdb02555653131b6ull, -263, -60},
+    {0x993fe2c6d07b7facull, -236, -52},
+    {0xe45c10c42a2b3b06ull, -210, -44},
+    {0xaa242499697392d3ull, -183, -36},
+    {0xfd87b5f28300ca0eull, -157, -28},
+    {0xbce5086492111aebull, -130, -20},
+    {0x8cbccc096f5088ccull, -103, -12},
+    {0xd1b71758e219652cull, -77, -4},
+    {0x9c40000000000000ull, -50, 4},
+    {0xe8d4a51000000000ull, -24, 12},
+    {0xad78ebc5ac620000ull, 3, 20},
+    {0x813f3978f8940984ull, 30, 28},
+    {0xc097ce7bc90715b3ull, 56, 36},
+    {0x8f7e32ce7bea5c70ull, 83, 44},
+    {0xd5d238a4abe98068ull, 109, 52},
+    {0x9f4f2726179a2245ull, 136, 60},
+    {0xed63a231d4c4fb27ull, 162, 68},
+    {0xb0de65388cc8ada8ull, 189, 76},
+    {0x83c7088e1aab65dbull, 216, 84},
+    {0xc45d1df942711d9aull, 242, 92},
+    {0x924d692ca61be758ull, 269, 100},
+    {0xda01ee641a708deaull, 295, 108},
+    {0xa26da3999aef774aull, 322, 116},
+    {0xf209787bb47d6b85ull, 348, 124},
+    {0xb454e4a179dd1877ull, 375, 132},
+    {0x865b86925b9bc5c2ull, 402, 140},
+    {0xc83553c5c8965d3dull, 428, 148},
+    {0x952ab45cfa97a0b3ull, 455, 156},
+    {0xde469fbd99a05fe3ull, 481, 164},
+    {0xa59bc234db398c25ull, 508, 172},
+    {0xf6c69a72a3989f5cull, 534, 180},
+    {0xb7dcbf5354e9beceull, 561, 188},
+    {0x88fcf317f22241e2ull, 588, 196},
+    {0xcc20ce9bd35c78a5ull, 614, 204},
+    {0x98165af37b2153dfull, 641, 212},
+    {0xe2a0b5dc971f303aull, 667, 220},
+    {0xa8d9d1535ce3b396ull, 694, 228},
+    {0xfb9b7cd9a4a7443cull, 720, 236},
+    {0xbb764c4ca7a44410ull, 747, 244},
+    {0x8bab8eefb6409c1aull, 774, 252},
+    {0xd01fef10a657842cull, 800, 260},
+    {0x9b10a4e5e9913129ull, 827, 268},
+    {0xe7109bfba19c0c9dull, 853, 276},
+    {0xac2820d9623bf429ull, 880, 284},
+    {0x80444b5e7aa7cf85ull, 907, 292},
+    {0xbf21e44003acdd2dull, 933, 300},
+    {0x8e679c2f5e44ff8full, 960, 308},
+    {0xd433179d9c8cb841ull, 986, 316},
+    {0x9e19db92b4e31ba9ull, 1013, 324},
+    {0xeb96bf6ebadf77d9ull, 1039, 332},
+    {0xaf87023b9bf0ee6bull, 1066, 340},
+};
+
+#define NUMBER_FORMAT_CACHED_POWERS_OFFSET 348
+#define NUMBER_FORMAT_CACHED_POWERS_STEP 8
+
+static NumberFormatFloat
+NumberFormatMultiply(NumberFormatFloat a, NumberFormatFloat b)
+{
+    // NOTE(rjf): The top 64 bits of the 128-bit product, rounded.
+    unsigned long long low_mask = 0xffffffffull;
+    unsigned long long a_high = a.f >> 32;
+    unsigned long long a_low = a.f & low_mask;
+    unsigned long long b_high = b.f >> 32;
+    unsigned long long b_low = b.f & low_mask;
+    unsigned long long high_high = a_high * b_high;
+    unsigned long long low_high = a_low * b_high;
+    unsigned long long high_low = a_high * b_low;
+    unsigned long long low_low = a_low * b_low;
+    unsigned long long middle = (low_low >> 32) + (high_low & low_mask) + (low_high & low_mask) + (1ull << 31);
+    
+    NumberFormatFloat result;
+    result.f = high_high + (high_low >> 32) + (low_high >> 32) + (middle >> 32);
+    result.e = a.e + b.e + 64;
+    return result;
+}
+
+static NumberFormatFloat
+NumberFormatNormalize(NumberFormatFloat x)
+{
+    while(!(x.f & (1ull << 63)))
+    {
+        x.f <<= 1;
+        --x.e;
+    }
+    return x;
+}
+
+// NOTE(rjf): Moves the last digit down while that gets closer to w, and then
+//            says whether the digits are certain to be right, given that every
+//            scaled value can be off by unit.
+static int
+NumberFormatRoundWeed(char *digits, int length, unsigned long long distance_too_high_w,
+                      unsigned long long unsafe_interval, unsigned long long rest,
+                      unsigned long long ten_kappa, unsigned long long unit)
+{
+    unsigned long long small_distance = distance_too_high_w - unit;
+    unsigned long long big_distance = distance_too_high_w + unit;
+    
+    while(rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+          (rest + ten_kappa < small_distance ||
+           small_distance - rest >= rest + ten_kappa - small_distance))
+    {
+        --digits[length-1];
+        rest += ten_kappa;
+    }
+    
+    if(rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+       (rest + ten_kappa < big_distance ||
+        big_distance - rest > rest + ten_kappa - big_distance))
+    {
+        return 0;
+    }
+    
+    return 2*unit <= rest && rest <= unsafe_interval - 4*unit;
+}
+
+// NOTE(rjf): Writes the shortest digits of a positive, finite value, and the
+//            power of ten they're multiplied by, or returns 0 when it can't be
+//            sure they're the shortest.
+static int
+NumberFormatGrisu3(double value, char *digits, int *length, int *decimal_exponent)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned long long significand = bits & ((1ull << 52) - 1);
+    int biased_exponent = (int)((bits >> 52) & 0x7ff);
+    
+    NumberFormatFloat v;
+    if(biased_exponent)
+    {
+        v.f = significand | (1ull << 52);
+        v.e = biased_exponent - 1075;
+    }
+    else
+    {
+        v.f = significand;
+        v.e = -1074;
+    }
+    
+    // NOTE(rjf): The boundaries halfway to the neighbouring doubles, which are
+    //            closer below powers of two.
+    NumberFormatFloat plus = { (v.f << 1) + 1, v.e - 1 };
+    plus = NumberFormatNormalize(plus);
+    NumberFormatFloat minus;
+    if(significand == 0 && biased_exponent > 1)
+    {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }
+    else
+    {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    NumberFormatFloat w = NumberFormatNormalize(v);
+    
+    // NOTE(rjf): Picks the power of ten that puts w's exponent in [-60, -32].
+    double minimum_k = (-61 - w.e) * 0.30102999566398114;
+    int k = (int)minimum_k;
+    if(k < minimum_k)
+    {
+        ++k;
+    }
+    int index = (NUMBER_FORMAT_CACHED_POWERS_OFFSET + k - 1) / NUMBER_FORMAT_CACHED_POWERS_STEP + 1;
+    NumberFormatCachedPower cached = number_format_cached_powers[index];
+    NumberFormatFloat power = { cached.f, cached.e };
+    
+    NumberFormatFloat scaled_w = NumberFormatMultiply(w, power);
+    NumberFormatFloat low = NumberFormatMultiply(minus, power);
+    NumberFormatFloat high = NumberFormatMultiply(plus, power);
+    
+    // NOTE(rjf): Every product can be off by one, so only digits that land in
+    //            the interval even when it's narrowed by that on both sides can
+    //            be trusted.
+    unsigned long long unit = 1;
+    NumberFormatFloat too_low = { low.f - unit, low.e };
+    NumberFormatFloat too_high = { high.f + unit, high.e };
+    unsigned long long unsafe_interval = too_high.f - too_low.f;
+    int one_shift = -scaled_w.e;
+    unsigned long long one = 1ull << one_shift;
+    unsigned int integrals = (unsigned int)(too_high.f >> one_shift);
+    unsigned long long fractionals = too_high.f & (one - 1);
+    
+    unsigned int divisor = 1;
+    int kappa = 0;
+    if(integrals)
+    {
+        kappa = 1;
+        while(kappa < 10 && integrals / divisor >= 10)
+        {
+            divisor *= 10;
+            ++kappa;
+        }
+    }
+    
+    *length = 0;
+    while(kappa > 0)
+    {
+        digits[(*length)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        --kappa;
+        unsigned long long rest = ((unsigned long long)integrals << one_shift) + fractionals;
+        if(rest < unsafe_interval)
+        {
+            *decimal_exponent = -cached.decimal_exponent + kappa;
+            return NumberFormatRoundWeed(digits, *length, too_high.f - scaled_w.f, unsafe_interval, rest,
+                                         (unsigned long long)divisor << one_shift, unit);
+        }
+        divisor /= 10;
+    }
+    
+    for(;;)
+    {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digits[(*length)++] = (char)('0' + (fractionals >> one_shift));
+        fractionals &= one - 1;
+        --kappa;
+        if(fractionals < unsafe_interval)
+        {
+            *decimal_exponent = -cached.decimal_exponent + kappa;
+            return NumberFormatRoundWeed(digits, *length, (too_high.f - scaled_w.f) * unit, unsafe_interval,
+                                         fractionals, one, unit);
+        }
+    }
+}
+
+// NOTE(rjf): The slow path, for when Grisu3 isn't sure.
+static void
+NumberFormatShortestWithPrintf(double value, char *digits, int *length, int *decimal_exponent)
+{
+    char buffer[32];
+    for(int precision = 1; precision <= 17; ++precision)
+    {
+        snprintf(buffer, sizeof(buffer), "%.*e", precision-1, value);
+        if(strtod(buffer, 0) == value || precision == 17)
+        {
+            break;
+        }
+    }
+    
+    // NOTE(rjf): buffer is d.ddde[+-]xx, or just de[+-]xx.
+    char *at = buffer;
+    *length = 0;
+    for(; *at != 'e'; ++at)
+    {
+        if(*at != '.')
+        {
+            digits[(*length)++] = *at;
+        }
+    }
+    *decimal_exponent = atoi(at+1) - (*length - 1);
+    while(*length > 1 && digits[*length-1] == '0')
+    {
+        --*length;
+        ++*decimal_exponent;
+    }
+}
+
+// NOTE(rjf): Writes value into buffer, which must have room for
+//            NUMBER_FORMAT_MAX_LENGTH characters, and returns how many were
+//            written. The result isn't null-terminated.
+static int
+NumberFormat(char *buffer, double value, int style)
+{
+    int length = 0;
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    if(bits >> 63)
+    {
+        buffer[length++] = '-';
+        value = -value;
+    }
+    
+    if(value != value)
+    {
+        memcpy(buffer + length, "nan", 3);
+        length += 3;
+    }
+    else if(value > 1.7976931348623157e308)
+    {
+        memcpy(buffer + length, "inf", 3);
+        length += 3;
+    }
+    else if(value == 0)
+    {
+        buffer[length++] = '0';
+    }
+    else
+    {
+        char digits[20];
+        int digit_count = 0;
+        int decimal_exponent = 0;
+        if(!NumberFormatGrisu3(value, digits, &digit_count, &decimal_exponent))
+        {
+            NumberFormatShortestWithPrintf(value, digits, &digit_count, &decimal_exponent);
+        }
+        
+        // NOTE(rjf): The exponent of the first digit, as in d.ddd * 10^exponent.
+        int exponent = decimal_exponent + digit_count - 1;
+        int precision = digit_count <= 15 ? 15 : 17;
+        
+        if(style == NUMBER_FORMAT_STYLE_general && (exponent < -4 || exponent >= precision))
+        {
+            buffer[length++] = digits[0];
+            if(digit_count > 1)
+            {
+                buffer[length++] = '.';
+                memcpy(buffer + length, digits + 1, digit_count - 1);
+                length += digit_count - 1;
+            }
+            buffer[length++] = 'e';
+            buffer[length++] = exponent < 0 ? '-' : '+';
+            int magnitude = exponent < 0 ? -exponent : exponent;
+            if(magnitude >= 100)
+            {
+                buffer[length++] = (char)('0' + magnitude / 100);
+            }
+            buffer[length++] = (char)('0' + magnitude / 10 % 10);
+            buffer[length++] = (char)('0' + magnitude % 10);
+        }
+        else if(exponent < 0)
+        {
+            buffer[length++] = '0';
+            buffer[length++] = '.';
+            memset(buffer + length, '0', -exponent - 1);
+            length += -exponent - 1;
+            memcpy(buffer + length, digits, digit_count);
+            length += digit_count;
+        }
+        else if(exponent + 1 >= digit_count)
+        {
+            memcpy(buffer + length, digits, digit_count);
+            length += digit_count;
+            memset(buffer + length, '0', exponent + 1 - digit_count);
+            length += exponent + 1 - digit_count;
+        }
+        else
+        {
+            memcpy(buffer + length, digits, exponent + 1);
+            length += exponent + 1;
+            buffer[length++] = '.';
+            memcpy(buffer + length, digits + exponent + 1, digit_count - exponent - 1);
+            length += digit_count - exponent - 1;
+        }
+    }
+    
+    return length;
+}
@@ -0,0 +1,788 @@
+// NOTE(rjf): The optimizer, an optional pass over the tree between parsing and
+//            evaluation that removes function calls:
+//
+//            - A function literal that's applied right away,
+//              (function(x) body)(argument), becomes
+//              let x = argument in body, which evaluates the same, minus
+//              duplicating the environment for a closure. When the argument
+//              is a constant, or an identifier that body uses, it's put in
+//              place of x instead, and there's no let at all.
+//            - Calls to a function bound by a let,
+//              let f = function(x) body in ... f(argument) ..., are replaced
+//              the same way, when the function is called only once, or is
+//              small enough and the size budget isn't used up yet. If f isn't
+//              referred to at all anymore after that, its let goes away too.
+//
+//            Environments are flat tables, and a let deletes its name when it
+//            ends, so an inlined body's bindings can't be allowed to land on
+//            names the caller's environment already has. Every name that an
+//            inlined body binds is renamed to a fresh one (x becomes x#1, and
+//            so on), and a function isn't inlined anywhere one of the names it
+//            uses has been bound to something else since its let.
+//
+//            Nodes are never changed in place. Rewritten parts of the tree are
+//            new nodes, and the parts that didn't change are shared with the
+//            original, so this works on hash-consed trees as well.
+
+#define OPTIMIZER_MAX_DEPTH 4096
+#define OPTIMIZER_SMALL_FUNCTION_SIZE 16
+#define OPTIMIZER_DEFAULT_BUDGET 4096
+
+typedef struct OptimizerName
+{
+    char *string;
+    int string_length;
+}
+OptimizerName;
+
+// NOTE(rjf): A function bound by a let, which calls might be inlined from.
+typedef struct OptimizerFunction
+{
+    AbstractSyntaxTreeNode *definition;
+    unsigned long long size;
+    unsigned long long use_count;
+    unsigned long long inlined_count;
+    
+    // NOTE(rjf): Identifiers the function refers to that it doesn't bind itself.
+    OptimizerName *free_names;
+    unsigned int free_name_count;
+    unsigned int free_name_cap;
+}
+OptimizerFunction;
+
+// NOTE(rjf): A name bound by a let or a function, on the way down the tree.
+//            When copying an inlined body, replacement is what its uses turn
+//            into (a renamed identifier, or the argument).
+typedef struct OptimizerBinding OptimizerBinding;
+typedef struct OptimizerBinding
+{
+    OptimizerBinding *parent;
+    char *string;
+    int string_length;
+    OptimizerFunction *function;
+    AbstractSyntaxTreeNode *replacement;
+}
+OptimizerBinding;
+
+typedef struct Optimizer
+{
+    MemoryArena *arena;
+    unsigned long long budget;
+    unsigned int fresh_name_count;
+    
+    // NOTE(rjf): The optimizer recurses, so it stops going deeper than
+    //            OPTIMIZER_MAX_DEPTH. Anything below that is left as it is, and
+    //            analyses that get cut off set too_deep, so nothing is inlined
+    //            based on them.
+    unsigned int depth;
+    int too_deep;
+    
+    unsigned long long applied_function_count;
+    unsigned long long inlined_call_count;
+    unsigned long long removed_function_count;
+    unsigned long long inlined_node_count;
+}
+Optimizer;
+
+static void
+OptimizerInit(Optimizer *optimizer, MemoryArena *arena, unsigned long long budget)
+{
+    memset(optimizer, 0, sizeof(*optimizer));
+    optimizer->arena = arena;
+    optimizer->budget = budget;
+}
+
+static void
+OptimizerPrintStats(Optimizer *optimizer, FILE *file)
+{
+    fprintf(file, "optimizer: %llu call sites eliminated (%llu applied function literals, %llu calls to let-bound functions)\n",
+            optimizer->applied_function_count + optimizer->inlined_call_count,
+            optimizer->applied_function_count, optimizer->inlined_call_count);
+    fprintf(file, "optimizer: %llu functions removed, %llu nodes inlined, %llu nodes of budget left\n",
+            optimizer->removed_function_count, optimizer->inlined_node_count, optimizer->budget);
+}
+
+static int
+OptimizerEnter(Optimizer *optimizer)
+{
+    int entered = 0;
+    if(optimizer->depth < OPTIMIZER_MAX_DEPTH)
+    {
+        ++optimizer->depth;
+        entered = 1;
+    }
+    else
+    {
+        optimizer->too_deep = 1;
+    }
+    return entered;
+}
+
+static unsigned int
+OptimizerChildCount(AbstractSyntaxTreeNode *node)
+{
+    unsigned int count = 0;
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_let:                 { count = 2; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:     { count = 2; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:      { count = 1; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:        { count = 3; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_definition: { count = 1; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_call:       { count = 2; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_array_literal:       { count = node->array_literal.element_count; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_index:               { count = 2; break; }
+        default: break;
+    }
+    return count;
+}
+
+static AbstractSyntaxTreeNode **
+OptimizerChildSlot(AbstractSyntaxTreeNode *node, unsigned int index)
+{
+    AbstractSyntaxTreeNode **slot = 0;
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_let:
+        {
+            slot = index ? &node->let.body_expression : &node->let.binding_expression;
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+        {
+            slot = index ? &node->binary_operator.right : &node->binary_operator.left;
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+        {
+            slot = &node->unary_operator.expression;
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+        {
+            slot = (index == 0 ? &node->if_then_else.condition :
+                    index == 1 ? &node->if_then_else.pass_code :
+                    &node->if_then_else.fail_code);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+        {
+            slot = &node->function_definition.body;
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+        {
+            slot = index ? &node->function_call.parameter : &node->function_call.closure;
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+        {
+            slot = node->array_literal.elements + index;
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_index:
+        {
+            slot = index ? &node->index.index : &node->index.array;
+            break;
+        }
+        default: break;
+    }
+    return slot;
+}
+
+// NOTE(rjf): A let's body and a function's body are evaluated with a name bound
+//            that isn't bound outside of them.
+static OptimizerName
+OptimizerChildBinding(AbstractSyntaxTreeNode *node, unsigned int index)
+{
+    OptimizerName name = {0};
+    if(node->type == ABSTRACT_SYNTAX_TREE_NODE_let && index == 1)
+    {
+        name.string = node->let.string;
+        name.string_length = node->let.string_length;
+    }
+    else if(node->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+    {
+        name.string = node->function_definition.param_name;
+        name.string_length = node->function_definition.param_name_length;
+    }
+    return name;
+}
+
+// NOTE(rjf): A let rec group's names are bound in all of its bindings as well
+//            as its body, so groups are handled as a whole, at the let that
+//            starts them, rather than a child at a time. This links the group's
+//            names up in bindings, which has room for all of them, and returns
+//            the innermost.
+static OptimizerBinding *
+OptimizerBindGroup(AbstractSyntaxTreeNode *node, unsigned int count, OptimizerBinding *parent,
+                   OptimizerBinding *bindings)
+{
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+        bindings[i] = (OptimizerBinding){ i ? bindings + i - 1 : parent, let->let.string, let->let.string_length };
+    }
+    return bindings + count - 1;
+}
+
+static AbstractSyntaxTreeNode *
+OptimizerCopyNode(Optimizer *optimizer, AbstractSyntaxTreeNode *node)
+{
+    AbstractSyntaxTreeNode *copy = MemoryArenaAllocateNode(optimizer->arena);
+    *copy = *node;
+    if(node->type == ABSTRACT_SYNTAX_TREE_NODE_array_literal && node->array_literal.element_count)
+    {
+        unsigned int size = sizeof(node->array_literal.elements[0]) * node->array_literal.element_count;
+        copy->array_literal.elements = MemoryArenaAllocate(optimizer->arena, size, MEMORY_ARENA_CATEGORY_ast_nodes);
+        MemoryCopy(copy->array_literal.elements, node->array_literal.elements, size);
+    }
+    return copy;
+}
+
+// NOTE(rjf): Returns node with its index-th child replaced, copying node first
+//            unless it's already a copy (made since original).
+static AbstractSyntaxTreeNode *
+OptimizerReplaceChild(Optimizer *optimizer, AbstractSyntaxTreeNode *original, AbstractSyntaxTreeNode *node,
+                      unsigned int index, AbstractSyntaxTreeNode *child)
+{
+    if(*OptimizerChildSlot(node, index) != child)
+    {
+        if(node == original)
+        {
+            node = OptimizerCopyNode(optimizer, original);
+        }
+        *OptimizerChildSlot(node, index) = child;
+    }
+    return node;
+}
+
+static AbstractSyntaxTreeNode *
+OptimizerIdentifier(Optimizer *optimizer, char *source, char *string, int string_length)
+{
+    AbstractSyntaxTreeNode *identifier = MemoryArenaAllocateNode(optimizer->arena);
+    identifier->type = ABSTRACT_SYNTAX_TREE_NODE_identifier;
+    identifier->source = source;
+    identifier->identifier.string = string;
+    identifier->identifier.string_length = string_length;
+    return identifier;
+}
+
+// NOTE(rjf): '#' can't be part of an identifier in the source, so these can't
+//            collide with anything the program binds itself.
+static OptimizerName
+OptimizerFreshName(Optimizer *optimizer, char *string, int string_length)
+{
+    for(int i = 0; i < string_length; ++i)
+    {
+        if(string[i] == '#')
+        {
+            string_length = i;
+            break;
+        }
+    }
+    
+    OptimizerName name = {0};
+    unsigned int size = string_length + 16;
+    name.string = MemoryArenaAllocate(optimizer->arena, size, MEMORY_ARENA_CATEGORY_ast_nodes);
+    name.string_length = snprintf(name.string, size, "%.*s#%u", string_length, string, ++optimizer->fresh_name_count);
+    return name;
+}
+
+static unsigned long long
+OptimizerNodeSize(Optimizer *optimizer, AbstractSyntaxTreeNode *node)
+{
+    unsigned long long size = 0;
+    if(node && OptimizerEnter(optimizer))
+    {
+        size = 1;
+        unsigned int child_count = OptimizerChildCount(node);
+        for(unsigned int i = 0; i < child_count; ++i)
+        {
+            size += OptimizerNodeSize(optimizer, *OptimizerChildSlot(node, i));
+        }
+        --optimizer->depth;
+    }
+    return size;
+}
+
+// NOTE(rjf): How many identifiers in node refer to name as it's bound outside
+//            of node.
+static unsigned long long
+OptimizerCountReferences(Optimizer *optimizer, AbstractSyntaxTreeNode *node, char *string, int string_length)
+{
+    unsigned long long count = 0;
+    if(node && OptimizerEnter(optimizer))
+    {
+        unsigned int recursive_count = LetRecursiveCount(node);
+        if(node->type == ABSTRACT_SYNTAX_TREE_NODE_identifier)
+        {
+            count = StringMatch(node->identifier.string, node->identifier.string_length, string, string_length);
+        }
+        else if(recursive_count)
+        {
+            int bound = 0;
+            for(unsigned int i = 0; i < recursive_count && !bound; ++i)
+            {
+                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+                bound = StringMatch(let->let.string, let->let.string_length, string, string_length);
+            }
+            for(unsigned int i = 0; i < recursive_count && !bound; ++i)
+            {
+                count += OptimizerCountReferences(optimizer, LetRecursiveNested(node, i)->let.binding_expression,
+                                                  string, string_length);
+            }
+            if(!bound)
+            {
+                count += OptimizerCountReferences(optimizer,
+                                                  LetRecursiveNested(node, recursive_count - 1)->let.body_expression,
+                                                  string, string_length);
+            }
+        }
+        else
+        {
+            unsigned int child_count = OptimizerChildCount(node);
+            for(unsigned int i = 0; i < child_count; ++i)
+            {
+                OptimizerName binding = OptimizerChildBinding(node, i);
+                if(!StringMatch(binding.string, binding.string_length, string, string_length))
+                {
+                    count += OptimizerCountReferences(optimizer, *OptimizerChildSlot(node, i), string, string_length);
+                }
+            }
+        }
+        --optimizer->depth;
+    }
+    return count;
+}
+
+static int
+OptimizerFunctionUsesName(OptimizerFunction *function, char *string, int string_length)
+{
+    int uses = 0;
+    for(unsigned int i = 0; i < function->free_name_count; ++i)
+    {
+        if(StringMatch(function->free_names[i].string, function->free_names[i].string_length, string, string_length))
+        {
+            uses = 1;
+            break;
+        }
+    }
+    return uses;
+}
+
+static void
+OptimizerCollectFreeNames(Optimizer *optimizer, AbstractSyntaxTreeNode *node, OptimizerBinding *bound,
+                          OptimizerFunction *function)
+{
+    if(node && OptimizerEnter(optimizer))
+    {
+        if(node->type == ABSTRACT_SYNTAX_TREE_NODE_identifier)
+        {
+            char *string = node->identifier.string;
+            int string_length = node->identifier.string_length;
+            
+            int is_bound = 0;
+            for(OptimizerBinding *binding = bound; binding; binding = binding->parent)
+            {
+                if(StringMatch(binding->string, binding->string_length, string, string_length))
+                {
+                    is_bound = 1;
+                    break;
+                }
+            }
+            
+            if(!is_bound && !OptimizerFunctionUsesName(function, string, string_length))
+            {
+                if(function->free_name_count >= function->free_name_cap)
+                {
+                    function->free_name_cap = function->free_name_cap ? function->free_name_cap * 2 : 16;
+                    function->free_names = realloc(function->free_names,
+                                                   sizeof(function->free_names[0]) * function->free_name_cap);
+                }
+                function->free_names[function->free_name_count].string = string;
+                function->free_names[function->free_name_count].string_length = string_length;
+                ++function->free_name_count;
+            }
+        }
+        else if(LetRecursiveCount(node))
+        {
+            unsigned int recursive_count = LetRecursiveCount(node);
+            OptimizerBinding *group = malloc(sizeof(group[0]) * recursive_count);
+            OptimizerBinding *innermost = OptimizerBindGroup(node, recursive_count, bound, group);
+            for(unsigned int i = 0; i < recursive_count; ++i)
+            {
+                OptimizerCollectFreeNames(optimizer, LetRecursiveNested(node, i)->let.binding_expression, innermost,
+                                          function);
+            }
+            OptimizerCollectFreeNames(optimizer, LetRecursiveNested(node, recursive_count - 1)->let.body_expression,
+                                      innermost, function);
+            free(group);
+        }
+        else
+        {
+            unsigned int child_count = OptimizerChildCount(node);
+            for(unsigned int i = 0; i < child_count; ++i)
+            {
+                OptimizerName name = OptimizerChildBinding(node, i);
+                OptimizerBinding binding = { bound, name.string, name.string_length };
+                OptimizerCollectFreeNames(optimizer, *OptimizerChildSlot(node, i), name.string ? &binding : bound,
+                                          function);
+            }
+        }
+        --optimizer->depth;
+    }
+}
+
+// NOTE(rjf): Copies node for inlining. Identifiers that refer to one of
+//            renames are replaced by its replacement, and every name bound
+//            inside node is given a fresh name.
+static AbstractSyntaxTreeNode *
+OptimizerCopyForInlining(Optimizer *optimizer, AbstractSyntaxTreeNode *node, OptimizerBinding *renames)
+{
+    AbstractSyntaxTreeNode *result = node;
+    if(node && OptimizerEnter(optimizer))
+    {
+        if(node->type == ABSTRACT_SYNTAX_TREE_NODE_identifier)
+        {
+            for(OptimizerBinding *rename = renames; rename; rename = rename->parent)
+            {
+                if(StringMatch(rename->string, rename->string_length,
+                               node->identifier.string, node->identifier.string_length))
+                {
+                    result = rename->replacement;
+                    break;
+                }
+            }
+        }
+        else if(LetRecursiveCount(node))
+        {
+            // NOTE(rjf): Every let in the group is copied, since they all get
+            //            fresh names, and the renames cover all of the group.
+            unsigned int recursive_count = LetRecursiveCount(node);
+            OptimizerBinding *group = malloc(sizeof(group[0]) * recursive_count);
+            OptimizerBinding *innermost = OptimizerBindGroup(node, recursive_count, renames, group);
+            AbstractSyntaxTreeNode **copies = malloc(sizeof(copies[0]) * recursive_count);
+            for(unsigned int i = 0; i < recursive_count; ++i)
+            {
+                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+                OptimizerName fresh = OptimizerFreshName(optimizer, let->let.string, let->let.string_length);
+                copies[i] = OptimizerCopyNode(optimizer, let);
+                copies[i]->let.string = fresh.string;
+                copies[i]->let.string_length = fresh.string_length;
+                group[i].replacement = OptimizerIdentifier(optimizer, let->source, fresh.string, fresh.string_length);
+            }
+            for(unsigned int i = 0; i < recursive_count; ++i)
+            {
+                copies[i]->let.binding_expression = OptimizerCopyForInlining(optimizer, copies[i]->let.binding_expression,
+                                                                             innermost);
+                if(i + 1 < recursive_count)
+                {
+                    copies[i]->let.body_expression = copies[i+1];
+                }
+            }
+            copies[recursive_count - 1]->let.body_expression =
+                OptimizerCopyForInlining(optimizer, copies[recursive_count - 1]->let.body_expression, innermost);
+            result = copies[0];
+            free(copies);
+            free(group);
+        }
+        else
+        {
+            OptimizerName fresh = {0};
+            if(node->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+            {
+                fresh = OptimizerFreshName(optimizer, node->let.string, node->let.string_length);
+                result = OptimizerCopyNode(optimizer, node);
+                result->let.string = fresh.string;
+                result->let.string_length = fresh.string_length;
+            }
+            else if(node->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+            {
+                fresh = OptimizerFreshName(optimizer, node->function_definition.param_name,
+                                           node->function_definition.param_name_length);
+                result = OptimizerCopyNode(optimizer, node);
+                result->function_definition.param_name = fresh.string;
+                result->function_definition.param_name_length = fresh.string_length;
+            }
+            
+            unsigned int child_count = OptimizerChildCount(node);
+            for(unsigned int i = 0; i < child_count; ++i)
+            {
+                OptimizerName name = OptimizerChildBinding(node, i);
+                OptimizerBinding rename = { renames, name.string, name.string_length };
+                if(name.string)
+                {
+                    rename.replacement = OptimizerIdentifier(optimizer, node->source, fresh.string, fresh.string_length);
+                }
+                AbstractSyntaxTreeNode *child = OptimizerCopyForInlining(optimizer, *OptimizerChildSlot(node, i),
+                                                                         name.string ? &rename : renames);
+                result = OptimizerReplaceChild(optimizer, node, result, i, child);
+            }
+        }
+        --optimizer->depth;
+    }
+    return result;
+}
+
+// NOTE(rjf): Beta reduction: the body of definition, with argument bound to its
+//            parameter. Returns 0 if it can't be done.
+static AbstractSyntaxTreeNode *
+OptimizerApply(Optimizer *optimizer, AbstractSyntaxTreeNode *definition, AbstractSyntaxTreeNode *argument,
+               char *source)
+{
+    AbstractSyntaxTreeNode *result = 0;
+    AbstractSyntaxTreeNode *body = definition->function_definition.body;
+    
+    if(body && argument)
+    {
+        char *param_name = definition->function_definition.param_name;
+        int param_name_length = definition->function_definition.param_name_length;
+        
+        // NOTE(rjf): Evaluating a constant can't fail, so it doesn't matter how
+        //            many times that happens. An identifier can fail, if it isn't
+        //            bound, so it's only substituted if it'll still be looked up.
+        optimizer->too_deep = 0;
+        int substitute = (argument->type == ABSTRACT_SYNTAX_TREE_NODE_numeric_constant ||
+                          argument->type == ABSTRACT_SYNTAX_TREE_NODE_boolean_constant ||
+                          (argument->type == ABSTRACT_SYNTAX_TREE_NODE_identifier &&
+                           OptimizerCountReferences(optimizer, body, param_name, param_name_length) > 0));
+        
+        OptimizerName fresh = {0};
+        OptimizerBinding rename = { 0, param_name, param_name_length };
+        if(substitute)
+        {
+            rename.replacement = argument;
+        }
+        else
+        {
+            fresh = OptimizerFreshName(optimizer, param_name, param_name_length);
+            rename.replacement = OptimizerIdentifier(optimizer, definition->source, fresh.string, fresh.string_length);
+        }
+        
+        AbstractSyntaxTreeNode *copy = OptimizerCopyForInlining(optimizer, body, &rename);
+        
+        if(!optimizer->too_deep)
+        {
+            if(substitute)
+            {
+                result = copy;
+            }
+            else
+            {
+                result = MemoryArenaAllocateNode(optimizer->arena);
+                result->type = ABSTRACT_SYNTAX_TREE_NODE_let;
+                result->source = source;
+                result->let.string = fresh.string;
+                result->let.string_length = fresh.string_length;
+                result->let.binding_expression = argument;
+                result->let.body_expression = copy;
+            }
+        }
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): Finds the let-bound function that a call to callee would call, if
+//            its body can be inlined where scope is.
+static OptimizerFunction *
+OptimizerFindInlineFunction(OptimizerBinding *scope, AbstractSyntaxTreeNode *callee)
+{
+    OptimizerBinding *binding = scope;
+    while(binding && !StringMatch(binding->string, binding->string_length,
+                                  callee->identifier.string, callee->identifier.string_length))
+    {
+        binding = binding->parent;
+    }
+    
+    OptimizerFunction *function = binding ? binding->function : 0;
+    
+    // NOTE(rjf): A name the function uses that has been bound since its let would
+    //            refer to something else where the call is.
+    for(OptimizerBinding *between = scope; function && between != binding; between = between->parent)
+    {
+        if(OptimizerFunctionUsesName(function, between->string, between->string_length))
+        {
+            function = 0;
+        }
+    }
+    
+    return function;
+}
+
+// NOTE(rjf): Returns what a call of callee with argument can be reduced to, or
+//            0 if it can't be.
+static AbstractSyntaxTreeNode *
+OptimizerReduceCall(Optimizer *optimizer, AbstractSyntaxTreeNode *callee, AbstractSyntaxTreeNode *argument,
+                    char *source, OptimizerBinding *scope)
+{
+    AbstractSyntaxTreeNode *result = 0;
+    
+    if(callee && argument && OptimizerEnter(optimizer))
+    {
+        if(callee->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+        {
+            result = OptimizerApply(optimizer, callee, argument, source);
+            if(result)
+            {
+                ++optimizer->applied_function_count;
+            }
+        }
+        else if(callee->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+        {
+            // NOTE(rjf): (let x = a in f)(b) is let x = a in f(b), as long as b
+            //            doesn't use x. This is what keeps curried calls of
+            //            function literals reducing after the first argument.
+            optimizer->too_deep = 0;
+            if(!OptimizerCountReferences(optimizer, argument, callee->let.string, callee->let.string_length) &&
+               !optimizer->too_deep)
+            {
+                OptimizerBinding binding = { scope, callee->let.string, callee->let.string_length };
+                AbstractSyntaxTreeNode *body = OptimizerReduceCall(optimizer, callee->let.body_expression, argument,
+                                                                   source, &binding);
+                if(body)
+                {
+                    result = OptimizerCopyNode(optimizer, callee);
+                    result->let.body_expression = body;
+                }
+            }
+        }
+        else if(callee->type == ABSTRACT_SYNTAX_TREE_NODE_identifier)
+        {
+            OptimizerFunction *function = OptimizerFindInlineFunction(scope, callee);
+            if(function && (function->use_count == 1 || function->size <= optimizer->budget))
+            {
+                result = OptimizerApply(optimizer, function->definition, argument, source);
+                if(result)
+                {
+                    ++optimizer->inlined_call_count;
+                    ++function->inlined_count;
+                    optimizer->inlined_node_count += function->size;
+                    if(function->use_count != 1)
+                    {
+                        optimizer->budget -= function->size;
+                    }
+                }
+            }
+        }
+        --optimizer->depth;
+    }
+    
+    return result;
+}
+
+static AbstractSyntaxTreeNode *
+OptimizeNode(Optimizer *optimizer, AbstractSyntaxTreeNode *node, OptimizerBinding *scope)
+{
+    AbstractSyntaxTreeNode *result = node;
+    
+    if(node && OptimizerEnter(optimizer))
+    {
+        unsigned int recursive_count = LetRecursiveCount(node);
+        if(recursive_count)
+        {
+            // NOTE(rjf): Calls to a let rec group's functions aren't inlined, but
+            //            what's inside of them is still optimized, with the whole
+            //            group bound around it. The lets are copied from the
+            //            innermost outward, where anything inside of them changed.
+            OptimizerBinding *group = malloc(sizeof(group[0]) * recursive_count);
+            OptimizerBinding *innermost = OptimizerBindGroup(node, recursive_count, scope, group);
+            AbstractSyntaxTreeNode **bindings = malloc(sizeof(bindings[0]) * recursive_count);
+            for(unsigned int i = 0; i < recursive_count; ++i)
+            {
+                bindings[i] = OptimizeNode(optimizer, LetRecursiveNested(node, i)->let.binding_expression, innermost);
+            }
+            AbstractSyntaxTreeNode *last = LetRecursiveNested(node, recursive_count - 1);
+            AbstractSyntaxTreeNode *rest = OptimizeNode(optimizer, last->let.body_expression, innermost);
+            for(unsigned int i = recursive_count; i > 0; --i)
+            {
+                AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i-1);
+                AbstractSyntaxTreeNode *copy = OptimizerReplaceChild(optimizer, let, let, 0, bindings[i-1]);
+                rest = OptimizerReplaceChild(optimizer, let, copy, 1, rest);
+            }
+            result = rest;
+            free(bindings);
+            free(group);
+        }
+        else if(node->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+        {
+            char *string = node->let.string;
+            int string_length = node->let.string_length;
+            AbstractSyntaxTreeNode *binding_expression = OptimizeNode(optimizer, node->let.binding_expression, scope);
+            
+            // NOTE(rjf): A function that refers to its own name would be calling
+            //            some outer binding of it, which the let hides.
+            OptimizerFunction function = {0};
+            int inlinable = 0;
+            if(binding_expression && binding_expression->type == ABSTRACT_SYNTAX_TREE_NODE_function_definition)
+            {
+                optimizer->too_deep = 0;
+                function.definition = binding_expression;
+                function.size = OptimizerNodeSize(optimizer, binding_expression->function_definition.body);
+                function.use_count = OptimizerCountReferences(optimizer, node->let.body_expression, string, string_length);
+                OptimizerCollectFreeNames(optimizer, binding_expression, 0, &function);
+                inlinable = (!optimizer->too_deep &&
+                             !OptimizerFunctionUsesName(&function, string, string_length) &&
+                             (function.use_count == 1 || function.size <= OPTIMIZER_SMALL_FUNCTION_SIZE));
+            }
+            
+            OptimizerBinding binding = { scope, string, string_length, inlinable ? &function : 0 };
+            AbstractSyntaxTreeNode *body_expression = OptimizeNode(optimizer, node->let.body_expression, &binding);
+            
+            int removed = 0;
+            if(function.inlined_count)
+            {
+                optimizer->too_deep = 0;
+                if(!OptimizerCountReferences(optimizer, body_expression, string, string_length) && !optimizer->too_deep)
+                {
+                    ++optimizer->removed_function_count;
+                    result = body_expression;
+                    removed = 1;
+                }
+            }
+            
+            if(!removed)
+            {
+                result = OptimizerReplaceChild(optimizer, node, result, 0, binding_expression);
+                result = OptimizerReplaceChild(optimizer, node, result, 1, body_expression);
+            }
+            
+            free(function.free_names);
+        }
+        else
+        {
+            unsigned int child_count = OptimizerChildCount(node);
+            for(unsigned int i = 0; i < child_count; ++i)
+            {
+                OptimizerName name = OptimizerChildBinding(node, i);
+                OptimizerBinding binding = { scope, name.string, name.string_length };
+                AbstractSyntaxTreeNode *child = OptimizeNode(optimizer, *OptimizerChildSlot(node, i),
+                                                             name.string ? &binding : scope);
+                result = OptimizerReplaceChild(optimizer, node, result, i, child);
+            }
+            
+            if(node->type == ABSTRACT_SYNTAX_TREE_NODE_function_call)
+            {
+                AbstractSyntaxTreeNode *reduced = OptimizerReduceCall(optimizer, result->function_call.closure,
+                                                                      result->function_call.parameter,
+                                                                      node->source, scope);
+                if(reduced)
+                {
+                    result = reduced;
+                }
+            }
+        }
+        
+        --optimizer->depth;
+    }
+    
+    return result;
+}
+
+static AbstractSyntaxTreeNode *
+OptimizeAbstractSyntaxTree(Optimizer *optimizer, AbstractSyntaxTreeNode *root)
+{
+    optimizer->depth = 0;
+    return OptimizeNode(optimizer, root, 0);
+}
@@ -0,0 +1,215 @@
+
+// NOTE(rjf): Buffered output. Everything is appended to one large buffer,
+//            which is handed to write(2) only when it fills up (or when
+//            OutputFlush is called), so printing a huge tree costs a handful
+//            of system calls instead of one stdio call per token. With an fd
+//            of -1, flushing appends to memory instead, which grows as needed
+//            and belongs to whoever takes it.
+
+#define OUTPUT_BUFFER_CAPACITY (256*1024)
+
+typedef struct OutputBuffer
+{
+    int fd;
+    int failed;
+    unsigned int length;
+    char *memory;
+    unsigned long long memory_length;
+    unsigned long long memory_cap;
+    char data[OUTPUT_BUFFER_CAPACITY];
+}
+OutputBuffer;
+
+static void
+OutputBufferInit(OutputBuffer *output, int fd)
+{
+    output->fd = fd;
+    output->failed = 0;
+    output->length = 0;
+    output->memory = 0;
+    output->memory_length = 0;
+    output->memory_cap = 0;
+}
+
+// NOTE(rjf): Returns 0 if anything written since the buffer was initialized
+//            couldn't be written out (a closed pipe, a full disk, ...).
+static int
+OutputFlush(OutputBuffer *output)
+{
+    char *data = output->data;
+    unsigned int size = output->length;
+    
+    if(output->fd < 0)
+    {
+        if(output->memory_length + size > output->memory_cap)
+        {
+            while(output->memory_length + size > output->memory_cap)
+            {
+                output->memory_cap = output->memory_cap ? output->memory_cap * 2 : 64*1024;
+            }
+            output->memory = realloc(output->memory, output->memory_cap);
+        }
+        MemoryCopy(output->memory + output->memory_length, data, size);
+        output->memory_length += size;
+        size = 0;
+    }
+    
+#if LETTUCE_POSIX
+    while(size > 0 && !output->failed)
+    {
+        ssize_t bytes_written = write(output->fd, data, size);
+        if(bytes_written < 0)
+        {
+            if(errno != EINTR)
+            {
+                output->failed = 1;
+            }
+            continue;
+        }
+        data += bytes_written;
+        size -= (unsigned int)bytes_written;
+    }
+#else
+    FILE *file = output->fd == 2 ? stderr : stdout;
+    if(size > 0 && fwrite(data, 1, size, file) != size)
+    {
+        output->failed = 1;
+    }
+    fflush(file);
+#endif
+    
+    output->length = 0;
+    return !output->failed;
+}
+
+static void
+OutputWrite(OutputBuffer *output, char *data, unsigned int size)
+{
+    while(size > 0)
+    {
+        if(output->length == OUTPUT_BUFFER_CAPACITY)
+        {
+            OutputFlush(output);
+        }
+        
+        unsigned int to_copy = OUTPUT_BUFFER_CAPACITY - output->length;
+        if(to_copy > size)
+        {
+            to_copy = size;
+        }
+        MemoryCopy(output->data + output->length, data, to_copy);
+        output->length += to_copy;
+        data += to_copy;
+        size -= to_copy;
+    }
+}
+
+static void
+OutputWriteCString(OutputBuffer *output, char *string)
+{
+    OutputWrite(output, string, (unsigned int)strlen(string));
+}
+
+static void
+OutputWriteCharacter(OutputBuffer *output, char character)
+{
+    if(output->length == OUTPUT_BUFFER_CAPACITY)
+    {
+        OutputFlush(output);
+    }
+    output->data[output->length++] = character;
+}
+
+static void
+OutputWriteSpaces(OutputBuffer *output, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        OutputWriteCharacter(output, ' ');
+    }
+}
+
+static void
+OutputWriteF(OutputBuffer *output, char *format, ...)
+{
+    // NOTE(rjf): Anything printed through here is short (numbers, result
+    //            lines), so it's formatted straight into the buffer, and if it
+    //            didn't fit, flushing first always makes enough room.
+    for(int attempt = 0; attempt < 2; ++attempt)
+    {
+        unsigned int available = OUTPUT_BUFFER_CAPACITY - output->length;
+        va_list args;
+        va_start(args, format);
+        int needed = vsnprintf(output->data + output->length, available, format, args);
+        va_end(args);
+        
+        if(needed < 0 || needed >= OUTPUT_BUFFER_CAPACITY)
+        {
+            break;
+        }
+        else if((unsigned int)needed < available)
+        {
+            output->length += needed;
+            break;
+        }
+        OutputFlush(output);
+    }
+}
+
+// NOTE(rjf): Writes the shortest digits that read back as the same double, in
+//            one of the NUMBER_FORMAT_STYLEs, straight into the buffer.
+static void
+OutputWriteNumberInStyle(OutputBuffer *output, double value, int style)
+{
+    if(OUTPUT_BUFFER_CAPACITY - output->length < NUMBER_FORMAT_MAX_LENGTH)
+    {
+        OutputFlush(output);
+    }
+    output->length += NumberFormat(output->data + output->length, value, style);
+}
+
+static void
+OutputWriteNumber(OutputBuffer *output, double value)
+{
+    OutputWriteNumberInStyle(output, value, NUMBER_FORMAT_STYLE_general);
+}
+
+// NOTE(rjf): Writes an array the way it would be written in a program.
+static void
+OutputWriteArray(OutputBuffer *output, double *elements, unsigned int count)
+{
+    OutputWriteCharacter(output, '{');
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        if(i)
+        {
+            OutputWrite(output, ", ", 2);
+        }
+        OutputWriteNumber(output, elements[i]);
+    }
+    OutputWriteCharacter(output, '}');
+}
+
+static void
+OutputWriteJSONString(OutputBuffer *output, char *string, int string_length)
+{
+    OutputWriteCharacter(output, '"');
+    for(int i = 0; i < string_length; ++i)
+    {
+        unsigned char character = (unsigned char)string[i];
+        if(character == '"' || character == '\\')
+        {
+            OutputWriteCharacter(output, '\\');
+            OutputWriteCharacter(output, (char)character);
+        }
+        else if(character < 0x20)
+        {
+            OutputWriteF(output, "\\u%04x", character);
+        }
+        else
+        {
+            OutputWriteCharacter(output, (char)character);
+        }
+    }
+    OutputWriteCharacter(output, '"');
+}
@@ -5,42 +5,574 @@ typedef struct ParseError
 }
 ParseError;
 
-static AbstractSyntaxTreeNode *
-ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
+// NOTE(rjf): What an expression had linked up (see ParseExpression) when a
+//            parenthesis inside of it opened. tail_slot is 0 when it hadn't
+//            linked anything.
+typedef struct ParseGroup
 {
-    AbstractSyntaxTreeNode *result = 0;
-    ParseError error = {0};
-    Token token = PeekToken(tokenizer);
+    AbstractSyntaxTreeNode *outer_result;
+    AbstractSyntaxTreeNode **tail_slot;
+}
+ParseGroup;
+
+// NOTE(rjf): The parser recurses for most kinds of nesting, so a deep enough
+//            program would overflow the C stack. When it starts, it works out
+//            how much of the stack of the thread it's on is left, and gives up
+//            with an error once it has used all but this fraction of that,
+//            which is left for the calls the deepest level makes and for
+//            whatever runs on the tree afterwards. Where the platform can't
+//            tell us where the thread's stack ends, RLIMIT_STACK (or 8 MB, if
+//            that's bigger or unlimited) is counted from where parsing starts.
+#define PARSE_STACK_RESERVED_FRACTION 4
+#define PARSE_DEFAULT_STACK_BYTES (8*1024*1024)
+
+// NOTE(rjf): The lowest address the parser's frames can go down to, for a
+//            parse that starts with stack_marker.
+static char *
+ParseStackLimit(char *stack_marker)
+{
+    unsigned long long bytes_left = 0;
     
-    if(TokenMatchCString(token, "(") ||
-       TokenMatchCString(token, "["))
+#if defined(_WIN32)
+    ULONG_PTR stack_low = 0;
+    ULONG_PTR stack_high = 0;
+    GetCurrentThreadStackLimits(&stack_low, &stack_high);
+    bytes_left = (unsigned long long)(stack_marker - (char *)stack_low);
+#elif defined(__APPLE__)
+    char *stack_high = pthread_get_stackaddr_np(pthread_self());
+    char *stack_low = stack_high - pthread_get_stacksize_np(pthread_self());
+    bytes_left = (unsigned long long)(stack_marker - stack_low);
+#elif defined(__GLIBC__)
+    pthread_attr_t attributes;
+    if(!pthread_getattr_np(pthread_self(), &attributes))
     {
-        NextToken(tokenizer, 0);
-        result = ParseExpression(tokenizer, arena, &error);
-        
-        if(error.string)
+        void *stack_low = 0;
+        size_t stack_size = 0;
+        if(!pthread_attr_getstack(&attributes, &stack_low, &stack_size) &&
+           stack_marker > (char *)stack_low)
         {
-            if(error_out)
+            bytes_left = (unsigned long long)(stack_marker - (char *)stack_low);
+        }
+        pthread_attr_destroy(&attributes);
+    }
+#endif
+    
+#if LETTUCE_POSIX
+    if(!bytes_left)
+    {
+        struct rlimit limit = {0};
+        bytes_left = PARSE_DEFAULT_STACK_BYTES;
+        if(!getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY &&
+           limit.rlim_cur < bytes_left)
+        {
+            bytes_left = limit.rlim_cur;
+        }
+    }
+#else
+    if(!bytes_left)
+    {
+        bytes_left = 1024*1024;
+    }
+#endif
+    
+    return stack_marker - (bytes_left - bytes_left / PARSE_STACK_RESERVED_FRACTION);
+}
+
+// NOTE(rjf): Hash-consing. Generated programs tend to repeat the same
+//            subexpressions over and over, so when the tokenizer has a node
+//            table, every node the parser finishes is looked up by its type,
+//            its payload, and the identities of its children, and a node that
+//            is already in the table is used in its place. Children are always
+//            finished before their parents, so identical subtrees come out as
+//            the same node, and the tree becomes a DAG. Nodes are never changed
+//            after they are finished, so the printer and the evaluator work on
+//            shared subtrees as they would on copies. A shared node keeps the
+//            source position of its first occurrence.
+typedef struct AbstractSyntaxTreeNodeTable
+{
+    AbstractSyntaxTreeNode **slots;
+    unsigned long long slot_count;
+    unsigned long long unique_count;
+    
+    // NOTE(rjf): Every node parsed while the table was attached, and how many
+    //            of them turned out to be duplicates.
+    unsigned long long node_count;
+    unsigned long long duplicate_count;
+    
+    // NOTE(rjf): Nodes that aren't needed until they're finished are built here
+    //            and only copied to the arena if they're new.
+    AbstractSyntaxTreeNode scratch;
+}
+AbstractSyntaxTreeNodeTable;
+
+static unsigned long long
+AbstractSyntaxTreeHashBytes(unsigned long long hash, void *data, unsigned long long size)
+{
+    unsigned char *bytes = data;
+    for(unsigned long long i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+#define AbstractSyntaxTreeHashValue(hash, value) AbstractSyntaxTreeHashBytes((hash), &(value), sizeof(value))
+
+static unsigned long long
+AbstractSyntaxTreeNodeHash(AbstractSyntaxTreeNode *node)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    hash = AbstractSyntaxTreeHashValue(hash, node->type);
+    
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_let:
+        {
+            hash = AbstractSyntaxTreeHashBytes(hash, node->let.string, node->let.string_length);
+            hash = AbstractSyntaxTreeHashValue(hash, node->let.recursive_count);
+            hash = AbstractSyntaxTreeHashValue(hash, node->let.binding_expression);
+            hash = AbstractSyntaxTreeHashValue(hash, node->let.body_expression);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+        {
+            hash = AbstractSyntaxTreeHashBytes(hash, node->identifier.string, node->identifier.string_length);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->numeric_constant.value);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->boolean_constant.value);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->binary_operator.type);
+            hash = AbstractSyntaxTreeHashValue(hash, node->binary_operator.left);
+            hash = AbstractSyntaxTreeHashValue(hash, node->binary_operator.right);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->unary_operator.type);
+            hash = AbstractSyntaxTreeHashValue(hash, node->unary_operator.expression);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->if_then_else.condition);
+            hash = AbstractSyntaxTreeHashValue(hash, node->if_then_else.pass_code);
+            hash = AbstractSyntaxTreeHashValue(hash, node->if_then_else.fail_code);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+        {
+            hash = AbstractSyntaxTreeHashBytes(hash, node->function_definition.param_name,
+                                               node->function_definition.param_name_length);
+            hash = AbstractSyntaxTreeHashValue(hash, node->function_definition.param_count);
+            hash = AbstractSyntaxTreeHashValue(hash, node->function_definition.body);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->function_call.closure);
+            hash = AbstractSyntaxTreeHashValue(hash, node->function_call.parameter);
+            hash = AbstractSyntaxTreeHashValue(hash, node->function_call.argument_count);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+        {
+            hash = AbstractSyntaxTreeHashBytes(hash, node->array_literal.elements,
+                                               sizeof(node->array_literal.elements[0]) * node->array_literal.element_count);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_index:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->index.array);
+            hash = AbstractSyntaxTreeHashValue(hash, node->index.index);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+        {
+            hash = AbstractSyntaxTreeHashValue(hash, node->operator_reference.type);
+            break;
+        }
+        default: break;
+    }
+    
+    return hash;
+}
+
+static int
+AbstractSyntaxTreeNodesMatch(AbstractSyntaxTreeNode *a, AbstractSyntaxTreeNode *b)
+{
+    int match = 0;
+    
+    if(a->type == b->type)
+    {
+        switch(a->type)
+        {
+            case ABSTRACT_SYNTAX_TREE_NODE_let:
             {
-                *error_out = error;
+                match = (StringMatch(a->let.string, a->let.string_length, b->let.string, b->let.string_length) &&
+                         a->let.recursive_count == b->let.recursive_count &&
+                         a->let.binding_expression == b->let.binding_expression &&
+                         a->let.body_expression == b->let.body_expression);
+                break;
             }
-            goto end_parse;
+            case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+            {
+                match = StringMatch(a->identifier.string, a->identifier.string_length,
+                                    b->identifier.string, b->identifier.string_length);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+            {
+                // NOTE(rjf): Compared bit for bit, so 0 and -0 stay apart.
+                match = !memcmp(&a->numeric_constant.value, &b->numeric_constant.value,
+                                sizeof(a->numeric_constant.value));
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+            {
+                match = a->boolean_constant.value == b->boolean_constant.value;
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+            {
+                match = (a->binary_operator.type == b->binary_operator.type &&
+                         a->binary_operator.left == b->binary_operator.left &&
+                         a->binary_operator.right == b->binary_operator.right);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+            {
+                match = (a->unary_operator.type == b->unary_operator.type &&
+                         a->unary_operator.expression == b->unary_operator.expression);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+            {
+                match = (a->if_then_else.condition == b->if_then_else.condition &&
+                         a->if_then_else.pass_code == b->if_then_else.pass_code &&
+                         a->if_then_else.fail_code == b->if_then_else.fail_code);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+            {
+                match = (StringMatch(a->function_definition.param_name, a->function_definition.param_name_length,
+                                     b->function_definition.param_name, b->function_definition.param_name_length) &&
+                         a->function_definition.param_count == b->function_definition.param_count &&
+                         a->function_definition.body == b->function_definition.body);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+            {
+                match = (a->function_call.closure == b->function_call.closure &&
+                         a->function_call.parameter == b->function_call.parameter &&
+                         a->function_call.argument_count == b->function_call.argument_count);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+            {
+                match = (a->array_literal.element_count == b->array_literal.element_count &&
+                         (!a->array_literal.element_count ||
+                          !memcmp(a->array_literal.elements, b->array_literal.elements,
+                                  sizeof(a->array_literal.elements[0]) * a->array_literal.element_count)));
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_index:
+            {
+                match = (a->index.array == b->index.array &&
+                         a->index.index == b->index.index);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+            {
+                match = a->operator_reference.type == b->operator_reference.type;
+                break;
+            }
+            default: break;
         }
+    }
+    
+    return match;
+}
+
+// NOTE(rjf): Returns the slot that holds a node matching this one, or the
+//            empty slot it would go in.
+static AbstractSyntaxTreeNode **
+AbstractSyntaxTreeNodeTableFind(AbstractSyntaxTreeNodeTable *table, AbstractSyntaxTreeNode *node)
+{
+    if((table->unique_count + 1) * 4 > table->slot_count * 3)
+    {
+        unsigned long long old_slot_count = table->slot_count;
+        AbstractSyntaxTreeNode **old_slots = table->slots;
+        table->slot_count = old_slot_count ? old_slot_count * 2 : 1024;
+        table->slots = calloc(table->slot_count, sizeof(table->slots[0]));
         
-        if(TokenMatchCString(PeekToken(tokenizer), ")") ||
-           TokenMatchCString(PeekToken(tokenizer), "]"))
+        for(unsigned long long i = 0; i < old_slot_count; ++i)
         {
-            NextToken(tokenizer, 0);
+            if(old_slots[i])
+            {
+                unsigned long long j = AbstractSyntaxTreeNodeHash(old_slots[i]) & (table->slot_count - 1);
+                while(table->slots[j])
+                {
+                    j = (j + 1) & (table->slot_count - 1);
+                }
+                table->slots[j] = old_slots[i];
+            }
+        }
+        free(old_slots);
+    }
+    
+    unsigned long long i = AbstractSyntaxTreeNodeHash(node) & (table->slot_count - 1);
+    while(table->slots[i] && !AbstractSyntaxTreeNodesMatch(table->slots[i], node))
+    {
+        i = (i + 1) & (table->slot_count - 1);
+    }
+    
+    return table->slots + i;
+}
+
+// NOTE(rjf): Forgets every node, for when the arena they were on is reset, but
+//            keeps counting.
+static void
+AbstractSyntaxTreeNodeTableReset(AbstractSyntaxTreeNodeTable *table)
+{
+    if(table->slots)
+    {
+        memset(table->slots, 0, sizeof(table->slots[0]) * table->slot_count);
+    }
+    table->unique_count = 0;
+}
+
+static void
+AbstractSyntaxTreeNodeTableCleanUp(AbstractSyntaxTreeNodeTable *table)
+{
+    free(table->slots);
+    table->slots = 0;
+    table->slot_count = 0;
+    table->unique_count = 0;
+}
+
+static double
+AbstractSyntaxTreeNodeTableDeduplicationRatio(AbstractSyntaxTreeNodeTable *table)
+{
+    unsigned long long unique_count = table->node_count - table->duplicate_count;
+    return unique_count ? (double)table->node_count / unique_count : 1.0;
+}
+
+static void
+AbstractSyntaxTreeNodeTablePrintStats(AbstractSyntaxTreeNodeTable *table, FILE *file)
+{
+    fprintf(file, "hash-consing: %llu nodes parsed, %llu unique (%.2fx deduplication)\n",
+            table->node_count, table->node_count - table->duplicate_count,
+            AbstractSyntaxTreeNodeTableDeduplicationRatio(table));
+}
+
+// NOTE(rjf): Nodes whose children are all parsed before the node is needed
+//            are started with ParseBeginNode and finished with ParseFinishNode.
+//            When hash-consing, they're built in the table's scratch node.
+static AbstractSyntaxTreeNode *
+ParseBeginNode(Tokenizer *tokenizer, MemoryArena *arena)
+{
+    AbstractSyntaxTreeNode *node = 0;
+    if(tokenizer->node_table)
+    {
+        node = &tokenizer->node_table->scratch;
+        memset(node, 0, sizeof(*node));
+    }
+    else
+    {
+        node = MemoryArenaAllocateNode(arena);
+    }
+    return node;
+}
+
+// NOTE(rjf): Array literals' elements are collected in a temporary list while
+//            they're parsed; this moves them to the arena.
+static void
+ParseCopyArrayElements(MemoryArena *arena, AbstractSyntaxTreeNode *node)
+{
+    if(node->type == ABSTRACT_SYNTAX_TREE_NODE_array_literal && node->array_literal.element_count)
+    {
+        unsigned int size = sizeof(node->array_literal.elements[0]) * node->array_literal.element_count;
+        AbstractSyntaxTreeNode **elements = MemoryArenaAllocate(arena, size, MEMORY_ARENA_CATEGORY_ast_nodes);
+        MemoryCopy(elements, node->array_literal.elements, size);
+        node->array_literal.elements = elements;
+    }
+}
+
+// NOTE(rjf): Takes either a node from ParseBeginNode, or one that is already on
+//            the arena, and returns the node to use for it.
+static AbstractSyntaxTreeNode *
+ParseFinishNode(Tokenizer *tokenizer, MemoryArena *arena, AbstractSyntaxTreeNode *node)
+{
+    AbstractSyntaxTreeNode *result = node;
+    AbstractSyntaxTreeNodeTable *table = tokenizer->node_table;
+    
+    if(table)
+    {
+        ++table->node_count;
+        AbstractSyntaxTreeNode **slot = AbstractSyntaxTreeNodeTableFind(table, node);
+        if(*slot)
+        {
+            result = *slot;
+            ++table->duplicate_count;
         }
         else
         {
-            // NOTE(rjf): ERROR! Why is there not a following paren?
-            if(error_out)
+            if(node == &table->scratch)
             {
-                error_out->string = "Expected ) or ].";
+                result = MemoryArenaAllocateNode(arena);
+                *result = *node;
+                ParseCopyArrayElements(arena, result);
             }
-            goto end_parse;
+            *slot = result;
+            ++table->unique_count;
+        }
+    }
+    else
+    {
+        ParseCopyArrayElements(arena, result);
+    }
+    
+    return result;
+}
+
+static AbstractSyntaxTreeNode **
+ParseTailSlot(AbstractSyntaxTreeNode *node)
+{
+    AbstractSyntaxTreeNode **slot = 0;
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_let:                 { slot = &node->let.body_expression; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:        { slot = &node->if_then_else.fail_code; break; }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_definition: { slot = &node->function_definition.body; break; }
+        default: break;
+    }
+    return slot;
+}
+
+// NOTE(rjf): Lets, ifs with an else, and function definitions are linked up
+//            before their last child is parsed (see ParseExpression), so they
+//            are finished all at once, from the innermost outward, when the
+//            chain's last slot has been filled in.
+static AbstractSyntaxTreeNode *
+ParseFinishTailChain(Tokenizer *tokenizer, MemoryArena *arena, AbstractSyntaxTreeNode *first,
+                     AbstractSyntaxTreeNode **last_slot)
+{
+    AbstractSyntaxTreeNode *result = first;
+    
+    if(tokenizer->node_table)
+    {
+        AbstractSyntaxTreeNode **chain = 0;
+        unsigned long long chain_count = 0;
+        unsigned long long chain_cap = 0;
+        
+        for(AbstractSyntaxTreeNode *node = first;;)
+        {
+            if(chain_count >= chain_cap)
+            {
+                chain_cap = chain_cap ? chain_cap * 2 : 64;
+                chain = realloc(chain, sizeof(chain[0]) * chain_cap);
+            }
+            chain[chain_count++] = node;
+            
+            AbstractSyntaxTreeNode **slot = ParseTailSlot(node);
+            if(slot == last_slot)
+            {
+                break;
+            }
+            node = *slot;
+        }
+        
+        for(unsigned long long i = chain_count; i > 0; --i)
+        {
+            chain[i-1] = ParseFinishNode(tokenizer, arena, chain[i-1]);
+            if(i > 1)
+            {
+                *ParseTailSlot(chain[i-2]) = chain[i-1];
+            }
+        }
+        
+        result = chain[0];
+        free(chain);
+    }
+    
+    return result;
+}
+
+static AbstractSyntaxTreeNode *
+ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
+{
+    AbstractSyntaxTreeNode *result = 0;
+    ParseError error = {0};
+    Token token = PeekToken(tokenizer);
+    
+    // NOTE(rjf): A let's body, an if's else branch, and a function's body each
+    //            end their expression, so instead of recursing for them, the node
+    //            is linked in through tail_slot and the loop starts over to parse
+    //            what goes in that slot. Long let chains and else-if cascades
+    //            then don't use any more C stack than a single expression.
+    AbstractSyntaxTreeNode *outer_result = 0;
+    AbstractSyntaxTreeNode **tail_slot = &outer_result;
+    
+    // NOTE(rjf): Parentheses don't recurse either. When one opens, the chain
+    //            linked up so far is put aside here, and the loop starts over
+    //            for what's inside; when it closes, the chain is put back and
+    //            parsing goes on with the parenthesized expression as the result.
+    ParseGroup *groups = 0;
+    unsigned int group_count = 0;
+    unsigned int group_cap = 0;
+    
+    // NOTE(rjf): Errors are checked for at the end, so they need somewhere to go.
+    ParseError ignored_error = {0};
+    if(!error_out)
+    {
+        error_out = &ignored_error;
+    }
+    
+    char stack_marker = 0;
+    int outermost = !tokenizer->parse_stack_limit;
+    if(outermost)
+    {
+        tokenizer->parse_stack_limit = ParseStackLimit(&stack_marker);
+    }
+    else if(&stack_marker < tokenizer->parse_stack_limit)
+    {
+        if(error_out)
+        {
+            error_out->string = "Expression is nested too deeply to parse.";
         }
+        goto end_parse;
+    }
+    
+    parse_tail:;
+    
+    if(TokenMatchCString(token, "(") ||
+       TokenMatchCString(token, "["))
+    {
+        NextToken(tokenizer, 0);
+        if(group_count >= group_cap)
+        {
+            group_cap = group_cap ? group_cap * 2 : 16;
+            groups = realloc(groups, sizeof(groups[0]) * group_cap);
+        }
+        groups[group_count].outer_result = outer_result;
+        groups[group_count].tail_slot = tail_slot == &outer_result ? 0 : tail_slot;
+        ++group_count;
+        
+        outer_result = 0;
+        tail_slot = &outer_result;
+        result = 0;
+        token = PeekToken(tokenizer);
+        goto parse_tail;
     }
     else if(TokenMatchCString(token, "if"))
     {
@@ -49,6 +581,7 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         
         AbstractSyntaxTreeNode *if_then_else = MemoryArenaAllocateNode(arena);
         if_then_else->type = ABSTRACT_SYNTAX_TREE_NODE_if_then_else;
+        if_then_else->source = token.string;
         if_then_else->if_then_else.condition = ParseExpression(tokenizer, arena, &error);
         
         if(error.string)
@@ -77,26 +610,18 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
             goto end_parse;
         }
         
+        if_then_else->if_then_else.fail_code = 0;
+        
         if(TokenMatchCString(PeekToken(tokenizer), "else"))
         {
             NextToken(tokenizer, 0);
-            if_then_else->if_then_else.fail_code = ParseExpression(tokenizer, arena, &error);
-            
-            if(error.string)
-            {
-                if(error_out)
-                {
-                    *error_out = error;
-                }
-                goto end_parse;
-            }
-        }
-        else
-        {
-            if_then_else->if_then_else.fail_code = 0;
+            *tail_slot = if_then_else;
+            tail_slot = &if_then_else->if_then_else.fail_code;
+            token = PeekToken(tokenizer);
+            goto parse_tail;
         }
         
-        result = if_then_else;
+        result = ParseFinishNode(tokenizer, arena, if_then_else);
     }
     else if(TokenMatchCString(token, "function"))
     {
@@ -104,26 +629,44 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         NextToken(tokenizer, 0);
         Token identifier = {0};
         
-        if(RequireTokenMatch(tokenizer, "(", 0) &&
-           RequireTokenType(tokenizer, TOKEN_alphanumeric_block, &identifier) &&
-           RequireTokenMatch(tokenizer, ")", 0))
-        {
-            AbstractSyntaxTreeNode *def = MemoryArenaAllocateNode(arena);
-            def->type = ABSTRACT_SYNTAX_TREE_NODE_function_definition;
-            def->function_definition.param_name = identifier.string;
-            def->function_definition.param_name_length = identifier.string_length;
-            def->function_definition.body = ParseExpression(tokenizer, arena, &error);
-            
-            if(error.string)
+        // NOTE(rjf): Every parameter gets a function of its own, nested in the
+        //            one before (see FunctionDefinition).
+        AbstractSyntaxTreeNode *first_def = 0;
+        unsigned int param_count = 0;
+        int parsed_params = RequireTokenMatch(tokenizer, "(", 0);
+        while(parsed_params)
+        {
+            parsed_params = RequireTokenType(tokenizer, TOKEN_alphanumeric_block, &identifier);
+            if(parsed_params)
             {
-                if(error_out)
+                AbstractSyntaxTreeNode *def = MemoryArenaAllocateNode(arena);
+                def->type = ABSTRACT_SYNTAX_TREE_NODE_function_definition;
+                def->source = token.string;
+                def->function_definition.param_name = identifier.string;
+                def->function_definition.param_name_length = identifier.string_length;
+                def->function_definition.body = 0;
+                *tail_slot = def;
+                tail_slot = &def->function_definition.body;
+                first_def = first_def ? first_def : def;
+                ++param_count;
+                
+                if(TokenMatchCString(PeekToken(tokenizer), ","))
                 {
-                    *error_out = error;
+                    NextToken(tokenizer, 0);
+                }
+                else
+                {
+                    parsed_params = RequireTokenMatch(tokenizer, ")", 0);
+                    break;
                 }
-                goto end_parse;
             }
-            
-            result = def;
+        }
+        
+        if(parsed_params)
+        {
+            first_def->function_definition.param_count = param_count;
+            token = PeekToken(tokenizer);
+            goto parse_tail;
         }
         else
         {
@@ -137,46 +680,61 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
     }
     else if(TokenMatchCString(token, "let"))
     {
-        // NOTE(rjf): A let binding.
+        // NOTE(rjf): A let binding, or a let rec group, whose bindings are
+        //            separated by "and" and parsed as nested lets (see Let).
+        //            "rec" is only a keyword when another name follows it.
         
         NextToken(tokenizer, 0);
-        Token identifier;
+        Token identifier = {0};
+        int recursive = 0;
+        AbstractSyntaxTreeNode *first_let = 0;
+        unsigned int let_count = 0;
         
         if(RequireTokenType(tokenizer, TOKEN_alphanumeric_block, &identifier) &&
-           RequireTokenMatch(tokenizer, "=", 0))
+           TokenMatchCString(identifier, "rec") &&
+           PeekToken(tokenizer).type == TOKEN_alphanumeric_block)
         {
-            
+            recursive = 1;
+            RequireTokenType(tokenizer, TOKEN_alphanumeric_block, &identifier);
         }
-        else
+        
+        for(;;)
         {
-            // NOTE(rjf): ERROR, identifier not found for let expression
-            if(error_out)
+            if(identifier.type == TOKEN_alphanumeric_block &&
+               RequireTokenMatch(tokenizer, "=", 0))
             {
-                error_out->string = "Expected identifier for let expression.";
+                
             }
-            goto end_parse;
-        }
-        
-        AbstractSyntaxTreeNode *let = MemoryArenaAllocateNode(arena);
-        let->type = ABSTRACT_SYNTAX_TREE_NODE_let;
-        let->let.string = identifier.string;
-        let->let.string_length = identifier.string_length;
-        let->let.binding_expression = ParseExpression(tokenizer, arena, &error);
-        
-        if(error.string)
-        {
-            if(error_out)
+            else
             {
-                *error_out = error;
+                // NOTE(rjf): ERROR, identifier not found for let expression
+                if(error_out)
+                {
+                    error_out->string = "Expected identifier for let expression.";
+                }
+                goto end_parse;
             }
-            goto end_parse;
-        }
-        
-        Token in;
-        
-        if(RequireTokenMatch(tokenizer, "in", &in))
-        {
-            let->let.body_expression = ParseExpression(tokenizer, arena, &error);
+            
+            for(AbstractSyntaxTreeNode *bound = first_let; bound; bound = bound->let.body_expression)
+            {
+                if(StringMatch(bound->let.string, bound->let.string_length,
+                               identifier.string, identifier.string_length))
+                {
+                    // NOTE(rjf): ERROR, a let rec group binds the same name twice
+                    if(error_out)
+                    {
+                        error_out->string = "let rec can't bind the same name twice.";
+                    }
+                    goto end_parse;
+                }
+            }
+            
+            AbstractSyntaxTreeNode *let = MemoryArenaAllocateNode(arena);
+            let->type = ABSTRACT_SYNTAX_TREE_NODE_let;
+            let->source = token.string;
+            let->let.string = identifier.string;
+            let->let.string_length = identifier.string_length;
+            let->let.binding_expression = ParseExpression(tokenizer, arena, &error);
             
             if(error.string)
             {
@@ -186,6 +744,45 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
                 }
                 goto end_parse;
             }
+            
+            if(recursive && (!let->let.binding_expression ||
+                             let->let.binding_expression->type != ABSTRACT_SYNTAX_TREE_NODE_function_definition))
+            {
+                // NOTE(rjf): ERROR, let rec can only bind functions
+                if(error_out)
+                {
+                    error_out->string = "let rec can only bind functions.";
+                }
+                goto end_parse;
+            }
+            
+            let->let.body_expression = 0;
+            *tail_slot = let;
+            tail_slot = &let->let.body_expression;
+            first_let = first_let ? first_let : let;
+            ++let_count;
+            
+            if(recursive && RequireTokenMatch(tokenizer, "and", 0))
+            {
+                identifier = (Token){0};
+                RequireTokenType(tokenizer, TOKEN_alphanumeric_block, &identifier);
+            }
+            else
+            {
+                break;
+            }
+        }
+        
+        Token in;
+        
+        if(RequireTokenMatch(tokenizer, "in", &in))
+        {
+            if(recursive)
+            {
+                first_let->let.recursive_count = let_count;
+            }
+            token = PeekToken(tokenizer);
+            goto parse_tail;
         }
         else
         {
@@ -196,8 +793,6 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
             }
             goto end_parse;
         }
-        
-        result = let;
     }
     else if(token.type == TOKEN_alphanumeric_block)
     {
@@ -205,30 +800,33 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         {
             // NOTE(rjf): Boolean constant of true.
             NextToken(tokenizer, 0);
-            AbstractSyntaxTreeNode *val = MemoryArenaAllocateNode(arena);
+            AbstractSyntaxTreeNode *val = ParseBeginNode(tokenizer, arena);
             val->type = ABSTRACT_SYNTAX_TREE_NODE_boolean_constant;
+            val->source = token.string;
             val->boolean_constant.value = 1;
-            result = val;
+            result = ParseFinishNode(tokenizer, arena, val);
         }
         else if(TokenMatchCString(token, "false"))
         {
             // NOTE(rjf): Boolean constant of false.
             NextToken(tokenizer, 0);
-            AbstractSyntaxTreeNode *val = MemoryArenaAllocateNode(arena);
+            AbstractSyntaxTreeNode *val = ParseBeginNode(tokenizer, arena);
             val->type = ABSTRACT_SYNTAX_TREE_NODE_boolean_constant;
+            val->source = token.string;
             val->boolean_constant.value = 0;
-            result = val;
+            result = ParseFinishNode(tokenizer, arena, val);
         }
         else
         {
             // NOTE(rjf): In this case, we must have an identifier being used.
             NextToken(tokenizer, 0);
             
-            AbstractSyntaxTreeNode *val = MemoryArenaAllocateNode(arena);
+            AbstractSyntaxTreeNode *val = ParseBeginNode(tokenizer, arena);
             val->type = ABSTRACT_SYNTAX_TREE_NODE_identifier;
+            val->source = token.string;
             val->identifier.string = token.string;
             val->identifier.string_length = token.string_length;
-            result = val;
+            result = ParseFinishNode(tokenizer, arena, val);
         }
     }
     else if(token.type == TOKEN_numeric_constant)
@@ -238,10 +836,78 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         
         NextToken(tokenizer, 0);
         
-        AbstractSyntaxTreeNode *val = MemoryArenaAllocateNode(arena);
+        AbstractSyntaxTreeNode *val = ParseBeginNode(tokenizer, arena);
         val->type = ABSTRACT_SYNTAX_TREE_NODE_numeric_constant;
+        val->source = token.string;
         val->numeric_constant.value = TokenToDouble(token);
-        result = val;
+        result = ParseFinishNode(tokenizer, arena, val);
+    }
+    else if(TokenMatchCString(token, "{"))
+    {
+        // NOTE(rjf): An array literal. We don't know how many elements there
+        //            are until the closing brace, so they're collected in a
+        //            temporary list first.
+        NextToken(tokenizer, 0);
+        AbstractSyntaxTreeNode **elements = 0;
+        unsigned int element_count = 0;
+        unsigned int element_cap = 0;
+        
+        if(!TokenMatchCString(PeekToken(tokenizer), "}"))
+        {
+            for(;;)
+            {
+                AbstractSyntaxTreeNode *element = ParseExpression(tokenizer, arena, &error);
+                if(!error.string && !element)
+                {
+                    error.string = "Expected an array element.";
+                }
+                if(error.string)
+                {
+                    break;
+                }
+                
+                if(element_count >= element_cap)
+                {
+                    element_cap = element_cap ? element_cap * 2 : 16;
+                    elements = realloc(elements, sizeof(elements[0]) * element_cap);
+                }
+                elements[element_count++] = element;
+                
+                if(TokenMatchCString(PeekToken(tokenizer), ","))
+                {
+                    NextToken(tokenizer, 0);
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+        
+        if(!error.string && !RequireTokenMatch(tokenizer, "}", 0))
+        {
+            error.string = "Expected , or } in array.";
+        }
+        
+        if(!error.string)
+        {
+            AbstractSyntaxTreeNode *array = ParseBeginNode(tokenizer, arena);
+            array->type = ABSTRACT_SYNTAX_TREE_NODE_array_literal;
+            array->source = token.string;
+            array->array_literal.element_count = element_count;
+            array->array_literal.elements = elements;
+            result = ParseFinishNode(tokenizer, arena, array);
+        }
+        free(elements);
+        
+        if(error.string)
+        {
+            if(error_out)
+            {
+                *error_out = error;
+            }
+            goto end_parse;
+        }
     }
     else if(token.type == TOKEN_symbolic_block)
     {
@@ -249,6 +915,19 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         //            identifier or numeric constant must be a unary operator,
         //            so we'll handle those here.
         NextToken(tokenizer, 0);
+        
+        // NOTE(rjf): A binary operator on its own in parentheses, like (+), is
+        //            the operator used as a function.
+        int operator_type = TokenToBinaryOperator(token);
+        if(operator_type != BINARY_OPERATOR_invalid &&
+           TokenMatchCString(PeekToken(tokenizer), ")"))
+        {
+            AbstractSyntaxTreeNode *reference = ParseBeginNode(tokenizer, arena);
+            reference->type = ABSTRACT_SYNTAX_TREE_NODE_operator_reference;
+            reference->source = token.string;
+            reference->operator_reference.type = operator_type;
+            result = ParseFinishNode(tokenizer, arena, reference);
+        }
     }
     else
     {
@@ -260,6 +939,111 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         goto end_parse;
     }
     
+    parse_postfix:;
+    
+    if(result)
+    {
+        for(;;)
+        {
+            Token next = PeekToken(tokenizer);
+            if(TokenMatchCString(next, "("))
+            {
+                // NOTE(rjf): A function call operator. Every argument gets a call
+                //            of its own, made on the result of the one before (see
+                //            FunctionCall).
+                Token open_paren = {0};
+                NextToken(tokenizer, &open_paren);
+                for(unsigned int argument_count = 1;; ++argument_count)
+                {
+                    AbstractSyntaxTreeNode *parameter = ParseExpression(tokenizer, arena, &error);
+                    
+                    if(error.string)
+                    {
+                        if(error_out)
+                        {
+                            *error_out = error;
+                        }
+                        goto end_parse;
+                    }
+                    else if(!parameter && argument_count > 1)
+                    {
+                        // NOTE(rjf): ERROR, a comma with no argument after it.
+                        if(error_out)
+                        {
+                            error_out->string = "Expected a function argument.";
+                        }
+                        goto end_parse;
+                    }
+                    
+                    AbstractSyntaxTreeNode *call = ParseBeginNode(tokenizer, arena);
+                    call->type = ABSTRACT_SYNTAX_TREE_NODE_function_call;
+                    call->source = open_paren.string;
+                    call->function_call.closure = result;
+                    call->function_call.parameter = parameter;
+                    call->function_call.argument_count = argument_count;
+                    result = ParseFinishNode(tokenizer, arena, call);
+                    
+                    if(parameter && TokenMatchCString(PeekToken(tokenizer), ","))
+                    {
+                        NextToken(tokenizer, 0);
+                    }
+                    else if(RequireTokenMatch(tokenizer, ")", 0) || argument_count == 1)
+                    {
+                        // NOTE(rjf): A call with one argument has always been
+                        //            allowed to leave off its ).
+                        break;
+                    }
+                    else
+                    {
+                        // NOTE(rjf): ERROR, a call with several arguments that
+                        //            doesn't end with ).
+                        if(error_out)
+                        {
+                            error_out->string = "Expected , or ) after a function argument.";
+                        }
+                        goto end_parse;
+                    }
+                }
+            }
+            else if(TokenMatchCString(next, "["))
+            {
+                // NOTE(rjf): Array indexing.
+                Token open_bracket = {0};
+                NextToken(tokenizer, &open_bracket);
+                AbstractSyntaxTreeNode *index_expression = ParseExpression(tokenizer, arena, &error);
+                
+                if(error.string)
+                {
+                    if(error_out)
+                    {
+                        *error_out = error;
+                    }
+                    goto end_parse;
+                }
+                
+                if(!index_expression || !RequireTokenMatch(tokenizer, "]", 0))
+                {
+                    if(error_out)
+                    {
+                        error_out->string = "Expected an index followed by ].";
+                    }
+                    goto end_parse;
+                }
+                
+                AbstractSyntaxTreeNode *index = ParseBeginNode(tokenizer, arena);
+                index->type = ABSTRACT_SYNTAX_TREE_NODE_index;
+                index->source = open_bracket.string;
+                index->index.array = result;
+                index->index.index = index_expression;
+                result = ParseFinishNode(tokenizer, arena, index);
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+    
     token = PeekToken(tokenizer);
     
     if(!TokenMatchCString(token, "(") &&
@@ -273,16 +1057,11 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         {
             NextToken(tokenizer, 0);
             
-            AbstractSyntaxTreeNode *binary_operator = MemoryArenaAllocateNode(arena);
-            binary_operator->type = ABSTRACT_SYNTAX_TREE_NODE_binary_operator;
-            binary_operator->binary_operator.type = operator_type;
-            binary_operator->binary_operator.left = result;
-            
             int right_hand_side_is_guarded_by_parentheses =
                 TokenMatchCString(PeekToken(tokenizer), "(") ||
                 TokenMatchCString(PeekToken(tokenizer), "[");
             
-            binary_operator->binary_operator.right = ParseExpression(tokenizer, arena, &error);
+            AbstractSyntaxTreeNode *right = ParseExpression(tokenizer, arena, &error);
             
             if(error.string)
             {
@@ -293,31 +1072,48 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
                 goto end_parse;
             }
             
-            AbstractSyntaxTreeNode *right = binary_operator->binary_operator.right;
+            AbstractSyntaxTreeNode *left = result;
+            char *source = token.string;
             
-            if(!right_hand_side_is_guarded_by_parentheses &&
+            if(!right_hand_side_is_guarded_by_parentheses && right &&
                right->type == ABSTRACT_SYNTAX_TREE_NODE_binary_operator &&
-               right->binary_operator.type < binary_operator->binary_operator.type)
+               right->binary_operator.type < operator_type)
             {
-                binary_operator->binary_operator.type = right->binary_operator.type;
-                right->binary_operator.type = operator_type;
+                // NOTE(rjf): The right hand side binds more loosely than this
+                //            operator, so a op (b rop c) is rotated into
+                //            (a op b) rop c. When hash-consing, the right hand
+                //            side might be shared, so (a op b) is a new node;
+                //            otherwise, the right hand side's node is reused.
+                int right_operator_type = right->binary_operator.type;
+                char *right_source = right->source;
+                AbstractSyntaxTreeNode *right_left = right->binary_operator.left;
+                AbstractSyntaxTreeNode *right_right = right->binary_operator.right;
                 
-                AbstractSyntaxTreeNode *swap = binary_operator->binary_operator.left;
-                binary_operator->binary_operator.left = right->binary_operator.right;
-                AbstractSyntaxTreeNode *swap2 = right->binary_operator.left;
-                right->binary_operator.left = swap;
-                right->binary_operator.right = swap2;
+                AbstractSyntaxTreeNode *inner = tokenizer->node_table ? ParseBeginNode(tokenizer, arena) : right;
+                inner->type = ABSTRACT_SYNTAX_TREE_NODE_binary_operator;
+                inner->source = source;
+                inner->binary_operator.type = operator_type;
+                inner->binary_operator.left = left;
+                inner->binary_operator.right = right_left;
                 
-                swap = binary_operator->binary_operator.left;
-                binary_operator->binary_operator.left = binary_operator->binary_operator.right;
-                binary_operator->binary_operator.right = swap;
+                left = ParseFinishNode(tokenizer, arena, inner);
+                right = right_right;
+                operator_type = right_operator_type;
+                source = right_source;
             }
             
-            result = binary_operator;
+            AbstractSyntaxTreeNode *binary_operator = ParseBeginNode(tokenizer, arena);
+            binary_operator->type = ABSTRACT_SYNTAX_TREE_NODE_binary_operator;
+            binary_operator->source = source;
+            binary_operator->binary_operator.type = operator_type;
+            binary_operator->binary_operator.left = left;
+            binary_operator->binary_operator.right = right;
+            result = ParseFinishNode(tokenizer, arena, binary_operator);
         }
         else
         {
-            if(TokenMatchCString(token, "]") || TokenMatchCString(token, ")"))
+            if(TokenMatchCString(token, "]") || TokenMatchCString(token, ")") ||
+               TokenMatchCString(token, "}") || TokenMatchCString(token, ","))
             {
                 // NOTE(rjf): This is not a token we are looking for, and so we should
                 //            move along (this is used to end an expression, so this is
@@ -338,36 +1134,41 @@ ParseExpression(Tokenizer *tokenizer, MemoryArena *arena, ParseError *error_out)
         }
     }
     
-    if(result)
+    end_parse:;
+    
+    if(tail_slot != &outer_result)
+    {
+        *tail_slot = result;
+        result = ParseFinishTailChain(tokenizer, arena, outer_result, tail_slot);
+        outer_result = 0;
+        tail_slot = &outer_result;
+    }
+    
+    if(group_count && !error_out->string)
     {
-        while(TokenMatchCString(PeekToken(tokenizer), "("))
+        --group_count;
+        if(RequireTokenMatch(tokenizer, ")", 0) ||
+           RequireTokenMatch(tokenizer, "]", 0))
         {
-            // NOTE(rjf): A function call operator.
-            NextToken(tokenizer, 0);
-            AbstractSyntaxTreeNode *call = MemoryArenaAllocateNode(arena);
-            call->type = ABSTRACT_SYNTAX_TREE_NODE_function_call;
-            call->function_call.closure = result;
-            call->function_call.parameter = ParseExpression(tokenizer, arena, &error);
-            
-            if(error.string)
-            {
-                if(error_out)
-                {
-                    *error_out = error;
-                }
-                goto end_parse;
-            }
-            
-            result = call;
-            
-            if(TokenMatchCString(PeekToken(tokenizer), ")"))
+            outer_result = groups[group_count].outer_result;
+            if(groups[group_count].tail_slot)
             {
-                NextToken(tokenizer, 0);
+                tail_slot = groups[group_count].tail_slot;
             }
+            goto parse_postfix;
+        }
+        else
+        {
+            // NOTE(rjf): ERROR! Why is there not a following paren?
+            error_out->string = "Expected ) or ].";
         }
     }
+    free(groups);
     
-    end_parse:;
+    if(outermost)
+    {
+        tokenizer->parse_stack_limit = 0;
+    }
     
     return result;
 }
@@ -0,0 +1,202 @@
+
+// NOTE(rjf): Hardware (and a few software) performance counters, via Linux's
+//            perf_event_open. Every counter is opened on its own, not as a
+//            group, so that if the kernel or the hardware doesn't have one of
+//            them (or perf_event_paranoid doesn't allow it, or we're in a VM),
+//            the rest still work. Counters that couldn't be opened are just
+//            reported as unavailable. On other platforms, nothing is available.
+//
+//            If the kernel has to multiplex counters, values are scaled by
+//            time_enabled / time_running, like perf stat does.
+
+#define PERF_COUNTER_LIST \
+PerfCounter(cycles,        "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES) \
+PerfCounter(instructions,  "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS) \
+PerfCounter(branch_misses, "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES) \
+PerfCounter(l1d_misses,    "L1d-misses",    PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))) \
+PerfCounter(llc_misses,    "LLC-misses",    PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))) \
+PerfCounter(page_faults,   "page-faults",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS) \
+
+enum
+{
+#define PerfCounter(name, str, type, config) PERF_COUNTER_##name,
+    PERF_COUNTER_LIST
+#undef PerfCounter
+    PERF_COUNTER_COUNT
+};
+
+static char *perf_counter_names[PERF_COUNTER_COUNT] = {
+#define PerfCounter(name, str, type, config) str,
+    PERF_COUNTER_LIST
+#undef PerfCounter
+};
+
+// NOTE(rjf): A zeroed PerfCounters that was never opened (or had nothing
+//            available) is fine to start and stop; it just counts nothing.
+typedef struct PerfCounters
+{
+    int fds[PERF_COUNTER_COUNT];
+    int available_count;
+}
+PerfCounters;
+
+typedef struct PerfCounterValues
+{
+    int available[PERF_COUNTER_COUNT];
+    double values[PERF_COUNTER_COUNT];
+}
+PerfCounterValues;
+
+#if defined(__linux__)
+
+static int
+PerfCounterOpen(unsigned int type, unsigned long long config, int exclude_kernel)
+{
+    struct perf_event_attr attributes = {0};
+    attributes.size = sizeof(attributes);
+    attributes.type = type;
+    attributes.config = config;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = exclude_kernel;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+// NOTE(rjf): Returns how many counters could be opened, which is 0 if the
+//            kernel doesn't let us have any.
+static int
+PerfCountersOpen(PerfCounters *counters)
+{
+    unsigned int types[PERF_COUNTER_COUNT] = {
+#define PerfCounter(name, str, type, config) type,
+        PERF_COUNTER_LIST
+#undef PerfCounter
+    };
+    unsigned long long configs[PERF_COUNTER_COUNT] = {
+#define PerfCounter(name, str, type, config) config,
+        PERF_COUNTER_LIST
+#undef PerfCounter
+    };
+    
+    counters->available_count = 0;
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        // NOTE(rjf): Counting kernel time too is more accurate (page faults are
+        //            handled there), but perf_event_paranoid >= 2 doesn't allow
+        //            it for unprivileged users, so fall back to user time only.
+        counters->fds[i] = PerfCounterOpen(types[i], configs[i], 0);
+        if(counters->fds[i] < 0)
+        {
+            counters->fds[i] = PerfCounterOpen(types[i], configs[i], 1);
+        }
+        if(counters->fds[i] >= 0)
+        {
+            ++counters->available_count;
+        }
+    }
+    
+    return counters->available_count;
+}
+
+static void
+PerfCountersClose(PerfCounters *counters)
+{
+    for(int i = 0; counters->available_count && i < PERF_COUNTER_COUNT; ++i)
+    {
+        if(counters->fds[i] >= 0)
+        {
+            close(counters->fds[i]);
+            counters->fds[i] = -1;
+        }
+    }
+    counters->available_count = 0;
+}
+
+static void
+PerfCountersStart(PerfCounters *counters)
+{
+    for(int i = 0; counters->available_count && i < PERF_COUNTER_COUNT; ++i)
+    {
+        if(counters->fds[i] >= 0)
+        {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void
+PerfCountersStop(PerfCounters *counters, PerfCounterValues *values)
+{
+    for(int i = 0; counters->available_count && i < PERF_COUNTER_COUNT; ++i)
+    {
+        if(counters->fds[i] >= 0)
+        {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        values->available[i] = 0;
+        values->values[i] = 0;
+        
+        // NOTE(rjf): value, time enabled, time running.
+        unsigned long long data[3] = {0};
+        if(counters->available_count && counters->fds[i] >= 0 &&
+           read(counters->fds[i], data, sizeof(data)) == sizeof(data) &&
+           data[2] > 0)
+        {
+            values->available[i] = 1;
+            values->values[i] = (double)data[0] * ((double)data[1] / (double)data[2]);
+        }
+    }
+}
+
+#else
+
+static int
+PerfCountersOpen(PerfCounters *counters)
+{
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        counters->fds[i] = -1;
+    }
+    counters->available_count = 0;
+    return 0;
+}
+
+static void PerfCountersClose(PerfCounters *counters) {}
+static void PerfCountersStart(PerfCounters *counters) {}
+
+static void
+PerfCountersStop(PerfCounters *counters, PerfCounterValues *values)
+{
+    memset(values, 0, sizeof(*values));
+}
+
+#endif
+
+// NOTE(rjf): Prints one line of counters, each divided by divisor (so they can
+//            be per run, or per node). Unavailable counters are printed as "-".
+static void
+PerfCounterValuesPrint(FILE *file, PerfCounterValues *values, double divisor)
+{
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        if(values->available[i])
+        {
+            fprintf(file, " %s=%.*f", perf_counter_names[i], divisor == 1.0 ? 0 : 3, values->values[i] / divisor);
+        }
+        else
+        {
+            fprintf(file, " %s=-", perf_counter_names[i]);
+        }
+    }
+    if(values->available[PERF_COUNTER_cycles] && values->available[PERF_COUNTER_instructions] &&
+       values->values[PERF_COUNTER_cycles] > 0)
+    {
+        fprintf(file, " IPC=%.2f", values->values[PERF_COUNTER_instructions] / values->values[PERF_COUNTER_cycles]);
+    }
+}
@@ -0,0 +1,990 @@
+// NOTE(rjf): The CSV pipeline, for evaluating one program once per row of a
+//            CSV file. The first row names the columns, and the program's free
+//            identifiers are bound to the fields of the columns with the same
+//            names, parsed as numbers (or true and false). Every row writes one
+//            line, the way --batch does.
+//
+//            There are three stages. This thread reads the input, from a mapping
+//            if it's a regular file, or with read(2) otherwise, and splits it
+//            into chunks of about PIPELINE_CHUNK_SIZE bytes that end at the end
+//            of a row. A pool of worker threads each take the next chunk, parse
+//            and evaluate its rows with an arena, stack and environment of
+//            their own, and format the results into memory. A writer thread
+//            writes the chunks' results in the order they were read, so chunks
+//            that finish early wait in the ring for the ones before them.
+//
+//            The ring is the only place chunks are, and the reader waits for
+//            the writer when it's full, so memory doesn't depend on how big the
+//            input is. Pages of a mapped input are dropped once their chunk is
+//            written.
+//
+//            Rows end at newlines, so quoted fields can't have newlines in them.
+
+#define PIPELINE_CHUNK_SIZE (1024*1024)
+#define PIPELINE_CHUNKS_PER_THREAD 4
+#define PIPELINE_MAX_NUMBER_LENGTH 64
+
+enum
+{
+    PIPELINE_CHUNK_empty,
+    PIPELINE_CHUNK_read,
+    PIPELINE_CHUNK_evaluating,
+    PIPELINE_CHUNK_done,
+};
+
+typedef struct PipelineChunk
+{
+    int state;
+    char *data;
+    unsigned long long size;
+    
+    // NOTE(rjf): Where data is read to, when the input isn't mapped. It's kept
+    //            for the next chunk that goes in the same place in the ring.
+    char *buffer;
+    unsigned long long buffer_cap;
+    
+    unsigned long long row_count;
+    char *output;
+    unsigned long long output_length;
+}
+PipelineChunk;
+
+// NOTE(rjf): A free identifier of the program, and the column it's bound to.
+typedef struct PipelineBinding
+{
+    char *name;
+    int name_length;
+    int column;
+}
+PipelineBinding;
+
+typedef struct Pipeline
+{
+    AbstractSyntaxTreeNode *root;
+    EvaluationLimits limits;
+    int print_stats;
+    
+    PipelineBinding *bindings;
+    unsigned int binding_count;
+    
+    // NOTE(rjf): For every column up to the last one that's used, which binding
+    //            it has, or -1.
+    int *column_bindings;
+    unsigned int column_count;
+    
+    // NOTE(rjf): Chunks are numbered in the order they're read, and chunk n is
+    //            at n % chunk_count in the ring. Everything below read_count has
+    //            been read, below evaluate_count given to a worker, and below
+    //            write_count written.
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    PipelineChunk *chunks;
+    unsigned int chunk_count;
+    unsigned long long read_count;
+    unsigned long long evaluate_count;
+    unsigned long long write_count;
+    int reading_done;
+    int write_failed;
+    
+    // NOTE(rjf): Parsing and evaluating are added up over every worker, so
+    //            they can be more than the time the pipeline took.
+    unsigned long long input_bytes;
+    unsigned long long output_bytes;
+    unsigned long long row_count;
+    unsigned long long read_nanoseconds;
+    unsigned long long read_wait_nanoseconds;
+    unsigned long long parse_nanoseconds;
+    unsigned long long evaluate_nanoseconds;
+    unsigned long long write_nanoseconds;
+    unsigned long long write_wait_nanoseconds;
+    unsigned int peak_chunks_in_flight;
+}
+Pipeline;
+
+typedef struct PipelineScope PipelineScope;
+struct PipelineScope
+{
+    PipelineScope *parent;
+    char *string;
+    int string_length;
+};
+
+typedef struct PipelineScopeWork
+{
+    AbstractSyntaxTreeNode *node;
+    PipelineScope *scope;
+}
+PipelineScopeWork;
+
+static void
+PipelinePushScopeWork(PipelineScopeWork **work, unsigned int *work_count, unsigned int *work_cap,
+                      AbstractSyntaxTreeNode *node, PipelineScope *scope)
+{
+    if(node)
+    {
+        if(*work_count >= *work_cap)
+        {
+            *work_cap = *work_cap ? *work_cap * 2 : 256;
+            *work = realloc(*work, sizeof((*work)[0]) * *work_cap);
+        }
+        (*work)[*work_count].node = node;
+        (*work)[*work_count].scope = scope;
+        ++*work_count;
+    }
+}
+
+static PipelineScope *
+PipelineBindScope(MemoryArena *arena, PipelineScope *parent, char *string, int string_length)
+{
+    PipelineScope *scope = MemoryArenaAllocate(arena, sizeof(*scope), MEMORY_ARENA_CATEGORY_other);
+    scope->parent = parent;
+    scope->string = string;
+    scope->string_length = string_length;
+    return scope;
+}
+
+// NOTE(rjf): Finds the identifiers that root uses without a let or function
+//            binding them, other than builtins, each once. The tree is walked
+//            with an explicit stack, like escape analysis does.
+static void
+PipelineFindFreeNames(Pipeline *pipeline, AbstractSyntaxTreeNode *root)
+{
+    MemoryArena arena = {0};
+    arena.backend = MEMORY_ARENA_BACKEND_chunked;
+    PipelineScopeWork *work = 0;
+    unsigned int work_count = 0;
+    unsigned int work_cap = 0;
+    unsigned int binding_cap = 0;
+    
+    PipelinePushScopeWork(&work, &work_count, &work_cap, root, 0);
+    while(work_count)
+    {
+        PipelineScopeWork item = work[--work_count];
+        AbstractSyntaxTreeNode *node = item.node;
+        switch(node->type)
+        {
+            case ABSTRACT_SYNTAX_TREE_NODE_let:
+            {
+                // NOTE(rjf): A let rec group's names are bound in its bindings,
+                //            as well as in its body.
+                unsigned int recursive_count = LetRecursiveCount(node);
+                if(recursive_count)
+                {
+                    PipelineScope *group_scope = item.scope;
+                    for(unsigned int i = 0; i < recursive_count; ++i)
+                    {
+                        AbstractSyntaxTreeNode *let = LetRecursiveNested(node, i);
+                        group_scope = PipelineBindScope(&arena, group_scope, let->let.string, let->let.string_length);
+                    }
+                    for(unsigned int i = 0; i < recursive_count; ++i)
+                    {
+                        PipelinePushScopeWork(&work, &work_count, &work_cap,
+                                              LetRecursiveNested(node, i)->let.binding_expression, group_scope);
+                    }
+                    PipelinePushScopeWork(&work, &work_count, &work_cap,
+                                          LetRecursiveNested(node, recursive_count - 1)->let.body_expression, group_scope);
+                    break;
+                }
+                PipelineScope *body_scope = PipelineBindScope(&arena, item.scope, node->let.string,
+                                                              node->let.string_length);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->let.binding_expression, item.scope);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->let.body_expression, body_scope);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+            {
+                int bound = 0;
+                for(PipelineScope *scope = item.scope; scope && !bound; scope = scope->parent)
+                {
+                    bound = StringMatch(scope->string, scope->string_length, node->identifier.string,
+                                        node->identifier.string_length);
+                }
+                for(unsigned int i = 0; i < pipeline->binding_count && !bound; ++i)
+                {
+                    bound = StringMatch(pipeline->bindings[i].name, pipeline->bindings[i].name_length,
+                                        node->identifier.string, node->identifier.string_length);
+                }
+                EvaluationResult builtin;
+                if(!bound && !BuiltinLookUp(node->identifier.string, node->identifier.string_length, &builtin))
+                {
+                    if(pipeline->binding_count >= binding_cap)
+                    {
+                        binding_cap = binding_cap ? binding_cap * 2 : 16;
+                        pipeline->bindings = realloc(pipeline->bindings, sizeof(pipeline->bindings[0]) * binding_cap);
+                    }
+                    PipelineBinding *binding = pipeline->bindings + pipeline->binding_count++;
+                    binding->name = node->identifier.string;
+                    binding->name_length = node->identifier.string_length;
+                    binding->column = -1;
+                }
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+            {
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->binary_operator.left, item.scope);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->binary_operator.right, item.scope);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+            {
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->unary_operator.expression, item.scope);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+            {
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->if_then_else.condition, item.scope);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->if_then_else.pass_code, item.scope);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->if_then_else.fail_code, item.scope);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+            {
+                PipelineScope *body_scope = PipelineBindScope(&arena, item.scope, node->function_definition.param_name,
+                                                              node->function_definition.param_name_length);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->function_definition.body, body_scope);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+            {
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->function_call.closure, item.scope);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->function_call.parameter, item.scope);
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+            {
+                for(unsigned int i = 0; i < node->array_literal.element_count; ++i)
+                {
+                    PipelinePushScopeWork(&work, &work_count, &work_cap, node->array_literal.elements[i], item.scope);
+                }
+                break;
+            }
+            case ABSTRACT_SYNTAX_TREE_NODE_index:
+            {
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->index.array, item.scope);
+                PipelinePushScopeWork(&work, &work_count, &work_cap, node->index.index, item.scope);
+                break;
+            }
+            default: break;
+        }
+    }
+    
+    free(work);
+    MemoryArenaCleanUp(&arena);
+}
+
+// NOTE(rjf): Finds the field that starts at *at, without the quotes around it
+//            if it has them, and moves *at past the comma after it.
+static void
+PipelineNextField(char **at, char *end, char **field_start, char **field_end)
+{
+    char *start = *at;
+    while(start < end && (*start == ' ' || *start == '\t'))
+    {
+        ++start;
+    }
+    
+    char *field_finish = start;
+    char *next = start;
+    if(start < end && *start == '"')
+    {
+        ++start;
+        field_finish = start;
+        while(field_finish < end && !(field_finish[0] == '"' && (field_finish + 1 == end || field_finish[1] != '"')))
+        {
+            field_finish += field_finish[0] == '"' ? 2 : 1;
+        }
+        next = field_finish < end ? field_finish + 1 : end;
+        while(next < end && *next != ',')
+        {
+            ++next;
+        }
+    }
+    else
+    {
+        while(next < end && *next != ',')
+        {
+            ++next;
+        }
+        field_finish = next;
+        while(field_finish > start && (field_finish[-1] == ' ' || field_finish[-1] == '\t'))
+        {
+            --field_finish;
+        }
+    }
+    
+    *field_start = start;
+    *field_end = field_finish;
+    *at = next < end ? next + 1 : end;
+}
+
+// NOTE(rjf): Plain decimals, which is most of what's in a CSV, are read here
+//            straight from the input. When the digits and the power of ten are
+//            both exact doubles, one division rounds correctly. Anything else
+//            goes through strtod, like the server's bindings.
+static int
+PipelineParseValue(char *start, char *end, EvaluationResult *value)
+{
+    int success = 0;
+    unsigned long long length = end - start;
+    static double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    
+    char *at = start;
+    int negative = 0;
+    if(at < end && (*at == '-' || *at == '+'))
+    {
+        negative = *at == '-';
+        ++at;
+    }
+    unsigned long long mantissa = 0;
+    int digit_count = 0;
+    int significant_digit_count = 0;
+    int fraction_digit_count = 0;
+    int seen_point = 0;
+    for(; at < end; ++at)
+    {
+        if(CharIsNumeric(*at) && significant_digit_count < 19)
+        {
+            mantissa = mantissa*10 + (*at - '0');
+            significant_digit_count += mantissa != 0;
+            ++digit_count;
+            fraction_digit_count += seen_point;
+        }
+        else if(*at == '.' && !seen_point)
+        {
+            seen_point = 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+    
+    if(at == end && digit_count && mantissa <= (1ull << 53) && fraction_digit_count <= 22)
+    {
+        value->type = EVALUATION_RESULT_number;
+        value->number = (double)mantissa / powers_of_ten[fraction_digit_count];
+        if(negative)
+        {
+            value->number = -value->number;
+        }
+        success = 1;
+    }
+    else if(length == 4 && !memcmp(start, "true", 4))
+    {
+        value->type = EVALUATION_RESULT_boolean;
+        value->boolean = 1;
+        success = 1;
+    }
+    else if(length == 5 && !memcmp(start, "false", 5))
+    {
+        value->type = EVALUATION_RESULT_boolean;
+        value->boolean = 0;
+        success = 1;
+    }
+    else if(length && length < PIPELINE_MAX_NUMBER_LENGTH)
+    {
+        char copy[PIPELINE_MAX_NUMBER_LENGTH];
+        MemoryCopy(copy, start, length);
+        copy[length] = 0;
+        char *number_end = 0;
+        value->type = EVALUATION_RESULT_number;
+        value->number = strtod(copy, &number_end);
+        success = number_end == copy + length;
+    }
+    return success;
+}
+
+// NOTE(rjf): Returns 0 if a column the program uses isn't in the header.
+static int
+PipelineReadHeader(Pipeline *pipeline, char *line, char *end)
+{
+    int success = 1;
+    int column = 0;
+    for(char *at = line; at < end; ++column)
+    {
+        char *field_start = 0;
+        char *field_end = 0;
+        PipelineNextField(&at, end, &field_start, &field_end);
+        for(unsigned int i = 0; i < pipeline->binding_count; ++i)
+        {
+            PipelineBinding *binding = pipeline->bindings + i;
+            if(binding->column < 0 && StringMatch(binding->name, binding->name_length, field_start,
+                                                  (int)(field_end - field_start)))
+            {
+                binding->column = column;
+            }
+        }
+    }
+    
+    for(unsigned int i = 0; i < pipeline->binding_count; ++i)
+    {
+        PipelineBinding *binding = pipeline->bindings + i;
+        if(binding->column < 0)
+        {
+            fprintf(stderr, "FATAL ERROR: %.*s is not a column of the CSV.\n", binding->name_length, binding->name);
+            success = 0;
+        }
+        else if((unsigned int)binding->column + 1 > pipeline->column_count)
+        {
+            pipeline->column_count = binding->column + 1;
+        }
+    }
+    
+    pipeline->column_bindings = malloc(sizeof(pipeline->column_bindings[0]) * (pipeline->column_count + 1));
+    for(unsigned int i = 0; i < pipeline->column_count; ++i)
+    {
+        pipeline->column_bindings[i] = -1;
+    }
+    for(unsigned int i = 0; i < pipeline->binding_count; ++i)
+    {
+        if(pipeline->bindings[i].column >= 0)
+        {
+            pipeline->column_bindings[pipeline->bindings[i].column] = (int)i;
+        }
+    }
+    return success;
+}
+
+typedef struct PipelineWorker
+{
+    Pipeline *pipeline;
+    MemoryArena arena;
+    EvaluationStack *stack;
+    InterpreterEnvironment environment;
+    OutputBuffer *output;
+    unsigned long long parse_nanoseconds;
+    unsigned long long evaluate_nanoseconds;
+}
+PipelineWorker;
+
+static void
+PipelineEvaluateChunk(PipelineWorker *worker, PipelineChunk *chunk)
+{
+    Pipeline *pipeline = worker->pipeline;
+    InterpreterEnvironment *environment = &worker->environment;
+    OutputBuffer *output = worker->output;
+    unsigned long long row_count = 0;
+    
+    char *at = chunk->data;
+    char *end = chunk->data + chunk->size;
+    while(at < end)
+    {
+        char *line = at;
+        char *line_end = memchr(at, '\n', end - at);
+        if(!line_end)
+        {
+            line_end = end;
+        }
+        at = line_end < end ? line_end + 1 : end;
+        if(line_end > line && line_end[-1] == '\r')
+        {
+            --line_end;
+        }
+        if(line_end == line)
+        {
+            continue;
+        }
+        
+        unsigned long long start_time = pipeline->print_stats ? GetTimeInNanoseconds() : 0;
+        MemoryArenaMarker marker = MemoryArenaSave(&worker->arena);
+        
+        // NOTE(rjf): A row with a field that isn't a number (or is missing) is
+        //            an error, rather than being evaluated with what was bound for
+        //            the row before.
+        EvaluationResult result = {0};
+        int fields_valid = 1;
+        char *field_at = line;
+        for(unsigned int column = 0; column < pipeline->column_count && fields_valid; ++column)
+        {
+            char *field_start = line_end;
+            char *field_end = line_end;
+            if(field_at < line_end)
+            {
+                PipelineNextField(&field_at, line_end, &field_start, &field_end);
+            }
+            int binding_index = pipeline->column_bindings[column];
+            if(binding_index >= 0)
+            {
+                PipelineBinding *binding = pipeline->bindings + binding_index;
+                EvaluationResult value = {0};
+                if(PipelineParseValue(field_start, field_end, &value))
+                {
+                    InterpreterEnvironmentBind(environment, binding->name, binding->name_length, value);
+                }
+                else
+                {
+                    fields_valid = 0;
+                    result = EvaluationErrorResult(MakeStringOnArenaF(&worker->arena, "%.*s is not a number in this row.",
+                                                                      binding->name_length, binding->name));
+                }
+            }
+        }
+        
+        unsigned long long parsed_time = pipeline->print_stats ? GetTimeInNanoseconds() : 0;
+        if(fields_valid)
+        {
+            result = EvaluateAbstractSyntaxTree(environment, pipeline->root);
+        }
+        OutputWriteEvaluationResult(output, result);
+        MemoryArenaRestore(&worker->arena, marker);
+        if(pipeline->print_stats)
+        {
+            unsigned long long evaluated_time = GetTimeInNanoseconds();
+            worker->parse_nanoseconds += parsed_time - start_time;
+            worker->evaluate_nanoseconds += evaluated_time - parsed_time;
+        }
+        ++row_count;
+    }
+    
+    OutputFlush(output);
+    chunk->output = output->memory;
+    chunk->output_length = output->memory_length;
+    chunk->row_count = row_count;
+    output->memory = 0;
+    output->memory_length = 0;
+    output->memory_cap = 0;
+}
+
+static void *
+PipelineWorkerThread(void *data)
+{
+    PipelineWorker *worker = data;
+    Pipeline *pipeline = worker->pipeline;
+    
+    worker->stack = malloc(sizeof(*worker->stack));
+    worker->stack->arena = (MemoryArena){0};
+    EvaluationStackInit(worker->stack, &pipeline->limits);
+    worker->environment.arena = &worker->arena;
+    worker->environment.stack = worker->stack;
+    InterpreterEnvironmentReserve(&worker->environment);
+    worker->output = malloc(sizeof(*worker->output));
+    OutputBufferInit(worker->output, -1);
+    
+    for(;;)
+    {
+        pthread_mutex_lock(&pipeline->mutex);
+        while(pipeline->evaluate_count == pipeline->read_count && !pipeline->reading_done)
+        {
+            pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+        }
+        PipelineChunk *chunk = 0;
+        if(pipeline->evaluate_count < pipeline->read_count)
+        {
+            chunk = pipeline->chunks + pipeline->evaluate_count % pipeline->chunk_count;
+            chunk->state = PIPELINE_CHUNK_evaluating;
+            ++pipeline->evaluate_count;
+        }
+        pthread_mutex_unlock(&pipeline->mutex);
+        
+        if(!chunk)
+        {
+            break;
+        }
+        
+        PipelineEvaluateChunk(worker, chunk);
+        
+        pthread_mutex_lock(&pipeline->mutex);
+        chunk->state = PIPELINE_CHUNK_done;
+        pipeline->row_count += chunk->row_count;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->mutex);
+    }
+    
+    free(worker->output);
+    EvaluationStackCleanUp(worker->stack);
+    free(worker->stack);
+    MemoryArenaCleanUp(&worker->arena);
+    return 0;
+}
+
+static void *
+PipelineWriterThread(void *data)
+{
+    Pipeline *pipeline = data;
+    OutputBuffer *output = malloc(sizeof(*output));
+    OutputBufferInit(output, 1);
+    long page_size = sysconf(_SC_PAGESIZE);
+    
+    for(;;)
+    {
+        unsigned long long wait_start_time = GetTimeInNanoseconds();
+        pthread_mutex_lock(&pipeline->mutex);
+        PipelineChunk *chunk = pipeline->chunks + pipeline->write_count % pipeline->chunk_count;
+        while(!(pipeline->write_count < pipeline->read_count && chunk->state == PIPELINE_CHUNK_done) &&
+              !(pipeline->reading_done && pipeline->write_count == pipeline->read_count))
+        {
+            pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+        }
+        int done = pipeline->write_count == pipeline->read_count;
+        pthread_mutex_unlock(&pipeline->mutex);
+        unsigned long long write_start_time = GetTimeInNanoseconds();
+        pipeline->write_wait_nanoseconds += write_start_time - wait_start_time;
+        
+        if(done)
+        {
+            break;
+        }
+        
+        OutputWrite(output, chunk->output, (unsigned int)chunk->output_length);
+        pipeline->output_bytes += chunk->output_length;
+        free(chunk->output);
+        chunk->output = 0;
+        
+        // NOTE(rjf): The pages that are all inside of a mapped chunk won't be
+        //            looked at again.
+        if(!chunk->buffer)
+        {
+            unsigned long long first_page = AlignUpPow2((unsigned long long)chunk->data, page_size);
+            unsigned long long last_page = ((unsigned long long)chunk->data + chunk->size) & ~(unsigned long long)(page_size - 1);
+            if(last_page > first_page)
+            {
+                madvise((void *)first_page, last_page - first_page, MADV_DONTNEED);
+            }
+        }
+        pipeline->write_nanoseconds += GetTimeInNanoseconds() - write_start_time;
+        
+        pthread_mutex_lock(&pipeline->mutex);
+        chunk->state = PIPELINE_CHUNK_empty;
+        pipeline->write_failed = output->failed;
+        ++pipeline->write_count;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->mutex);
+    }
+    
+    pipeline->write_failed = !OutputFlush(output);
+    free(output);
+    return 0;
+}
+
+// NOTE(rjf): Waits for the next place in the ring to be free, and returns it.
+//            Returns 0 once the output can't be written, since there's no
+//            point in reading any more.
+static PipelineChunk *
+PipelineBeginChunk(Pipeline *pipeline)
+{
+    unsigned long long start_time = GetTimeInNanoseconds();
+    pthread_mutex_lock(&pipeline->mutex);
+    while(pipeline->read_count - pipeline->write_count >= pipeline->chunk_count && !pipeline->write_failed)
+    {
+        pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+    }
+    int write_failed = pipeline->write_failed;
+    pthread_mutex_unlock(&pipeline->mutex);
+    pipeline->read_wait_nanoseconds += GetTimeInNanoseconds() - start_time;
+    return write_failed ? 0 : pipeline->chunks + pipeline->read_count % pipeline->chunk_count;
+}
+
+static void
+PipelineEndChunk(Pipeline *pipeline, PipelineChunk *chunk)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    chunk->state = PIPELINE_CHUNK_read;
+    ++pipeline->read_count;
+    unsigned int in_flight = (unsigned int)(pipeline->read_count - pipeline->write_count);
+    if(in_flight > pipeline->peak_chunks_in_flight)
+    {
+        pipeline->peak_chunks_in_flight = in_flight;
+    }
+    pipeline->input_bytes += chunk->size;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+// NOTE(rjf): Fills buffer from fd, from *length up to cap. Returns 0 at the end
+//            of the input.
+static int
+PipelineReadMore(int fd, char *buffer, unsigned long long *length, unsigned long long cap)
+{
+    int more = 1;
+    while(*length < cap)
+    {
+        ssize_t bytes_read = read(fd, buffer + *length, cap - *length);
+        if(bytes_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(bytes_read <= 0)
+        {
+            more = 0;
+            break;
+        }
+        *length += (unsigned long long)bytes_read;
+    }
+    return more;
+}
+
+static void
+PipelinePrintStats(Pipeline *pipeline, int thread_count, unsigned long long nanoseconds, FILE *file)
+{
+    double seconds = nanoseconds / 1e9;
+    double megabytes = pipeline->input_bytes / (1024.0*1024.0);
+    fprintf(file, "pipeline: %llu rows, %.1f MB in %llu chunks, %d threads, %.3f s (%.1f MB/s, %.0f rows/s)\n",
+            pipeline->row_count, megabytes, pipeline->read_count, thread_count, seconds,
+            seconds > 0 ? megabytes / seconds : 0, seconds > 0 ? pipeline->row_count / seconds : 0);
+    fprintf(file, "pipeline: read     %8.3f s, %8.3f s waiting for room, %.1f MB/s\n",
+            pipeline->read_nanoseconds / 1e9, pipeline->read_wait_nanoseconds / 1e9,
+            pipeline->read_nanoseconds ? megabytes / (pipeline->read_nanoseconds / 1e9) : 0);
+    fprintf(file, "pipeline: parse    %8.3f s over all workers, %.0f rows/s per worker\n",
+            pipeline->parse_nanoseconds / 1e9,
+            pipeline->parse_nanoseconds ? pipeline->row_count / (pipeline->parse_nanoseconds / 1e9) : 0);
+    fprintf(file, "pipeline: evaluate %8.3f s over all workers, %.0f rows/s per worker\n",
+            pipeline->evaluate_nanoseconds / 1e9,
+            pipeline->evaluate_nanoseconds ? pipeline->row_count / (pipeline->evaluate_nanoseconds / 1e9) : 0);
+    fprintf(file, "pipeline: write    %8.3f s, %8.3f s waiting for the next chunk, %.1f MB written\n",
+            pipeline->write_nanoseconds / 1e9, pipeline->write_wait_nanoseconds / 1e9,
+            pipeline->output_bytes / (1024.0*1024.0));
+    fprintf(file, "pipeline: at most %u of %u chunks in flight\n", pipeline->peak_chunks_in_flight,
+            pipeline->chunk_count);
+}
+
+// NOTE(rjf): Evaluates root once for every row of the CSV at csv_path (or
+//            stdin, for -), writing the results to stdout. limits apply to each
+//            row. thread_count can be 0, for one worker per processor. Returns
+//            0 if the pipeline couldn't run, or its output couldn't be written.
+static int
+RunPipeline(char *csv_path, AbstractSyntaxTreeNode *root, EvaluationLimits *limits, int thread_count, int print_stats)
+{
+    unsigned long long start_time = GetTimeInNanoseconds();
+    Pipeline *pipeline = calloc(1, sizeof(*pipeline));
+    pipeline->root = root;
+    if(limits)
+    {
+        pipeline->limits = *limits;
+    }
+    pipeline->print_stats = print_stats;
+    PipelineFindFreeNames(pipeline, root);
+    
+    if(thread_count <= 0)
+    {
+        thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(thread_count <= 0)
+        {
+            thread_count = 1;
+        }
+    }
+    
+    // NOTE(rjf): A regular file is mapped, and anything else is streamed.
+    int fd = strcmp(csv_path, "-") ? open(csv_path, O_RDONLY) : 0;
+    struct stat file_stat = {0};
+    char *mapping = 0;
+    unsigned long long mapping_size = 0;
+    if(fd >= 0 && !fstat(fd, &file_stat) && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0)
+    {
+        mapping_size = (unsigned long long)file_stat.st_size;
+        mapping = mmap(0, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            mapping = 0;
+        }
+        else
+        {
+            madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+        }
+    }
+    
+    // NOTE(rjf): What's been read past the end of the last chunk, when the
+    //            input is streamed, which starts the next one.
+    char *carry = 0;
+    unsigned long long carry_length = 0;
+    unsigned long long carry_cap = 0;
+    int more_input = 1;
+    
+    int success = fd >= 0;
+    char *header = 0;
+    char *header_end = 0;
+    char *at = mapping;
+    if(!success)
+    {
+        fprintf(stderr, "FATAL ERROR: \"%s\" could not be opened.\n", csv_path);
+    }
+    else if(mapping)
+    {
+        header = mapping;
+        header_end = memchr(mapping, '\n', mapping_size);
+        header_end = header_end ? header_end : mapping + mapping_size;
+        at = header_end < mapping + mapping_size ? header_end + 1 : header_end;
+    }
+    else
+    {
+        carry_cap = PIPELINE_CHUNK_SIZE;
+        carry = malloc(carry_cap);
+        for(;;)
+        {
+            unsigned long long scanned = carry_length;
+            more_input = PipelineReadMore(fd, carry, &carry_length, carry_cap);
+            header_end = memchr(carry + scanned, '\n', carry_length - scanned);
+            if(header_end || !more_input)
+            {
+                break;
+            }
+            carry_cap *= 2;
+            carry = realloc(carry, carry_cap);
+        }
+        header = carry;
+        header_end = header_end ? header_end : carry + carry_length;
+    }
+    
+    if(success)
+    {
+        char *line_end = header_end;
+        if(line_end > header && line_end[-1] == '\r')
+        {
+            --line_end;
+        }
+        success = PipelineReadHeader(pipeline, header, line_end);
+    }
+    if(success && !mapping)
+    {
+        unsigned long long header_length = header_end < carry + carry_length ? header_end - carry + 1 : carry_length;
+        memmove(carry, carry + header_length, carry_length - header_length);
+        carry_length -= header_length;
+    }
+    
+    pthread_t writer_thread;
+    pthread_t *worker_threads = 0;
+    PipelineWorker *workers = 0;
+    if(success)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        pthread_mutex_init(&pipeline->mutex, 0);
+        pthread_cond_init(&pipeline->changed, 0);
+        pipeline->chunk_count = thread_count * PIPELINE_CHUNKS_PER_THREAD;
+        pipeline->chunks = calloc(pipeline->chunk_count, sizeof(pipeline->chunks[0]));
+        workers = calloc(thread_count, sizeof(workers[0]));
+        worker_threads = calloc(thread_count, sizeof(worker_threads[0]));
+        for(int i = 0; i < thread_count; ++i)
+        {
+            workers[i].pipeline = pipeline;
+            pthread_create(worker_threads + i, 0, PipelineWorkerThread, workers + i);
+        }
+        pthread_create(&writer_thread, 0, PipelineWriterThread, pipeline);
+        
+        char *end = mapping + mapping_size;
+        while(mapping ? at < end : (carry_length || more_input))
+        {
+            PipelineChunk *chunk = PipelineBeginChunk(pipeline);
+            if(!chunk)
+            {
+                break;
+            }
+            unsigned long long read_start_time = GetTimeInNanoseconds();
+            if(mapping)
+            {
+                char *chunk_end = end - at > PIPELINE_CHUNK_SIZE ? at + PIPELINE_CHUNK_SIZE : end;
+                char *newline = chunk_end < end ? memchr(chunk_end, '\n', end - chunk_end) : 0;
+                chunk_end = chunk_end < end ? (newline ? newline + 1 : end) : end;
+                chunk->data = at;
+                chunk->size = chunk_end - at;
+                at = chunk_end;
+            }
+            else
+            {
+                // NOTE(rjf): The chunk ends after the last newline that was read,
+                //            and what's after that is carried over. A row that's
+                //            longer than a chunk makes the buffer grow until it
+                //            fits.
+                if(!chunk->buffer)
+                {
+                    chunk->buffer_cap = PIPELINE_CHUNK_SIZE;
+                    chunk->buffer = malloc(chunk->buffer_cap);
+                }
+                unsigned long long length = 0;
+                for(;;)
+                {
+                    if(carry_length > chunk->buffer_cap)
+                    {
+                        chunk->buffer_cap = carry_length * 2;
+                        chunk->buffer = realloc(chunk->buffer, chunk->buffer_cap);
+                    }
+                    MemoryCopy(chunk->buffer + length, carry, carry_length);
+                    length += carry_length;
+                    carry_length = 0;
+                    if(more_input)
+                    {
+                        more_input = PipelineReadMore(fd, chunk->buffer, &length, chunk->buffer_cap);
+                    }
+                    
+                    unsigned long long row_end = length;
+                    while(row_end > 0 && chunk->buffer[row_end - 1] != '\n')
+                    {
+                        --row_end;
+                    }
+                    if(!more_input)
+                    {
+                        row_end = length;
+                    }
+                    if(row_end)
+                    {
+                        if(carry_cap < length - row_end)
+                        {
+                            carry_cap = length - row_end;
+                            carry = realloc(carry, carry_cap);
+                        }
+                        carry_length = length - row_end;
+                        MemoryCopy(carry, chunk->buffer + row_end, carry_length);
+                        length = row_end;
+                        break;
+                    }
+                    chunk->buffer_cap *= 2;
+                    chunk->buffer = realloc(chunk->buffer, chunk->buffer_cap);
+                }
+                chunk->data = chunk->buffer;
+                chunk->size = length;
+            }
+            pipeline->read_nanoseconds += GetTimeInNanoseconds() - read_start_time;
+            if(chunk->size)
+            {
+                PipelineEndChunk(pipeline, chunk);
+            }
+        }
+        
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->reading_done = 1;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->mutex);
+        for(int i = 0; i < thread_count; ++i)
+        {
+            pthread_join(worker_threads[i], 0);
+            pipeline->parse_nanoseconds += workers[i].parse_nanoseconds;
+            pipeline->evaluate_nanoseconds += workers[i].evaluate_nanoseconds;
+        }
+        pthread_join(writer_thread, 0);
+        success = !pipeline->write_failed;
+        if(!success)
+        {
+            fprintf(stderr, "FATAL ERROR: The pipeline's output could not be written.\n");
+        }
+        
+        if(print_stats)
+        {
+            PipelinePrintStats(pipeline, thread_count, GetTimeInNanoseconds() - start_time, stderr);
+        }
+        
+        for(unsigned int i = 0; i < pipeline->chunk_count; ++i)
+        {
+            free(pipeline->chunks[i].buffer);
+        }
+        free(pipeline->chunks);
+        free(workers);
+        free(worker_threads);
+        pthread_mutex_destroy(&pipeline->mutex);
+        pthread_cond_destroy(&pipeline->changed);
+    }
+    
+    if(mapping)
+    {
+        munmap(mapping, mapping_size);
+    }
+    if(fd > 0)
+    {
+        close(fd);
+    }
+    free(carry);
+    free(pipeline->bindings);
+    free(pipeline->column_bindings);
+    free(pipeline);
+    return success;
+}
@@ -0,0 +1,430 @@
+
+// NOTE(rjf): Per-node execution profiler, only compiled in when LETTUCE_PROFILE
+//            is defined (build.sh builds it as build/lettuce_profile), so the
+//            normal interpreter doesn't pay anything for it.
+//
+//            Every EvaluateAbstractSyntaxTree call counts a visit to its node
+//            and times it with the CPU's cycle counter. Time spent in child
+//            nodes is subtracted to get the node's exclusive cycles. Inclusive
+//            cycles are only added by the outermost activation of a node, so
+//            recursion doesn't count the same time twice.
+//
+//            On top of that, the profiler keeps a calling context tree: one
+//            entry per distinct path of nodes from the root. That's what the
+//            collapsed stacks (one "frame;frame;frame cycles" line per path)
+//            are written from, for flamegraph.pl and friends.
+
+#if LETTUCE_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define ReadCycleCounter() __rdtsc()
+#else
+#define ReadCycleCounter() GetTimeInNanoseconds()
+#endif
+
+typedef struct ProfilerContext
+{
+    AbstractSyntaxTreeNode *node;
+    unsigned int parent;
+    unsigned int first_child;
+    unsigned int next_sibling;
+    unsigned long long visits;
+    unsigned long long exclusive_cycles;
+}
+ProfilerContext;
+
+typedef struct ProfilerFrame
+{
+    unsigned int context;
+    unsigned long long start_cycles;
+    unsigned long long child_cycles;
+}
+ProfilerFrame;
+
+typedef struct Profiler
+{
+    char *source;
+    unsigned long long source_length;
+    
+    // NOTE(rjf): Every node that has been visited at least once.
+    AbstractSyntaxTreeNode **nodes;
+    unsigned int node_count;
+    unsigned int node_cap;
+    
+    // NOTE(rjf): Context 0 is the root, which has no node.
+    ProfilerContext *contexts;
+    unsigned int context_count;
+    unsigned int context_cap;
+    unsigned int current_context;
+    
+    ProfilerFrame *frames;
+    unsigned int frame_count;
+    unsigned int frame_cap;
+    
+    unsigned long long total_cycles;
+    
+    // NOTE(rjf): Offsets of the start of every line, built the first time a
+    //            location is asked for.
+    unsigned long long *line_starts;
+    unsigned int line_count;
+}
+Profiler;
+
+// NOTE(rjf): Only one evaluation is profiled at a time, and only from the
+//            command line, so this doesn't need to be per-thread.
+static Profiler *global_profiler;
+
+static void
+ProfilerBegin(Profiler *profiler, char *source, unsigned long long source_length)
+{
+    profiler->source = source;
+    profiler->source_length = source_length;
+    profiler->context_cap = 1024;
+    profiler->contexts = calloc(profiler->context_cap, sizeof(profiler->contexts[0]));
+    profiler->context_count = 1;
+    profiler->current_context = 0;
+    global_profiler = profiler;
+}
+
+static void
+ProfilerEnd(Profiler *profiler)
+{
+    global_profiler = 0;
+}
+
+static void
+ProfilerCleanUp(Profiler *profiler)
+{
+    free(profiler->nodes);
+    free(profiler->contexts);
+    free(profiler->frames);
+    free(profiler->line_starts);
+}
+
+static unsigned int
+ProfilerFindOrAddContext(Profiler *profiler, unsigned int parent, AbstractSyntaxTreeNode *node)
+{
+    unsigned int result = profiler->contexts[parent].first_child;
+    while(result && profiler->contexts[result].node != node)
+    {
+        result = profiler->contexts[result].next_sibling;
+    }
+    
+    if(!result)
+    {
+        if(profiler->context_count >= profiler->context_cap)
+        {
+            profiler->context_cap *= 2;
+            profiler->contexts = realloc(profiler->contexts, sizeof(profiler->contexts[0]) * profiler->context_cap);
+        }
+        result = profiler->context_count++;
+        ProfilerContext *context = profiler->contexts + result;
+        context->node = node;
+        context->parent = parent;
+        context->first_child = 0;
+        context->next_sibling = profiler->contexts[parent].first_child;
+        context->visits = 0;
+        context->exclusive_cycles = 0;
+        profiler->contexts[parent].first_child = result;
+    }
+    
+    return result;
+}
+
+static void
+ProfilerEnterNode(AbstractSyntaxTreeNode *node)
+{
+    Profiler *profiler = global_profiler;
+    if(profiler)
+    {
+        if(!node->profile_visits)
+        {
+            if(profiler->node_count >= profiler->node_cap)
+            {
+                profiler->node_cap = profiler->node_cap ? profiler->node_cap * 2 : 1024;
+                profiler->nodes = realloc(profiler->nodes, sizeof(profiler->nodes[0]) * profiler->node_cap);
+            }
+            profiler->nodes[profiler->node_count++] = node;
+        }
+        ++node->profile_visits;
+        ++node->profile_active_count;
+        
+        if(profiler->frame_count >= profiler->frame_cap)
+        {
+            profiler->frame_cap = profiler->frame_cap ? profiler->frame_cap * 2 : 1024;
+            profiler->frames = realloc(profiler->frames, sizeof(profiler->frames[0]) * profiler->frame_cap);
+        }
+        
+        unsigned int context = ProfilerFindOrAddContext(profiler, profiler->current_context, node);
+        ++profiler->contexts[context].visits;
+        profiler->current_context = context;
+        
+        ProfilerFrame *frame = profiler->frames + profiler->frame_count++;
+        frame->context = context;
+        frame->child_cycles = 0;
+        
+        // NOTE(rjf): Read the counter last, so the bookkeeping above isn't
+        //            charged to the node.
+        frame->start_cycles = ReadCycleCounter();
+    }
+}
+
+static void
+ProfilerExitNode(AbstractSyntaxTreeNode *node)
+{
+    unsigned long long end_cycles = ReadCycleCounter();
+    Profiler *profiler = global_profiler;
+    if(profiler && profiler->frame_count)
+    {
+        ProfilerFrame *frame = profiler->frames + --profiler->frame_count;
+        unsigned long long elapsed = end_cycles - frame->start_cycles;
+        unsigned long long exclusive = elapsed - frame->child_cycles;
+        
+        node->profile_exclusive_cycles += exclusive;
+        if(--node->profile_active_count == 0)
+        {
+            node->profile_inclusive_cycles += elapsed;
+        }
+        
+        profiler->contexts[frame->context].exclusive_cycles += exclusive;
+        profiler->current_context = profiler->contexts[frame->context].parent;
+        
+        if(profiler->frame_count)
+        {
+            profiler->frames[profiler->frame_count-1].child_cycles += elapsed;
+        }
+        else
+        {
+            profiler->total_cycles += elapsed;
+        }
+    }
+}
+
+static void
+ProfilerSourceLocation(Profiler *profiler, AbstractSyntaxTreeNode *node, int *line_out, int *column_out)
+{
+    if(!profiler->line_starts)
+    {
+        unsigned int line_cap = 1024;
+        profiler->line_starts = malloc(sizeof(profiler->line_starts[0]) * line_cap);
+        profiler->line_starts[profiler->line_count++] = 0;
+        for(unsigned long long i = 0; i < profiler->source_length; ++i)
+        {
+            if(profiler->source[i] == '\n')
+            {
+                if(profiler->line_count >= line_cap)
+                {
+                    line_cap *= 2;
+                    profiler->line_starts = realloc(profiler->line_starts, sizeof(profiler->line_starts[0]) * line_cap);
+                }
+                profiler->line_starts[profiler->line_count++] = i+1;
+            }
+        }
+    }
+    
+    int line = 0;
+    int column = 0;
+    if(node->source >= profiler->source &&
+       node->source < profiler->source + profiler->source_length)
+    {
+        unsigned long long offset = (unsigned long long)(node->source - profiler->source);
+        
+        // NOTE(rjf): Find the last line that starts at or before the offset.
+        unsigned int low = 0;
+        unsigned int high = profiler->line_count;
+        while(high - low > 1)
+        {
+            unsigned int middle = low + (high - low) / 2;
+            if(profiler->line_starts[middle] <= offset)
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        line = (int)low + 1;
+        column = (int)(offset - profiler->line_starts[low]) + 1;
+    }
+    *line_out = line;
+    *column_out = column;
+}
+
+static int
+ProfilerNodeName(AbstractSyntaxTreeNode *node, char *buffer, int buffer_size)
+{
+    int length = 0;
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_let:
+        {
+            length = snprintf(buffer, buffer_size, LetRecursiveCount(node) ? "let rec %.*s" : "let %.*s",
+                              node->let.string_length, node->let.string);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+        {
+            length = snprintf(buffer, buffer_size, "%.*s", node->identifier.string_length, node->identifier.string);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_numeric_constant:
+        {
+            char number[NUMBER_FORMAT_MAX_LENGTH];
+            int number_length = NumberFormat(number, node->numeric_constant.value, NUMBER_FORMAT_STYLE_general);
+            length = snprintf(buffer, buffer_size, "%.*s", number_length, number);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_boolean_constant:
+        {
+            length = snprintf(buffer, buffer_size, "%s", node->boolean_constant.value ? "true" : "false");
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+        {
+            char *operator_string = "?";
+#define BinaryOperator(name, str) if(node->binary_operator.type == BINARY_OPERATOR_##name) { operator_string = str; }
+            BINARY_OPERATOR_LIST
+#undef BinaryOperator
+            length = snprintf(buffer, buffer_size, "%s", operator_string);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+        {
+            length = snprintf(buffer, buffer_size, "if");
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+        {
+            length = snprintf(buffer, buffer_size, "function(%.*s)",
+                              node->function_definition.param_name_length,
+                              node->function_definition.param_name);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+        {
+            length = snprintf(buffer, buffer_size, "call");
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+        {
+            length = snprintf(buffer, buffer_size, "array[%u]", node->array_literal.element_count);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_index:
+        {
+            length = snprintf(buffer, buffer_size, "index");
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_operator_reference:
+        {
+            char *operator_string = "?";
+#define BinaryOperator(name, str) if(node->operator_reference.type == BINARY_OPERATOR_##name) { operator_string = str; }
+            BINARY_OPERATOR_LIST
+#undef BinaryOperator
+            length = snprintf(buffer, buffer_size, "(%s)", operator_string);
+            break;
+        }
+        default:
+        {
+            length = snprintf(buffer, buffer_size, "node");
+            break;
+        }
+    }
+    return length < buffer_size ? length : buffer_size - 1;
+}
+
+static int
+ProfilerCompareNodes(const void *a, const void *b)
+{
+    AbstractSyntaxTreeNode *node_a = *(AbstractSyntaxTreeNode **)a;
+    AbstractSyntaxTreeNode *node_b = *(AbstractSyntaxTreeNode **)b;
+    return (node_a->profile_exclusive_cycles < node_b->profile_exclusive_cycles ? 1 :
+            node_a->profile_exclusive_cycles > node_b->profile_exclusive_cycles ? -1 : 0);
+}
+
+static void
+ProfilerPrintHotSpots(Profiler *profiler, FILE *file, int count)
+{
+    qsort(profiler->nodes, profiler->node_count, sizeof(profiler->nodes[0]), ProfilerCompareNodes);
+    
+    double total = profiler->total_cycles ? (double)profiler->total_cycles : 1.0;
+    fprintf(file, "%-10s %-24s %12s %16s %7s %16s %7s\n",
+            "location", "node", "visits", "exclusive", "%", "inclusive", "%");
+    for(unsigned int i = 0; i < profiler->node_count && i < (unsigned int)count; ++i)
+    {
+        AbstractSyntaxTreeNode *node = profiler->nodes[i];
+        int line = 0;
+        int column = 0;
+        ProfilerSourceLocation(profiler, node, &line, &column);
+        char location[32];
+        snprintf(location, sizeof(location), "%d:%d", line, column);
+        char name[64];
+        ProfilerNodeName(node, name, sizeof(name));
+        fprintf(file, "%-10s %-24s %12llu %16llu %6.2f%% %16llu %6.2f%%\n",
+                location, name, node->profile_visits,
+                node->profile_exclusive_cycles, 100.0 * node->profile_exclusive_cycles / total,
+                node->profile_inclusive_cycles, 100.0 * node->profile_inclusive_cycles / total);
+    }
+    fprintf(file, "%llu cycles total, %u nodes visited, %u distinct stacks\n",
+            profiler->total_cycles, profiler->node_count, profiler->context_count - 1);
+}
+
+// NOTE(rjf): Writes one line per calling context that has any exclusive time,
+//            in the collapsed format flamegraph.pl reads:
+//            "let f@1:1;call@2:5;+@1:30 1234". Returns 0 on failure.
+static int
+ProfilerWriteCollapsedStacks(Profiler *profiler, FILE *file)
+{
+    int success = 1;
+    unsigned int path_cap = 64;
+    unsigned int *path = malloc(sizeof(path[0]) * path_cap);
+    
+    for(unsigned int i = 1; i < profiler->context_count && success; ++i)
+    {
+        ProfilerContext *context = profiler->contexts + i;
+        if(context->exclusive_cycles)
+        {
+            unsigned int depth = 0;
+            for(unsigned int at = i; at; at = profiler->contexts[at].parent)
+            {
+                if(depth >= path_cap)
+                {
+                    path_cap *= 2;
+                    path = realloc(path, sizeof(path[0]) * path_cap);
+                }
+                path[depth++] = at;
+            }
+            
+            while(depth > 0)
+            {
+                AbstractSyntaxTreeNode *node = profiler->contexts[path[--depth]].node;
+                int line = 0;
+                int column = 0;
+                ProfilerSourceLocation(profiler, node, &line, &column);
+                char name[64];
+                int name_length = ProfilerNodeName(node, name, sizeof(name));
+                for(int j = 0; j < name_length; ++j)
+                {
+                    // NOTE(rjf): Spaces and semicolons mean something in this format.
+                    if(name[j] == ';' || name[j] == ' ')
+                    {
+                        name[j] = '_';
+                    }
+                }
+                fprintf(file, "%s@%d:%d%s", name, line, column, depth ? ";" : "");
+            }
+            success = fprintf(file, " %llu\n", context->exclusive_cycles) > 0;
+        }
+    }
+    
+    free(path);
+    return success;
+}
+
+#endif // LETTUCE_PROFILE
@@ -0,0 +1,144 @@
+
+// NOTE(rjf): A Program is a parsed lettuce source that can be evaluated any
+//            number of times. It owns a copy of its source (identifier tokens
+//            point into it) and an arena holding its AST, so it can outlive
+//            whatever buffer the source originally came from.
+
+typedef struct Program
+{
+    MemoryArena arena;
+    char *source;
+    unsigned int source_length;
+    AbstractSyntaxTreeNode *root;
+    ParseError error;
+}
+Program;
+
+typedef struct ProgramBinding
+{
+    char *name;
+    int name_length;
+    EvaluationResult value;
+}
+ProgramBinding;
+
+static int
+ProgramCompile(Program *program, char *source, unsigned int source_length)
+{
+    MemoryArena *arena = &program->arena;
+    
+    program->source = MemoryArenaAllocate(arena, source_length+1, MEMORY_ARENA_CATEGORY_source);
+    MemoryCopy(program->source, source, source_length);
+    program->source[source_length] = 0;
+    program->source_length = source_length;
+    
+    Tokenizer tokenizer = {0};
+    TokenizerInit(&tokenizer, program->source, source_length);
+    program->root = ParseExpression(&tokenizer, arena, &program->error);
+    
+    if(program->error.string)
+    {
+        program->root = 0;
+    }
+    else if(!program->root)
+    {
+        program->error.string = "Not a valid expression.";
+    }
+    else
+    {
+        EscapeAnalyzeAbstractSyntaxTree(program->root);
+    }
+    
+    return !program->error.string;
+}
+
+// NOTE(rjf): An evaluation of a program that can be run a slice at a time. It
+//            mustn't move while it's in progress, since the stack refers to its
+//            environment.
+typedef struct ProgramEvaluation
+{
+    InterpreterEnvironment environment;
+    EvaluationStack *stack;
+    EvaluationResult result;
+}
+ProgramEvaluation;
+
+static int
+ProgramEvaluationFinish(ProgramEvaluation *evaluation, int done)
+{
+    if(done)
+    {
+        EvaluationStackCleanUp(evaluation->stack);
+        free(evaluation->stack);
+        evaluation->stack = 0;
+    }
+    return done;
+}
+
+// NOTE(rjf): limits can be 0. When one of them is hit, the result is an error
+//            with error.limit saying which, and whatever the program's lets and
+//            calls allocated on the arena has already been freed. With
+//            slice_nodes set, this returns 0 once that many nodes have been
+//            evaluated, and ProgramEvaluationResume does the next slice.
+//            Otherwise, or once it returns 1, evaluation->result is set.
+static int
+ProgramEvaluationBegin(ProgramEvaluation *evaluation, Program *program, MemoryArena *arena,
+                       ProgramBinding *bindings, int binding_count,
+                       EvaluationLimits *limits, unsigned long long slice_nodes)
+{
+    int done = 1;
+    memset(evaluation, 0, sizeof(*evaluation));
+    
+    if(program->root)
+    {
+        EvaluationStack *stack = malloc(sizeof(*stack));
+        stack->arena = (MemoryArena){0};
+        stack->arena.backend = MEMORY_ARENA_BACKEND_chunked;
+        EvaluationStackInit(stack, limits);
+        stack->slice_nodes = slice_nodes;
+        evaluation->stack = stack;
+        
+        InterpreterEnvironment *environment = &evaluation->environment;
+        environment->arena = arena;
+        environment->stack = stack;
+        
+        for(int i = 0; i < binding_count; ++i)
+        {
+            InterpreterEnvironmentBind(environment, bindings[i].name, bindings[i].name_length,
+                                       bindings[i].value);
+        }
+        
+        done = ProgramEvaluationFinish(evaluation, EvaluationBegin(stack, environment, program->root,
+                                                                   &evaluation->result));
+    }
+    else
+    {
+        evaluation->result.type = EVALUATION_RESULT_error;
+        evaluation->result.error.error_string = (program->error.string ? program->error.string :
+                                                 "Program was not compiled.");
+    }
+    
+    return done;
+}
+
+static int
+ProgramEvaluationResume(ProgramEvaluation *evaluation)
+{
+    return ProgramEvaluationFinish(evaluation, EvaluationResume(evaluation->stack, &evaluation->result));
+}
+
+static EvaluationResult
+ProgramEvaluate(Program *program, MemoryArena *arena,
+                ProgramBinding *bindings, int binding_count,
+                EvaluationLimits *limits)
+{
+    ProgramEvaluation evaluation;
+    ProgramEvaluationBegin(&evaluation, program, arena, bindings, binding_count, limits, 0);
+    return evaluation.result;
+}
+
+static void
+ProgramCleanUp(Program *program)
+{
+    MemoryArenaCleanUp(&program->arena);
+}
@@ -0,0 +1,735 @@
+// NOTE(rjf): Long-lived evaluation server. Clients connect over a Unix domain
+//            socket and send requests in the format described in
+//            lettuce_server_protocol.c. Compiled programs are kept in a cache
+//            that is shared between workers.
+//
+//            Connections aren't tied to threads. Every connection that's waiting
+//            for a request is watched by one poller (epoll, or kqueue outside of
+//            Linux), which a fixed pool of worker threads wait on. A worker that
+//            gets a connection reads a request and evaluates it for one slice of
+//            --slice nodes. An evaluation that isn't done by then goes on a run
+//            queue, and picks up where it left off when a worker gets to it
+//            again. Workers take from the poller and the run queue in turn, so a
+//            long evaluation doesn't hold on to a thread while short ones wait
+//            behind it, and new requests don't keep long ones from finishing.
+//            Each evaluation in flight has its own arena, from a pool, which is
+//            reset (not freed) after every request.
+//
+//            Connections are non-blocking. A worker reads as much of a request
+//            as has arrived, keeps what it has in the connection's request, and
+//            hands the connection back to the poller until the rest shows up, so
+//            a client that sends half a request and stops only holds up itself.
+
+#define SERVER_PROGRAM_CACHE_SIZE 4096
+#define SERVER_DEFAULT_SLICE_NODES 4096
+
+// NOTE(rjf): Workers parse programs, which takes C stack in proportion to how
+//            deeply they're nested, so they all get the same amount, rather
+//            than whatever threads get by default (512 KB on macOS).
+#define SERVER_WORKER_STACK_SIZE (8*1024*1024)
+
+typedef struct ServerProgramCacheSlot
+{
+    unsigned long long hash;
+    Program *program;
+}
+ServerProgramCacheSlot;
+
+typedef struct ServerProgramCache
+{
+    pthread_rwlock_t lock;
+    unsigned int count;
+    ServerProgramCacheSlot slots[SERVER_PROGRAM_CACHE_SIZE];
+}
+ServerProgramCache;
+
+// NOTE(rjf): An evaluation in flight, and everything it needs until its
+//            response is written.
+typedef struct ServerRequest ServerRequest;
+struct ServerRequest
+{
+    ServerRequest *next_free;
+    MemoryArena arena;
+    ProgramEvaluation evaluation;
+    unsigned long long hash;
+    Program *uncached_program;
+    
+    // NOTE(rjf): Set until the whole request has been read, along with how far
+    //            reading it got.
+    int reading;
+    int is_eval;
+    int binding_count;
+    int bindings_read;
+    int bindings_valid;
+    ProgramBinding *bindings;
+    char *source;
+    unsigned int source_length;
+    unsigned int source_read;
+};
+
+typedef struct ServerConnection ServerConnection;
+struct ServerConnection
+{
+    ServerConnection *next;
+    int fd;
+    ServerRequest *request;
+    SocketReader reader;
+};
+
+typedef struct Server
+{
+    int listen_fd;
+    int poller;
+    EvaluationLimits limits;
+    unsigned long long slice_nodes;
+    ServerProgramCache program_cache;
+    
+    pthread_mutex_t run_queue_mutex;
+    ServerConnection *run_queue_first;
+    ServerConnection *run_queue_last;
+    
+    pthread_mutex_t free_request_mutex;
+    ServerRequest *free_requests;
+}
+Server;
+
+// NOTE(rjf): Watches fd until it's readable once, and then has one call to
+//            ServerPollerWait return data. Watching it again re-arms it.
+#if defined(__linux__)
+
+static int
+ServerPollerInit(void)
+{
+    return epoll_create1(0);
+}
+
+static int
+ServerPollerWatch(int poller, int fd, void *data, int first_time)
+{
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = data;
+    return epoll_ctl(poller, first_time ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+}
+
+static int
+ServerPollerWait(int poller, void **data, int wait)
+{
+    struct epoll_event event = {0};
+    int count = epoll_wait(poller, &event, 1, wait ? -1 : 0);
+    *data = event.data.ptr;
+    return count;
+}
+
+#else
+
+static int
+ServerPollerInit(void)
+{
+    return kqueue();
+}
+
+static int
+ServerPollerWatch(int poller, int fd, void *data, int first_time)
+{
+    struct kevent change;
+    EV_SET(&change, fd, EVFILT_READ, EV_ADD | EV_ONESHOT, 0, 0, data);
+    return kevent(poller, &change, 1, 0, 0, 0);
+}
+
+static int
+ServerPollerWait(int poller, void **data, int wait)
+{
+    struct kevent event = {0};
+    struct timespec no_time = {0};
+    int count = kevent(poller, 0, 0, &event, 1, wait ? 0 : &no_time);
+    *data = event.udata;
+    return count;
+}
+
+#endif
+
+static Program *
+ServerProgramCacheLookUp(ServerProgramCache *cache, unsigned long long hash)
+{
+    Program *program = 0;
+    
+    pthread_rwlock_rdlock(&cache->lock);
+    unsigned int slot = (unsigned int)(hash % SERVER_PROGRAM_CACHE_SIZE);
+    for(unsigned int i = 0; i < SERVER_PROGRAM_CACHE_SIZE; ++i)
+    {
+        ServerProgramCacheSlot *cache_slot = cache->slots + slot;
+        if(!cache_slot->program)
+        {
+            break;
+        }
+        else if(cache_slot->hash == hash)
+        {
+            program = cache_slot->program;
+            break;
+        }
+        slot = (slot + 1) % SERVER_PROGRAM_CACHE_SIZE;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    
+    return program;
+}
+
+// NOTE(rjf): Returns the program that ends up in the cache for this hash, which
+//            is not the one passed in if another worker got there first. Returns
+//            0 if the cache is full, in which case the caller still owns program.
+//            Cached programs are never evicted, so pointers into the cache stay
+//            valid for as long as the server runs.
+static Program *
+ServerProgramCacheInsert(ServerProgramCache *cache, unsigned long long hash, Program *program)
+{
+    Program *result = 0;
+    
+    pthread_rwlock_wrlock(&cache->lock);
+    if(cache->count < SERVER_PROGRAM_CACHE_SIZE / 2)
+    {
+        unsigned int slot = (unsigned int)(hash % SERVER_PROGRAM_CACHE_SIZE);
+        for(;;)
+        {
+            ServerProgramCacheSlot *cache_slot = cache->slots + slot;
+            if(!cache_slot->program)
+            {
+                cache_slot->hash = hash;
+                cache_slot->program = program;
+                ++cache->count;
+                result = program;
+                break;
+            }
+            else if(cache_slot->hash == hash)
+            {
+                result = cache_slot->program;
+                break;
+            }
+            slot = (slot + 1) % SERVER_PROGRAM_CACHE_SIZE;
+        }
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    
+    return result;
+}
+
+static int
+ServerParseBinding(char *line, MemoryArena *arena, ProgramBinding *binding)
+{
+    int success = 0;
+    
+    char *value = strchr(line, ' ');
+    if(value && value != line)
+    {
+        int name_length = (int)(value - line);
+        ++value;
+        
+        binding->name = MemoryArenaAllocate(arena, name_length, MEMORY_ARENA_CATEGORY_other);
+        MemoryCopy(binding->name, line, name_length);
+        binding->name_length = name_length;
+        
+        if(!strcmp(value, "true") || !strcmp(value, "false"))
+        {
+            binding->value.type = EVALUATION_RESULT_boolean;
+            binding->value.boolean = value[0] == 't';
+            success = 1;
+        }
+        else
+        {
+            char *end = 0;
+            binding->value.type = EVALUATION_RESULT_number;
+            binding->value.number = strtod(value, &end);
+            success = end != value && *end == 0;
+        }
+    }
+    
+    return success;
+}
+
+static int
+ServerWriteResponse(int fd, unsigned long long hash, int have_hash, EvaluationResult result)
+{
+    char response[SERVER_PROTOCOL_MAX_LINE_LENGTH];
+    char hash_string[17] = "-";
+    int length = 0;
+    
+    if(have_hash)
+    {
+        snprintf(hash_string, sizeof(hash_string), "%016llx", hash);
+    }
+    
+    switch(result.type)
+    {
+        case EVALUATION_RESULT_number:
+        {
+            char number[NUMBER_FORMAT_MAX_LENGTH];
+            int number_length = NumberFormat(number, result.number, NUMBER_FORMAT_STYLE_general);
+            length = snprintf(response, sizeof(response), "OK %s number %.*s\n", hash_string, number_length, number);
+            break;
+        }
+        case EVALUATION_RESULT_boolean:
+        {
+            length = snprintf(response, sizeof(response), "OK %s boolean %s\n", hash_string,
+                              result.boolean ? "true" : "false");
+            break;
+        }
+        case EVALUATION_RESULT_array:
+        {
+            length = snprintf(response, sizeof(response), "OK %s array %u\n", hash_string, result.array.count);
+            break;
+        }
+        case EVALUATION_RESULT_closure:
+        case EVALUATION_RESULT_builtin:
+        case EVALUATION_RESULT_compiled:
+        {
+            length = snprintf(response, sizeof(response), "OK %s closure\n", hash_string);
+            break;
+        }
+        default:
+        {
+            length = snprintf(response, sizeof(response), "ERROR %s %s\n", hash_string,
+                              result.error.error_string ? result.error.error_string : "Unknown error.");
+            break;
+        }
+    }
+    
+    if(length >= (int)sizeof(response))
+    {
+        length = sizeof(response) - 1;
+        response[length-1] = '\n';
+    }
+    
+    return SocketWriteAll(fd, response, (size_t)length);
+}
+
+static EvaluationResult
+ServerErrorResult(char *message)
+{
+    EvaluationResult result = {0};
+    result.type = EVALUATION_RESULT_error;
+    result.error.error_string = message;
+    return result;
+}
+
+
+static ServerRequest *
+ServerAcquireRequest(Server *server)
+{
+    pthread_mutex_lock(&server->free_request_mutex);
+    ServerRequest *request = server->free_requests;
+    if(request)
+    {
+        server->free_requests = request->next_free;
+    }
+    pthread_mutex_unlock(&server->free_request_mutex);
+    
+    // NOTE(rjf): There can be as many of these as there are connections, so
+    //            they use chunked arenas rather than each reserving address space.
+    if(!request)
+    {
+        request = calloc(1, sizeof(ServerRequest));
+        request->arena.backend = MEMORY_ARENA_BACKEND_chunked;
+    }
+    request->hash = 0;
+    request->uncached_program = 0;
+    request->reading = 1;
+    request->bindings_read = 0;
+    request->bindings_valid = 1;
+    request->source = 0;
+    request->source_read = 0;
+    return request;
+}
+
+static void
+ServerReleaseRequest(Server *server, ServerRequest *request)
+{
+    if(request->uncached_program)
+    {
+        ProgramCleanUp(request->uncached_program);
+        free(request->uncached_program);
+    }
+    MemoryArenaReset(&request->arena);
+    
+    pthread_mutex_lock(&server->free_request_mutex);
+    request->next_free = server->free_requests;
+    server->free_requests = request;
+    pthread_mutex_unlock(&server->free_request_mutex);
+}
+
+static int
+ServerFinishRequest(Server *server, ServerConnection *connection)
+{
+    ServerRequest *request = connection->request;
+    int keep_connection = ServerWriteResponse(connection->fd, request->hash, 1, request->evaluation.result);
+    ServerReleaseRequest(server, request);
+    connection->request = 0;
+    return keep_connection;
+}
+
+// NOTE(rjf): Looks up or compiles the program for a request that's been read in
+//            full, and evaluates it for the first slice. Returns 0 when the
+//            connection should be closed. When the evaluation isn't done after
+//            the first slice, it's left in connection->request.
+static int
+ServerBeginRequest(Server *server, ServerConnection *connection)
+{
+    int fd = connection->fd;
+    ServerRequest *request = connection->request;
+    unsigned long long hash = request->hash;
+    int keep_connection = 1;
+    Program *program = 0;
+    
+    request->reading = 0;
+    
+    if(request->is_eval)
+    {
+        char *source = request->source;
+        unsigned int source_length = request->source_length;
+        source[source_length] = 0;
+        hash = HashProgramSource(source, source_length);
+        
+        program = ServerProgramCacheLookUp(&server->program_cache, hash);
+        
+        // NOTE(rjf): On a hash collision, the source is compiled but not cached.
+        int hash_collided = program && !StringMatch(program->source, program->source_length,
+                                                    source, source_length);
+        if(!program || hash_collided)
+        {
+            Program *new_program = calloc(1, sizeof(Program));
+            program = 0;
+            if(ProgramCompile(new_program, source, source_length) && !hash_collided)
+            {
+                program = ServerProgramCacheInsert(&server->program_cache, hash, new_program);
+            }
+            
+            if(program != new_program)
+            {
+                if(program)
+                {
+                    ProgramCleanUp(new_program);
+                    free(new_program);
+                }
+                else
+                {
+                    request->uncached_program = new_program;
+                    program = new_program;
+                }
+            }
+        }
+    }
+    else
+    {
+        program = ServerProgramCacheLookUp(&server->program_cache, hash);
+    }
+    
+    request->hash = hash;
+    
+    if(!program)
+    {
+        keep_connection = ServerWriteResponse(fd, hash, 1, ServerErrorResult("Unknown program."));
+        ServerReleaseRequest(server, request);
+        connection->request = 0;
+    }
+    else if(!request->bindings_valid)
+    {
+        keep_connection = ServerWriteResponse(fd, hash, 1, ServerErrorResult("Malformed binding."));
+        ServerReleaseRequest(server, request);
+        connection->request = 0;
+    }
+    else if(ProgramEvaluationBegin(&request->evaluation, program, &request->arena,
+                                   request->bindings, request->binding_count,
+                                   &server->limits, server->slice_nodes))
+    {
+        keep_connection = ServerFinishRequest(server, connection);
+    }
+    
+    return keep_connection;
+}
+
+// NOTE(rjf): Reads as much of a request as the client has sent so far, and
+//            starts evaluating it once it's all there. Returns 0 when the
+//            connection should be closed, either because the client went away or
+//            because the request was malformed badly enough that we can't find
+//            the start of the next one. A request that's only partly there is
+//            kept in connection->request, with connection->reader.would_block
+//            set, to be picked up again once the socket is readable.
+static int
+ServerReadRequest(Server *server, ServerConnection *connection)
+{
+    int fd = connection->fd;
+    SocketReader *reader = &connection->reader;
+    ServerRequest *request = connection->request;
+    char line[SERVER_PROTOCOL_MAX_LINE_LENGTH];
+    
+    if(!request)
+    {
+        if(SocketReaderReadLine(reader, line, sizeof(line)) < 0)
+        {
+            return reader->would_block;
+        }
+        
+        int binding_count = 0;
+        unsigned int source_length = 0;
+        unsigned long long hash = 0;
+        int is_eval = 0;
+        
+        if(sscanf(line, "EVAL %d %u", &binding_count, &source_length) == 2)
+        {
+            is_eval = 1;
+        }
+        else if(sscanf(line, "CALL %llx %d", &hash, &binding_count) == 2)
+        {
+            is_eval = 0;
+        }
+        else
+        {
+            ServerWriteResponse(fd, 0, 0, ServerErrorResult("Malformed request."));
+            return 0;
+        }
+        
+        if(binding_count < 0 || binding_count > SERVER_PROTOCOL_MAX_BINDINGS ||
+           source_length > SERVER_PROTOCOL_MAX_SOURCE_LENGTH)
+        {
+            ServerWriteResponse(fd, 0, 0, ServerErrorResult("Request exceeds server limits."));
+            return 0;
+        }
+        
+        request = ServerAcquireRequest(server);
+        request->hash = hash;
+        request->is_eval = is_eval;
+        request->binding_count = binding_count;
+        request->source_length = source_length;
+        request->bindings = MemoryArenaAllocate(&request->arena, sizeof(ProgramBinding)*(binding_count+1),
+                                                MEMORY_ARENA_CATEGORY_other);
+        connection->request = request;
+    }
+    
+    while(request->bindings_read < request->binding_count)
+    {
+        if(SocketReaderReadLine(reader, line, sizeof(line)) < 0)
+        {
+            return reader->would_block;
+        }
+        else if(!ServerParseBinding(line, &request->arena, request->bindings + request->bindings_read))
+        {
+            request->bindings_valid = 0;
+        }
+        ++request->bindings_read;
+    }
+    
+    if(request->is_eval)
+    {
+        if(!request->source)
+        {
+            request->source = MemoryArenaAllocate(&request->arena, request->source_length+1,
+                                                  MEMORY_ARENA_CATEGORY_source);
+        }
+        if(!SocketReaderReadBytes(reader, request->source, request->source_length, &request->source_read))
+        {
+            return reader->would_block;
+        }
+    }
+    
+    return ServerBeginRequest(server, connection);
+}
+
+static void
+ServerQueueConnection(Server *server, ServerConnection *connection)
+{
+    pthread_mutex_lock(&server->run_queue_mutex);
+    connection->next = 0;
+    if(server->run_queue_last)
+    {
+        server->run_queue_last->next = connection;
+    }
+    else
+    {
+        server->run_queue_first = connection;
+    }
+    server->run_queue_last = connection;
+    pthread_mutex_unlock(&server->run_queue_mutex);
+}
+
+static ServerConnection *
+ServerDequeueConnection(Server *server)
+{
+    pthread_mutex_lock(&server->run_queue_mutex);
+    ServerConnection *connection = server->run_queue_first;
+    if(connection)
+    {
+        server->run_queue_first = connection->next;
+        if(!server->run_queue_first)
+        {
+            server->run_queue_last = 0;
+        }
+    }
+    pthread_mutex_unlock(&server->run_queue_mutex);
+    return connection;
+}
+
+// NOTE(rjf): Waits on the poller only when nothing is queued. Whoever queues a
+//            connection comes back here afterwards, so queued ones don't sit
+//            there while every worker waits.
+static ServerConnection *
+ServerNextConnection(Server *server, int queued_first)
+{
+    ServerConnection *connection = queued_first ? ServerDequeueConnection(server) : 0;
+    
+    while(!connection)
+    {
+        pthread_mutex_lock(&server->run_queue_mutex);
+        int wait = !server->run_queue_first;
+        pthread_mutex_unlock(&server->run_queue_mutex);
+        
+        void *data = 0;
+        int count = ServerPollerWait(server->poller, &data, wait);
+        if(count > 0 && data == &server->listen_fd)
+        {
+            int fd = accept(server->listen_fd, 0, 0);
+            ServerPollerWatch(server->poller, server->listen_fd, &server->listen_fd, 0);
+            if(fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+            {
+                close(fd);
+            }
+            else if(fd >= 0)
+            {
+                ServerConnection *new_connection = calloc(1, sizeof(ServerConnection));
+                new_connection->fd = fd;
+                new_connection->reader.fd = fd;
+                ServerPollerWatch(server->poller, fd, new_connection, 1);
+            }
+        }
+        else if(count > 0)
+        {
+            connection = data;
+        }
+        else if(count < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "FATAL ERROR: Waiting for connections failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+        else
+        {
+            connection = ServerDequeueConnection(server);
+        }
+    }
+    
+    return connection;
+}
+
+static void *
+ServerWorkerThread(void *data)
+{
+    Server *server = data;
+    int queued_first = 0;
+    
+    for(;;)
+    {
+        ServerConnection *connection = ServerNextConnection(server, queued_first);
+        ServerRequest *request = connection->request;
+        queued_first = !queued_first;
+        
+        int keep_connection = 1;
+        if(!request || request->reading)
+        {
+            keep_connection = ServerReadRequest(server, connection);
+        }
+        else if(ProgramEvaluationResume(&request->evaluation))
+        {
+            keep_connection = ServerFinishRequest(server, connection);
+        }
+        
+        // NOTE(rjf): Requests that are already buffered wouldn't wake the poller,
+        //            so the connection is queued for those too. Once a read has
+        //            run out of data, though, only the poller knows when there's more.
+        request = connection->request;
+        int evaluating = request && !request->reading;
+        int buffered = connection->reader.start < connection->reader.end && !connection->reader.would_block;
+        if(!keep_connection)
+        {
+            if(connection->request)
+            {
+                ServerReleaseRequest(server, connection->request);
+            }
+            close(connection->fd);
+            free(connection);
+        }
+        else if(evaluating || buffered)
+        {
+            ServerQueueConnection(server, connection);
+        }
+        else
+        {
+            ServerPollerWatch(server->poller, connection->fd, connection, 0);
+        }
+    }
+    
+    return 0;
+}
+
+// NOTE(rjf): limits apply to every request, and can be 0. slice_nodes can be 0,
+//            for SERVER_DEFAULT_SLICE_NODES.
+static int
+RunServer(char *socket_path, int thread_count, EvaluationLimits *limits, unsigned long long slice_nodes)
+{
+    Server *server = calloc(1, sizeof(Server));
+    if(limits)
+    {
+        server->limits = *limits;
+    }
+    server->slice_nodes = slice_nodes ? slice_nodes : SERVER_DEFAULT_SLICE_NODES;
+    pthread_rwlock_init(&server->program_cache.lock, 0);
+    pthread_mutex_init(&server->run_queue_mutex, 0);
+    pthread_mutex_init(&server->free_request_mutex, 0);
+    
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if(CalculateCStringLength(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "FATAL ERROR: Socket path \"%s\" is too long.\n", socket_path);
+        return 1;
+    }
+    MemoryCopy(address.sun_path, socket_path, CalculateCStringLength(socket_path));
+    
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server->poller = ServerPollerInit();
+    unlink(socket_path);
+    if(server->listen_fd < 0 || server->poller < 0 ||
+       fcntl(server->listen_fd, F_SETFL, fcntl(server->listen_fd, F_GETFL) | O_NONBLOCK) < 0 ||
+       bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+       listen(server->listen_fd, SOMAXCONN) < 0 ||
+       ServerPollerWatch(server->poller, server->listen_fd, &server->listen_fd, 1) < 0)
+    {
+        fprintf(stderr, "FATAL ERROR: Could not listen on \"%s\": %s.\n", socket_path, strerror(errno));
+        return 1;
+    }
+    
+    // NOTE(rjf): Clients hanging up mid-response should only fail that write.
+    signal(SIGPIPE, SIG_IGN);
+    
+    if(thread_count <= 0)
+    {
+        thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(thread_count <= 0)
+        {
+            thread_count = 1;
+        }
+    }
+    
+    fprintf(stderr, "Listening on \"%s\" with %d worker threads, %llu nodes per slice.\n",
+            socket_path, thread_count, server->slice_nodes);
+    
+    // NOTE(rjf): This thread is one of the workers.
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    pthread_attr_t thread_attributes;
+    pthread_attr_init(&thread_attributes);
+    pthread_attr_setstacksize(&thread_attributes, SERVER_WORKER_STACK_SIZE);
+    for(int i = 1; i < thread_count; ++i)
+    {
+        pthread_create(threads + i, &thread_attributes, ServerWorkerThread, server);
+    }
+    pthread_attr_destroy(&thread_attributes);
+    ServerWorkerThread(server);
+    
+    return 1;
+}
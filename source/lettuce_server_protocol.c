@@ -0,0 +1,187 @@
+
+// NOTE(rjf): Wire format shared by the evaluation server and its clients. It's a
+//            line-based text protocol, with the only binary part being program
+//            source, which is length-prefixed so it can contain newlines.
+//
+//            Requests:
+//
+//              EVAL <binding count> <source length>\n
+//              <name> <value>\n                       (once per binding)
+//              <source bytes>
+//
+//              CALL <program hash> <binding count>\n
+//              <name> <value>\n                       (once per binding)
+//
+//            A binding value is a number, "true", or "false". EVAL compiles the
+//            source (or finds it in the program cache) and evaluates it. CALL
+//            evaluates a program that an earlier EVAL already put in the cache,
+//            without sending its source again.
+//
+//            Responses are always exactly one line:
+//
+//              OK <program hash> number <value>\n
+//              OK <program hash> boolean <true|false>\n
+//              OK <program hash> array <element count>\n
+//              OK <program hash> closure\n
+//              ERROR <program hash or -> <message>\n
+
+#define SERVER_PROTOCOL_MAX_LINE_LENGTH 1024
+#define SERVER_PROTOCOL_MAX_BINDINGS 256
+#define SERVER_PROTOCOL_MAX_SOURCE_LENGTH (64*1024*1024)
+#define SOCKET_WRITE_TIMEOUT_MILLISECONDS 5000
+
+// NOTE(rjf): Works on blocking and non-blocking sockets. On a non-blocking one,
+//            a read that fails because nothing has arrived yet sets would_block,
+//            and leaves whatever was buffered so the read can be tried again.
+typedef struct SocketReader
+{
+    int fd;
+    int would_block;
+    unsigned int start;
+    unsigned int end;
+    char buffer[64*1024];
+}
+SocketReader;
+
+static int
+SocketReaderFill(SocketReader *reader)
+{
+    if(reader->start > 0)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    
+    ssize_t bytes_read = 0;
+    do
+    {
+        bytes_read = read(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end);
+    }
+    while(bytes_read < 0 && errno == EINTR);
+    
+    if(bytes_read > 0)
+    {
+        reader->end += (unsigned int)bytes_read;
+    }
+    else if(bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        reader->would_block = 1;
+    }
+    
+    return bytes_read > 0;
+}
+
+// NOTE(rjf): Reads a line, without its newline, into out (null-terminated).
+//            Returns the line length, or -1 on EOF, error, or an overlong line.
+static int
+SocketReaderReadLine(SocketReader *reader, char *out, int out_capacity)
+{
+    int length = -1;
+    reader->would_block = 0;
+    
+    for(;;)
+    {
+        char *newline = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start);
+        if(newline)
+        {
+            int line_length = (int)(newline - (reader->buffer + reader->start));
+            if(line_length < out_capacity)
+            {
+                MemoryCopy(out, reader->buffer + reader->start, line_length);
+                out[line_length] = 0;
+                length = line_length;
+            }
+            reader->start += line_length + 1;
+            break;
+        }
+        else if(reader->end - reader->start >= (unsigned int)out_capacity ||
+                !SocketReaderFill(reader))
+        {
+            break;
+        }
+    }
+    
+    return length;
+}
+
+// NOTE(rjf): Reads until *copied reaches count, starting from wherever *copied
+//            already is, so a read that would block can be picked up later.
+static int
+SocketReaderReadBytes(SocketReader *reader, char *out, unsigned int count, unsigned int *copied)
+{
+    int success = 1;
+    reader->would_block = 0;
+    
+    while(*copied < count)
+    {
+        if(reader->start == reader->end && !SocketReaderFill(reader))
+        {
+            success = 0;
+            break;
+        }
+        
+        unsigned int available = reader->end - reader->start;
+        unsigned int to_copy = count - *copied;
+        if(to_copy > available)
+        {
+            to_copy = available;
+        }
+        MemoryCopy(out + *copied, reader->buffer + reader->start, to_copy);
+        reader->start += to_copy;
+        *copied += to_copy;
+    }
+    
+    return success;
+}
+
+// NOTE(rjf): On a non-blocking socket, waits for a full send buffer to drain,
+//            but gives up after SOCKET_WRITE_TIMEOUT_MILLISECONDS, so a peer that
+//            stops reading can't hold on to the writer forever.
+static int
+SocketWriteAll(int fd, char *data, size_t size)
+{
+    int success = 1;
+    
+    while(size > 0)
+    {
+        ssize_t bytes_written = write(fd, data, size);
+        if(bytes_written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct pollfd poll_fd = {0};
+                poll_fd.fd = fd;
+                poll_fd.events = POLLOUT;
+                int ready = poll(&poll_fd, 1, SOCKET_WRITE_TIMEOUT_MILLISECONDS);
+                if(ready > 0 || (ready < 0 && errno == EINTR))
+                {
+                    continue;
+                }
+            }
+            success = 0;
+            break;
+        }
+        data += bytes_written;
+        size -= (size_t)bytes_written;
+    }
+    
+    return success;
+}
+
+static unsigned long long
+HashProgramSource(char *source, unsigned int source_length)
+{
+    // NOTE(rjf): 64-bit FNV-1a.
+    unsigned long long hash = 14695981039346656037ull;
+    for(unsigned int i = 0; i < source_length; ++i)
+    {
+        hash ^= (unsigned char)source[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
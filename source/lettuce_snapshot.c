@@ -0,0 +1,752 @@
+// NOTE(rjf): Snapshots. A program can start with a prelude of lets that take a
+//            long time to evaluate but always produce the same thing, like
+//            tables of closures. --snapshot-save <image> evaluates the lets a
+//            program starts with and writes what they bound out as an image:
+//            the environment, the closures and arrays in it, the environments
+//            those closures captured, and the parts of the AST and source they
+//            refer to. --snapshot <image> maps one back in and evaluates
+//            another program with those names already bound.
+//
+//            Images are relocatable. Everything is copied into one block, where
+//            pointers are stored as offsets from its start, and the offsets of
+//            those pointers are kept in a table at the end. Restoring maps the
+//            file privately and adds the base address to each of them, which
+//            costs as much as the prelude kept, not as much as it evaluated.
+//            The environments in the image are also listed, so they can be
+//            given the arena and stack of the evaluation that restores them.
+//
+//            Values, environments and nodes are written with whatever layout
+//            the binary that wrote the image was compiled with, and names are
+//            in tables by the hashes it computed, so an image only loads into
+//            the same build of lettuce.
+
+#define SNAPSHOT_MAGIC "LETTUCE\x1a"
+#define SNAPSHOT_FORMAT_VERSION 1
+
+static char snapshot_build[32] = __DATE__ " " __TIME__;
+
+typedef struct SnapshotHeader
+{
+    char magic[8];
+    unsigned int format_version;
+    unsigned int node_size;
+    unsigned int value_size;
+    unsigned int environment_size;
+    char build[32];
+    unsigned long long size;
+    unsigned long long source;
+    unsigned long long source_length;
+    unsigned long long environment;
+    unsigned long long environment_list;
+    unsigned long long environment_count;
+    unsigned long long relocation_list;
+    unsigned long long relocation_count;
+}
+SnapshotHeader;
+
+enum
+{
+    SNAPSHOT_OBJECT_bytes,
+    SNAPSHOT_OBJECT_node,
+    SNAPSHOT_OBJECT_node_list,
+    SNAPSHOT_OBJECT_environment,
+    SNAPSHOT_OBJECT_values,
+};
+
+// NOTE(rjf): An object that has been copied into the image, so that everything
+//            referring to it refers to the same copy.
+typedef struct SnapshotObject
+{
+    void *pointer;
+    unsigned long long size;
+    unsigned long long offset;
+}
+SnapshotObject;
+
+// NOTE(rjf): An object whose pointers haven't been written yet. Objects are
+//            copied first and have their pointers filled in later, from a
+//            list, so that deep trees don't recurse.
+typedef struct SnapshotWork
+{
+    int type;
+    void *original;
+    unsigned long long offset;
+    unsigned long long count;
+}
+SnapshotWork;
+
+typedef struct SnapshotWriter
+{
+    char *data;
+    unsigned long long size;
+    unsigned long long cap;
+    
+    char *source;
+    unsigned long long source_length;
+    unsigned long long source_offset;
+    
+    SnapshotObject *object_table;
+    unsigned int object_table_count;
+    unsigned int object_table_cap;
+    
+    SnapshotWork *work;
+    unsigned int work_count;
+    unsigned int work_cap;
+    
+    unsigned long long *relocations;
+    unsigned long long relocation_count;
+    unsigned long long relocation_cap;
+    
+    unsigned long long *environments;
+    unsigned long long environment_count;
+    unsigned long long environment_cap;
+    
+    char *error;
+}
+SnapshotWriter;
+
+static unsigned int
+SnapshotHashPointer(void *pointer)
+{
+    unsigned long long value = (unsigned long long)pointer;
+    value ^= value >> 29;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 32;
+    return (unsigned int)value;
+}
+
+static unsigned long long
+SnapshotAllocate(SnapshotWriter *writer, unsigned long long size, void *copy_from)
+{
+    unsigned long long offset = AlignUpPow2(writer->size, MEMORY_ARENA_MAX_ALIGNMENT);
+    if(offset + size > writer->cap)
+    {
+        while(offset + size > writer->cap)
+        {
+            writer->cap = writer->cap ? writer->cap * 2 : 64*1024;
+        }
+        writer->data = realloc(writer->data, writer->cap);
+    }
+    memset(writer->data + writer->size, 0, offset - writer->size);
+    if(copy_from)
+    {
+        MemoryCopy(writer->data + offset, copy_from, size);
+    }
+    else
+    {
+        memset(writer->data + offset, 0, size);
+    }
+    writer->size = offset + size;
+    return offset;
+}
+
+static void
+SnapshotPushOffset(unsigned long long **list, unsigned long long *count, unsigned long long *cap,
+                   unsigned long long offset)
+{
+    if(*count >= *cap)
+    {
+        *cap = *cap ? *cap * 2 : 256;
+        *list = realloc(*list, sizeof((*list)[0]) * *cap);
+    }
+    (*list)[(*count)++] = offset;
+}
+
+// NOTE(rjf): target is 0 for a null pointer, which nothing in the image can be
+//            at, since the header is.
+static void
+SnapshotSetPointer(SnapshotWriter *writer, unsigned long long field, unsigned long long target)
+{
+    *(unsigned long long *)(writer->data + field) = target;
+    if(target)
+    {
+        SnapshotPushOffset(&writer->relocations, &writer->relocation_count, &writer->relocation_cap, field);
+    }
+}
+
+static SnapshotObject *
+SnapshotLookUpObject(SnapshotWriter *writer, void *pointer)
+{
+    if(writer->object_table_count * 2 >= writer->object_table_cap)
+    {
+        unsigned int old_cap = writer->object_table_cap;
+        SnapshotObject *old_table = writer->object_table;
+        writer->object_table_cap = old_cap ? old_cap * 2 : 1024;
+        writer->object_table = calloc(writer->object_table_cap, sizeof(writer->object_table[0]));
+        unsigned int mask = writer->object_table_cap - 1;
+        for(unsigned int i = 0; i < old_cap; ++i)
+        {
+            if(old_table[i].pointer)
+            {
+                unsigned int slot = SnapshotHashPointer(old_table[i].pointer) & mask;
+                while(writer->object_table[slot].pointer)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                writer->object_table[slot] = old_table[i];
+            }
+        }
+        free(old_table);
+    }
+    
+    unsigned int mask = writer->object_table_cap - 1;
+    unsigned int slot = SnapshotHashPointer(pointer) & mask;
+    while(writer->object_table[slot].pointer && writer->object_table[slot].pointer != pointer)
+    {
+        slot = (slot + 1) & mask;
+    }
+    return writer->object_table + slot;
+}
+
+// NOTE(rjf): Copies size bytes at pointer into the image, unless they already
+//            have been, and returns where they are.
+static unsigned long long
+SnapshotCopy(SnapshotWriter *writer, int type, void *pointer, unsigned long long size, unsigned long long count)
+{
+    unsigned long long offset = 0;
+    if(pointer)
+    {
+        SnapshotObject *object = SnapshotLookUpObject(writer, pointer);
+        if(object->pointer && object->size >= size)
+        {
+            offset = object->offset;
+        }
+        else
+        {
+            offset = SnapshotAllocate(writer, size, pointer);
+            if(!object->pointer)
+            {
+                ++writer->object_table_count;
+            }
+            object->pointer = pointer;
+            object->size = size;
+            object->offset = offset;
+            
+            if(type != SNAPSHOT_OBJECT_bytes)
+            {
+                if(writer->work_count >= writer->work_cap)
+                {
+                    writer->work_cap = writer->work_cap ? writer->work_cap * 2 : 256;
+                    writer->work = realloc(writer->work, sizeof(writer->work[0]) * writer->work_cap);
+                }
+                SnapshotWork *work = writer->work + writer->work_count++;
+                work->type = type;
+                work->original = pointer;
+                work->offset = offset;
+                work->count = count;
+            }
+        }
+    }
+    return offset;
+}
+
+// NOTE(rjf): Names mostly point into the source, which is copied whole, so
+//            only the ones that don't (like names the optimizer made up) are
+//            copied by themselves. They're null-terminated in the image either
+//            way, for error strings.
+static unsigned long long
+SnapshotCopyString(SnapshotWriter *writer, char *string, unsigned long long length)
+{
+    unsigned long long offset = 0;
+    if(string >= writer->source && string + length <= writer->source + writer->source_length)
+    {
+        offset = writer->source_offset + (string - writer->source);
+    }
+    else if(string)
+    {
+        offset = SnapshotAllocate(writer, length + 1, 0);
+        MemoryCopy(writer->data + offset, string, length);
+    }
+    return offset;
+}
+
+// NOTE(rjf): Writes the pointer at field, in original, into the copy of
+//            original at object.
+static void
+SnapshotWriteStringField(SnapshotWriter *writer, unsigned long long object, void *original, char **field,
+                         unsigned long long length)
+{
+    unsigned long long field_offset = object + ((char *)field - (char *)original);
+    SnapshotSetPointer(writer, field_offset, SnapshotCopyString(writer, *field, length));
+}
+
+static void
+SnapshotWriteNodeField(SnapshotWriter *writer, unsigned long long object, void *original,
+                       AbstractSyntaxTreeNode **field)
+{
+    unsigned long long field_offset = object + ((char *)field - (char *)original);
+    SnapshotSetPointer(writer, field_offset, SnapshotCopy(writer, SNAPSHOT_OBJECT_node, *field,
+                                                          sizeof(AbstractSyntaxTreeNode), 1));
+}
+
+static void
+SnapshotWriteValue(SnapshotWriter *writer, unsigned long long object, EvaluationResult *value)
+{
+    switch(value->type)
+    {
+        case EVALUATION_RESULT_error:
+        {
+            if(value->error.error_string)
+            {
+                SnapshotWriteStringField(writer, object, value, &value->error.error_string,
+                                         CalculateCStringLength(value->error.error_string));
+            }
+            break;
+        }
+        case EVALUATION_RESULT_closure:
+        {
+            SnapshotWriteStringField(writer, object, value, &value->closure.param_name,
+                                     value->closure.param_name_length);
+            SnapshotWriteNodeField(writer, object, value, &value->closure.body);
+            unsigned long long field = object + ((char *)&value->closure.environment - (char *)value);
+            SnapshotSetPointer(writer, field, SnapshotCopy(writer, SNAPSHOT_OBJECT_environment, value->closure.environment,
+                                                           sizeof(InterpreterEnvironment), 1));
+            break;
+        }
+        case EVALUATION_RESULT_array:
+        {
+            unsigned long long field = object + ((char *)&value->array.elements - (char *)value);
+            SnapshotSetPointer(writer, field, (value->array.count ?
+                                               SnapshotCopy(writer, SNAPSHOT_OBJECT_bytes, value->array.elements,
+                                                            sizeof(value->array.elements[0]) * value->array.count, 0) :
+                                               0));
+            break;
+        }
+        case EVALUATION_RESULT_builtin:
+        {
+            unsigned long long field = object + ((char *)&value->builtin.applied - (char *)value);
+            SnapshotSetPointer(writer, field, (value->builtin.applied_count ?
+                                               SnapshotCopy(writer, SNAPSHOT_OBJECT_values, value->builtin.applied,
+                                                            sizeof(value->builtin.applied[0]) * value->builtin.applied_count,
+                                                            value->builtin.applied_count) :
+                                               0));
+            break;
+        }
+        case EVALUATION_RESULT_compiled:
+        {
+            writer->error = "Closures made by compiled code can't be saved.";
+            break;
+        }
+        default: break;
+    }
+}
+
+static void
+SnapshotWriteNode(SnapshotWriter *writer, unsigned long long object, AbstractSyntaxTreeNode *node)
+{
+    // NOTE(rjf): Nodes the optimizer made point at the source of the ones they
+    //            came from, so this is only 0 for nodes that didn't come from
+    //            this source at all.
+    unsigned long long source_field = object + ((char *)&node->source - (char *)node);
+    SnapshotSetPointer(writer, source_field, ((node->source >= writer->source &&
+                                               node->source < writer->source + writer->source_length) ?
+                                              writer->source_offset + (node->source - writer->source) : 0));
+    
+    switch(node->type)
+    {
+        case ABSTRACT_SYNTAX_TREE_NODE_let:
+        {
+            SnapshotWriteStringField(writer, object, node, &node->let.string, node->let.string_length);
+            SnapshotWriteNodeField(writer, object, node, &node->let.binding_expression);
+            SnapshotWriteNodeField(writer, object, node, &node->let.body_expression);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_identifier:
+        {
+            SnapshotWriteStringField(writer, object, node, &node->identifier.string, node->identifier.string_length);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_binary_operator:
+        {
+            SnapshotWriteNodeField(writer, object, node, &node->binary_operator.left);
+            SnapshotWriteNodeField(writer, object, node, &node->binary_operator.right);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_unary_operator:
+        {
+            SnapshotWriteNodeField(writer, object, node, &node->unary_operator.expression);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_if_then_else:
+        {
+            SnapshotWriteNodeField(writer, object, node, &node->if_then_else.condition);
+            SnapshotWriteNodeField(writer, object, node, &node->if_then_else.pass_code);
+            SnapshotWriteNodeField(writer, object, node, &node->if_then_else.fail_code);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_definition:
+        {
+            SnapshotWriteStringField(writer, object, node, &node->function_definition.param_name,
+                                     node->function_definition.param_name_length);
+            SnapshotWriteNodeField(writer, object, node, &node->function_definition.body);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_function_call:
+        {
+            SnapshotWriteNodeField(writer, object, node, &node->function_call.closure);
+            SnapshotWriteNodeField(writer, object, node, &node->function_call.parameter);
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_array_literal:
+        {
+            unsigned long long field = object + ((char *)&node->array_literal.elements - (char *)node);
+            SnapshotSetPointer(writer, field, (node->array_literal.element_count ?
+                                               SnapshotCopy(writer, SNAPSHOT_OBJECT_node_list, node->array_literal.elements,
+                                                            sizeof(node->array_literal.elements[0]) *
+                                                            node->array_literal.element_count,
+                                                            node->array_literal.element_count) :
+                                               0));
+            break;
+        }
+        case ABSTRACT_SYNTAX_TREE_NODE_index:
+        {
+            SnapshotWriteNodeField(writer, object, node, &node->index.array);
+            SnapshotWriteNodeField(writer, object, node, &node->index.index);
+            break;
+        }
+        default: break;
+    }
+}
+
+// NOTE(rjf): Only live slots are written. Deleted and empty ones are cleared,
+//            since their values can point at memory that was freed.
+static void
+SnapshotWriteEnvironment(SnapshotWriter *writer, unsigned long long object, InterpreterEnvironment *environment)
+{
+    SnapshotPushOffset(&writer->environments, &writer->environment_count, &writer->environment_cap, object);
+    
+    InterpreterEnvironment *copy = (InterpreterEnvironment *)(writer->data + object);
+    copy->arena = 0;
+    copy->gc = 0;
+    copy->stack = 0;
+    copy->region_marker = 0;
+    copy->identifier_table_values = 0;
+    copy->identifier_table_keys = 0;
+    
+    unsigned int cap = environment->identifier_table_cap;
+    if(cap)
+    {
+        unsigned long long values = SnapshotAllocate(writer, sizeof(environment->identifier_table_values[0]) * cap,
+                                                     environment->identifier_table_values);
+        unsigned long long keys = SnapshotAllocate(writer, sizeof(environment->identifier_table_keys[0]) * cap,
+                                                   environment->identifier_table_keys);
+        SnapshotSetPointer(writer, object + ((char *)&environment->identifier_table_values - (char *)environment), values);
+        SnapshotSetPointer(writer, object + ((char *)&environment->identifier_table_keys - (char *)environment), keys);
+        
+        for(unsigned int i = 0; i < cap; ++i)
+        {
+            unsigned long long value = values + i*sizeof(environment->identifier_table_values[0]);
+            unsigned long long key = keys + i*sizeof(environment->identifier_table_keys[0]);
+            if(environment->identifier_table_keys[i].string && !environment->identifier_table_keys[i].deleted)
+            {
+                SnapshotWriteStringField(writer, key, environment->identifier_table_keys + i,
+                                         &environment->identifier_table_keys[i].string,
+                                         environment->identifier_table_keys[i].string_length);
+                SnapshotWriteValue(writer, value, &environment->identifier_table_values[i].value);
+            }
+            else
+            {
+                memset(writer->data + value, 0, sizeof(environment->identifier_table_values[0]));
+            }
+        }
+    }
+}
+
+// NOTE(rjf): Writes environment out to path, with source being what the nodes
+//            in it were parsed from. Returns 0, with an error, if it can't.
+static int
+SnapshotSave(char *path, InterpreterEnvironment *environment, char *source, unsigned long long source_length,
+             char **error_out)
+{
+    SnapshotWriter writer_ = {0};
+    SnapshotWriter *writer = &writer_;
+    writer->source = source;
+    writer->source_length = source_length;
+    
+    SnapshotAllocate(writer, sizeof(SnapshotHeader), 0);
+    writer->source_offset = SnapshotAllocate(writer, source_length + 1, 0);
+    MemoryCopy(writer->data + writer->source_offset, source, source_length);
+    unsigned long long root = SnapshotCopy(writer, SNAPSHOT_OBJECT_environment, environment,
+                                           sizeof(InterpreterEnvironment), 1);
+    
+    while(writer->work_count && !writer->error)
+    {
+        SnapshotWork work = writer->work[--writer->work_count];
+        switch(work.type)
+        {
+            case SNAPSHOT_OBJECT_node:
+            {
+                SnapshotWriteNode(writer, work.offset, work.original);
+                break;
+            }
+            case SNAPSHOT_OBJECT_node_list:
+            {
+                AbstractSyntaxTreeNode **nodes = work.original;
+                for(unsigned long long i = 0; i < work.count; ++i)
+                {
+                    SnapshotWriteNodeField(writer, work.offset + i*sizeof(nodes[0]), nodes + i, nodes + i);
+                }
+                break;
+            }
+            case SNAPSHOT_OBJECT_environment:
+            {
+                SnapshotWriteEnvironment(writer, work.offset, work.original);
+                break;
+            }
+            case SNAPSHOT_OBJECT_values:
+            {
+                EvaluationResult *values = work.original;
+                for(unsigned long long i = 0; i < work.count; ++i)
+                {
+                    SnapshotWriteValue(writer, work.offset + i*sizeof(values[0]), values + i);
+                }
+                break;
+            }
+            default: break;
+        }
+    }
+    
+    if(!writer->error)
+    {
+        unsigned long long environment_list = SnapshotAllocate(writer, sizeof(writer->environments[0]) *
+                                                               writer->environment_count, writer->environments);
+        unsigned long long relocation_list = SnapshotAllocate(writer, sizeof(writer->relocations[0]) *
+                                                              writer->relocation_count, writer->relocations);
+        
+        SnapshotHeader *header = (SnapshotHeader *)writer->data;
+        MemoryCopy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+        header->format_version = SNAPSHOT_FORMAT_VERSION;
+        header->node_size = sizeof(AbstractSyntaxTreeNode);
+        header->value_size = sizeof(EvaluationResult);
+        header->environment_size = sizeof(InterpreterEnvironment);
+        MemoryCopy(header->build, snapshot_build, sizeof(header->build));
+        header->size = writer->size;
+        header->source = writer->source_offset;
+        header->source_length = source_length;
+        header->environment = root;
+        header->environment_list = environment_list;
+        header->environment_count = writer->environment_count;
+        header->relocation_list = relocation_list;
+        header->relocation_count = writer->relocation_count;
+        
+        FILE *file = fopen(path, "wb");
+        if(!file)
+        {
+            writer->error = "The image could not be created.";
+        }
+        else
+        {
+            if(fwrite(writer->data, 1, writer->size, file) != writer->size)
+            {
+                writer->error = "The image could not be written.";
+            }
+            if(fclose(file))
+            {
+                writer->error = "The image could not be written.";
+            }
+        }
+    }
+    
+    *error_out = writer->error;
+    free(writer->data);
+    free(writer->object_table);
+    free(writer->work);
+    free(writer->relocations);
+    free(writer->environments);
+    return !writer->error;
+}
+
+// NOTE(rjf): Evaluates the bindings of the lets that root starts with into
+//            environment, like they would be for their bodies, and returns the
+//            first node that isn't one of those lets. Returns 0 instead, with
+//            the error in result, if a binding runs into a limit.
+static AbstractSyntaxTreeNode *
+SnapshotEvaluatePrelude(InterpreterEnvironment *environment, AbstractSyntaxTreeNode *root, EvaluationResult *result)
+{
+    AbstractSyntaxTreeNode *node = root;
+    while(node && node->type == ABSTRACT_SYNTAX_TREE_NODE_let)
+    {
+        unsigned int recursive_count = LetRecursiveCount(node);
+        if(recursive_count)
+        {
+            InterpreterEnvironmentBindRecursive(environment, node, recursive_count);
+            node = LetRecursiveNested(node, recursive_count - 1)->let.body_expression;
+            continue;
+        }
+        
+        EvaluationResult value = EvaluateAbstractSyntaxTree(environment, node->let.binding_expression);
+        if(value.type == EVALUATION_RESULT_error && value.error.limit != EVALUATION_LIMIT_none)
+        {
+            *result = value;
+            node = 0;
+        }
+        else
+        {
+            InterpreterEnvironmentBind(environment, node->let.string, node->let.string_length, value);
+            node = node->let.body_expression;
+        }
+    }
+    return node;
+}
+
+typedef struct Snapshot
+{
+    char *base;
+    unsigned long long size;
+    InterpreterEnvironment *environment;
+    unsigned long long environment_count;
+    unsigned long long relocation_count;
+    unsigned long long load_nanoseconds;
+    char *error;
+    char error_buffer[256];
+}
+Snapshot;
+
+// NOTE(rjf): Maps the image at path, and gives its environments arena and
+//            stack. Returns 0, with snapshot->error set, if it can't be loaded.
+static int
+SnapshotLoad(Snapshot *snapshot, char *path, MemoryArena *arena, EvaluationStack *stack)
+{
+    unsigned long long start_time = GetTimeInNanoseconds();
+    memset(snapshot, 0, sizeof(*snapshot));
+    
+    int fd = open(path, O_RDONLY);
+    struct stat file_stat = {0};
+    if(fd < 0 || fstat(fd, &file_stat) || !S_ISREG(file_stat.st_mode))
+    {
+        snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" could not be opened.", path);
+        snapshot->error = snapshot->error_buffer;
+    }
+    else if((unsigned long long)file_stat.st_size < sizeof(SnapshotHeader))
+    {
+        snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" is not a snapshot image.", path);
+        snapshot->error = snapshot->error_buffer;
+    }
+    else
+    {
+        // NOTE(rjf): Private, so relocating and evaluating only copy the pages
+        //            they write to, and the file is never changed.
+        snapshot->size = (unsigned long long)file_stat.st_size;
+        char *base = mmap(0, snapshot->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if(base == MAP_FAILED)
+        {
+            snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" could not be mapped.", path);
+            snapshot->error = snapshot->error_buffer;
+        }
+        else
+        {
+            snapshot->base = base;
+        }
+    }
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    
+    SnapshotHeader *header = (SnapshotHeader *)snapshot->base;
+    unsigned long long size = snapshot->size;
+    if(snapshot->error)
+    {
+        // NOTE(rjf): Nothing was mapped.
+    }
+    else if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->size != size)
+    {
+        snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" is not a snapshot image.", path);
+        snapshot->error = snapshot->error_buffer;
+    }
+    else if(header->format_version != SNAPSHOT_FORMAT_VERSION ||
+            header->node_size != sizeof(AbstractSyntaxTreeNode) ||
+            header->value_size != sizeof(EvaluationResult) ||
+            header->environment_size != sizeof(InterpreterEnvironment) ||
+            memcmp(header->build, snapshot_build, sizeof(header->build)))
+    {
+        snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer),
+                 "\"%s\" was written by a different build of lettuce (%.*s).", path,
+                 (int)strnlen(header->build, sizeof(header->build)), header->build);
+        snapshot->error = snapshot->error_buffer;
+    }
+    else if(header->environment < sizeof(SnapshotHeader) ||
+            header->environment > size - sizeof(InterpreterEnvironment) ||
+            header->environment_list > size || header->environment_count > (size - header->environment_list) / 8 ||
+            header->relocation_list > size || header->relocation_count > (size - header->relocation_list) / 8)
+    {
+        snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" is damaged.", path);
+        snapshot->error = snapshot->error_buffer;
+    }
+    else
+    {
+        char *base = snapshot->base;
+        unsigned long long *relocations = (unsigned long long *)(base + header->relocation_list);
+        for(unsigned long long i = 0; i < header->relocation_count && !snapshot->error; ++i)
+        {
+            unsigned long long field = relocations[i];
+            if(field % 8 || field > size - 8 || *(unsigned long long *)(base + field) >= size)
+            {
+                snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" is damaged.", path);
+                snapshot->error = snapshot->error_buffer;
+            }
+            else
+            {
+                *(char **)(base + field) = base + *(unsigned long long *)(base + field);
+            }
+        }
+        
+        unsigned long long *environments = (unsigned long long *)(base + header->environment_list);
+        for(unsigned long long i = 0; i < header->environment_count && !snapshot->error; ++i)
+        {
+            if(environments[i] % 8 || environments[i] > size - sizeof(InterpreterEnvironment))
+            {
+                snprintf(snapshot->error_buffer, sizeof(snapshot->error_buffer), "\"%s\" is damaged.", path);
+                snapshot->error = snapshot->error_buffer;
+            }
+            else
+            {
+                InterpreterEnvironment *environment = (InterpreterEnvironment *)(base + environments[i]);
+                environment->arena = arena;
+                environment->stack = stack;
+            }
+        }
+        
+        snapshot->environment = (InterpreterEnvironment *)(base + header->environment);
+        snapshot->environment_count = header->environment_count;
+        snapshot->relocation_count = header->relocation_count;
+    }
+    
+    if(snapshot->error && snapshot->base)
+    {
+        munmap(snapshot->base, snapshot->size);
+        snapshot->base = 0;
+    }
+    snapshot->load_nanoseconds = GetTimeInNanoseconds() - start_time;
+    return !snapshot->error;
+}
+
+// NOTE(rjf): Gives environment the snapshot's bindings, in tables of its own,
+//            so that whatever it binds doesn't change the snapshot's.
+static void
+SnapshotBind(Snapshot *snapshot, InterpreterEnvironment *environment)
+{
+    InterpreterEnvironment *copy = InterpreterEnvironmentDuplicate(snapshot->environment);
+    environment->identifier_table_count = copy->identifier_table_count;
+    environment->identifier_table_cap = copy->identifier_table_cap;
+    environment->identifier_table_values = copy->identifier_table_values;
+    environment->identifier_table_keys = copy->identifier_table_keys;
+}
+
+static void
+SnapshotPrintStats(Snapshot *snapshot, FILE *file)
+{
+    fprintf(file, "snapshot: %llu bytes mapped, %llu environments, %llu pointers relocated, in %.3f ms\n",
+            snapshot->size, snapshot->environment_count, snapshot->relocation_count,
+            snapshot->load_nanoseconds / 1000000.0);
+}
+
+static void
+SnapshotCleanUp(Snapshot *snapshot)
+{
+    if(snapshot->base)
+    {
+        munmap(snapshot->base, snapshot->size);
+    }
+    memset(snapshot, 0, sizeof(*snapshot));
+}
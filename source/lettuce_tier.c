@@ -0,0 +1,807 @@
+// NOTE(rjf): Tiered execution. Every closure call the evaluator makes is
+//            counted per function body, and once a body has been called
+//            threshold times, it's handed to a background thread, which
+//            compiles it on its own with the C backend (see lettuce_emit_c.c)
+//            into a shared object. When that's loaded, the function's state
+//            is switched to compiled, and from then on calls to it run the
+//            compiled code instead of walking the tree.
+//
+//            The names the body uses from outside are looked up in the
+//            closure's environment on every call and handed to the compiled
+//            code. The interpreter's own closures and builtins are passed as
+//            closures whose function is TierCallHost, which calls back into
+//            the interpreter. Closures the compiled code makes can come back
+//            out as EVALUATION_RESULT_compiled, which the interpreter calls
+//            with compiled code again, so a recursive function that's called
+//            through a closure it returned stays compiled.
+//
+//            Whatever compiled code can't do, like taking arrays, or going
+//            deeper than its share of the C stack, deoptimizes the call: its
+//            arena allocations are thrown away, and since evaluation has no
+//            side effects, the call is just evaluated again by the
+//            interpreter. A compiled closure is turned back into one of ours
+//            for that (see TierMaterialize). A function that deoptimizes too
+//            often is demoted back to the interpreter for good.
+//
+//            The compiler thread only reads the syntax tree and writes a
+//            function's fields before publishing its state, so the
+//            interpreter only needs an acquire load per call to see them.
+
+#define TIER_DEFAULT_THRESHOLD 1000
+#define TIER_MAX_DEOPTIMIZATIONS 16
+
+enum
+{
+    TIER_STATE_interpreted,
+    TIER_STATE_queued,
+    TIER_STATE_compiled,
+    TIER_STATE_failed,
+};
+
+typedef CompiledValue TierEntryPoint(CompiledHost *host, CompiledClosure *closure, CompiledValue argument);
+
+typedef struct TierFunction TierFunction;
+typedef struct TierFunction
+{
+    AbstractSyntaxTreeNode *body;
+    
+    // NOTE(rjf): Closures don't keep the function literal they came from, so
+    //            one is made up for the compiler from the closure's parameter
+    //            and body.
+    AbstractSyntaxTreeNode definition;
+    
+    unsigned long long call_count;
+    unsigned long long compiled_call_count;
+    unsigned int deoptimization_count;
+    int state;
+    int registered;
+    
+    // NOTE(rjf): The first of functions is definition itself, the rest are
+    //            the function literals inside it, and function_pointers are
+    //            what they were compiled to.
+    void *library;
+    TierEntryPoint *call;
+    void **function_pointers;
+    EmitCFunction **functions;
+    unsigned int function_count;
+    
+    unsigned long long compile_nanoseconds;
+    char *failure;
+    char failure_buffer[512];
+    
+    TierFunction *next_queued;
+}
+TierFunction;
+
+// NOTE(rjf): What a compiled function pointer was compiled from, so that its
+//            closures can be turned back into the interpreter's.
+typedef struct TierCompiledFunction
+{
+    void *pointer;
+    EmitCFunction *function;
+}
+TierCompiledFunction;
+
+typedef struct Tier
+{
+    unsigned long long threshold;
+    int log;
+    char *source;
+    unsigned long long source_length;
+    
+    // NOTE(rjf): Where the C stack was when the evaluation started, for
+    //            keeping compiled code from running out of it.
+    char *stack_base;
+    
+    // NOTE(rjf): Both open addressing, and only used by the interpreter's
+    //            thread. Functions are keyed by their body.
+    TierFunction **function_table;
+    unsigned int function_table_count;
+    unsigned int function_table_cap;
+    TierCompiledFunction *compiled_table;
+    unsigned int compiled_table_count;
+    unsigned int compiled_table_cap;
+    
+    int thread_started;
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    TierFunction *queue_first;
+    TierFunction *queue_last;
+    
+    unsigned long long compiled_call_count;
+    unsigned long long deoptimization_count;
+}
+Tier;
+
+// NOTE(rjf): One call running compiled code, for the host callbacks. call is
+//            used for the compiled closures the code hands back.
+typedef struct TierInvocation
+{
+    Tier *tier;
+    EvaluationStack *stack;
+    InterpreterEnvironment *environment;
+    TierEntryPoint *call;
+}
+TierInvocation;
+
+// NOTE(rjf): threshold is how many calls make a function hot, or 0 for
+//            TIER_DEFAULT_THRESHOLD. Log lines go to stderr when log is set.
+static void
+TierInit(Tier *tier, unsigned long long threshold, int log, char *source, unsigned long long source_length,
+         char *stack_base)
+{
+    memset(tier, 0, sizeof(*tier));
+    tier->threshold = threshold ? threshold : TIER_DEFAULT_THRESHOLD;
+    tier->log = log;
+    tier->source = source;
+    tier->source_length = source_length;
+    tier->stack_base = stack_base;
+    pthread_mutex_init(&tier->mutex, 0);
+    pthread_cond_init(&tier->condition, 0);
+}
+
+static void
+TierSourceLocation(Tier *tier, AbstractSyntaxTreeNode *node, int *line_out, int *column_out)
+{
+    int line = 0;
+    int column = 0;
+    if(node->source >= tier->source && node->source < tier->source + tier->source_length)
+    {
+        line = 1;
+        column = 1;
+        for(char *at = tier->source; at < node->source; ++at)
+        {
+            if(*at == '\n')
+            {
+                ++line;
+                column = 1;
+            }
+            else
+            {
+                ++column;
+            }
+        }
+    }
+    *line_out = line;
+    *column_out = column;
+}
+
+static void
+TierLog(Tier *tier, TierFunction *function, char *format, ...)
+{
+    if(tier->log)
+    {
+        int line = 0;
+        int column = 0;
+        TierSourceLocation(tier, function->body, &line, &column);
+        
+        char message[768];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        fprintf(stderr, "tier: function(%.*s) at %d:%d %s\n", function->definition.function_definition.param_name_length,
+                function->definition.function_definition.param_name, line, column, message);
+    }
+}
+
+static void *
+TierCompilerThread(void *user)
+{
+    Tier *tier = user;
+    for(;;)
+    {
+        pthread_mutex_lock(&tier->mutex);
+        while(!tier->queue_first && !tier->stopping)
+        {
+            pthread_cond_wait(&tier->condition, &tier->mutex);
+        }
+        TierFunction *function = tier->stopping ? 0 : tier->queue_first;
+        if(function)
+        {
+            tier->queue_first = function->next_queued;
+            if(!tier->queue_first)
+            {
+                tier->queue_last = 0;
+            }
+        }
+        pthread_mutex_unlock(&tier->mutex);
+        
+        if(!function)
+        {
+            break;
+        }
+        
+        unsigned long long start_time = GetTimeInNanoseconds();
+        char *error = 0;
+        function->library = EmitCBuildLibrary(0, &function->definition, function->failure_buffer,
+                                              sizeof(function->failure_buffer), &error,
+                                              &function->functions, &function->function_count);
+        if(function->library)
+        {
+            function->call = (TierEntryPoint *)dlsym(function->library, "LettuceCallClosure");
+            function->function_pointers = dlsym(function->library, "LettuceFunctions");
+            if(!function->call || !function->function_pointers)
+            {
+                error = "The compiled function has no entry point.";
+            }
+        }
+        function->compile_nanoseconds = GetTimeInNanoseconds() - start_time;
+        
+        if(error)
+        {
+            function->failure = error;
+            TierLog(tier, function, "can't be compiled: %s", error);
+            __atomic_store_n(&function->state, TIER_STATE_failed, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            TierLog(tier, function, "compiled after %llu calls, in %.1f ms", function->call_count,
+                    function->compile_nanoseconds / 1000000.0);
+            __atomic_store_n(&function->state, TIER_STATE_compiled, __ATOMIC_RELEASE);
+        }
+    }
+    return 0;
+}
+
+static TierFunction *
+TierLookUpFunction(Tier *tier, AbstractSyntaxTreeNode *body)
+{
+    if(tier->function_table_count * 2 >= tier->function_table_cap)
+    {
+        unsigned int old_cap = tier->function_table_cap;
+        TierFunction **old_table = tier->function_table;
+        tier->function_table_cap = old_cap ? old_cap * 2 : 64;
+        tier->function_table = calloc(tier->function_table_cap, sizeof(tier->function_table[0]));
+        unsigned int mask = tier->function_table_cap - 1;
+        for(unsigned int i = 0; i < old_cap; ++i)
+        {
+            if(old_table[i])
+            {
+                unsigned int slot = EmitCHashPointer(old_table[i]->body) & mask;
+                while(tier->function_table[slot])
+                {
+                    slot = (slot + 1) & mask;
+                }
+                tier->function_table[slot] = old_table[i];
+            }
+        }
+        free(old_table);
+    }
+    
+    unsigned int mask = tier->function_table_cap - 1;
+    unsigned int slot = EmitCHashPointer(body) & mask;
+    while(tier->function_table[slot] && tier->function_table[slot]->body != body)
+    {
+        slot = (slot + 1) & mask;
+    }
+    if(!tier->function_table[slot])
+    {
+        TierFunction *function = calloc(1, sizeof(*function));
+        function->body = body;
+        tier->function_table[slot] = function;
+        ++tier->function_table_count;
+    }
+    return tier->function_table[slot];
+}
+
+static EmitCFunction *
+TierLookUpCompiledFunction(Tier *tier, void *pointer)
+{
+    EmitCFunction *result = 0;
+    if(tier->compiled_table_cap)
+    {
+        unsigned int mask = tier->compiled_table_cap - 1;
+        for(unsigned int slot = EmitCHashPointer(pointer) & mask;
+            tier->compiled_table[slot].pointer;
+            slot = (slot + 1) & mask)
+        {
+            if(tier->compiled_table[slot].pointer == pointer)
+            {
+                result = tier->compiled_table[slot].function;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static void
+TierInsertCompiledFunction(Tier *tier, void *pointer, EmitCFunction *function)
+{
+    if(tier->compiled_table_count * 2 >= tier->compiled_table_cap)
+    {
+        unsigned int old_cap = tier->compiled_table_cap;
+        TierCompiledFunction *old_table = tier->compiled_table;
+        tier->compiled_table_cap = old_cap ? old_cap * 2 : 64;
+        tier->compiled_table = calloc(tier->compiled_table_cap, sizeof(tier->compiled_table[0]));
+        tier->compiled_table_count = 0;
+        for(unsigned int i = 0; i < old_cap; ++i)
+        {
+            if(old_table[i].pointer)
+            {
+                TierInsertCompiledFunction(tier, old_table[i].pointer, old_table[i].function);
+            }
+        }
+        free(old_table);
+    }
+    
+    unsigned int mask = tier->compiled_table_cap - 1;
+    unsigned int slot = EmitCHashPointer(pointer) & mask;
+    while(tier->compiled_table[slot].pointer)
+    {
+        slot = (slot + 1) & mask;
+    }
+    tier->compiled_table[slot].pointer = pointer;
+    tier->compiled_table[slot].function = function;
+    ++tier->compiled_table_count;
+}
+
+static void
+TierEnqueue(Tier *tier, TierFunction *function, EvaluationResult *closure)
+{
+    function->definition.type = ABSTRACT_SYNTAX_TREE_NODE_function_definition;
+    function->definition.source = function->body->source;
+    function->definition.function_definition.param_name = closure->closure.param_name;
+    function->definition.function_definition.param_name_length = closure->closure.param_name_length;
+    function->definition.function_definition.body = function->body;
+    function->state = TIER_STATE_queued;
+    
+    pthread_mutex_lock(&tier->mutex);
+    if(!tier->thread_started)
+    {
+        tier->thread_started = !pthread_create(&tier->thread, 0, TierCompilerThread, tier);
+    }
+    if(tier->thread_started)
+    {
+        if(tier->queue_last)
+        {
+            tier->queue_last->next_queued = function;
+        }
+        else
+        {
+            tier->queue_first = function;
+        }
+        tier->queue_last = function;
+        pthread_cond_signal(&tier->condition);
+    }
+    else
+    {
+        function->state = TIER_STATE_failed;
+        function->failure = "The compiler thread could not be started.";
+    }
+    pthread_mutex_unlock(&tier->mutex);
+}
+
+static CompiledValue TierCallHost(CompiledContext *context, CompiledClosure *closure, CompiledValue argument);
+
+// NOTE(rjf): Returns 0 if the value can't be passed to compiled code.
+static int
+TierWrap(TierInvocation *invocation, EvaluationResult *value, CompiledValue *out)
+{
+    int result = 1;
+    CompiledValue compiled = {0};
+    compiled.type = value->type;
+    if(value->type == EVALUATION_RESULT_number)
+    {
+        compiled.number = value->number;
+    }
+    else if(value->type == EVALUATION_RESULT_boolean)
+    {
+        compiled.boolean = value->boolean;
+    }
+    else if(value->type == EVALUATION_RESULT_error)
+    {
+        compiled.error.error_string = value->error.error_string;
+        compiled.error.limit = value->error.limit;
+    }
+    else if(value->type == EVALUATION_RESULT_compiled)
+    {
+        compiled.type = EVALUATION_RESULT_closure;
+        compiled.closure = value->compiled.closure;
+    }
+    else if(value->type == EVALUATION_RESULT_closure || value->type == EVALUATION_RESULT_builtin)
+    {
+        MemoryArena *arena = invocation->environment->arena;
+        EvaluationResult *copy = MemoryArenaAllocate(arena, sizeof(*copy), MEMORY_ARENA_CATEGORY_closures);
+        CompiledClosure *closure = MemoryArenaAllocateAligned(arena, sizeof(*closure) + sizeof(closure->captures[0]),
+                                                              MEMORY_ARENA_MAX_ALIGNMENT, MEMORY_ARENA_CATEGORY_closures);
+        *copy = *value;
+        closure->function = (void *)TierCallHost;
+        closure->captures[0].host = copy;
+        compiled.type = EVALUATION_RESULT_closure;
+        compiled.closure = closure;
+    }
+    else
+    {
+        result = 0;
+    }
+    *out = compiled;
+    return result;
+}
+
+static void
+TierUnwrap(TierEntryPoint *call, CompiledValue *value, EvaluationResult *out)
+{
+    EvaluationResult unwrapped = {0};
+    unwrapped.type = value->type;
+    if(value->type == EVALUATION_RESULT_number)
+    {
+        unwrapped.number = value->number;
+    }
+    else if(value->type == EVALUATION_RESULT_boolean)
+    {
+        unwrapped.boolean = value->boolean;
+    }
+    else if(value->type == EVALUATION_RESULT_closure)
+    {
+        if(value->closure->function == (void *)TierCallHost)
+        {
+            unwrapped = *(EvaluationResult *)value->closure->captures[0].host;
+        }
+        else
+        {
+            unwrapped.type = EVALUATION_RESULT_compiled;
+            unwrapped.compiled.closure = value->closure;
+            unwrapped.compiled.call = (void *)call;
+        }
+    }
+    else
+    {
+        unwrapped.error.error_string = value->error.error_string;
+        unwrapped.error.limit = value->error.limit;
+    }
+    *out = unwrapped;
+}
+
+// NOTE(rjf): Turns a compiled closure into one of ours, with an environment
+//            that just has what it captured. Returns 0 if it wasn't made by a
+//            function we compiled.
+static int
+TierMaterialize(Tier *tier, InterpreterEnvironment *environment, EvaluationResult *closure)
+{
+    CompiledClosure *compiled = closure->compiled.closure;
+    EmitCFunction *function = TierLookUpCompiledFunction(tier, compiled->function);
+    if(function)
+    {
+        InterpreterEnvironment *closure_environment = MemoryArenaAllocateZero(environment->arena, sizeof(*closure_environment),
+                                                                              MEMORY_ARENA_CATEGORY_closures);
+        closure_environment->arena = environment->arena;
+        closure_environment->stack = environment->stack;
+        InterpreterEnvironmentReserve(closure_environment);
+        for(unsigned int i = 0; i < function->capture_count; ++i)
+        {
+            EvaluationResult value;
+            TierUnwrap(closure->compiled.call, compiled->captures + i, &value);
+            InterpreterEnvironmentBind(closure_environment, function->captures[i].string,
+                                       function->captures[i].string_length, value);
+        }
+        
+        AbstractSyntaxTreeNode *definition = function->definition;
+        EvaluationResult result = {0};
+        result.type = EVALUATION_RESULT_closure;
+        result.closure.param_name = definition->function_definition.param_name;
+        result.closure.param_name_length = definition->function_definition.param_name_length;
+        result.closure.body = definition->function_definition.body;
+        result.closure.environment = closure_environment;
+        *closure = result;
+    }
+    return !!function;
+}
+
+// NOTE(rjf): Calls function, one of ours, on behalf of compiled code. Returns
+//            0 if the compiled code has to stop, because evaluation is being
+//            unwound, or because the result can't be given to it.
+static int
+TierApply(TierInvocation *invocation, EvaluationResult *function, CompiledValue argument, CompiledValue *result)
+{
+    EvaluationResult unwrapped_argument;
+    TierUnwrap(invocation->call, &argument, &unwrapped_argument);
+    
+    // NOTE(rjf): Compiled code holds on to its arena allocations until it
+    //            returns, so like the interpreter's calls, this frees what the
+    //            call allocated when nothing can refer to it anymore.
+    MemoryArena *arena = invocation->environment->arena;
+    MemoryArenaMarker marker = MemoryArenaSave(arena);
+    EvaluationResult value = EvaluationResultApply(invocation->environment, function, &unwrapped_argument);
+    if(EvaluationResultIsScalar(value))
+    {
+        MemoryArenaRestore(arena, marker);
+    }
+    return !invocation->stack->abort_error && TierWrap(invocation, &value, result);
+}
+
+static CompiledValue
+TierCallHost(CompiledContext *context, CompiledClosure *closure, CompiledValue argument)
+{
+    CompiledValue result = {0};
+    if(!TierApply(context->host->user, closure->captures[0].host, argument, &result))
+    {
+        context->stop(context, EMIT_C_ABORT_host);
+    }
+    return result;
+}
+
+static void *
+TierAllocate(void *user, unsigned long long size)
+{
+    TierInvocation *invocation = user;
+    EvaluationStack *stack = invocation->stack;
+    void *result = 0;
+    if(!stack->limits.max_bytes ||
+       EvaluationStackUsedBytes(stack, invocation->environment) + size - stack->base_bytes <= stack->limits.max_bytes)
+    {
+        result = MemoryArenaAllocateAligned(invocation->environment->arena, (unsigned int)size, MEMORY_ARENA_MAX_ALIGNMENT,
+                                            MEMORY_ARENA_CATEGORY_closures);
+    }
+    return result;
+}
+
+static int
+TierCheck(void *user)
+{
+    TierInvocation *invocation = user;
+    EvaluationStack *stack = invocation->stack;
+    int limit = EVALUATION_LIMIT_none;
+    if(stack->deadline && GetTimeInNanoseconds() >= stack->deadline)
+    {
+        limit = EVALUATION_LIMIT_deadline;
+    }
+    return limit;
+}
+
+static unsigned long long
+TierStackBytes(Tier *tier)
+{
+    char marker;
+    return tier->stack_base > &marker ? tier->stack_base - &marker : &marker - tier->stack_base;
+}
+
+// NOTE(rjf): Runs closure with compiled code. Returns 0 if the call has to be
+//            run by the interpreter instead.
+static int
+TierRun(TierInvocation *invocation, CompiledClosure *closure, CompiledValue argument, EvaluationResult *result)
+{
+    EvaluationStack *stack = invocation->stack;
+    int handled = 0;
+    
+    // NOTE(rjf): Closures made by compiled code are allocated one at a time,
+    //            rather than a chunk at a time, since they're kept until the
+    //            call that made them is done.
+    CompiledHost host = {0};
+    host.allocate = TierAllocate;
+    host.check = TierCheck;
+    host.user = invocation;
+    host.max_depth = stack->max_depth > stack->depth ? stack->max_depth - stack->depth : 1;
+    host.max_stack_bytes = EMIT_C_MAX_STACK_BYTES;
+    host.stack_base = invocation->tier->stack_base;
+    
+    CompiledValue value = invocation->call(&host, closure, argument);
+    int aborted = value.type == EVALUATION_RESULT_error && !value.error.error_string && value.error.limit;
+    
+    if(stack->abort_error)
+    {
+        // NOTE(rjf): An evaluation the compiled code called back into hit a
+        //            limit, and the interpreter is unwinding.
+        handled = 1;
+    }
+    else if(aborted && value.error.limit == EVALUATION_LIMIT_depth)
+    {
+        EvaluationStackAbort(stack, EVALUATION_LIMIT_depth, "Evaluation went deeper than the limit of %llu frames.",
+                             stack->max_depth);
+        handled = 1;
+    }
+    else if(aborted && value.error.limit == EVALUATION_LIMIT_memory)
+    {
+        EvaluationStackAbort(stack, EVALUATION_LIMIT_memory, "Evaluation used more than the limit of %llu bytes.",
+                             stack->limits.max_bytes);
+        handled = 1;
+    }
+    else if(aborted && value.error.limit == EVALUATION_LIMIT_deadline)
+    {
+        EvaluationStackAbort(stack, EVALUATION_LIMIT_deadline, "Evaluation took longer than the limit of %llu ms.",
+                             stack->limits.deadline_milliseconds);
+        handled = 1;
+    }
+    else if(!aborted)
+    {
+        TierUnwrap(invocation->call, &value, result);
+        handled = 1;
+    }
+    
+    if(handled && stack->abort_error)
+    {
+        *result = EvaluationErrorResult(stack->abort_error);
+        result->error.limit = stack->abort_limit;
+    }
+    return handled;
+}
+
+static int
+TierCallCompiledClosure(Tier *tier, InterpreterEnvironment *environment, EvaluationResult *function,
+                        EvaluationResult *argument, EvaluationResult *result)
+{
+    MemoryArena *arena = environment->arena;
+    MemoryArenaMarker arena_marker = MemoryArenaSave(arena);
+    int handled = 0;
+    
+    TierInvocation invocation = {0};
+    invocation.tier = tier;
+    invocation.stack = environment->stack;
+    invocation.environment = environment;
+    invocation.call = function->compiled.call;
+    
+    CompiledValue compiled_argument;
+    if(TierStackBytes(tier) < EMIT_C_MAX_STACK_BYTES / 2 && TierWrap(&invocation, argument, &compiled_argument))
+    {
+        handled = TierRun(&invocation, function->compiled.closure, compiled_argument, result);
+    }
+    
+    if(handled)
+    {
+        if(EvaluationResultIsScalar(*result))
+        {
+            MemoryArenaRestore(arena, arena_marker);
+        }
+        ++tier->compiled_call_count;
+    }
+    else
+    {
+        MemoryArenaRestore(arena, arena_marker);
+        ++tier->deoptimization_count;
+        if(!TierMaterialize(tier, environment, function))
+        {
+            *result = EvaluationErrorResult("A compiled closure could not be called.");
+            handled = 1;
+        }
+    }
+    return handled;
+}
+
+static int
+TierCallClosure(Tier *tier, EvaluationResult *function, EvaluationResult *argument, EvaluationResult *result)
+{
+    TierFunction *tier_function = TierLookUpFunction(tier, function->closure.body);
+    int state = __atomic_load_n(&tier_function->state, __ATOMIC_ACQUIRE);
+    int handled = 0;
+    
+    if(state == TIER_STATE_compiled && !tier_function->registered)
+    {
+        for(unsigned int i = 0; i < tier_function->function_count; ++i)
+        {
+            TierInsertCompiledFunction(tier, tier_function->function_pointers[i], tier_function->functions[i]);
+        }
+        tier_function->registered = 1;
+    }
+    
+    if(state == TIER_STATE_interpreted)
+    {
+        if(++tier_function->call_count >= tier->threshold)
+        {
+            TierEnqueue(tier, tier_function, function);
+        }
+    }
+    else if(state == TIER_STATE_compiled && TierStackBytes(tier) < EMIT_C_MAX_STACK_BYTES / 2)
+    {
+        InterpreterEnvironment *environment = function->closure.environment;
+        MemoryArena *arena = environment->arena;
+        MemoryArenaMarker arena_marker = MemoryArenaSave(arena);
+        
+        TierInvocation invocation = {0};
+        invocation.tier = tier;
+        invocation.stack = environment->stack;
+        invocation.environment = environment;
+        invocation.call = tier_function->call;
+        
+        // NOTE(rjf): The compiled closure for the call gets what the body uses
+        //            from the closure's environment.
+        EmitCFunction *compiled_function = tier_function->functions[0];
+        unsigned int capture_count = compiled_function->capture_count;
+        CompiledClosure *closure = MemoryArenaAllocateAligned(arena, sizeof(*closure) +
+                                                              capture_count*sizeof(closure->captures[0]),
+                                                              MEMORY_ARENA_MAX_ALIGNMENT,
+                                                              MEMORY_ARENA_CATEGORY_closures);
+        closure->function = tier_function->function_pointers[0];
+        int can_run = 1;
+        for(unsigned int i = 0; can_run && i < capture_count; ++i)
+        {
+            OptimizerName *name = compiled_function->captures + i;
+            EvaluationResult value;
+            can_run = ((InterpreterEnvironmentLookUp(environment, name->string, name->string_length, &value) ||
+                        BuiltinLookUp(name->string, name->string_length, &value)) &&
+                       TierWrap(&invocation, &value, closure->captures + i));
+        }
+        CompiledValue compiled_argument;
+        if(can_run && TierWrap(&invocation, argument, &compiled_argument))
+        {
+            handled = TierRun(&invocation, closure, compiled_argument, result);
+        }
+        
+        if(handled)
+        {
+            if(EvaluationResultIsScalar(*result))
+            {
+                MemoryArenaRestore(arena, arena_marker);
+            }
+            ++tier_function->compiled_call_count;
+            ++tier->compiled_call_count;
+        }
+        else
+        {
+            MemoryArenaRestore(arena, arena_marker);
+            ++tier->deoptimization_count;
+            if(++tier_function->deoptimization_count >= TIER_MAX_DEOPTIMIZATIONS)
+            {
+                tier_function->state = TIER_STATE_failed;
+                tier_function->failure = "It was deoptimized too often.";
+                TierLog(tier, tier_function, "demoted to the interpreter after %u deoptimizations",
+                        tier_function->deoptimization_count);
+            }
+        }
+    }
+    
+    return handled;
+}
+
+static int
+TierCall(InterpreterEnvironment *environment, EvaluationResult *function, EvaluationResult *argument,
+         EvaluationResult *result)
+{
+    Tier *tier = environment->stack->tier;
+    int handled = 0;
+    if(tier && function->type == EVALUATION_RESULT_compiled)
+    {
+        handled = TierCallCompiledClosure(tier, environment, function, argument, result);
+    }
+    else if(tier)
+    {
+        handled = TierCallClosure(tier, function, argument, result);
+    }
+    return handled;
+}
+
+static void
+TierCleanUp(Tier *tier)
+{
+    pthread_mutex_lock(&tier->mutex);
+    tier->stopping = 1;
+    pthread_cond_signal(&tier->condition);
+    pthread_mutex_unlock(&tier->mutex);
+    if(tier->thread_started)
+    {
+        pthread_join(tier->thread, 0);
+    }
+    
+    unsigned long long compiled_count = 0;
+    unsigned long long failed_count = 0;
+    for(unsigned int i = 0; i < tier->function_table_cap; ++i)
+    {
+        TierFunction *function = tier->function_table[i];
+        if(function)
+        {
+            compiled_count += !!function->library;
+            failed_count += !function->library && function->state == TIER_STATE_failed;
+            if(function->library)
+            {
+                dlclose(function->library);
+            }
+            EmitCFreeFunctions(function->functions, function->function_count);
+            free(function);
+        }
+    }
+    
+    if(tier->log)
+    {
+        fprintf(stderr, "tier: %u functions called, %llu compiled, %llu couldn't be; "
+                "%llu calls ran compiled, %llu deoptimized\n", tier->function_table_count, compiled_count,
+                failed_count, tier->compiled_call_count, tier->deoptimization_count);
+    }
+    
+    free(tier->function_table);
+    free(tier->compiled_table);
+    pthread_mutex_destroy(&tier->mutex);
+    pthread_cond_destroy(&tier->condition);
+    memset(tier, 0, sizeof(*tier));
+}
@@ -15,8 +15,11 @@ typedef struct Token
 }
 Token;
 
+// NOTE(rjf): The buffer is the range [buffer, end). It doesn't have to be
+//            null-terminated, so sources can be tokenized straight out of a
+//            file mapping.
 static Token
-GetNextTokenFromBuffer(char *buffer)
+GetNextTokenFromBuffer(char *buffer, char *end)
 {
     Token token = {0};
     
@@ -31,15 +34,20 @@ GetNextTokenFromBuffer(char *buffer)
         ")",
         "[",
         "]",
+        "{",
+        "}",
+        ",",
     };
     
-    for(int i = 0; buffer[i]; ++i)
+    long long length = end - buffer;
+    
+    for(long long i = 0; i < length; ++i)
     {
-        int j;
+        long long j;
         
         if(CharIsAlpha(buffer[i]) || buffer[i] == '_')
         {
-            for(j = i+1; buffer[j]; ++j)
+            for(j = i+1; j < length; ++j)
             {
                 if(!CharIsAlpha(buffer[j]) && !CharIsNumeric(buffer[j]) &&
                    buffer[j] != '_')
@@ -50,12 +58,12 @@ GetNextTokenFromBuffer(char *buffer)
             
             token.type = TOKEN_alphanumeric_block;
             token.string = buffer+i;
-            token.string_length = j-i;
+            token.string_length = (int)(j-i);
             break;
         }
         else if(CharIsNumeric(buffer[i]))
         {
-            for(j = i+1; buffer[j]; ++j)
+            for(j = i+1; j < length; ++j)
             {
                 if(!CharIsAlpha(buffer[j]) && !CharIsNumeric(buffer[j]) &&
                    buffer[j] != '.')
@@ -66,23 +74,39 @@ GetNextTokenFromBuffer(char *buffer)
             
             token.type = TOKEN_numeric_constant;
             token.string = buffer+i;
-            token.string_length = j-i;
+            token.string_length = (int)(j-i);
             break;
         }
         else if(CharIsSymbolic(buffer[i]))
         {
-            for(j = i+1; buffer[j]; ++j)
+            for(j = i+1; j < length; ++j)
             {
                 if(!CharIsSymbolic(buffer[j]))
                 {
                     break;
                 }
+                
+                // NOTE(rjf): A group also ends a block, so "=(" is "=" then "(".
+                int starts_symbol_group = 0;
+                for(int k = 0; k < sizeof(symbol_groups)/sizeof(symbol_groups[0]); ++k)
+                {
+                    if(symbol_groups[k][0] == buffer[j])
+                    {
+                        starts_symbol_group = 1;
+                        break;
+                    }
+                }
+                if(starts_symbol_group)
+                {
+                    break;
+                }
             }
             
             for(int k = 0; k < sizeof(symbol_groups)/sizeof(symbol_groups[0]); ++k)
             {
                 int symbol_group_len = CalculateCStringLength(symbol_groups[k]);
-                if(StringMatch(symbol_groups[k], symbol_group_len,
+                if(symbol_group_len <= j-i &&
+                   StringMatch(symbol_groups[k], symbol_group_len,
                                buffer+i, symbol_group_len))
                 {
                     j = i + symbol_group_len;
@@ -92,7 +116,7 @@ GetNextTokenFromBuffer(char *buffer)
             
             token.type = TOKEN_symbolic_block;
             token.string = buffer+i;
-            token.string_length = j-i;
+            token.string_length = (int)(j-i);
             break;
         }
     }
@@ -100,31 +124,41 @@ GetNextTokenFromBuffer(char *buffer)
     return token;
 }
 
+typedef struct AbstractSyntaxTreeNodeTable AbstractSyntaxTreeNodeTable;
+
 typedef struct Tokenizer
 {
     char *at;
+    char *end;
+    
+    // NOTE(rjf): How far down the C stack the parser can go before it gives up
+    //            (see ParseStackLimit). Set by the outermost ParseExpression.
+    char *parse_stack_limit;
+    
+    // NOTE(rjf): If this is set, ParseExpression shares identical subtrees
+    //            through it (see lettuce_parse.c).
+    AbstractSyntaxTreeNodeTable *node_table;
 }
 Tokenizer;
 
+static void
+TokenizerInit(Tokenizer *tokenizer, char *source, unsigned long long source_length)
+{
+    tokenizer->at = source;
+    tokenizer->end = source + source_length;
+}
+
 static int
 TokenMatchCString(Token a, char *b)
 {
     int matches = 0;
     
+    // NOTE(rjf): Only reads within the token, which might be the last thing
+    //            in the buffer, and only matches whole tokens, so "<=" isn't
+    //            taken for "<" and "inner" isn't taken for "in".
     if(a.type > 0)
     {
-        matches = 1;
-        for(int i = 0; b[i]; ++i)
-        {
-            if(a.string[i] != b[i])
-            {
-                if(b[i] || i > a.string_length)
-                {
-                    matches = 0;
-                }
-                break;
-            }
-        }
+        matches = StringMatch(a.string, a.string_length, b, CalculateCStringLength(b));
     }
     
     return matches;
@@ -133,13 +167,19 @@ TokenMatchCString(Token a, char *b)
 static Token
 PeekToken(Tokenizer *tokenizer)
 {
-    return GetNextTokenFromBuffer(tokenizer->at);
+    Token token = GetNextTokenFromBuffer(tokenizer->at, tokenizer->end);
+    
+    // NOTE(rjf): Whatever came before the token can't be part of any token, so
+    //            skip it now instead of rescanning it on every peek.
+    tokenizer->at = token.type ? token.string : tokenizer->end;
+    
+    return token;
 }
 
 static void
 NextToken(Tokenizer *tokenizer, Token *token_ptr)
 {
-    Token token = GetNextTokenFromBuffer(tokenizer->at);
+    Token token = PeekToken(tokenizer);
     if(token.type)
     {
         tokenizer->at = token.string + token.string_length;
@@ -1,24 +1,174 @@
 #define MemoryCopy memcpy
 
+// NOTE(rjf): Reads until EOF rather than trusting the file's size, so this also
+//            works on pipes. The result is null-terminated, but *size_out is
+//            the real size, in case the file itself contains nulls.
 static char *
-LoadEntireFileAndNullTerminate(char *filename)
+LoadEntireFile(FILE *file, unsigned long long *size_out)
 {
     char *result = 0;
+    unsigned long long size = 0;
+    unsigned long long capacity = 64*1024;
     
-    FILE *file = fopen(filename, "r");
-    if(file)
+    result = malloc(capacity);
+    while(result)
     {
-        fseek(file, 0, SEEK_END);
-        unsigned int file_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        result = malloc(file_size+1);
-        if(result)
+        size += fread(result + size, 1, capacity - 1 - size, file);
+        if(size < capacity - 1)
         {
-            fread(result, file_size, 1, file);
-            result[file_size] = 0;
+            if(ferror(file))
+            {
+                free(result);
+                result = 0;
+            }
+            break;
         }
+        capacity *= 2;
+        char *new_result = realloc(result, capacity);
+        if(!new_result)
+        {
+            free(result);
+        }
+        result = new_result;
     }
     
+    if(result)
+    {
+        result[size] = 0;
+        *size_out = size;
+    }
+    
+    return result;
+}
+
+// NOTE(rjf): A read-only view of a source file. Where we can, the file is mapped
+//            rather than read, so loading costs no copy, and the only memory it
+//            uses is the pages the tokenizer actually touches. The data is NOT
+//            null-terminated; use size.
+typedef struct SourceFile
+{
+    char *data;
+    unsigned long long size;
+    int is_mapped;
+}
+SourceFile;
+
+static int
+SourceFileLoad(SourceFile *source_file, char *filename)
+{
+    int success = 0;
+    source_file->data = 0;
+    source_file->size = 0;
+    source_file->is_mapped = 0;
+    
+#if LETTUCE_POSIX
+    int fd = open(filename, O_RDONLY);
+    if(fd >= 0)
+    {
+        struct stat file_stat = {0};
+        if(fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+        {
+            source_file->size = (unsigned long long)file_stat.st_size;
+            if(source_file->size == 0)
+            {
+                // NOTE(rjf): Zero-length mappings aren't allowed, and there's
+                //            nothing to map anyway.
+                success = 1;
+            }
+            else
+            {
+                void *memory = mmap(0, source_file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(memory != MAP_FAILED)
+                {
+                    madvise(memory, source_file->size, MADV_SEQUENTIAL);
+                    source_file->data = memory;
+                    source_file->is_mapped = 1;
+                    success = 1;
+                }
+            }
+        }
+        close(fd);
+    }
+#elif defined(_WIN32)
+    HANDLE file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                                     FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if(file_handle != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER file_size = {0};
+        if(GetFileSizeEx(file_handle, &file_size))
+        {
+            source_file->size = (unsigned long long)file_size.QuadPart;
+            if(source_file->size == 0)
+            {
+                success = 1;
+            }
+            else
+            {
+                HANDLE mapping = CreateFileMappingA(file_handle, 0, PAGE_READONLY, 0, 0, 0);
+                if(mapping)
+                {
+                    source_file->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    source_file->is_mapped = !!source_file->data;
+                    success = source_file->is_mapped;
+                    CloseHandle(mapping);
+                }
+            }
+        }
+        CloseHandle(file_handle);
+    }
+#endif
+    
+    // NOTE(rjf): If the file can't be mapped (or it isn't a regular file, like a
+    //            pipe), fall back to reading it.
+    if(!success)
+    {
+        FILE *file = fopen(filename, "rb");
+        if(file)
+        {
+            source_file->data = LoadEntireFile(file, &source_file->size);
+            success = !!source_file->data;
+            fclose(file);
+        }
+    }
+    
+    return success;
+}
+
+static void
+SourceFileUnload(SourceFile *source_file)
+{
+    if(source_file->is_mapped)
+    {
+#if LETTUCE_POSIX
+        munmap(source_file->data, source_file->size);
+#elif defined(_WIN32)
+        UnmapViewOfFile(source_file->data);
+#endif
+    }
+    else
+    {
+        free(source_file->data);
+    }
+    source_file->data = 0;
+    source_file->size = 0;
+    source_file->is_mapped = 0;
+}
+
+static unsigned long long
+GetTimeInNanoseconds(void)
+{
+    unsigned long long result = 0;
+#if LETTUCE_POSIX
+    struct timespec time = {0};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    result = (unsigned long long)time.tv_sec*1000000000ull + (unsigned long long)time.tv_nsec;
+#elif defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    result = (unsigned long long)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#endif
     return result;
 }
 
@@ -98,7 +248,70 @@ CalculateCStringLength(char *str)
     return result;
 }
 
+// NOTE(rjf): Arenas have two backends. The virtual backend reserves one big
+//            range of address space up front and commits pages from it as the
+//            arena grows, so allocation is a pointer bump and the memory is
+//            contiguous. The chunked backend is a linked list of malloc'd
+//            chunks that grow geometrically. It's used where virtual memory
+//            isn't available, when the reservation fails, when a caller asks
+//            for it explicitly, and when a virtual arena runs out of its
+//            reservation (in which case further allocations come from chunks).
+
 #define MEMORY_ARENA_CHUNK_SIZE 1024
+#define MEMORY_ARENA_MAX_CHUNK_SIZE (1024*1024)
+#define MEMORY_ARENA_MAX_ALIGNMENT 16
+#define MEMORY_ARENA_DEFAULT_RESERVE_SIZE (16ull*1024*1024*1024)
+#define MEMORY_ARENA_COMMIT_GRANULARITY (64*1024)
+#define MEMORY_ARENA_HUGE_PAGE_SIZE (2*1024*1024)
+
+enum
+{
+    MEMORY_ARENA_BACKEND_virtual,
+    MEMORY_ARENA_BACKEND_chunked,
+};
+
+enum
+{
+    MEMORY_ARENA_FLAG_huge_pages = (1<<0),
+};
+
+// NOTE(rjf): Every allocation is tagged with what it's for, so we can tell how
+//            much of an arena is AST versus runtime environments, etc. Tokens
+//            point into the source text, so they're counted as source.
+#define MEMORY_ARENA_CATEGORY_LIST \
+MemoryArenaCategory(source, "source/tokens") \
+MemoryArenaCategory(ast_nodes, "ast nodes") \
+MemoryArenaCategory(environments, "environments") \
+MemoryArenaCategory(closures, "closures") \
+MemoryArenaCategory(error_strings, "error strings") \
+MemoryArenaCategory(arrays, "arrays") \
+MemoryArenaCategory(other, "other") \
+
+enum
+{
+#define MemoryArenaCategory(name, str) MEMORY_ARENA_CATEGORY_##name,
+    MEMORY_ARENA_CATEGORY_LIST
+#undef MemoryArenaCategory
+    MEMORY_ARENA_CATEGORY_COUNT
+};
+
+static char *memory_arena_category_names[MEMORY_ARENA_CATEGORY_COUNT] = {
+#define MemoryArenaCategory(name, str) str,
+    MEMORY_ARENA_CATEGORY_LIST
+#undef MemoryArenaCategory
+};
+
+// NOTE(rjf): bytes and count are what's currently allocated, so they go down
+//            when a marker is restored or the arena is reset. The peak and
+//            total counts never go down.
+typedef struct MemoryArenaCategoryStats
+{
+    unsigned long long bytes;
+    unsigned long long count;
+    unsigned long long peak_bytes;
+    unsigned long long total_count;
+}
+MemoryArenaCategoryStats;
 
 typedef struct MemoryArenaChunk MemoryArenaChunk;
 typedef struct MemoryArenaChunk
@@ -112,8 +325,21 @@ MemoryArenaChunk;
 
 typedef struct MemoryArena
 {
+    int backend;
+    int flags;
+    
     MemoryArenaChunk first_chunk;
     MemoryArenaChunk *active_chunk;
+    
+    char *virtual_base;
+    unsigned long long virtual_reserve_size;
+    unsigned long long virtual_commit_size;
+    unsigned long long virtual_alloc_pos;
+    
+    MemoryArenaCategoryStats category_stats[MEMORY_ARENA_CATEGORY_COUNT];
+    unsigned long long bytes;
+    unsigned long long peak_bytes;
+    unsigned long long padding_bytes;
 }
 MemoryArena;
 
@@ -128,55 +354,386 @@ MemoryArenaCleanUp(MemoryArena *arena)
         free(chunk);
         chunk = next_chunk;
     }
+    
+    if(arena->virtual_base)
+    {
+#if LETTUCE_POSIX
+        munmap(arena->virtual_base, arena->virtual_reserve_size);
+#elif defined(_WIN32)
+        VirtualFree(arena->virtual_base, 0, MEM_RELEASE);
+#endif
+    }
 }
 
-static void *
-MemoryArenaAllocate(MemoryArena *arena, unsigned int size)
+static void
+MemoryArenaReset(MemoryArena *arena)
 {
-    void *result = 0;
+    // NOTE(rjf): Rewinds the arena to empty without giving any memory back, so
+    //            that the chunks can be reused by the next round of allocations.
+    arena->first_chunk.memory_alloc_pos = 0;
+    arena->active_chunk = &arena->first_chunk;
+    arena->virtual_alloc_pos = 0;
     
-    if(!arena->active_chunk)
+    for(int i = 0; i < MEMORY_ARENA_CATEGORY_COUNT; ++i)
+    {
+        arena->category_stats[i].bytes = 0;
+        arena->category_stats[i].count = 0;
+    }
+    arena->bytes = 0;
+    arena->padding_bytes = 0;
+}
+
+// NOTE(rjf): A marker remembers how far an arena had allocated, so that
+//            everything allocated after it can be given back at once by
+//            restoring it. Markers must be restored in the reverse order they
+//            were saved. Chunks past the restored position aren't freed; the
+//            allocator reuses them as the arena grows again.
+typedef struct MemoryArenaMarker
+{
+    MemoryArenaChunk *chunk;
+    unsigned int chunk_alloc_pos;
+    unsigned long long virtual_alloc_pos;
+    unsigned long long category_bytes[MEMORY_ARENA_CATEGORY_COUNT];
+    unsigned long long category_count[MEMORY_ARENA_CATEGORY_COUNT];
+    unsigned long long bytes;
+    unsigned long long padding_bytes;
+}
+MemoryArenaMarker;
+
+static MemoryArenaMarker
+MemoryArenaSave(MemoryArena *arena)
+{
+    MemoryArenaMarker marker = {0};
+    marker.chunk = arena->active_chunk;
+    marker.chunk_alloc_pos = arena->active_chunk ? arena->active_chunk->memory_alloc_pos : 0;
+    marker.virtual_alloc_pos = arena->virtual_alloc_pos;
+    for(int i = 0; i < MEMORY_ARENA_CATEGORY_COUNT; ++i)
+    {
+        marker.category_bytes[i] = arena->category_stats[i].bytes;
+        marker.category_count[i] = arena->category_stats[i].count;
+    }
+    marker.bytes = arena->bytes;
+    marker.padding_bytes = arena->padding_bytes;
+    return marker;
+}
+
+static void
+MemoryArenaRestore(MemoryArena *arena, MemoryArenaMarker marker)
+{
+    if(marker.chunk)
+    {
+        arena->active_chunk = marker.chunk;
+        arena->active_chunk->memory_alloc_pos = marker.chunk_alloc_pos;
+    }
+    else
     {
         arena->active_chunk = &arena->first_chunk;
+        arena->first_chunk.memory_alloc_pos = 0;
+    }
+    arena->virtual_alloc_pos = marker.virtual_alloc_pos;
+    for(int i = 0; i < MEMORY_ARENA_CATEGORY_COUNT; ++i)
+    {
+        arena->category_stats[i].bytes = marker.category_bytes[i];
+        arena->category_stats[i].count = marker.category_count[i];
+    }
+    arena->bytes = marker.bytes;
+    arena->padding_bytes = marker.padding_bytes;
+}
+
+static unsigned int
+MemoryArenaNaturalAlignment(unsigned int size)
+{
+    // NOTE(rjf): The largest power of two dividing the size, so that a struct
+    //            containing doubles or pointers gets 8 bytes, and a string gets 1.
+    unsigned int alignment = size & (~size + 1);
+    if(alignment == 0 || alignment > MEMORY_ARENA_MAX_ALIGNMENT)
+    {
+        alignment = MEMORY_ARENA_MAX_ALIGNMENT;
+    }
+    return alignment;
+}
+
+static unsigned long long
+AlignUpPow2(unsigned long long value, unsigned long long alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static int
+MemoryArenaVirtualReserve(MemoryArena *arena)
+{
+    int success = 0;
+    
+    if(!arena->virtual_reserve_size)
+    {
+        arena->virtual_reserve_size = MEMORY_ARENA_DEFAULT_RESERVE_SIZE;
     }
+    arena->virtual_reserve_size = AlignUpPow2(arena->virtual_reserve_size, MEMORY_ARENA_HUGE_PAGE_SIZE);
     
-    MemoryArenaChunk *chunk = arena->active_chunk;
+#if LETTUCE_POSIX
+    // NOTE(rjf): Over-reserve by a huge page so the base can be aligned to one,
+    //            otherwise transparent huge pages can't back the start of the range.
+    size_t mapping_size = arena->virtual_reserve_size + MEMORY_ARENA_HUGE_PAGE_SIZE;
+    char *mapping = mmap(0, mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mapping != MAP_FAILED)
+    {
+        char *base = (char *)AlignUpPow2((unsigned long long)mapping, MEMORY_ARENA_HUGE_PAGE_SIZE);
+        size_t head_size = base - mapping;
+        size_t tail_size = mapping_size - head_size - arena->virtual_reserve_size;
+        if(head_size)
+        {
+            munmap(mapping, head_size);
+        }
+        if(tail_size)
+        {
+            munmap(base + arena->virtual_reserve_size, tail_size);
+        }
+#ifdef MADV_HUGEPAGE
+        if(arena->flags & MEMORY_ARENA_FLAG_huge_pages)
+        {
+            madvise(base, arena->virtual_reserve_size, MADV_HUGEPAGE);
+        }
+#endif
+        arena->virtual_base = base;
+        success = 1;
+    }
+#elif defined(_WIN32)
+    arena->virtual_base = VirtualAlloc(0, arena->virtual_reserve_size, MEM_RESERVE, PAGE_NOACCESS);
+    success = !!arena->virtual_base;
+#endif
+    
+    arena->virtual_commit_size = 0;
+    arena->virtual_alloc_pos = 0;
+    
+    return success;
+}
+
+static int
+MemoryArenaVirtualCommit(MemoryArena *arena, unsigned long long needed_size)
+{
+    int success = 0;
+    
+    unsigned long long granularity = ((arena->flags & MEMORY_ARENA_FLAG_huge_pages) ?
+                                      MEMORY_ARENA_HUGE_PAGE_SIZE : MEMORY_ARENA_COMMIT_GRANULARITY);
+    unsigned long long new_commit_size = AlignUpPow2(needed_size, granularity);
+    if(new_commit_size > arena->virtual_reserve_size)
+    {
+        new_commit_size = arena->virtual_reserve_size;
+    }
     
-    if(!chunk->memory)
+    if(needed_size <= new_commit_size)
     {
-        chunk->memory_size = MEMORY_ARENA_CHUNK_SIZE;
-        if(chunk->memory_size < size)
+        char *commit_start = arena->virtual_base + arena->virtual_commit_size;
+        unsigned long long commit_size = new_commit_size - arena->virtual_commit_size;
+#if LETTUCE_POSIX
+        success = mprotect(commit_start, commit_size, PROT_READ | PROT_WRITE) == 0;
+#elif defined(_WIN32)
+        success = !!VirtualAlloc(commit_start, commit_size, MEM_COMMIT, PAGE_READWRITE);
+#endif
+        if(success)
         {
-            chunk->memory_size = size;
+            arena->virtual_commit_size = new_commit_size;
         }
-        chunk->memory = malloc(chunk->memory_size);
-        chunk->memory_alloc_pos = 0;
-        chunk->next = 0;
     }
     
-    if(chunk->memory_alloc_pos + size > chunk->memory_size)
+    return success;
+}
+
+static void
+MemoryArenaRecordAllocation(MemoryArena *arena, unsigned int size, unsigned int padding, int category)
+{
+    MemoryArenaCategoryStats *stats = arena->category_stats + category;
+    stats->bytes += size;
+    stats->count += 1;
+    stats->total_count += 1;
+    if(stats->bytes > stats->peak_bytes)
+    {
+        stats->peak_bytes = stats->bytes;
+    }
+    arena->bytes += size;
+    arena->padding_bytes += padding;
+    if(arena->bytes > arena->peak_bytes)
+    {
+        arena->peak_bytes = arena->bytes;
+    }
+}
+
+static void *
+MemoryArenaAllocateAligned(MemoryArena *arena, unsigned int size, unsigned int alignment, int category)
+{
+    void *result = 0;
+    
+    if(arena->backend == MEMORY_ARENA_BACKEND_virtual)
     {
-        unsigned int needed_size = MEMORY_ARENA_CHUNK_SIZE;
-        if(needed_size < size)
+        if(!arena->virtual_base && !MemoryArenaVirtualReserve(arena))
+        {
+            arena->backend = MEMORY_ARENA_BACKEND_chunked;
+        }
+        else
         {
-            needed_size = size;
+            unsigned long long pos = AlignUpPow2(arena->virtual_alloc_pos, alignment);
+            unsigned long long end = pos + size;
+            if(end <= arena->virtual_commit_size || MemoryArenaVirtualCommit(arena, end))
+            {
+                result = arena->virtual_base + pos;
+                MemoryArenaRecordAllocation(arena, size, (unsigned int)(pos - arena->virtual_alloc_pos), category);
+                arena->virtual_alloc_pos = end;
+            }
         }
-        MemoryArenaChunk *new_chunk = malloc(sizeof(MemoryArenaChunk) + needed_size);
-        chunk->next = new_chunk;
-        new_chunk->memory = (char *)new_chunk + sizeof(MemoryArenaChunk);
-        new_chunk->memory_size = needed_size;
-        new_chunk->memory_alloc_pos = 0;
-        new_chunk->next = 0;
-        chunk = chunk->next;
-        arena->active_chunk = chunk;
     }
     
-    result = (char *)chunk->memory + chunk->memory_alloc_pos;
-    chunk->memory_alloc_pos += size;
+    if(!result)
+    {
+        if(!arena->active_chunk)
+        {
+            arena->active_chunk = &arena->first_chunk;
+        }
+        
+        MemoryArenaChunk *chunk = arena->active_chunk;
+        
+        if(!chunk->memory)
+        {
+            chunk->memory_size = MEMORY_ARENA_CHUNK_SIZE;
+            if(chunk->memory_size < size + alignment)
+            {
+                chunk->memory_size = size + alignment;
+            }
+            chunk->memory = malloc(chunk->memory_size);
+            chunk->memory_alloc_pos = 0;
+            chunk->next = 0;
+        }
+        
+        unsigned long long chunk_address = (unsigned long long)chunk->memory;
+        unsigned int pos = (unsigned int)(AlignUpPow2(chunk_address + chunk->memory_alloc_pos, alignment) - chunk_address);
+        
+        if(pos + size > chunk->memory_size)
+        {
+            // NOTE(rjf): Chunks following the active one are left over from before a
+            //            reset, so we can just reuse them if they're big enough.
+            if(chunk->next && chunk->next->memory_size >= size + alignment)
+            {
+                chunk = chunk->next;
+            }
+            else
+            {
+                // NOTE(rjf): Each new chunk is twice the size of the last (up to a
+                //            limit), so the number of mallocs grows logarithmically
+                //            with the size of the arena rather than linearly.
+                unsigned int needed_size = chunk->memory_size * 2;
+                if(needed_size > MEMORY_ARENA_MAX_CHUNK_SIZE)
+                {
+                    needed_size = MEMORY_ARENA_MAX_CHUNK_SIZE;
+                }
+                if(needed_size < size + alignment)
+                {
+                    needed_size = size + alignment;
+                }
+                MemoryArenaChunk *new_chunk = malloc(sizeof(MemoryArenaChunk) + needed_size);
+                new_chunk->memory = (char *)new_chunk + sizeof(MemoryArenaChunk);
+                new_chunk->memory_size = needed_size;
+                new_chunk->next = chunk->next;
+                chunk->next = new_chunk;
+                chunk = new_chunk;
+            }
+            chunk->memory_alloc_pos = 0;
+            arena->active_chunk = chunk;
+            
+            chunk_address = (unsigned long long)chunk->memory;
+            pos = (unsigned int)(AlignUpPow2(chunk_address, alignment) - chunk_address);
+        }
+        
+        result = (char *)chunk->memory + pos;
+        MemoryArenaRecordAllocation(arena, size, pos - chunk->memory_alloc_pos, category);
+        chunk->memory_alloc_pos = pos + size;
+    }
     
     return result;
 }
 
+static void *
+MemoryArenaAllocate(MemoryArena *arena, unsigned int size, int category)
+{
+    return MemoryArenaAllocateAligned(arena, size, MemoryArenaNaturalAlignment(size), category);
+}
+
+static void *
+MemoryArenaAllocateZero(MemoryArena *arena, unsigned int size, int category)
+{
+    void *result = MemoryArenaAllocate(arena, size, category);
+    if(result)
+    {
+        memset(result, 0, size);
+    }
+    return result;
+}
+
+// NOTE(rjf): Bytes at the end of every chunk before the active one, which were
+//            skipped because the next allocation didn't fit.
+static unsigned long long
+MemoryArenaChunkTailBytes(MemoryArena *arena, unsigned int *chunk_count_out, unsigned int *largest_tail_out)
+{
+    unsigned long long tail_bytes = 0;
+    unsigned int chunk_count = 0;
+    unsigned int largest_tail = 0;
+    
+    if(arena->active_chunk && arena->first_chunk.memory)
+    {
+        for(MemoryArenaChunk *chunk = &arena->first_chunk; chunk; chunk = chunk->next)
+        {
+            ++chunk_count;
+            if(chunk == arena->active_chunk)
+            {
+                break;
+            }
+            unsigned int tail = chunk->memory_size - chunk->memory_alloc_pos;
+            tail_bytes += tail;
+            if(tail > largest_tail)
+            {
+                largest_tail = tail;
+            }
+        }
+    }
+    
+    if(chunk_count_out)
+    {
+        *chunk_count_out = chunk_count;
+    }
+    if(largest_tail_out)
+    {
+        *largest_tail_out = largest_tail;
+    }
+    return tail_bytes;
+}
+
+static void
+MemoryArenaPrintStats(MemoryArena *arena, FILE *file)
+{
+    fprintf(file, "%-16s %14s %12s %14s %14s\n", "category", "bytes", "count", "peak bytes", "total count");
+    for(int i = 0; i < MEMORY_ARENA_CATEGORY_COUNT; ++i)
+    {
+        MemoryArenaCategoryStats *stats = arena->category_stats + i;
+        fprintf(file, "%-16s %14llu %12llu %14llu %14llu\n", memory_arena_category_names[i],
+                stats->bytes, stats->count, stats->peak_bytes, stats->total_count);
+    }
+    fprintf(file, "%-16s %14llu %12s %14llu\n", "all", arena->bytes, "", arena->peak_bytes);
+    fprintf(file, "alignment padding: %llu bytes\n", arena->padding_bytes);
+    
+    if(arena->virtual_base)
+    {
+        fprintf(file, "virtual: %llu bytes used, %llu committed, %llu reserved\n",
+                arena->virtual_alloc_pos, arena->virtual_commit_size, arena->virtual_reserve_size);
+    }
+    if(arena->first_chunk.memory)
+    {
+        unsigned int chunk_count = 0;
+        unsigned int largest_tail = 0;
+        unsigned long long tail_bytes = MemoryArenaChunkTailBytes(arena, &chunk_count, &largest_tail);
+        fprintf(file, "chunks: %u in use, %llu bytes wasted at chunk tails (largest %u)\n",
+                chunk_count, tail_bytes, largest_tail);
+    }
+}
+
+// NOTE(rjf): Only used for error messages, so it's counted as error strings.
 static char *
 MakeStringOnArenaF(MemoryArena *arena, char *format, ...)
 {
@@ -187,7 +744,7 @@ MakeStringOnArenaF(MemoryArena *arena, char *format, ...)
     unsigned int needed_bytes = vsnprintf(0, 0, format, args)+1;
     va_end(args);
     
-    result = MemoryArenaAllocate(arena, needed_bytes);
+    result = MemoryArenaAllocate(arena, needed_bytes, MEMORY_ARENA_CATEGORY_error_strings);
     
     if(result)
     {
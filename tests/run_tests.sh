@@ -0,0 +1,60 @@
+#!/bin/bash
+# Runs the regression programs in this folder and compares what the interpreter
+# prints against what it should. Pass the interpreter to test, or it uses the
+# one build.sh makes.
+cd "$(dirname "$0")"
+LETTUCE=${1:-../build/lettuce}
+failed=0
+
+# NOTE: Set STACK_KB to run a check with that much C stack (see ulimit -s).
+
+check()
+{
+    local program=$1
+    local expected=$2
+    shift 2
+    local actual
+    actual=$(if [ -n "$STACK_KB" ]; then ulimit -s "$STACK_KB"; fi; "$LETTUCE" -q "$program" "$@" 2>&1)
+    if [ "$actual" != "$expected" ]; then
+        echo "FAILED: $program $* ${STACK_KB:+(stack $STACK_KB KB)}"
+        echo "  expected: $expected"
+        echo "  got:      $actual"
+        failed=1
+    fi
+}
+
+# A compiled function calls back into the interpreter, whose stack of call
+# arguments grows, and then deoptimizes, leaving the rest of the call to us.
+check tier_callback_during_call.l "Program was evaluated to array {1, 2}." --tier --tier-threshold 2
+
+# Every comma in a call has to have an argument after it, and once there's a
+# comma the call has to end with ).
+check call_trailing_comma.l "PARSE ERROR: Expected a function argument."
+check call_empty_argument.l "PARSE ERROR: Expected a function argument."
+check call_unclosed_arguments.l "PARSE ERROR: Expected , or ) after a function argument."
+
+# A let rec group can't bind one name twice.
+check let_rec_duplicate_name.l "PARSE ERROR: let rec can't bind the same name twice."
+
+# The parser gives up with an error before it runs out of C stack, however
+# much of it there is, and programs that fit still parse.
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+nest()
+{
+    printf '(1 + %.0s' $(seq $1)
+    printf '1'
+    printf ')%.0s' $(seq $1)
+    echo
+}
+nest 20000 > "$scratch/nested_20000.l"
+nest 100 > "$scratch/nested_100.l"
+for stack in 512 2048 8192; do
+    STACK_KB=$stack check "$scratch/nested_20000.l" "PARSE ERROR: Expression is nested too deeply to parse."
+    STACK_KB=$stack check "$scratch/nested_100.l" "Program was evaluated to numeric value 101."
+done
+
+if [ $failed = 0 ]; then
+    echo "All tests passed."
+fi
+exit $failed